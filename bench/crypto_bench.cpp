@@ -0,0 +1,108 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "CryptoHandler.hpp"
+
+// Single-core throughput of CryptoHandler. "copy" is the allocating
+// Encrypt/Decrypt path behind a per-call lock, as BackedWriter and
+// BackedReader used it before sealing in place; "in-place" seals inside a
+// frame buffer with MAC headroom, as they do now.
+namespace {
+constexpr size_t kBytesPerRun = 64 * 1024 * 1024;
+const std::string kKey(32, 'k');
+
+using Clock = std::chrono::steady_clock;
+
+double MegabytesPerSecond(size_t bytes, Clock::duration elapsed) {
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  return seconds > 0 ? static_cast<double>(bytes) / seconds / (1024.0 * 1024.0) : 0.0;
+}
+
+void Report(const char* name, size_t size, size_t bytes, Clock::duration elapsed) {
+  std::cout << name << " " << size << " B: " << static_cast<long long>(MegabytesPerSecond(bytes, elapsed))
+            << " MB/s\n";
+}
+
+void BenchEncrypt(size_t size, ut::CipherSuite suite) {
+  const size_t iterations = kBytesPerRun / size;
+  const std::string plaintext(size, 'x');
+  size_t sink = 0;
+
+  ut::CryptoHandler copy_handler(kKey, 0, suite);
+  std::mutex mutex;
+  auto start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    std::lock_guard<std::mutex> guard(mutex);
+    sink += copy_handler.Encrypt(plaintext).size();
+  }
+  Report("encrypt copy    ", size, iterations * size, Clock::now() - start);
+
+  ut::CryptoHandler handler(kKey, 0, suite);
+  std::string frame(ut::CryptoHandler::kMacBytes + size, '\0');
+  start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    std::memcpy(&frame[ut::CryptoHandler::kMacBytes], plaintext.data(), size);
+    handler.EncryptInPlace(&frame[0], frame.size());
+    sink += static_cast<unsigned char>(frame[0]);
+  }
+  Report("encrypt in-place", size, iterations * size, Clock::now() - start);
+
+  if (sink == 0) {
+    std::cout << "\n";
+  }
+}
+
+void BenchDecrypt(size_t size, ut::CipherSuite suite) {
+  const size_t iterations = kBytesPerRun / size;
+  const size_t sealed_size = ut::CryptoHandler::kMacBytes + size;
+  std::vector<char> sealed(iterations * sealed_size);
+  ut::CryptoHandler sealer(kKey, 0, suite);
+  for (size_t i = 0; i < iterations; ++i) {
+    char* frame = sealed.data() + i * sealed_size;
+    std::memset(frame + ut::CryptoHandler::kMacBytes, 'x', size);
+    sealer.EncryptInPlace(frame, sealed_size);
+  }
+  size_t sink = 0;
+
+  ut::CryptoHandler copy_handler(kKey, 0, suite);
+  std::mutex mutex;
+  auto start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    std::lock_guard<std::mutex> guard(mutex);
+    sink += copy_handler.Decrypt(std::string_view(sealed.data() + i * sealed_size, sealed_size)).size();
+  }
+  Report("decrypt copy    ", size, iterations * size, Clock::now() - start);
+
+  ut::CryptoHandler handler(kKey, 0, suite);
+  start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    char* frame = sealed.data() + i * sealed_size;
+    handler.DecryptInPlace(frame, sealed_size);
+    sink += static_cast<unsigned char>(frame[sealed_size - 1]);
+  }
+  Report("decrypt in-place", size, iterations * size, Clock::now() - start);
+
+  if (sink == 0) {
+    std::cout << "\n";
+  }
+}
+}
+
+int main() {
+  for (ut::CipherSuite suite : {ut::CipherSuite::kChaCha20Poly1305, ut::CipherSuite::kAes256Gcm}) {
+    if (!ut::IsCipherSuiteAvailable(suite)) {
+      std::cout << ut::CipherSuiteName(suite) << ": unavailable\n";
+      continue;
+    }
+    std::cout << ut::CipherSuiteName(suite) << ":\n";
+    for (size_t size : {static_cast<size_t>(64), static_cast<size_t>(4 * 1024), static_cast<size_t>(64 * 1024)}) {
+      BenchEncrypt(size, suite);
+      BenchDecrypt(size, suite);
+    }
+  }
+  return 0;
+}
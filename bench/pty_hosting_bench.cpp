@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Packet.hpp"
+#include "PipeSocketHandler.hpp"
+#include "PtyHost.hpp"
+#include "Reactor.hpp"
+#include "UtConstants.hpp"
+
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+#endif
+
+// Session setup and keystroke round trip per hosting mode. The shell
+// stand-in is `cat` on a raw PTY, so each byte typed is echoed once.
+//
+//   handoff:    undying-terminal-terminal starts the shell and passes the
+//               PTY master to the server over the pipe socket (SCM_RIGHTS);
+//               the session then reads and writes the PTY directly, and the
+//               terminal process waits until the session ends
+//   in-process: the server starts the shell itself (PtyHost)
+//
+// Once the handoff is done both modes relay on the same descriptor, so the
+// round trips should match; what in-process hosting saves is the handoff at
+// setup and the terminal process that stays resident per session.
+namespace {
+#ifndef _WIN32
+constexpr int kSessions = 50;
+constexpr int kWarmup = 200;
+constexpr int kRoundTrips = 20000;
+
+using Clock = std::chrono::steady_clock;
+
+void MakeRaw(int master) {
+  termios raw{};
+  tcgetattr(master, &raw);
+  cfmakeraw(&raw);
+  tcsetattr(master, TCSANOW, &raw);
+}
+
+void ReadExactly(int fd, char* buf, size_t count) {
+  while (count > 0) {
+    const ssize_t rc = read(fd, buf, count);
+    if (rc <= 0) {
+      return;
+    }
+    buf += rc;
+    count -= static_cast<size_t>(rc);
+  }
+}
+
+void Report(const std::string& name, std::vector<double>& samples, const char* unit) {
+  std::sort(samples.begin(), samples.end());
+  double total = 0;
+  for (double sample : samples) {
+    total += sample;
+  }
+  std::cout << name << ": mean " << static_cast<long long>(total / static_cast<double>(samples.size())) << " "
+            << unit << ", p50 " << static_cast<long long>(samples[samples.size() / 2]) << " " << unit << ", p99 "
+            << static_cast<long long>(samples[samples.size() * 99 / 100]) << " " << unit << "\n";
+}
+
+long ResidentKb(pid_t pid) {
+  std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmRSS:", 0) == 0) {
+      return std::stol(line.substr(6));
+    }
+  }
+  return -1;
+}
+
+double MicrosSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+// As the session does: write a keystroke, wake on readiness, read the echo.
+void RoundTrips(const std::string& name, int master) {
+  std::vector<double> samples;
+  samples.reserve(kRoundTrips);
+  char echo = 0;
+  for (int i = 0; i < kWarmup + kRoundTrips; ++i) {
+    const auto start = Clock::now();
+    [[maybe_unused]] const ssize_t rc = write(master, "x", 1);
+    pollfd fd{master, POLLIN, 0};
+    poll(&fd, 1, -1);
+    ReadExactly(master, &echo, 1);
+    if (i >= kWarmup) {
+      samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+    }
+  }
+  Report(name + " round trip", samples, "ns");
+}
+
+// The terminal side of the handoff, as in undying-terminal-terminal: start
+// the shell, send the master, then wait for the server to hang up.
+[[noreturn]] void RunTerminal(ut::SocketHandle socket) {
+  termios raw{};
+  cfmakeraw(&raw);
+  int master = -1;
+  const pid_t shell = forkpty(&master, nullptr, &raw, nullptr);
+  if (shell == 0) {
+    execlp("cat", "cat", static_cast<char*>(nullptr));
+    _exit(127);
+  }
+  ut::PipeSocketHandler handler;
+  if (shell < 0 || !handler.WritePacketWithFd(socket, ut::Packet(ut::kTerminalPtyHandoffHeader, ""), master)) {
+    _exit(1);
+  }
+  ut::Packet packet;
+  try {
+    while (handler.ReadPacket(socket, &packet)) {
+    }
+  } catch (...) {
+  }
+  close(master);
+  waitpid(shell, nullptr, 0);
+  _exit(0);
+}
+
+struct HandoffSession {
+  pid_t terminal = -1;
+  ut::SocketHandle socket = ut::kInvalidSocket;
+  int pty = -1;
+};
+
+HandoffSession StartHandoff() {
+  HandoffSession session;
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+    return session;
+  }
+  session.terminal = fork();
+  if (session.terminal == 0) {
+    close(pair[0]);
+    RunTerminal(static_cast<ut::SocketHandle>(pair[1]));
+  }
+  close(pair[1]);
+  session.socket = static_cast<ut::SocketHandle>(pair[0]);
+  ut::PipeSocketHandler handler;
+  ut::Packet packet;
+  if (!handler.ReadPacketWithFd(session.socket, &packet, &session.pty) ||
+      packet.header() != ut::kTerminalPtyHandoffHeader) {
+    session.pty = -1;
+  }
+  return session;
+}
+
+void EndHandoff(HandoffSession& session) {
+  if (session.pty >= 0) {
+    close(session.pty);
+  }
+  ut::PipeSocketHandler().Close(session.socket);
+  waitpid(session.terminal, nullptr, 0);
+}
+
+void BenchHandoff() {
+  std::vector<double> setup;
+  for (int i = 0; i < kSessions; ++i) {
+    const auto start = Clock::now();
+    HandoffSession session = StartHandoff();
+    setup.push_back(MicrosSince(start));
+    if (session.pty < 0) {
+      std::cerr << "PTY handoff failed\n";
+      EndHandoff(session);
+      return;
+    }
+    if (i + 1 == kSessions) {
+      RoundTrips("handoff", session.pty);
+      std::cout << "  terminal process RSS: " << ResidentKb(session.terminal) << " KB per session\n";
+    }
+    EndHandoff(session);
+  }
+  Report("handoff setup", setup, "us");
+}
+
+void BenchInProcess() {
+  ut::Reactor reactor;
+  std::vector<double> setup;
+  for (int i = 0; i < kSessions; ++i) {
+    const auto start = Clock::now();
+    PtyHost host;
+    if (!host.Start("/bin/cat")) {
+      std::cerr << "PtyHost::Start failed\n";
+      return;
+    }
+    MakeRaw(host.master());
+    setup.push_back(MicrosSince(start));
+    if (i + 1 == kSessions) {
+      RoundTrips("in-process", host.master());
+    }
+    const int pid = host.pid();
+    host.Release(&reactor);
+    while (kill(pid, 0) == 0) {
+      reactor.Poll(10);
+    }
+  }
+  Report("in-process setup", setup, "us");
+}
+#endif
+}
+
+int main() {
+#ifdef _WIN32
+  std::cout << "pty_hosting_bench compares POSIX hosting modes only\n";
+#else
+  std::cout << kSessions << " sessions per mode, " << kRoundTrips << " one-byte keystroke round trips\n";
+  BenchHandoff();
+  BenchInProcess();
+#endif
+  return 0;
+}
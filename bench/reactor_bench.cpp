@@ -0,0 +1,142 @@
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Reactor.hpp"
+#include "TcpSocketHandler.hpp"
+
+// Relay-loop cost per reactor backend on one shard: many idle TCP
+// connections, readied for the reactor as sessions and tunnels are, of which
+// a few receive a small frame each round (keystrokes and short bursts of
+// terminal output). Each ready callback reads its frame and writes it back
+// through TcpSocketHandler, as a session relay would forward it; a peer
+// thread sends the frames and waits for every echo before the next round.
+//
+//   epoll:    a readiness wait, then a recv and a send per frame
+//   io_uring: one io_uring_enter per pass submits the sends and waits; the
+//             frames arrive by multishot receive into provided buffers
+namespace {
+#ifndef _WIN32
+constexpr size_t kConnections = 2000;
+constexpr size_t kActivePerRound = 32;
+constexpr size_t kRounds = 20000;
+constexpr size_t kFrameBytes = 64;
+
+using Clock = std::chrono::steady_clock;
+
+struct Connections {
+  std::vector<ut::SocketHandle> local;
+  std::vector<ut::SocketHandle> remote;
+};
+
+bool Open(ut::TcpSocketHandler& handler, Connections* connections) {
+  const ut::SocketHandle listener = handler.Listen("127.0.0.1", 0);
+  if (listener == ut::kInvalidSocket) {
+    return false;
+  }
+  const int port = handler.GetBoundPort(listener);
+  bool ok = true;
+  for (size_t i = 0; i < kConnections && ok; ++i) {
+    const ut::SocketHandle remote = handler.Connect("127.0.0.1", port);
+    const ut::SocketHandle local = remote == ut::kInvalidSocket ? ut::kInvalidSocket : handler.Accept(listener);
+    ok = local != ut::kInvalidSocket && handler.PrepareForReactor(local);
+    if (remote != ut::kInvalidSocket) {
+      connections->remote.push_back(remote);
+    }
+    if (local != ut::kInvalidSocket) {
+      connections->local.push_back(local);
+    }
+  }
+  handler.Close(listener);
+  return ok;
+}
+
+void Close(ut::TcpSocketHandler& handler, const Connections& connections) {
+  for (ut::SocketHandle socket : connections.local) {
+    handler.Close(socket);
+  }
+  for (ut::SocketHandle socket : connections.remote) {
+    handler.Close(socket);
+  }
+}
+
+void Bench(ut::Reactor::Backend backend, const char* name) {
+  ut::TcpSocketHandler handler;
+  Connections connections;
+  if (!Open(handler, &connections)) {
+    std::cerr << "loopback connections failed (raise the open file limit)\n";
+    Close(handler, connections);
+    return;
+  }
+
+  {
+    ut::Reactor reactor(backend);
+    for (ut::SocketHandle socket : connections.local) {
+      reactor.Add(socket, [&handler, socket] {
+        char frame[4 * kFrameBytes];
+        const int rc = handler.Read(socket, frame, sizeof(frame));
+        if (rc > 0) {
+          handler.Write(socket, frame, static_cast<size_t>(rc));
+        }
+      });
+    }
+
+    std::atomic<bool> done{false};
+    double seconds = 0;
+    std::thread peer([&] {
+      std::mt19937 rng(1);
+      std::uniform_int_distribution<size_t> pick(0, kConnections - 1);
+      std::vector<size_t> active(kActivePerRound);
+      char frame[kFrameBytes] = {};
+      char reply[kFrameBytes];
+      const auto start = Clock::now();
+      for (size_t round = 0; round < kRounds; ++round) {
+        for (size_t& index : active) {
+          index = pick(rng);
+          handler.WriteAllOrThrow(connections.remote[index], frame, sizeof(frame), false);
+        }
+        for (size_t index : active) {
+          handler.ReadAll(connections.remote[index], reply, sizeof(reply), false);
+        }
+      }
+      seconds = std::chrono::duration<double>(Clock::now() - start).count();
+      done = true;
+      reactor.Wake();
+    });
+    while (!done) {
+      reactor.Poll(-1);
+    }
+    peer.join();
+    std::cout << name << ": " << static_cast<long long>(static_cast<double>(kRounds * kActivePerRound) / seconds)
+              << " frames/s, " << static_cast<long long>(seconds * 1e6 / kRounds) << " us/round\n";
+
+    for (ut::SocketHandle socket : connections.local) {
+      reactor.Remove(socket);
+    }
+  }
+  Close(handler, connections);
+}
+#endif
+}
+
+int main() {
+#ifdef _WIN32
+  std::cout << "reactor_bench compares the Linux backends only\n";
+#else
+  std::cout << kConnections << " connections, " << kActivePerRound << " active per round, " << kRounds
+            << " rounds of " << kFrameBytes << "-byte frames\n";
+  Bench(ut::Reactor::Backend::kEpoll, "epoll");
+  try {
+    ut::Reactor probe(ut::Reactor::Backend::kIoUring);
+  } catch (const std::exception& ex) {
+    std::cout << "io_uring: skipped (" << ex.what() << ")\n";
+    return 0;
+  }
+  Bench(ut::Reactor::Backend::kIoUring, "io_uring");
+#endif
+  return 0;
+}
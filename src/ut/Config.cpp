@@ -94,6 +94,8 @@ void Config::Load() {
       this->telemetry = value == "1" || value == "true";
     } else if (key == "shared_key") {
       shared_key_hex = value;
+    } else if (key == "in_process_pty") {
+      this->in_process_pty = value == "1" || value == "true";
     }
   }
 }
@@ -12,6 +12,9 @@ struct Config {
   bool telemetry = true;
   std::string config_path;
   std::string shared_key_hex;
+  // Server: spawn shells in the server process instead of relaying through
+  // undying-terminal-terminal (POSIX only).
+  bool in_process_pty = false;
 
   void Load();
   bool IsVerbose() const { return verbose; }
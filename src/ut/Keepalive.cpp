@@ -2,61 +2,59 @@
 
 #include <chrono>
 
-#ifdef _WIN32
-#include <windows.h>
-#define SLEEP_SECONDS(s) Sleep((s) * 1000)
-#else
-#include <unistd.h>
-#define SLEEP_SECONDS(s) sleep(s)
-#endif
+namespace {
+int64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+}
 
-Keepalive::Keepalive() = default;
+Keepalive::Keepalive(ut::Reactor* reactor) : reactor_(reactor) {}
 
 Keepalive::~Keepalive() {
   Stop();
 }
 
-void Keepalive::Start(int interval_seconds, SendCallback send_fn) {
-  if (running_) {
+void Keepalive::Start(int interval_seconds, int dead_seconds, SendCallback send_fn, DeadCallback on_dead) {
+  if (timer_ != 0) {
     return;
   }
 
   interval_seconds_ = interval_seconds;
-  running_ = true;
-  connection_dead_ = false;
-  missed_count_ = 0;
-
-  thread_ = std::thread([this, send_fn]() {
-    while (running_) {
-      SLEEP_SECONDS(interval_seconds_);
-      if (!running_) {
-        break;
-      }
-
-      if (send_fn && send_fn()) {
-        missed_count_ = 0;
-      } else {
-        ++missed_count_;
-        if (missed_count_ >= max_missed_) {
-          connection_dead_ = true;
-        }
-      }
-    }
-  });
+  dead_seconds_ = dead_seconds;
+  send_fn_ = std::move(send_fn);
+  on_dead_ = std::move(on_dead);
+  Reset();
+  timer_ = reactor_->AddTimer(interval_seconds_ * 1000, [this] { Tick(); });
 }
 
 void Keepalive::Stop() {
-  running_ = false;
-  if (thread_.joinable()) {
-    thread_.join();
+  if (timer_ != 0) {
+    reactor_->CancelTimer(timer_);
+    timer_ = 0;
   }
 }
 
 void Keepalive::Reset() {
-  missed_count_ = 0;
+  last_rx_ms_ = NowMs();
   connection_dead_ = false;
 }
 
 bool Keepalive::IsConnectionDead() const {
   return connection_dead_;
 }
+
+void Keepalive::Tick() {
+  timer_ = reactor_->AddTimer(interval_seconds_ * 1000, [this] { Tick(); });
+  if (send_fn_) {
+    send_fn_();
+  }
+  if (NowMs() - last_rx_ms_ > static_cast<int64_t>(dead_seconds_) * 1000) {
+    // Start a new silent stretch, so a reconnect gets as long to deliver.
+    last_rx_ms_ = NowMs();
+    connection_dead_ = true;
+    if (on_dead_) {
+      on_dead_();
+    }
+  }
+}
@@ -1,26 +1,43 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <functional>
-#include <thread>
 
+#include "protocol/Reactor.hpp"
+
+// Sends a keepalive every interval from a reactor timer, and declares the
+// connection dead once nothing has been received for `dead_seconds`. No
+// thread of its own: the reactor's polling thread runs both checks.
 class Keepalive {
  public:
-  using SendCallback = std::function<bool()>;
+  using SendCallback = std::function<void()>;
+  using DeadCallback = std::function<void()>;
 
-  Keepalive();
+  explicit Keepalive(ut::Reactor* reactor);
   ~Keepalive();
 
-  void Start(int interval_seconds, SendCallback send_fn);
+  Keepalive(const Keepalive&) = delete;
+  Keepalive& operator=(const Keepalive&) = delete;
+
+  // Start and Stop belong to the reactor's polling thread (or run while
+  // nothing polls it). `on_dead` runs there too, after every `dead_seconds`
+  // of silence.
+  void Start(int interval_seconds, int dead_seconds, SendCallback send_fn, DeadCallback on_dead);
   void Stop();
+  // Something arrived from the peer. Safe from any thread.
   void Reset();
   bool IsConnectionDead() const;
 
  private:
-  std::atomic<bool> running_{false};
-  std::atomic<bool> connection_dead_{false};
-  std::atomic<int> missed_count_{0};
-  std::thread thread_;
+  void Tick();
+
+  ut::Reactor* reactor_ = nullptr;
+  ut::TimerWheel::TimerId timer_ = 0;
   int interval_seconds_ = 5;
-  int max_missed_ = 3;
+  int dead_seconds_ = 15;
+  SendCallback send_fn_;
+  DeadCallback on_dead_;
+  std::atomic<int64_t> last_rx_ms_{0};
+  std::atomic<bool> connection_dead_{false};
 };
@@ -1,7 +1,5 @@
 #include "ReconnectionManager.hpp"
 
-#include <algorithm>
-
 #ifdef _WIN32
 #include <windows.h>
 #define SLEEP_MS(ms) Sleep(ms)
@@ -23,17 +21,14 @@ bool ReconnectionManager::AttemptReconnect(ConnectCallback connect_fn) {
     return false;
   }
 
-  while (retry_count_ < max_retries_) {
-    int delay = base_delay_ms_ * (1 << retry_count_);
-    if (delay > max_delay_ms_) {
-      delay = max_delay_ms_;
-    }
-
-    if (retry_count_ > 0) {
+  // The first attempt goes out at once; later ones back off with jitter.
+  bool first = backoff_.attempts() == 0;
+  while (backoff_.attempts() < max_retries_) {
+    const int delay = backoff_.NextDelayMs();
+    if (!first) {
       SLEEP_MS(delay);
     }
-
-    ++retry_count_;
+    first = false;
 
     if (connect_fn(host_, port_)) {
       return true;
@@ -44,5 +39,5 @@ bool ReconnectionManager::AttemptReconnect(ConnectCallback connect_fn) {
 }
 
 void ReconnectionManager::ResetBackoff() {
-  retry_count_ = 0;
+  backoff_.Reset();
 }
@@ -3,6 +3,8 @@
 #include <functional>
 #include <string>
 
+#include "protocol/Backoff.hpp"
+
 class ReconnectionManager {
  public:
   using ConnectCallback = std::function<bool(const std::string& host, int port)>;
@@ -12,14 +14,12 @@ class ReconnectionManager {
   void SetTarget(const std::string& host, int port, const std::string& client_id);
   bool AttemptReconnect(ConnectCallback connect_fn);
   void ResetBackoff();
-  int GetRetryCount() const { return retry_count_; }
+  int GetRetryCount() const { return backoff_.attempts(); }
 
  private:
   std::string host_;
   int port_ = 2022;
   std::string client_id_;
-  int retry_count_ = 0;
   int max_retries_ = 5;
-  int base_delay_ms_ = 100;
-  int max_delay_ms_ = 2000;
+  ut::Backoff backoff_{100, 2000};
 };
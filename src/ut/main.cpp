@@ -12,6 +12,7 @@
 #include <vector>
 
 #include "ClientId.hpp"
+#include "Keepalive.hpp"
 #include "PseudoTerminalConsole.hpp"
 #include "SshConfig.hpp"
 #include "SshCommandBuilder.hpp"
@@ -19,8 +20,10 @@
 #include "WinsockContext.hpp"
 
 #include "protocol/ClientConnection.hpp"
+#include "protocol/LatencyTrace.hpp"
 #include "protocol/Packet.hpp"
 #include "protocol/PortForwardHandler.hpp"
+#include "protocol/Reactor.hpp"
 #include "protocol/TcpSocketHandler.hpp"
 #include "protocol/TunnelUtils.hpp"
 #include "UtConstants.hpp"
@@ -104,6 +107,17 @@ bool SendTerminalInfo(ut::ClientConnection& connection, const std::string& clien
   return true;
 }
 
+// Stops reading from the server while a tunnel socket is not taking what the
+// server sends it; the reactor thread flushes the tunnels meanwhile.
+void WaitForTunnels(const std::atomic<bool>& running,
+                    const std::shared_ptr<ut::PortForwardHandler>& forward_handler,
+                    const std::shared_ptr<ut::PortForwardHandler>& reverse_handler) {
+  while (running && ((forward_handler && forward_handler->Backlogged()) ||
+                     (reverse_handler && reverse_handler->Backlogged()))) {
+    Sleep(5);
+  }
+}
+
 std::string EscapeForDoubleQuotes(const std::string& input) {
   std::string out;
   out.reserve(input.size());
@@ -733,16 +747,10 @@ int main(int argc, char** argv) {
       return 1;
     }
  
-    auto socket_handler = std::make_shared<ut::TcpSocketHandler>();
-    ut::ClientConnection connection(socket_handler, endpoint, client_id, passkey);
-    connection.SetReconnectEnabled(interactive);
-    if (!connection.Connect()) {
-       std::cerr << "Failed to connect to server\n";
-       return 1;
-     }
-
-    const bool returning_client = connection.IsReturningClient();
-    if (!returning_client) {
+    // INITIAL_PAYLOAD and the -c command go out with the ConnectRequest;
+    // the server drops them if the session already exists.
+    std::vector<ut::Packet> initial_packets;
+    {
       ut::InitialPayload payload;
       if (!jumphost_arg.empty()) {
         payload.set_jumphost(true);
@@ -763,25 +771,14 @@ int main(int argc, char** argv) {
       }
       std::string payload_bytes;
       payload.SerializeToString(&payload_bytes);
-      connection.WritePacket(ut::Packet(static_cast<uint8_t>(ut::INITIAL_PAYLOAD), payload_bytes));
-
-      ut::Packet response_packet;
-      if (!connection.ReadPacket(&response_packet) || response_packet.header() != static_cast<uint8_t>(ut::INITIAL_RESPONSE)) {
-        std::cerr << "Missing initial response\n";
-        return 1;
-      }
-      ut::InitialResponse response;
-      if (!response.ParseFromString(response_packet.payload()) || !response.error().empty()) {
-        std::cerr << "Initial response error: " << response.error() << "\n";
-        return 1;
-      }
+      initial_packets.emplace_back(static_cast<uint8_t>(ut::INITIAL_PAYLOAD), payload_bytes);
 
       if (!command_arg.empty()) {
         ut::TerminalBuffer tb;
         tb.set_buffer(NormalizeCommand(command_arg));
         std::string tb_bytes;
         if (tb.SerializeToString(&tb_bytes)) {
-          connection.WritePacket(ut::Packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), tb_bytes));
+          initial_packets.emplace_back(static_cast<uint8_t>(ut::TERMINAL_BUFFER), tb_bytes);
         }
       }
       if (!noexit && !command_arg.empty()) {
@@ -789,9 +786,31 @@ int main(int argc, char** argv) {
         tb.set_buffer("exit\r\n");
         std::string tb_bytes;
         if (tb.SerializeToString(&tb_bytes)) {
-          connection.WritePacket(ut::Packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), tb_bytes));
+          initial_packets.emplace_back(static_cast<uint8_t>(ut::TERMINAL_BUFFER), tb_bytes);
         }
       }
+    }
+
+    auto socket_handler = std::make_shared<ut::TcpSocketHandler>();
+    ut::ClientConnection connection(socket_handler, endpoint, client_id, passkey);
+    connection.SetReconnectEnabled(interactive);
+    if (!connection.Connect(initial_packets)) {
+       std::cerr << "Failed to connect to server\n";
+       return 1;
+     }
+
+    const bool returning_client = connection.IsReturningClient();
+    if (!returning_client) {
+      ut::Packet response_packet;
+      if (!connection.ReadPacket(&response_packet) || response_packet.header() != static_cast<uint8_t>(ut::INITIAL_RESPONSE)) {
+        std::cerr << "Missing initial response\n";
+        return 1;
+      }
+      ut::InitialResponse response;
+      if (!response_packet.ParsePayload(&response) || !response.error().empty()) {
+        std::cerr << "Initial response error: " << response.error() << "\n";
+        return 1;
+      }
     }
  
      PseudoTerminalConsole console;
@@ -803,27 +822,17 @@ int main(int argc, char** argv) {
     HANDLE stdin_handle = GetStdHandle(STD_INPUT_HANDLE);
     HANDLE stdout_handle = GetStdHandle(STD_OUTPUT_HANDLE);
     PredictiveEcho predictor(predictive_echo && interactive, stdout_handle);
+    ut::latency_trace::KeystrokeTracer tracer;
     std::atomic<bool> running{true};
-    std::atomic<int64_t> last_rx_ms{NowMs()};
 
-    constexpr int64_t kKeepaliveIntervalMs = 5000;
-    constexpr int64_t kKeepaliveDeadMs = 15000;
-    std::thread keepalive_thread;
+    // Keepalives and port forwards share one reactor thread.
+    ut::Reactor reactor;
+    Keepalive keepalive(&reactor);
     if (enable_keepalive) {
-      keepalive_thread = std::thread([&]() {
-        while (running) {
-          Sleep(static_cast<DWORD>(kKeepaliveIntervalMs));
-          if (!running) {
-            break;
-          }
-          connection.Write(ut::Packet(static_cast<uint8_t>(ut::KEEP_ALIVE), ""));
-          const int64_t age = NowMs() - last_rx_ms.load();
-          if (age > kKeepaliveDeadMs) {
-            connection.CloseSocketAndMaybeReconnect();
-            last_rx_ms.store(NowMs());
-          }
-        }
-      });
+      keepalive.Start(
+          ut::kKeepaliveIntervalSeconds, ut::kDeadPeerSeconds,
+          [&] { connection.Write(ut::Packet(static_cast<uint8_t>(ut::KEEP_ALIVE), tracer.KeepalivePayload())); },
+          [&] { connection.CloseSocketAndMaybeReconnect(); });
     }
 
     std::shared_ptr<ut::PortForwardHandler> forward_handler;
@@ -861,6 +870,7 @@ int main(int argc, char** argv) {
           if (!tb.SerializeToString(&tb_bytes)) {
             continue;
           }
+          tracer.StampKeystroke(&tb_bytes);
           connection.WritePacket(ut::Packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), tb_bytes));
         }
         running = false;
@@ -880,18 +890,24 @@ int main(int argc, char** argv) {
           auto reader = connection.reader();
           if (!reader || !reader->HasData()) {
             const int64_t now = NowMs();
-            if (!saw_output && now - start_ms > kFirstOutputTimeoutMs) {
+            const int64_t deadline = saw_output ? last_output_ms + kIdleExitMs : start_ms + kFirstOutputTimeoutMs;
+            if (now > deadline) {
               break;
             }
-            if (saw_output && now - last_output_ms > kIdleExitMs) {
-              break;
+            // Sleep until output arrives or the deadline passes instead of
+            // polling; the 5ms nap only covers a reconnect in progress.
+            if (!reader || !reader->WaitForData(static_cast<int>(deadline - now) + 1)) {
+              if (connection.socket() == ut::kInvalidSocket) {
+                Sleep(5);
+              }
             }
-            Sleep(5);
             continue;
           }
 
           if (!connection.ReadPacket(&packet)) {
-            Sleep(5);
+            if (connection.socket() == ut::kInvalidSocket) {
+              Sleep(5);
+            }
             continue;
           }
           if (packet.header() == static_cast<uint8_t>(ut::KEEP_ALIVE)) {
@@ -902,7 +918,7 @@ int main(int argc, char** argv) {
               continue;
             }
             ut::TerminalBuffer tb;
-            if (!tb.ParseFromString(packet.payload())) {
+            if (!packet.ParsePayload(&tb)) {
               continue;
             }
             std::string output = tb.buffer();
@@ -930,6 +946,7 @@ int main(int argc, char** argv) {
             if (reverse_handler) {
               reverse_handler->HandlePacket(packet, send_packet);
             }
+            WaitForTunnels(running, forward_handler, reverse_handler);
           }
         }
 
@@ -943,24 +960,29 @@ int main(int argc, char** argv) {
           if (DebugHandshake()) {
             std::cerr << "[handshake] client_from_server read_failed\n" << std::flush;
           }
-          Sleep(5);
+          // Reads block on a live socket; only wait out a reconnect.
+          if (connection.socket() == ut::kInvalidSocket) {
+            Sleep(5);
+          }
           continue;
         }
-        last_rx_ms.store(NowMs());
+        keepalive.Reset();
         if (DebugHandshake()) {
           std::cerr << "[handshake] client_from_server header="
                     << static_cast<int>(packet.header())
                     << " bytes=" << packet.payload().size() << "\n" << std::flush;
         }
         if (packet.header() == static_cast<uint8_t>(ut::KEEP_ALIVE)) {
+          tracer.OnKeepalive(packet.payload());
           continue;
         }
         if (packet.header() == static_cast<uint8_t>(ut::TERMINAL_BUFFER)) {
+          tracer.OnOutput(packet.payload());
           if (!enable_terminal_output) {
             continue;
           }
           ut::TerminalBuffer tb;
-          if (!tb.ParseFromString(packet.payload())) {
+          if (!packet.ParsePayload(&tb)) {
             continue;
           }
           std::string output = tb.buffer();
@@ -985,22 +1007,23 @@ int main(int argc, char** argv) {
           if (reverse_handler) {
             reverse_handler->HandlePacket(packet, send_packet);
           }
+          WaitForTunnels(running, forward_handler, reverse_handler);
         }
       }
       running = false;
     });
 
-    std::thread forward_thread;
-    if (forward_handler || reverse_handler) {
-      forward_thread = std::thread([&]() {
+    if (forward_handler) {
+      forward_handler->AttachReactor(&reactor, send_packet);
+    }
+    if (reverse_handler) {
+      reverse_handler->AttachReactor(&reactor, send_packet);
+    }
+    std::thread reactor_thread;
+    if (enable_keepalive || forward_handler || reverse_handler) {
+      reactor_thread = std::thread([&]() {
         while (running) {
-          if (forward_handler) {
-            forward_handler->Update(send_packet);
-          }
-          if (reverse_handler) {
-            reverse_handler->Update(send_packet);
-          }
-          Sleep(10);
+          reactor.Poll(-1);
         }
       });
     }
@@ -1028,15 +1051,25 @@ int main(int argc, char** argv) {
       output_thread.join();
     }
     running = false;
+    reactor.Wake();
     if (resize_thread.joinable()) {
       resize_thread.join();
     }
-    if (forward_thread.joinable()) {
-      forward_thread.join();
+    if (reactor_thread.joinable()) {
+      reactor_thread.join();
     }
-
-    if (keepalive_thread.joinable()) {
-      keepalive_thread.join();
+    keepalive.Stop();
+    if (ut::latency_trace::Enabled()) {
+      const std::string summary = ut::latency_trace::Summary();
+      if (!summary.empty()) {
+        std::cerr << "[latency] " << summary << "\n";
+      }
+    }
+    if (forward_handler) {
+      forward_handler->AttachReactor(nullptr, nullptr);
+    }
+    if (reverse_handler) {
+      reverse_handler->AttachReactor(nullptr, nullptr);
     }
     return 0;
   }
@@ -1122,16 +1155,10 @@ int main(int argc, char** argv) {
     const bool enable_keepalive = interactive || tunnel_only;
     const bool enable_terminal_output = !tunnel_only;
 
-    auto socket_handler = std::make_shared<ut::TcpSocketHandler>();
-    ut::ClientConnection connection(socket_handler, endpoint, client_id, passkey);
-    connection.SetReconnectEnabled(interactive);
-    if (!connection.Connect()) {
-      std::cerr << "Failed to connect to server\n";
-      return 1;
-    }
-
-    const bool returning_client = connection.IsReturningClient();
-    if (!returning_client) {
+    // INITIAL_PAYLOAD and the -c command go out with the ConnectRequest;
+    // the server drops them if the session already exists.
+    std::vector<ut::Packet> initial_packets;
+    {
       ut::InitialPayload payload;
       if (!jumphost_arg.empty()) {
         payload.set_jumphost(true);
@@ -1152,25 +1179,14 @@ int main(int argc, char** argv) {
       }
       std::string payload_bytes;
       payload.SerializeToString(&payload_bytes);
-      connection.WritePacket(ut::Packet(static_cast<uint8_t>(ut::INITIAL_PAYLOAD), payload_bytes));
-
-      ut::Packet response_packet;
-      if (!connection.ReadPacket(&response_packet) || response_packet.header() != static_cast<uint8_t>(ut::INITIAL_RESPONSE)) {
-        std::cerr << "Missing initial response\n";
-        return 1;
-      }
-      ut::InitialResponse response;
-      if (!response.ParseFromString(response_packet.payload()) || !response.error().empty()) {
-        std::cerr << "Initial response error: " << response.error() << "\n";
-        return 1;
-      }
+      initial_packets.emplace_back(static_cast<uint8_t>(ut::INITIAL_PAYLOAD), payload_bytes);
 
       if (!command_arg.empty()) {
         ut::TerminalBuffer tb;
         tb.set_buffer(NormalizeCommand(command_arg));
         std::string tb_bytes;
         if (tb.SerializeToString(&tb_bytes)) {
-          connection.WritePacket(ut::Packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), tb_bytes));
+          initial_packets.emplace_back(static_cast<uint8_t>(ut::TERMINAL_BUFFER), tb_bytes);
         }
       }
       if (!noexit && !command_arg.empty()) {
@@ -1178,9 +1194,31 @@ int main(int argc, char** argv) {
         tb.set_buffer("exit\r\n");
         std::string tb_bytes;
         if (tb.SerializeToString(&tb_bytes)) {
-          connection.WritePacket(ut::Packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), tb_bytes));
+          initial_packets.emplace_back(static_cast<uint8_t>(ut::TERMINAL_BUFFER), tb_bytes);
         }
       }
+    }
+
+    auto socket_handler = std::make_shared<ut::TcpSocketHandler>();
+    ut::ClientConnection connection(socket_handler, endpoint, client_id, passkey);
+    connection.SetReconnectEnabled(interactive);
+    if (!connection.Connect(initial_packets)) {
+      std::cerr << "Failed to connect to server\n";
+      return 1;
+    }
+
+    const bool returning_client = connection.IsReturningClient();
+    if (!returning_client) {
+      ut::Packet response_packet;
+      if (!connection.ReadPacket(&response_packet) || response_packet.header() != static_cast<uint8_t>(ut::INITIAL_RESPONSE)) {
+        std::cerr << "Missing initial response\n";
+        return 1;
+      }
+      ut::InitialResponse response;
+      if (!response_packet.ParsePayload(&response) || !response.error().empty()) {
+        std::cerr << "Initial response error: " << response.error() << "\n";
+        return 1;
+      }
     }
 
     PseudoTerminalConsole console;
@@ -1192,27 +1230,17 @@ int main(int argc, char** argv) {
     HANDLE stdin_handle = GetStdHandle(STD_INPUT_HANDLE);
     HANDLE stdout_handle = GetStdHandle(STD_OUTPUT_HANDLE);
     PredictiveEcho predictor(predictive_echo && interactive, stdout_handle);
+    ut::latency_trace::KeystrokeTracer tracer;
     std::atomic<bool> running{true};
-    std::atomic<int64_t> last_rx_ms{NowMs()};
 
-    constexpr int64_t kKeepaliveIntervalMs = 5000;
-    constexpr int64_t kKeepaliveDeadMs = 15000;
-    std::thread keepalive_thread;
+    // Keepalives and port forwards share one reactor thread.
+    ut::Reactor reactor;
+    Keepalive keepalive(&reactor);
     if (enable_keepalive) {
-      keepalive_thread = std::thread([&]() {
-        while (running) {
-          Sleep(static_cast<DWORD>(kKeepaliveIntervalMs));
-          if (!running) {
-            break;
-          }
-          connection.Write(ut::Packet(static_cast<uint8_t>(ut::KEEP_ALIVE), ""));
-          const int64_t age = NowMs() - last_rx_ms.load();
-          if (age > kKeepaliveDeadMs) {
-            connection.CloseSocketAndMaybeReconnect();
-            last_rx_ms.store(NowMs());
-          }
-        }
-      });
+      keepalive.Start(
+          ut::kKeepaliveIntervalSeconds, ut::kDeadPeerSeconds,
+          [&] { connection.Write(ut::Packet(static_cast<uint8_t>(ut::KEEP_ALIVE), tracer.KeepalivePayload())); },
+          [&] { connection.CloseSocketAndMaybeReconnect(); });
     }
 
     std::vector<ut::PortForwardSourceRequest> forward_requests;
@@ -1256,6 +1284,7 @@ int main(int argc, char** argv) {
           if (!tb.SerializeToString(&tb_bytes)) {
             continue;
           }
+          tracer.StampKeystroke(&tb_bytes);
           connection.WritePacket(ut::Packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), tb_bytes));
         }
         running = false;
@@ -1275,18 +1304,24 @@ int main(int argc, char** argv) {
           auto reader = connection.reader();
           if (!reader || !reader->HasData()) {
             const int64_t now = NowMs();
-            if (!saw_output && now - start_ms > kFirstOutputTimeoutMs) {
+            const int64_t deadline = saw_output ? last_output_ms + kIdleExitMs : start_ms + kFirstOutputTimeoutMs;
+            if (now > deadline) {
               break;
             }
-            if (saw_output && now - last_output_ms > kIdleExitMs) {
-              break;
+            // Sleep until output arrives or the deadline passes instead of
+            // polling; the 5ms nap only covers a reconnect in progress.
+            if (!reader || !reader->WaitForData(static_cast<int>(deadline - now) + 1)) {
+              if (connection.socket() == ut::kInvalidSocket) {
+                Sleep(5);
+              }
             }
-            Sleep(5);
             continue;
           }
 
           if (!connection.ReadPacket(&packet)) {
-            Sleep(5);
+            if (connection.socket() == ut::kInvalidSocket) {
+              Sleep(5);
+            }
             continue;
           }
           if (packet.header() == static_cast<uint8_t>(ut::KEEP_ALIVE)) {
@@ -1297,7 +1332,7 @@ int main(int argc, char** argv) {
               continue;
             }
             ut::TerminalBuffer tb;
-            if (!tb.ParseFromString(packet.payload())) {
+            if (!packet.ParsePayload(&tb)) {
               continue;
             }
             std::string output = tb.buffer();
@@ -1325,6 +1360,7 @@ int main(int argc, char** argv) {
             if (reverse_handler) {
               reverse_handler->HandlePacket(packet, send_packet);
             }
+            WaitForTunnels(running, forward_handler, reverse_handler);
           }
         }
 
@@ -1338,24 +1374,29 @@ int main(int argc, char** argv) {
           if (DebugHandshake()) {
             std::cerr << "[handshake] client_from_server read_failed\n" << std::flush;
           }
-          Sleep(5);
+          // Reads block on a live socket; only wait out a reconnect.
+          if (connection.socket() == ut::kInvalidSocket) {
+            Sleep(5);
+          }
           continue;
         }
-        last_rx_ms.store(NowMs());
+        keepalive.Reset();
         if (DebugHandshake()) {
           std::cerr << "[handshake] client_from_server header="
                     << static_cast<int>(packet.header())
                     << " bytes=" << packet.payload().size() << "\n" << std::flush;
         }
         if (packet.header() == static_cast<uint8_t>(ut::KEEP_ALIVE)) {
+          tracer.OnKeepalive(packet.payload());
           continue;
         }
         if (packet.header() == static_cast<uint8_t>(ut::TERMINAL_BUFFER)) {
+          tracer.OnOutput(packet.payload());
           if (!enable_terminal_output) {
             continue;
           }
           ut::TerminalBuffer tb;
-          if (!tb.ParseFromString(packet.payload())) {
+          if (!packet.ParsePayload(&tb)) {
             continue;
           }
           std::string output = tb.buffer();
@@ -1380,22 +1421,23 @@ int main(int argc, char** argv) {
           if (reverse_handler) {
             reverse_handler->HandlePacket(packet, send_packet);
           }
+          WaitForTunnels(running, forward_handler, reverse_handler);
         }
       }
       running = false;
     });
 
-    std::thread forward_thread;
-    if (forward_handler || reverse_handler) {
-      forward_thread = std::thread([&]() {
+    if (forward_handler) {
+      forward_handler->AttachReactor(&reactor, send_packet);
+    }
+    if (reverse_handler) {
+      reverse_handler->AttachReactor(&reactor, send_packet);
+    }
+    std::thread reactor_thread;
+    if (enable_keepalive || forward_handler || reverse_handler) {
+      reactor_thread = std::thread([&]() {
         while (running) {
-          if (forward_handler) {
-            forward_handler->Update(send_packet);
-          }
-          if (reverse_handler) {
-            reverse_handler->Update(send_packet);
-          }
-          Sleep(10);
+          reactor.Poll(-1);
         }
       });
     }
@@ -1423,15 +1465,25 @@ int main(int argc, char** argv) {
       output_thread.join();
     }
     running = false;
+    reactor.Wake();
     if (resize_thread.joinable()) {
       resize_thread.join();
     }
-    if (forward_thread.joinable()) {
-      forward_thread.join();
+    if (reactor_thread.joinable()) {
+      reactor_thread.join();
     }
-
-    if (keepalive_thread.joinable()) {
-      keepalive_thread.join();
+    keepalive.Stop();
+    if (ut::latency_trace::Enabled()) {
+      const std::string summary = ut::latency_trace::Summary();
+      if (!summary.empty()) {
+        std::cerr << "[latency] " << summary << "\n";
+      }
+    }
+    if (forward_handler) {
+      forward_handler->AttachReactor(nullptr, nullptr);
+    }
+    if (reverse_handler) {
+      reverse_handler->AttachReactor(nullptr, nullptr);
     }
 
     return 0;
@@ -1,9 +1,12 @@
 #include "BackedReader.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <stdexcept>
+#include <vector>
 
-#include <winsock2.h>
+#include "WorkerPool.hpp"
 
 namespace ut {
 BackedReader::BackedReader(std::shared_ptr<SocketHandler> socket_handler,
@@ -18,66 +21,59 @@ bool BackedReader::HasData() {
   if (socket_ == kInvalidSocket) {
     return false;
   }
-  if (!local_buffer_.empty()) {
+  if (HasBufferedFrame()) {
     return true;
   }
   return socket_handler_->HasData(socket_);
 }
 
+bool BackedReader::WaitForData(int timeout_ms) {
+  SocketHandle socket = kInvalidSocket;
+  {
+    std::lock_guard<std::mutex> guard(recover_mutex_);
+    if (socket_ == kInvalidSocket) {
+      return false;
+    }
+    if (HasBufferedFrame()) {
+      return true;
+    }
+    socket = socket_;
+  }
+  return socket_handler_->WaitForData(socket, timeout_ms);
+}
+
 int BackedReader::Read(Packet* packet) {
   std::lock_guard<std::mutex> guard(recover_mutex_);
   if (socket_ == kInvalidSocket) {
     return 0;
   }
-  if (!local_buffer_.empty()) {
-    *packet = Packet(local_buffer_.front());
-    local_buffer_.pop_front();
-    if (packet->is_encrypted()) {
-      packet->set_payload(crypto_handler_->Decrypt(packet->payload()));
-      packet->set_encrypted(false);
-    }
-    return 1;
-  }
-
-  if (partial_message_.size() < 4) {
-    char tmp[4] = {};
-    const int rc = socket_handler_->Read(socket_, tmp, 4 - partial_message_.size());
-    if (rc == 0) {
-      return -1;
-    }
-    if (rc < 0) {
-      return -1;
+  if (!HasBufferedFrame()) {
+    const int rc = FillReceiveBuffer();
+    if (rc == SocketHandler::kWouldBlock) {
+      return 0;
     }
-    partial_message_.append(tmp, tmp + rc);
-  }
-  if (partial_message_.size() < 4) {
-    return 0;
-  }
-
-  const int message_length = GetPartialMessageLength();
-  const int remaining = message_length - static_cast<int>(partial_message_.size() - 4);
-  if (remaining > 0) {
-    std::string s(static_cast<size_t>(remaining), '\0');
-    const int rc = socket_handler_->Read(socket_, &s[0], s.size());
-    if (rc == 0) {
+    if (rc <= 0) {
       return -1;
     }
-    if (rc < 0) {
-      return -1;
+    if (!HasBufferedFrame()) {
+      return 0;
     }
-    partial_message_.append(s.data(), s.data() + rc);
-  }
-  if (static_cast<int>(partial_message_.size() - 4) == message_length) {
-    ConstructPartialMessage(packet);
-    return 1;
+    OpenBufferedFrames();
   }
-  return 0;
+  ConstructBufferedMessage(packet);
+  return 1;
 }
 
-void BackedReader::Revive(SocketHandle socket, const std::vector<std::string>& buffered) {
-  partial_message_.clear();
-  local_buffer_.insert(local_buffer_.end(), buffered.begin(), buffered.end());
-  sequence_number_ += static_cast<int64_t>(buffered.size());
+void BackedReader::Revive(SocketHandle socket, int64_t peer_resume_sequence_number) {
+  if (peer_resume_sequence_number < sequence_number_) {
+    throw std::runtime_error("peer resumes behind reader");
+  }
+  crypto_handler_->SkipNonces(static_cast<uint64_t>(peer_resume_sequence_number - sequence_number_));
+  sequence_number_ = peer_resume_sequence_number;
+  read_pos_ = 0;
+  write_pos_ = 0;
+  opened_frames_ = 0;
+  receive_capacity_ = kReceiveBufferBytes;
   socket_ = socket;
 }
 
@@ -86,32 +82,128 @@ void BackedReader::InvalidateSocket() {
   socket_ = kInvalidSocket;
 }
 
-int BackedReader::GetPartialMessageLength() const {
-  if (partial_message_.size() < 4) {
-    throw std::runtime_error("partial header missing");
-  }
-  uint32_t len_be = 0;
-  std::memcpy(&len_be, partial_message_.data(), sizeof(len_be));
-  const uint32_t len = ntohl(len_be);
-  if (len == 0 || len > 128 * 1024 * 1024) {
+size_t BackedReader::BufferedFrameSize() const {
+  if (write_pos_ - read_pos_ < Packet::kLengthBytes) {
+    return 0;
+  }
+  const uint32_t len = Packet::DecodeLength(receive_buffer_->data() + read_pos_);
+  if (len < Packet::kHeaderBytes || len > 128 * 1024 * 1024) {
     throw std::runtime_error("invalid message length");
   }
-  return static_cast<int>(len);
+  return Packet::kLengthBytes + static_cast<size_t>(len);
+}
+
+bool BackedReader::HasBufferedFrame() const {
+  if (write_pos_ - read_pos_ < Packet::kLengthBytes) {
+    return false;
+  }
+  const uint32_t len = Packet::DecodeLength(receive_buffer_->data() + read_pos_);
+  if (len < Packet::kHeaderBytes || len > 128 * 1024 * 1024) {
+    // Let Read() surface the framing error.
+    return true;
+  }
+  return write_pos_ - read_pos_ >= Packet::kLengthBytes + static_cast<size_t>(len);
+}
+
+int BackedReader::FillReceiveBuffer() {
+  const size_t pending = write_pos_ - read_pos_;
+  const size_t capacity = std::max(receive_capacity_, BufferedFrameSize());
+  // Packets handed out earlier may still view the current buffer; only
+  // recycle it in place once nobody else holds a reference. A buffer grown
+  // for a burst is given back once traffic calms down.
+  if (!receive_buffer_ || receive_buffer_.use_count() != 1 || receive_buffer_->size() < capacity ||
+      receive_buffer_->size() > 2 * capacity) {
+    auto next = std::make_shared<std::string>(capacity, '\0');
+    if (pending > 0) {
+      std::memcpy(&(*next)[0], receive_buffer_->data() + read_pos_, pending);
+    }
+    receive_buffer_ = std::move(next);
+  } else if (read_pos_ > 0) {
+    std::memmove(&(*receive_buffer_)[0], receive_buffer_->data() + read_pos_, pending);
+  }
+  read_pos_ = 0;
+  write_pos_ = pending;
+
+  const int rc = socket_handler_->Read(socket_, &(*receive_buffer_)[write_pos_],
+                                       receive_buffer_->size() - write_pos_);
+  if (rc > 0) {
+    write_pos_ += static_cast<size_t>(rc);
+    if (write_pos_ == receive_buffer_->size()) {
+      receive_capacity_ = std::min(receive_capacity_ * 2, kMaxReceiveBufferBytes);
+    } else if (write_pos_ < receive_capacity_ / 2) {
+      receive_capacity_ = kReceiveBufferBytes;
+    }
+  }
+  return rc;
 }
 
-void BackedReader::ConstructPartialMessage(Packet* packet) {
-  const int message_length = GetPartialMessageLength();
-  const size_t body_offset = 4;
-  if (partial_message_.size() - body_offset != static_cast<size_t>(message_length)) {
-    throw std::runtime_error("partial message length mismatch");
-  }
-  const std::string serialized = partial_message_.substr(body_offset, message_length);
-  *packet = Packet(serialized);
-  if (packet->is_encrypted()) {
-    packet->set_payload(crypto_handler_->Decrypt(packet->payload()));
-    packet->set_encrypted(false);
-  }
-  partial_message_.clear();
+void BackedReader::OpenBufferedFrames() {
+  struct SealedFrame {
+    char* data;
+    size_t size;
+  };
+  std::vector<SealedFrame> frames;
+  size_t sealed_bytes = 0;
+  size_t pos = read_pos_;
+  while (write_pos_ - pos >= Packet::kLengthBytes) {
+    const uint32_t len = Packet::DecodeLength(receive_buffer_->data() + pos);
+    const size_t frame_size = Packet::kLengthBytes + static_cast<size_t>(len);
+    if (len < Packet::kHeaderBytes || len > 128 * 1024 * 1024 || write_pos_ - pos < frame_size) {
+      break;
+    }
+    char* frame = &(*receive_buffer_)[pos];
+    if (frame[Packet::kLengthBytes] == 0 || frame_size < Packet::kFrameOverhead + CryptoHandler::kMacBytes) {
+      break;
+    }
+    frames.push_back(SealedFrame{frame + Packet::kFrameOverhead, frame_size - Packet::kFrameOverhead});
+    sealed_bytes += frame_size;
+    pos += frame_size;
+  }
+  if (frames.size() < 2 || sealed_bytes < kParallelDecryptBytes) {
+    return;
+  }
+
+  // Frame i is opened with the nonce i steps ahead of the running one. A
+  // frame that fails to open ends the run; ConstructBufferedMessage retries
+  // it with DecryptInPlace, which raises the error in stream order.
+  std::atomic<size_t> first_failed{frames.size()};
+  WorkerPool::Shared().ParallelFor(frames.size(), [&](size_t i) {
+    if (!crypto_handler_->DecryptInPlaceAhead(frames[i].data, frames[i].size, i)) {
+      size_t expected = first_failed.load();
+      while (i < expected && !first_failed.compare_exchange_weak(expected, i)) {
+      }
+    }
+  });
+  opened_frames_ = first_failed.load();
+}
+
+void BackedReader::ConstructBufferedMessage(Packet* packet) {
+  size_t offset = read_pos_;
+  size_t frame_size = BufferedFrameSize();
+  read_pos_ += frame_size;
+  if (read_pos_ == write_pos_) {
+    read_pos_ = 0;
+    write_pos_ = 0;
+  }
+  char* frame = &(*receive_buffer_)[offset];
+  if (frame[Packet::kLengthBytes] != 0) {
+    // Decrypt inside the receive buffer, then rewrite the prefix and header
+    // over the MAC so the plaintext frame is contiguous again.
+    const char header = frame[Packet::kLengthBytes + 1];
+    if (opened_frames_ > 0) {
+      opened_frames_--;
+      crypto_handler_->SkipNonce();
+    } else {
+      crypto_handler_->DecryptInPlace(frame + Packet::kFrameOverhead, frame_size - Packet::kFrameOverhead);
+    }
+    offset += CryptoHandler::kMacBytes;
+    frame_size -= CryptoHandler::kMacBytes;
+    frame += CryptoHandler::kMacBytes;
+    Packet::EncodeLength(static_cast<uint32_t>(frame_size - Packet::kLengthBytes), frame);
+    frame[Packet::kLengthBytes] = 0;
+    frame[Packet::kLengthBytes + 1] = header;
+  }
+  *packet = Packet(receive_buffer_, offset, frame_size);
   sequence_number_++;
 }
 }
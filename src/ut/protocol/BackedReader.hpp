@@ -1,10 +1,8 @@
 #pragma once
 
-#include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
-#include <vector>
 
 #include "CryptoHandler.hpp"
 #include "Packet.hpp"
@@ -18,22 +16,47 @@ class BackedReader {
                SocketHandle socket);
 
   bool HasData();
+  // Blocks until HasData() would be true, up to `timeout_ms` (-1 for no
+  // limit). Returns false on timeout or while the socket is invalid. The wait
+  // runs outside the recover lock so a concurrent Revive is not held up.
+  bool WaitForData(int timeout_ms);
   int Read(Packet* packet);
-  void Revive(SocketHandle socket, const std::vector<std::string>& buffered);
+  // The peer resumes with the frame after `peer_resume_sequence_number`:
+  // sequence_number() when it replays everything we missed, or later when it
+  // skipped a backlog, in which case the skipped frames are never read.
+  void Revive(SocketHandle socket, int64_t peer_resume_sequence_number);
   void InvalidateSocket();
   int64_t sequence_number() const { return sequence_number_; }
   std::mutex& recover_mutex() { return recover_mutex_; }
 
  private:
-  int GetPartialMessageLength() const;
-  void ConstructPartialMessage(Packet* packet);
+  // Large enough that a burst of small frames is drained by one recv.
+  static constexpr size_t kReceiveBufferBytes = 64 * 1024;
+  // A sustained burst (a replayed backlog) doubles the buffer up to this, so
+  // each recv hands OpenBufferedFrames a sizeable run of frames.
+  static constexpr size_t kMaxReceiveBufferBytes = 1024 * 1024;
+  // Below this much ciphertext, handing frames to the pool costs more than
+  // opening them on the reading thread.
+  static constexpr size_t kParallelDecryptBytes = 64 * 1024;
+
+  size_t BufferedFrameSize() const;
+  bool HasBufferedFrame() const;
+  int FillReceiveBuffer();
+  // Opens the complete encrypted frames at the front of the buffer across
+  // the shared WorkerPool, so ConstructBufferedMessage only has to unwrap them.
+  void OpenBufferedFrames();
+  void ConstructBufferedMessage(Packet* packet);
 
   std::mutex recover_mutex_;
   std::shared_ptr<SocketHandler> socket_handler_;
   std::shared_ptr<CryptoHandler> crypto_handler_;
   SocketHandle socket_;
   int64_t sequence_number_ = 0;
-  std::deque<std::string> local_buffer_;
-  std::string partial_message_;
+  std::shared_ptr<std::string> receive_buffer_;
+  size_t read_pos_ = 0;
+  size_t write_pos_ = 0;
+  size_t receive_capacity_ = kReceiveBufferBytes;
+  // Frames at read_pos_ already opened by OpenBufferedFrames.
+  size_t opened_frames_ = 0;
 };
 }
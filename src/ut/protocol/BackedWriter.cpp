@@ -2,11 +2,10 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 
-#include <winsock2.h>
-
 namespace ut {
 namespace {
 bool DebugHandshake() {
@@ -18,84 +17,192 @@ BackedWriter::BackedWriter(std::shared_ptr<SocketHandler> socket_handler,
                            SocketHandle socket)
     : socket_handler_(std::move(socket_handler)),
       crypto_handler_(std::move(crypto_handler)),
-      socket_(socket) {}
+      socket_(socket),
+      backup_(static_cast<size_t>(ut::kMaxBackupBytes)) {}
 
 BackedWriterWriteState BackedWriter::Write(Packet packet) {
-  {
-    std::lock_guard<std::mutex> guard(recover_mutex_);
-    if (socket_ == kInvalidSocket) {
-      if (DebugHandshake()) {
-        std::cerr << "[handshake] writer socket invalid\n";
-      }
-      return BackedWriterWriteState::Skipped;
+  std::lock_guard<std::mutex> guard(recover_mutex_);
+  if (socket_ == kInvalidSocket) {
+    if (DebugHandshake()) {
+      std::cerr << "[handshake] writer socket invalid\n";
     }
+    return BackedWriterWriteState::Skipped;
+  }
 
-    packet.set_encrypted(true);
-    packet.set_payload(crypto_handler_->Encrypt(packet.payload()));
+  AppendLocked(packet);
+  // The frame goes out of the backup ring, queued behind a replay still in
+  // flight or anything a full socket has not taken yet.
+  return FlushCatchupLocked(kCatchupChunkBytes);
+}
 
-    backup_buffer_.push_front(packet);
-    backup_size_ += static_cast<int64_t>(packet.length());
-    sequence_number_++;
+void BackedWriter::Queue(Packet packet) {
+  std::lock_guard<std::mutex> guard(recover_mutex_);
+  AppendLocked(packet);
+}
 
-    while (backup_size_ > ut::kMaxBackupBytes && !backup_buffer_.empty()) {
-      backup_size_ -= static_cast<int64_t>(backup_buffer_.back().length());
-      backup_buffer_.pop_back();
-    }
+void BackedWriter::AppendLocked(const Packet& packet) {
+  const std::string_view plaintext = packet.payload();
+  Packet sealed = Packet::Allocate(true, packet.header(), CryptoHandler::kMacBytes + plaintext.size());
+  char* payload = sealed.mutable_payload();
+  if (!plaintext.empty()) {
+    std::memcpy(payload + CryptoHandler::kMacBytes, plaintext.data(), plaintext.size());
   }
+  crypto_handler_->EncryptInPlace(payload, sealed.payload().size());
 
-  std::string data = packet.serialize();
-  const uint32_t total_len = static_cast<uint32_t>(data.size());
-  uint32_t len_be = htonl(total_len);
+  backup_.Append(sealed.frame());
+  sequence_number_++;
+}
 
-  size_t bytes_written = 0;
-  std::string framed(reinterpret_cast<const char*>(&len_be), sizeof(len_be));
-  framed.append(data);
+BackedWriterWriteState BackedWriter::FlushCatchup(size_t max_bytes) {
+  std::lock_guard<std::mutex> guard(recover_mutex_);
+  if (socket_ == kInvalidSocket) {
+    return BackedWriterWriteState::Skipped;
+  }
+  return FlushCatchupLocked(max_bytes);
+}
+
+bool BackedWriter::HasCatchup() {
+  std::lock_guard<std::mutex> guard(recover_mutex_);
+  return socket_ != kInvalidSocket && sent_sequence_number_ < sequence_number_;
+}
+
+void BackedWriter::Acknowledge(int64_t sequence_number) {
+  std::lock_guard<std::mutex> guard(recover_mutex_);
+  TrimLocked(sequence_number);
+}
+
+void BackedWriter::TrimLocked(int64_t acked_sequence_number) {
+  const int64_t acked = std::min(acked_sequence_number, sent_sequence_number_);
+  const int64_t oldest = sequence_number_ - static_cast<int64_t>(backup_.count()) + 1;
+  if (acked >= oldest) {
+    backup_.DropOldest(static_cast<size_t>(acked - oldest + 1));
+  }
+}
 
+BackedWriterWriteState BackedWriter::FlushCatchupLocked(size_t max_bytes) {
+  const int64_t pending = sequence_number_ - sent_sequence_number_;
+  if (pending <= 0) {
+    return BackedWriterWriteState::Success;
+  }
+  if (pending > static_cast<int64_t>(backup_.count())) {
+    // Unsent frames were evicted; the next Revive reports the gap.
+    return BackedWriterWriteState::WroteWithFailure;
+  }
+  const size_t first = backup_.count() - static_cast<size_t>(pending);
+  size_t frames = 0;
+  size_t bytes = 0;
+  while (first + frames < backup_.count()) {
+    const size_t frame_size = backup_.Frame(first + frames).size();
+    if (frames > 0 && bytes + frame_size > max_bytes) {
+      break;
+    }
+    bytes += frame_size;
+    frames++;
+  }
+  SocketBuffer slices[2];
+  const size_t slice_count = backup_.Slices(first, frames, slices);
+  // The first frame may already be partly out.
+  size_t skip = sent_partial_bytes_;
+  for (size_t i = 0; i < slice_count && skip > 0; ++i) {
+    const size_t consumed = std::min(skip, slices[i].size);
+    slices[i].data = static_cast<const char*>(slices[i].data) + consumed;
+    slices[i].size -= consumed;
+    skip -= consumed;
+  }
+  size_t written = 0;
+  const BackedWriterWriteState state = WriteBuffers(slices, slice_count, &written);
+  // Only frames that went out whole count as sent.
+  size_t done = sent_partial_bytes_ + written;
+  for (size_t i = 0; i < frames; ++i) {
+    const size_t frame_size = backup_.Frame(first + i).size();
+    if (done < frame_size) {
+      break;
+    }
+    done -= frame_size;
+    sent_sequence_number_++;
+  }
+  sent_partial_bytes_ = done;
+  return state;
+}
 
+BackedWriterWriteState BackedWriter::WriteBuffers(SocketBuffer* buffers, size_t count, size_t* written) {
+  size_t index = 0;
   while (true) {
+    while (index < count && buffers[index].size == 0) {
+      index++;
+    }
+    if (index == count) {
+      return BackedWriterWriteState::Success;
+    }
     if (socket_ == kInvalidSocket) {
       return BackedWriterWriteState::WroteWithFailure;
     }
-    int rc = socket_handler_->Write(socket_, framed.data() + bytes_written, framed.size() - bytes_written);
-    if (rc >= 0) {
-      bytes_written += static_cast<size_t>(rc);
-      if (bytes_written == framed.size()) {
-        return BackedWriterWriteState::Success;
-      }
-    } else {
+    int rc = socket_handler_->WriteVector(socket_, buffers + index, count - index);
+    if (rc == SocketHandler::kWouldBlock) {
+      return BackedWriterWriteState::WouldBlock;
+    }
+    if (rc < 0) {
       if (DebugHandshake()) {
         std::cerr << "[handshake] writer write failed\n";
       }
       return BackedWriterWriteState::WroteWithFailure;
     }
+    size_t remaining = static_cast<size_t>(rc);
+    *written += remaining;
+    while (remaining > 0 && index < count) {
+      const size_t consumed = std::min(remaining, buffers[index].size);
+      buffers[index].data = static_cast<const char*>(buffers[index].data) + consumed;
+      buffers[index].size -= consumed;
+      remaining -= consumed;
+      if (buffers[index].size == 0) {
+        index++;
+      }
+    }
   }
 }
 
-std::vector<std::string> BackedWriter::Recover(int64_t last_valid_sequence_number) {
+void BackedWriter::Revive(SocketHandle socket, int64_t last_valid_sequence_number) {
   if (socket_ != kInvalidSocket) {
     throw std::runtime_error("recover with active socket");
   }
-  int64_t messages_to_recover = sequence_number_ - last_valid_sequence_number;
+  const int64_t messages_to_recover = sequence_number_ - last_valid_sequence_number;
   if (messages_to_recover < 0) {
     throw std::runtime_error("peer ahead of writer");
   }
-  if (messages_to_recover == 0) {
-    return {};
-  }
-  int64_t messages_seen = 0;
-  std::vector<std::string> out;
-  for (const auto& packet : backup_buffer_) {
-    out.push_back(packet.serialize());
-    messages_seen++;
-    if (messages_seen == messages_to_recover) {
-      std::reverse(out.begin(), out.end());
-      return out;
+  if (messages_to_recover > static_cast<int64_t>(backup_.count())) {
+    throw std::runtime_error("client too far behind server");
+  }
+  sent_sequence_number_ = last_valid_sequence_number;
+  sent_partial_bytes_ = 0;
+  TrimLocked(last_valid_sequence_number);
+  socket_ = socket;
+}
+
+bool BackedWriter::ReplayExceeds(int64_t last_valid_sequence_number, size_t max_bytes) const {
+  const int64_t messages_to_recover = sequence_number_ - last_valid_sequence_number;
+  if (messages_to_recover <= 0) {
+    return false;
+  }
+  if (messages_to_recover > static_cast<int64_t>(backup_.count())) {
+    return true;
+  }
+  size_t bytes = 0;
+  for (size_t i = backup_.count() - static_cast<size_t>(messages_to_recover); i < backup_.count(); ++i) {
+    bytes += backup_.Frame(i).size();
+    if (bytes > max_bytes) {
+      return true;
     }
   }
-  throw std::runtime_error("client too far behind server");
+  return false;
 }
 
-void BackedWriter::Revive(SocketHandle socket) {
+void BackedWriter::ReviveSkipping(SocketHandle socket) {
+  if (socket_ != kInvalidSocket) {
+    throw std::runtime_error("recover with active socket");
+  }
+  backup_.Clear();
+  sent_sequence_number_ = sequence_number_;
+  sent_partial_bytes_ = 0;
   socket_ = socket;
 }
 
@@ -1,11 +1,10 @@
 #pragma once
 
-#include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
-#include <vector>
 
+#include "BackupRing.hpp"
 #include "CryptoHandler.hpp"
 #include "UtConstants.hpp"
 #include "Packet.hpp"
@@ -16,6 +15,9 @@ enum class BackedWriterWriteState {
   Skipped = 0,
   Success = 1,
   WroteWithFailure = 2,
+  // Backed up, but a non-blocking socket had no room for all of it yet; the
+  // rest goes out through FlushCatchup once the socket is writable.
+  WouldBlock = 3,
 };
 
 class BackedWriter {
@@ -25,20 +27,48 @@ class BackedWriter {
                SocketHandle socket);
 
   BackedWriterWriteState Write(Packet packet);
-  std::vector<std::string> Recover(int64_t last_valid_sequence_number);
-  void Revive(SocketHandle socket);
+  // Seals and backs up `packet` without sending it; it goes out as part of
+  // the replay once Revive hands the writer a socket.
+  void Queue(Packet packet);
+  // Sends up to `max_bytes` of the backlog: frames Revive queued for replay
+  // and frames a full socket has not taken yet.
+  BackedWriterWriteState FlushCatchup(size_t max_bytes);
+  bool HasCatchup();
+  // Drops backed-up frames up to `sequence_number`, which the peer has
+  // confirmed receiving.
+  void Acknowledge(int64_t sequence_number);
+  // Resumes on `socket` and queues every frame after the peer's
+  // `last_valid_sequence_number` for replay. Caller holds recover_mutex().
+  void Revive(SocketHandle socket, int64_t last_valid_sequence_number);
+  // Whether replaying everything after `last_valid_sequence_number` means
+  // more than `max_bytes` or frames already evicted. Caller holds
+  // recover_mutex().
+  bool ReplayExceeds(int64_t last_valid_sequence_number, size_t max_bytes) const;
+  // Resumes on `socket` without a replay: the peer skips straight to
+  // sequence_number(). Caller holds recover_mutex().
+  void ReviveSkipping(SocketHandle socket);
   void InvalidateSocket();
 
   std::mutex& recover_mutex() { return recover_mutex_; }
   int64_t sequence_number() const { return sequence_number_; }
 
  private:
+  // Seals `packet` into the backup ring.
+  void AppendLocked(const Packet& packet);
+  BackedWriterWriteState FlushCatchupLocked(size_t max_bytes);
+  void TrimLocked(int64_t acked_sequence_number);
+  // Adds the bytes that went out to `written`, including when the socket
+  // fills up or fails part way.
+  BackedWriterWriteState WriteBuffers(SocketBuffer* buffers, size_t count, size_t* written);
+
   std::mutex recover_mutex_;
   std::shared_ptr<SocketHandler> socket_handler_;
   std::shared_ptr<CryptoHandler> crypto_handler_;
   SocketHandle socket_;
-  std::deque<Packet> backup_buffer_;
-  int64_t backup_size_ = 0;
+  BackupRing backup_;
   int64_t sequence_number_ = 0;
+  int64_t sent_sequence_number_ = 0;
+  // How much of the frame after sent_sequence_number_ a full socket took.
+  size_t sent_partial_bytes_ = 0;
 };
 }
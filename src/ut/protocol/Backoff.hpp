@@ -0,0 +1,32 @@
+#pragma once
+
+#include <algorithm>
+#include <random>
+
+namespace ut {
+// Exponential retry delays with jitter: the n-th delay is drawn from the
+// upper half of min(base * 2^n, max), so clients that lost the same network
+// at the same moment do not retry in lockstep.
+class Backoff {
+ public:
+  Backoff(int base_delay_ms, int max_delay_ms)
+      : base_delay_ms_(base_delay_ms), max_delay_ms_(max_delay_ms), rng_(std::random_device{}()) {}
+
+  int NextDelayMs() {
+    const int shift = std::min(attempts_, 20);
+    const int ceiling = static_cast<int>(std::min<long long>(static_cast<long long>(base_delay_ms_) << shift,
+                                                            max_delay_ms_));
+    ++attempts_;
+    std::uniform_int_distribution<int> jitter(ceiling / 2, ceiling);
+    return jitter(rng_);
+  }
+  void Reset() { attempts_ = 0; }
+  int attempts() const { return attempts_; }
+
+ private:
+  int base_delay_ms_;
+  int max_delay_ms_;
+  int attempts_ = 0;
+  std::mt19937 rng_;
+};
+}
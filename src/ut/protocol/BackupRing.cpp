@@ -0,0 +1,121 @@
+#include "BackupRing.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ut {
+BackupRing::BackupRing(size_t capacity) : capacity_(capacity) {}
+
+void BackupRing::Append(std::string_view frame) {
+  if (frame.size() > capacity_) {
+    Clear();
+    return;
+  }
+  size_t offset = 0;
+  while (!Place(frame.size(), &offset)) {
+    if (buffer_.size() < capacity_) {
+      Resize(std::min(capacity_, std::max({buffer_.size() * 2, kInitialBytes, bytes_ + frame.size()})));
+    } else {
+      PopOldest();
+    }
+  }
+  if (!entries_.empty() && offset < write_offset_) {
+    wrap_end_ = write_offset_;
+  }
+  if (!frame.empty()) {
+    std::memcpy(&buffer_[offset], frame.data(), frame.size());
+  }
+  entries_.push_back(Entry{offset, frame.size()});
+  write_offset_ = offset + frame.size();
+  bytes_ += frame.size();
+}
+
+void BackupRing::DropOldest(size_t frames) {
+  frames = std::min(frames, entries_.size());
+  for (size_t i = 0; i < frames; ++i) {
+    PopOldest();
+  }
+  if (buffer_.size() > kInitialBytes && bytes_ * 4 <= buffer_.size()) {
+    Resize(std::max(kInitialBytes, bytes_ * 2));
+  }
+}
+
+void BackupRing::Clear() {
+  entries_.clear();
+  std::string().swap(buffer_);
+  write_offset_ = 0;
+  wrap_end_ = 0;
+  bytes_ = 0;
+}
+
+std::string_view BackupRing::Frame(size_t index) const {
+  const Entry& entry = entries_.at(index);
+  return std::string_view(buffer_.data() + entry.offset, entry.size);
+}
+
+size_t BackupRing::Slices(size_t first, size_t frames, SocketBuffer out[2]) const {
+  if (first >= entries_.size()) {
+    return 0;
+  }
+  frames = std::min(frames, entries_.size() - first);
+  if (frames == 0) {
+    return 0;
+  }
+  const Entry& begin = entries_[first];
+  const Entry& last = entries_[first + frames - 1];
+  const size_t end = last.offset + last.size;
+  if (begin.offset <= last.offset) {
+    out[0] = SocketBuffer{buffer_.data() + begin.offset, end - begin.offset};
+    return 1;
+  }
+  out[0] = SocketBuffer{buffer_.data() + begin.offset, wrap_end_ - begin.offset};
+  out[1] = SocketBuffer{buffer_.data(), end};
+  return 2;
+}
+
+bool BackupRing::Place(size_t size, size_t* offset) const {
+  if (entries_.empty()) {
+    *offset = 0;
+    return size <= buffer_.size();
+  }
+  const size_t head = entries_.front().offset;
+  if (head < write_offset_) {
+    if (write_offset_ + size <= buffer_.size()) {
+      *offset = write_offset_;
+      return true;
+    }
+    if (size <= head) {
+      *offset = 0;
+      return true;
+    }
+    return false;
+  }
+  if (write_offset_ + size <= head) {
+    *offset = write_offset_;
+    return true;
+  }
+  return false;
+}
+
+void BackupRing::Resize(size_t target) {
+  std::string next(target, '\0');
+  size_t offset = 0;
+  for (Entry& entry : entries_) {
+    std::memcpy(&next[offset], buffer_.data() + entry.offset, entry.size);
+    entry.offset = offset;
+    offset += entry.size;
+  }
+  buffer_.swap(next);
+  write_offset_ = offset;
+  wrap_end_ = 0;
+}
+
+void BackupRing::PopOldest() {
+  bytes_ -= entries_.front().size;
+  entries_.pop_front();
+  if (entries_.empty()) {
+    write_offset_ = 0;
+    wrap_end_ = 0;
+  }
+}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+
+#include "SocketHandler.hpp"
+
+namespace ut {
+// Replay history for BackedWriter: wire frames stored back to back in one
+// byte ring. Frames never straddle the end of the ring (the tail is padded
+// instead), so every frame is contiguous and any run of recent frames spans
+// at most two slices. Storage grows on demand up to the capacity.
+class BackupRing {
+ public:
+  explicit BackupRing(size_t capacity);
+
+  void Append(std::string_view frame);
+  // Forgets the `frames` oldest frames and gives back storage once the ring
+  // is mostly empty.
+  void DropOldest(size_t frames);
+  void Clear();
+
+  size_t count() const { return entries_.size(); }
+  size_t bytes() const { return bytes_; }
+  size_t capacity() const { return capacity_; }
+
+  // The `index`-th frame counted from the oldest one still held.
+  std::string_view Frame(size_t index) const;
+  // Fills `out` with the slices covering `frames` frames starting at index
+  // `first` and returns how many slices were written (0, 1 or 2).
+  size_t Slices(size_t first, size_t frames, SocketBuffer out[2]) const;
+
+ private:
+  struct Entry {
+    size_t offset = 0;
+    size_t size = 0;
+  };
+
+  static constexpr size_t kInitialBytes = 64 * 1024;
+
+  bool Place(size_t size, size_t* offset) const;
+  void Resize(size_t target);
+  void PopOldest();
+
+  size_t capacity_;
+  std::string buffer_;
+  std::deque<Entry> entries_;
+  size_t write_offset_ = 0;
+  size_t wrap_end_ = 0;
+  size_t bytes_ = 0;
+};
+}
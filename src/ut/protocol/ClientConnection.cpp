@@ -3,6 +3,8 @@
 #include <chrono>
 #include <cstdlib>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 #include "UtConstants.hpp"
 #include "UT.pb.h"
@@ -17,29 +19,63 @@ ClientConnection::ClientConnection(std::shared_ptr<TcpSocketHandler> socket_hand
                                     const ut::SocketEndpoint& remote,
                                     const std::string& id,
                                     const std::string& key)
-    : Connection(socket_handler, id, key), tcp_handler_(std::move(socket_handler)), remote_(remote) {}
+    : Connection(socket_handler, id, key),
+      tcp_handler_(std::move(socket_handler)),
+      remote_(remote),
+      reconnector_([this](const Reconnector::Endpoints& endpoints,
+                          size_t* index) { return tcp_handler_->Connect(endpoints, index); },
+                   [this] { return tcp_handler_->Resolve(remote_.name(), remote_.port()); }) {
+  cipher_suite_ = PreferredCipherSuite();
+}
 
 ClientConnection::~ClientConnection() {
+  network_monitor_.Stop();
+  {
+    std::lock_guard<std::mutex> guard(wake_mutex_);
+    closing_ = true;
+  }
+  wake_.notify_all();
   WaitReconnect();
   CloseSocket();
 }
 
-bool ClientConnection::Connect() {
+bool ClientConnection::Connect(const std::vector<Packet>& initial_packets) {
+  if (initial_packets.size() > static_cast<size_t>(ut::kPipelinedPacketsMask)) {
+    return false;
+  }
   try {
-    socket_ = tcp_handler_->Connect(remote_.name(), remote_.port());
-    if (socket_ == kInvalidSocket) {
-      return false;
+    ut::ConnectResponse response;
+    while (true) {
+      socket_ = reconnector_.Connect();
+      if (socket_ == kInvalidSocket) {
+        return false;
+      }
+      if (!initial_packets.empty()) {
+        // Sealed for this attempt's cipher suite; a fallback seals them again.
+        writer_ = std::make_shared<BackedWriter>(socket_handler_,
+                                                 std::make_shared<CryptoHandler>(key_, ut::kClientServerNonceMsb, cipher_suite_),
+                                                 kInvalidSocket);
+        for (const auto& packet : initial_packets) {
+          writer_->Queue(packet);
+        }
+      }
+      response = Handshake(socket_, nullptr, initial_packets.size());
+      if (response.status() != ut::MISMATCHED_PROTOCOL || cipher_suite_ == CipherSuite::kChaCha20Poly1305) {
+        break;
+      }
+      // The server cannot run AES-GCM (or the session was set up without
+      // it); propose the software suite instead.
+      socket_handler_->Close(socket_);
+      socket_ = kInvalidSocket;
+      cipher_suite_ = CipherSuite::kChaCha20Poly1305;
     }
-    ut::ConnectRequest request;
-    request.set_clientid(id_);
-    request.set_version(ut::kProtocolVersion);
-    socket_handler_->WriteProto(socket_, request, true);
-    ut::ConnectResponse response = socket_handler_->ReadProto<ut::ConnectResponse>(socket_, true);
     returning_client_ = response.status() == ut::RETURNING_CLIENT;
     if (DebugHandshake()) {
       std::cerr << "[handshake] connect_response status=" << response.status()
+                << " cipher_suite=" << CipherSuiteName(cipher_suite_)
                 << " client_id_len=" << id_.size()
-                << " key_len=" << key_.size() << "\n";
+                << " key_len=" << key_.size()
+                << " pipelined=" << initial_packets.size() << "\n";
     }
     if (response.status() != ut::NEW_CLIENT && response.status() != ut::RETURNING_CLIENT) {
       socket_handler_->Close(socket_);
@@ -47,11 +83,15 @@ bool ClientConnection::Connect() {
       return false;
     }
     reader_ = std::make_shared<BackedReader>(socket_handler_,
-                                             std::make_shared<CryptoHandler>(key_, ut::kServerClientNonceMsb),
-                                             socket_);
-    writer_ = std::make_shared<BackedWriter>(socket_handler_,
-                                             std::make_shared<CryptoHandler>(key_, ut::kClientServerNonceMsb),
+                                             std::make_shared<CryptoHandler>(key_, ut::kServerClientNonceMsb, cipher_suite_),
                                              socket_);
+    // A new session keeps the writer that sent the pipelined packets; a
+    // returning one starts clean, as the server discarded them.
+    if (initial_packets.empty() || returning_client_) {
+      writer_ = std::make_shared<BackedWriter>(socket_handler_,
+                                               std::make_shared<CryptoHandler>(key_, ut::kClientServerNonceMsb, cipher_suite_),
+                                               socket_);
+    }
     if (returning_client_) {
       if (!Recover(socket_)) {
         socket_handler_->Close(socket_);
@@ -59,6 +99,9 @@ bool ClientConnection::Connect() {
         return false;
       }
     }
+    if (reconnect_enabled_) {
+      network_monitor_.Start([this] { OnNetworkChange(); });
+    }
     return true;
   } catch (...) {
     if (socket_ != kInvalidSocket) {
@@ -69,13 +112,49 @@ bool ClientConnection::Connect() {
   return false;
 }
 
- void ClientConnection::CloseSocketAndMaybeReconnect() {
-   WaitReconnect();
-   CloseSocket();
-   if (!shutting_down_ && reconnect_enabled_) {
-     reconnect_thread_ = std::make_shared<std::thread>(&ClientConnection::PollReconnect, this);
-   }
- }
+ut::ConnectResponse ClientConnection::Handshake(SocketHandle socket, const ut::SequenceHeader* resume,
+                                                size_t pipelined) {
+  ut::ConnectRequest request;
+  request.set_clientid(id_);
+  int version = ut::kProtocolVersion | (static_cast<int>(cipher_suite_) << ut::kCipherSuiteShift);
+  if (resume) {
+    request.set_version(version | ut::kResumeSequenceFlag);
+    socket_handler_->WriteProtos(socket, true, request, *resume);
+  } else {
+    request.set_version(version | (static_cast<int>(pipelined) << ut::kPipelinedPacketsShift));
+    socket_handler_->WriteProto(socket, request, true);
+  }
+  if (pipelined > 0) {
+    // The queued packets go out as a replay from sequence 0, without
+    // waiting for the ConnectResponse.
+    {
+      std::lock_guard<std::mutex> guard(writer_->recover_mutex());
+      writer_->Revive(socket, 0);
+    }
+    while (writer_->HasCatchup()) {
+      if (writer_->FlushCatchup(ut::kCatchupChunkBytes) == BackedWriterWriteState::WroteWithFailure) {
+        throw std::runtime_error("pipelined write failed");
+      }
+    }
+  }
+  return socket_handler_->ReadProto<ut::ConnectResponse>(socket, true);
+}
+
+void ClientConnection::CloseSocketAndMaybeReconnect() {
+  // The reader, the keepalive and the network monitor can all get here at
+  // once; the first starts the reconnect and the rest only close the socket.
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  CloseSocket();
+  if (reconnecting_) {
+    return;
+  }
+  // Any earlier reconnect thread has finished.
+  WaitReconnect();
+  if (!shutting_down_ && reconnect_enabled_) {
+    reconnecting_ = true;
+    reconnect_thread_ = std::make_shared<std::thread>(&ClientConnection::PollReconnect, this);
+  }
+}
 
 void ClientConnection::WaitReconnect() {
   if (reconnect_thread_) {
@@ -84,39 +163,75 @@ void ClientConnection::WaitReconnect() {
   }
 }
 
- void ClientConnection::PollReconnect() {
-   while (socket_ == kInvalidSocket) {
-     {
-       std::lock_guard<std::recursive_mutex> guard(mutex_);
-       if (shutting_down_ || !reconnect_enabled_) {
-         return;
-       }
-      SocketHandle new_socket = tcp_handler_->Connect(remote_.name(), remote_.port());
+void ClientConnection::PollReconnect() {
+  while (true) {
+    {
+      std::lock_guard<std::mutex> guard(wake_mutex_);
+      wake_requested_ = false;
+    }
+    {
+      std::lock_guard<std::recursive_mutex> guard(mutex_);
+      if (shutting_down_ || !reconnect_enabled_) {
+        reconnecting_ = false;
+        return;
+      }
+      SocketHandle new_socket = reconnector_.Connect();
       if (new_socket != kInvalidSocket) {
         try {
-          ut::ConnectRequest request;
-          request.set_clientid(id_);
-          request.set_version(ut::kProtocolVersion);
-          socket_handler_->WriteProto(new_socket, request, true);
-          ut::ConnectResponse response = socket_handler_->ReadProto<ut::ConnectResponse>(new_socket, true);
+          // Our position goes out with the request; the server answers with
+          // its own and starts the replay in the same flight.
+          ut::SequenceHeader header;
+          header.set_sequencenumber(static_cast<int32_t>(reader_->sequence_number()));
+          ut::ConnectResponse response = Handshake(new_socket, &header);
           if (response.status() == ut::INVALID_KEY) {
             socket_handler_->Close(new_socket);
             shutting_down_ = true;
+            reconnecting_ = false;
             return;
           }
           if (response.status() != ut::RETURNING_CLIENT) {
             socket_handler_->Close(new_socket);
           } else {
-            Recover(new_socket);
+            FinishRecover(new_socket);
           }
         } catch (...) {
           socket_handler_->Close(new_socket);
         }
       }
+      // Checked under the lock, so a socket that fails from here on starts
+      // a new reconnect.
+      if (socket_ != kInvalidSocket) {
+        reconnecting_ = false;
+        return;
+      }
+    }
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    wake_.wait_for(lock, std::chrono::milliseconds(reconnector_.NextDelayMs()),
+                   [this] { return wake_requested_ || closing_; });
+    if (closing_) {
+      return;
     }
-    if (socket_ == kInvalidSocket) {
-      std::this_thread::sleep_for(std::chrono::seconds(1));
+    // A new address or route is worth an immediate retry.
+    if (wake_requested_) {
+      reconnector_.NetworkChanged();
+    }
+  }
+}
+
+void ClientConnection::OnNetworkChange() {
+  {
+    std::lock_guard<std::mutex> guard(wake_mutex_);
+    wake_requested_ = true;
+  }
+  wake_.notify_all();
+  // A socket whose local address has gone (the interface went down or the
+  // lease changed) is dead even though TCP has not noticed yet.
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  if (socket_ != kInvalidSocket && !NetworkMonitor::HasLocalAddress(socket_)) {
+    if (DebugHandshake()) {
+      std::cerr << "[handshake] local_address_lost reconnecting\n";
     }
+    CloseSocketAndMaybeReconnect();
   }
 }
 }
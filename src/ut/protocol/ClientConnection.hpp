@@ -1,14 +1,24 @@
 #pragma once
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include "Connection.hpp"
+#include "NetworkMonitor.hpp"
+#include "Reconnector.hpp"
 #include "TcpSocketHandler.hpp"
 
 #include "UT.pb.h"
 
 namespace ut {
+// Reconnects on its own once the socket drops: the first retry goes out at
+// once to the last addresses that worked (Reconnector), later ones back off
+// with jitter, and a change to the local network (NetworkMonitor) cuts any
+// wait short. A network change that takes away the socket's local
+// address drops the socket at once instead of waiting for keepalives.
 class ClientConnection : public Connection {
  public:
   ClientConnection(std::shared_ptr<TcpSocketHandler> socket_handler,
@@ -17,7 +27,10 @@ class ClientConnection : public Connection {
                    const std::string& key);
   ~ClientConnection() override;
 
-   bool Connect();
+   // `initial_packets` (INITIAL_PAYLOAD first) go out in the same flight as
+   // the ConnectRequest, so a new session's INITIAL_RESPONSE arrives with
+   // the ConnectResponse. A returning client drops them.
+   bool Connect(const std::vector<Packet>& initial_packets = {});
    void CloseSocketAndMaybeReconnect() override;
 
    void SetReconnectEnabled(bool enabled) { reconnect_enabled_ = enabled; }
@@ -25,13 +38,28 @@ class ClientConnection : public Connection {
    bool IsReturningClient() const { return returning_client_; }
 
  private:
+  // With `resume`, the SequenceHeader rides in the same write as the
+  // ConnectRequest (kResumeSequenceFlag) and FinishRecover completes it.
+  // With `pipelined` > 0, the packets queued on writer_ follow the request
+  // before the response is awaited.
+  ut::ConnectResponse Handshake(SocketHandle socket, const ut::SequenceHeader* resume = nullptr,
+                                size_t pipelined = 0);
   void PollReconnect();
   void WaitReconnect();
+  void OnNetworkChange();
 
    std::shared_ptr<TcpSocketHandler> tcp_handler_;
    ut::SocketEndpoint remote_;
+   // Guarded by mutex_, as is reconnecting_: set while that thread retries.
    std::shared_ptr<std::thread> reconnect_thread_;
+   bool reconnecting_ = false;
    bool reconnect_enabled_ = true;
    bool returning_client_ = false;
+  Reconnector reconnector_;
+  NetworkMonitor network_monitor_;
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
+  bool wake_requested_ = false;
+  bool closing_ = false;
 };
 }
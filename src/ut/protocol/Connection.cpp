@@ -3,6 +3,7 @@
 #include <chrono>
 #include <thread>
 
+#include "UtConstants.hpp"
 #include "UT.pb.h"
 
 namespace ut {
@@ -45,15 +46,35 @@ bool Connection::Read(Packet* packet) {
     }
     reader = reader_;
   }
+  FlushCatchup();
   if (!reader) {
     return false;
   }
   int rc = reader->Read(packet);
+  while (rc > 0 && packet->header() == kAckPacketHeader) {
+    HandleAck(*packet);
+    if (!reader->HasData()) {
+      return false;
+    }
+    rc = reader->Read(packet);
+  }
   if (rc == -1) {
     CloseSocketAndMaybeReconnect();
     return false;
   }
-  return rc > 0;
+  if (rc == 0) {
+    return false;
+  }
+
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  received_sequence_number_ = reader->sequence_number();
+  unacked_bytes_ += packet->length();
+  if (unacked_bytes_ >= kAckIntervalBytes && socket_ != kInvalidSocket && writer_) {
+    if (WriteAckLocked() == BackedWriterWriteState::WroteWithFailure) {
+      CloseSocketAndMaybeReconnect();
+    }
+  }
+  return true;
 }
 
 bool Connection::Write(const Packet& packet) {
@@ -61,6 +82,18 @@ bool Connection::Write(const Packet& packet) {
   if (socket_ == kInvalidSocket || !writer_) {
     return false;
   }
+  if (AckDueLocked()) {
+    // Piggyback a pending acknowledgement on outgoing traffic (keepalives
+    // included) so the peer can trim its backup even when we send little.
+    auto ack_state = WriteAckLocked();
+    if (ack_state == BackedWriterWriteState::Skipped) {
+      return false;
+    }
+    if (ack_state == BackedWriterWriteState::WroteWithFailure) {
+      CloseSocketAndMaybeReconnect();
+      return false;
+    }
+  }
   auto state = writer_->Write(packet);
   if (state == BackedWriterWriteState::Skipped) {
     return false;
@@ -71,6 +104,54 @@ bool Connection::Write(const Packet& packet) {
   return true;
 }
 
+bool Connection::FlushCatchup() {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  if (socket_ == kInvalidSocket || !writer_ || !writer_->HasCatchup()) {
+    return false;
+  }
+  if (writer_->FlushCatchup(kCatchupChunkBytes) == BackedWriterWriteState::WroteWithFailure) {
+    CloseSocketAndMaybeReconnect();
+    return false;
+  }
+  return true;
+}
+
+bool Connection::HasCatchup() {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  return socket_ != kInvalidSocket && writer_ && writer_->HasCatchup();
+}
+
+void Connection::Queue(const Packet& packet) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  if (writer_) {
+    writer_->Queue(packet);
+  }
+}
+
+bool Connection::AckDueLocked() const {
+  return unacked_bytes_ > 0 &&
+         std::chrono::steady_clock::now() - last_ack_time_ >= std::chrono::milliseconds(kAckIntervalMs);
+}
+
+BackedWriterWriteState Connection::WriteAckLocked() {
+  ut::SequenceHeader ack;
+  ack.set_sequencenumber(static_cast<int32_t>(received_sequence_number_));
+  unacked_bytes_ = 0;
+  last_ack_time_ = std::chrono::steady_clock::now();
+  return writer_->Write(Packet(kAckPacketHeader, ack.SerializeAsString()));
+}
+
+void Connection::HandleAck(const Packet& packet) {
+  ut::SequenceHeader ack;
+  if (!packet.ParsePayload(&ack)) {
+    return;
+  }
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  if (writer_) {
+    writer_->Acknowledge(ack.sequencenumber());
+  }
+}
+
 void Connection::CloseSocket() {
   std::lock_guard<std::recursive_mutex> guard(mutex_);
   if (socket_ == kInvalidSocket) {
@@ -97,20 +178,56 @@ bool Connection::Recover(SocketHandle new_socket) {
     socket_handler_->WriteProto(new_socket, header, true);
 
     ut::SequenceHeader remote = socket_handler_->ReadProto<ut::SequenceHeader>(new_socket, true);
-
-    ut::CatchupBuffer catchup;
-    std::vector<std::string> recovered = writer_->Recover(remote.sequencenumber());
-    for (const auto& entry : recovered) {
-      catchup.add_buffer(entry);
+    int64_t resume = remote.sequencenumber();
+    int64_t peer_resume = reader_->sequence_number();
+    if (sends_resume_point_) {
+      resume = ResumePointLocked(remote.sequencenumber());
+      ut::SequenceHeader resume_header;
+      resume_header.set_sequencenumber(static_cast<int32_t>(resume));
+      socket_handler_->WriteProto(new_socket, resume_header, true);
+    } else {
+      peer_resume = socket_handler_->ReadProto<ut::SequenceHeader>(new_socket, true).sequencenumber();
     }
-    socket_handler_->WriteProto(new_socket, catchup, true);
+    ReviveLocked(new_socket, remote.sequencenumber(), resume, peer_resume);
+    return true;
+  } catch (...) {
+    socket_handler_->Close(new_socket);
+    return false;
+  }
+}
 
-    ut::CatchupBuffer inbound = socket_handler_->ReadProto<ut::CatchupBuffer>(new_socket, true);
-    std::vector<std::string> inbound_msgs(inbound.buffer().begin(), inbound.buffer().end());
+bool Connection::Recover(SocketHandle new_socket, int64_t remote_sequence_number,
+                         const ConnectResponse* response) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  std::lock_guard<std::mutex> reader_guard(reader_->recover_mutex());
+  std::lock_guard<std::mutex> writer_guard(writer_->recover_mutex());
+  try {
+    ut::SequenceHeader header;
+    header.set_sequencenumber(static_cast<int32_t>(reader_->sequence_number()));
+    const int64_t resume = ResumePointLocked(remote_sequence_number);
+    ut::SequenceHeader resume_header;
+    resume_header.set_sequencenumber(static_cast<int32_t>(resume));
+    if (response) {
+      socket_handler_->WriteProtos(new_socket, true, *response, header, resume_header);
+    } else {
+      socket_handler_->WriteProtos(new_socket, true, header, resume_header);
+    }
+    ReviveLocked(new_socket, remote_sequence_number, resume, reader_->sequence_number());
+    return true;
+  } catch (...) {
+    socket_handler_->Close(new_socket);
+    return false;
+  }
+}
 
-    socket_ = new_socket;
-    reader_->Revive(socket_, inbound_msgs);
-    writer_->Revive(socket_);
+bool Connection::FinishRecover(SocketHandle new_socket) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  std::lock_guard<std::mutex> reader_guard(reader_->recover_mutex());
+  std::lock_guard<std::mutex> writer_guard(writer_->recover_mutex());
+  try {
+    ut::SequenceHeader remote = socket_handler_->ReadProto<ut::SequenceHeader>(new_socket, true);
+    ut::SequenceHeader peer_resume = socket_handler_->ReadProto<ut::SequenceHeader>(new_socket, true);
+    ReviveLocked(new_socket, remote.sequencenumber(), remote.sequencenumber(), peer_resume.sequencenumber());
     return true;
   } catch (...) {
     socket_handler_->Close(new_socket);
@@ -118,6 +235,41 @@ bool Connection::Recover(SocketHandle new_socket) {
   }
 }
 
+int64_t Connection::ResumePointLocked(int64_t remote_sequence_number) const {
+  if (replay_skip_limit_ > 0 && writer_->ReplayExceeds(remote_sequence_number, replay_skip_limit_)) {
+    return writer_->sequence_number();
+  }
+  return remote_sequence_number;
+}
+
+void Connection::ReviveLocked(SocketHandle new_socket, int64_t remote_sequence_number,
+                              int64_t resume_sequence_number, int64_t peer_resume_sequence_number) {
+  if (resume_sequence_number > remote_sequence_number) {
+    writer_->ReviveSkipping(new_socket);
+    replay_skipped_ = true;
+  } else {
+    writer_->Revive(new_socket, remote_sequence_number);
+  }
+  socket_ = new_socket;
+  reader_->Revive(socket_, peer_resume_sequence_number);
+  received_sequence_number_ = reader_->sequence_number();
+  unacked_bytes_ = 0;
+  last_ack_time_ = std::chrono::steady_clock::now();
+  if (recover_callback_) {
+    recover_callback_();
+  }
+}
+
+void Connection::SetReplaySkipLimit(size_t max_bytes) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  replay_skip_limit_ = max_bytes;
+}
+
+void Connection::SetRecoverCallback(std::function<void()> callback) {
+  std::lock_guard<std::recursive_mutex> guard(mutex_);
+  recover_callback_ = std::move(callback);
+}
+
 void Connection::Shutdown() {
   std::lock_guard<std::recursive_mutex> guard(mutex_);
   shutting_down_ = true;
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <mutex>
 
@@ -8,6 +11,8 @@
 #include "SocketHandler.hpp"
 
 namespace ut {
+class ConnectResponse;
+
 class Connection {
  public:
   Connection(std::shared_ptr<SocketHandler> socket_handler,
@@ -19,26 +24,77 @@ class Connection {
   void WritePacket(const Packet& packet);
   bool Read(Packet* packet);
   bool Write(const Packet& packet);
+  // Sends the next chunk of a replay backlog queued by Recover. Returns
+  // true when a chunk was sent.
+  bool FlushCatchup();
+  bool HasCatchup();
+  // Backs up `packet` while the socket is down; it goes out with the replay
+  // once Recover resumes the connection.
+  void Queue(const Packet& packet);
 
   void CloseSocket();
   virtual void CloseSocketAndMaybeReconnect() { CloseSocket(); }
 
+  // Swaps SequenceHeaders with the peer on `new_socket` and resumes on it.
+  // The server follows its header with a second one saying where its replay
+  // starts (see SetReplaySkipLimit).
   bool Recover(SocketHandle new_socket);
+  // Server side, once the peer's SequenceHeader has been read: our headers
+  // go out (in one write with `response` when the client pipelined its
+  // header, so it has not been sent one yet) and the replay follows without
+  // waiting on the client.
+  bool Recover(SocketHandle new_socket, int64_t remote_sequence_number, const ConnectResponse* response);
+  // Pipelined resume, client side: ours went out with the ConnectRequest, so
+  // only the peer's SequenceHeaders are read.
+  bool FinishRecover(SocketHandle new_socket);
+  // Server side: a peer that missed more than `max_bytes` of output (or
+  // output already evicted from the backup) is not sent the backlog; it
+  // resumes after it and TakeReplaySkipped() reports that once. 0, the
+  // default, always replays.
+  void SetReplaySkipLimit(size_t max_bytes);
+  bool TakeReplaySkipped() { return replay_skipped_.exchange(false); }
+  // Runs (on the recovering thread) each time Recover installs a new socket,
+  // so a loop waiting on the old one can switch over.
+  void SetRecoverCallback(std::function<void()> callback);
   void Shutdown();
 
   std::shared_ptr<BackedReader> reader() { return reader_; }
   std::shared_ptr<BackedWriter> writer() { return writer_; }
   SocketHandle socket() const { return socket_; }
   const std::string& id() const { return id_; }
+  CipherSuite cipher_suite() const { return cipher_suite_; }
 
  protected:
+  bool AckDueLocked() const;
+  BackedWriterWriteState WriteAckLocked();
+  void HandleAck(const Packet& packet);
+  // Where our replay to a peer that last saw `remote_sequence_number`
+  // starts. Caller holds mutex_ and the writer's recover mutex.
+  int64_t ResumePointLocked(int64_t remote_sequence_number) const;
+  // Installs `new_socket` and queues the replay from `resume_sequence_number`
+  // (skipping the backlog when that is past `remote_sequence_number`); the
+  // peer's replay starts after `peer_resume_sequence_number`. Caller holds
+  // mutex_ and both recover mutexes.
+  void ReviveLocked(SocketHandle new_socket, int64_t remote_sequence_number, int64_t resume_sequence_number,
+                    int64_t peer_resume_sequence_number);
+
   std::shared_ptr<SocketHandler> socket_handler_;
   std::string id_;
   std::string key_;
+  CipherSuite cipher_suite_ = CipherSuite::kChaCha20Poly1305;
   std::shared_ptr<BackedReader> reader_;
   std::shared_ptr<BackedWriter> writer_;
   SocketHandle socket_;
   bool shutting_down_ = false;
+  int64_t received_sequence_number_ = 0;
+  size_t unacked_bytes_ = 0;
+  std::chrono::steady_clock::time_point last_ack_time_ = std::chrono::steady_clock::now();
+  std::function<void()> recover_callback_;
+  // Set on the server, which decides where each replay starts and tells the
+  // client in a second SequenceHeader.
+  bool sends_resume_point_ = false;
+  size_t replay_skip_limit_ = 0;
+  std::atomic<bool> replay_skipped_{false};
   std::recursive_mutex mutex_;
 };
 }
@@ -4,65 +4,154 @@
 #include <stdexcept>
 
 namespace ut {
-CryptoHandler::CryptoHandler(const std::string& key, unsigned char nonce_msb) {
-  std::lock_guard<std::mutex> guard(mutex_);
+namespace {
 #ifdef UNDYING_TERMINAL_REQUIRE_DEPS
+void InitSodium() {
   if (sodium_init() < 0) {
     throw std::runtime_error("libsodium init failed");
   }
-  if (key.size() != crypto_secretbox_KEYBYTES) {
+}
+#endif
+}
+
+CipherSuite PreferredCipherSuite() {
+  return IsCipherSuiteAvailable(CipherSuite::kAes256Gcm) ? CipherSuite::kAes256Gcm
+                                                         : CipherSuite::kChaCha20Poly1305;
+}
+
+bool IsCipherSuiteAvailable(CipherSuite suite) {
+  switch (suite) {
+    case CipherSuite::kChaCha20Poly1305:
+      return true;
+    case CipherSuite::kAes256Gcm:
+#ifdef UNDYING_TERMINAL_REQUIRE_DEPS
+      InitSodium();
+      return crypto_aead_aes256gcm_is_available() != 0;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+const char* CipherSuiteName(CipherSuite suite) {
+  switch (suite) {
+    case CipherSuite::kChaCha20Poly1305:
+      return "chacha20-poly1305";
+    case CipherSuite::kAes256Gcm:
+      return "aes-256-gcm";
+  }
+  return "unknown";
+}
+
+CryptoHandler::CryptoHandler(const std::string& key, unsigned char nonce_msb, CipherSuite suite) : suite_(suite) {
+  if (!IsCipherSuiteAvailable(suite)) {
+    throw std::runtime_error("cipher suite unavailable");
+  }
+#ifdef UNDYING_TERMINAL_REQUIRE_DEPS
+  InitSodium();
+  if (key.size() != sizeof(key_)) {
     throw std::runtime_error("invalid key length");
   }
   std::memcpy(key_, key.data(), key.size());
   std::memset(nonce_, 0, sizeof(nonce_));
-  nonce_[crypto_secretbox_NONCEBYTES - 1] = nonce_msb;
+  nonce_[sizeof(nonce_) - 1] = nonce_msb;
+  if (suite_ == CipherSuite::kAes256Gcm) {
+    crypto_aead_aes256gcm_beforenm(&aes_state_, key_);
+  }
 #else
   (void)key;
   (void)nonce_msb;
 #endif
 }
 
-std::string CryptoHandler::Encrypt(const std::string& buffer) {
-  std::lock_guard<std::mutex> guard(mutex_);
+void CryptoHandler::EncryptInPlace(char* buffer, size_t size) {
+  if (size < kMacBytes) {
+    throw std::runtime_error("encrypt failed: short buffer");
+  }
 #ifdef UNDYING_TERMINAL_REQUIRE_DEPS
-  IncrementNonce();
-  std::string out(buffer.size() + crypto_secretbox_MACBYTES, '\0');
-  if (crypto_secretbox_easy(reinterpret_cast<unsigned char*>(&out[0]),
-                            reinterpret_cast<const unsigned char*>(buffer.data()),
-                            buffer.size(), nonce_, key_) != 0) {
+  AdvanceNonce(nonce_, 1);
+  auto* mac = reinterpret_cast<unsigned char*>(buffer);
+  auto* data = mac + kMacBytes;
+  const unsigned long long length = size - kMacBytes;
+  int rc = 0;
+  if (suite_ == CipherSuite::kAes256Gcm) {
+    rc = crypto_aead_aes256gcm_encrypt_detached_afternm(data, mac, nullptr, data, length, nullptr, 0, nullptr,
+                                                        nonce_, &aes_state_);
+  } else {
+    rc = crypto_aead_chacha20poly1305_ietf_encrypt_detached(data, mac, nullptr, data, length, nullptr, 0, nullptr,
+                                                            nonce_, key_);
+  }
+  if (rc != 0) {
     throw std::runtime_error("encrypt failed");
   }
-  return out;
 #else
-  return buffer;
+  (void)buffer;
 #endif
 }
 
-std::string CryptoHandler::Decrypt(const std::string& buffer) {
-  std::lock_guard<std::mutex> guard(mutex_);
-#ifdef UNDYING_TERMINAL_REQUIRE_DEPS
-  IncrementNonce();
-  if (buffer.size() < crypto_secretbox_MACBYTES) {
+void CryptoHandler::DecryptInPlace(char* buffer, size_t size) {
+  if (size < kMacBytes) {
     throw std::runtime_error("decrypt failed: short buffer");
   }
-  std::string out(buffer.size() - crypto_secretbox_MACBYTES, '\0');
-  if (crypto_secretbox_open_easy(reinterpret_cast<unsigned char*>(&out[0]),
-                                 reinterpret_cast<const unsigned char*>(buffer.data()),
-                                 buffer.size(), nonce_, key_) != 0) {
+  AdvanceNonce(nonce_, 1);
+  if (!Open(buffer, size, nonce_)) {
     throw std::runtime_error("decrypt failed");
   }
+}
+
+bool CryptoHandler::DecryptInPlaceAhead(char* buffer, size_t size, uint64_t ahead) const {
+  if (size < kMacBytes) {
+    return false;
+  }
+  unsigned char nonce[sizeof(nonce_)];
+  std::memcpy(nonce, nonce_, sizeof(nonce));
+  AdvanceNonce(nonce, ahead + 1);
+  return Open(buffer, size, nonce);
+}
+
+std::string CryptoHandler::Encrypt(std::string_view buffer) {
+  std::string out(kMacBytes + buffer.size(), '\0');
+  if (!buffer.empty()) {
+    std::memcpy(&out[kMacBytes], buffer.data(), buffer.size());
+  }
+  EncryptInPlace(&out[0], out.size());
+  return out;
+}
+
+std::string CryptoHandler::Decrypt(std::string_view buffer) {
+  std::string out(buffer);
+  DecryptInPlace(&out[0], out.size());
+  out.erase(0, kMacBytes);
   return out;
+}
+
+bool CryptoHandler::Open(char* buffer, size_t size, const unsigned char* nonce) const {
+#ifdef UNDYING_TERMINAL_REQUIRE_DEPS
+  auto* mac = reinterpret_cast<unsigned char*>(buffer);
+  auto* data = mac + kMacBytes;
+  const unsigned long long length = size - kMacBytes;
+  if (suite_ == CipherSuite::kAes256Gcm) {
+    return crypto_aead_aes256gcm_decrypt_detached_afternm(data, nullptr, data, length, mac, nullptr, 0, nonce,
+                                                          &aes_state_) == 0;
+  }
+  return crypto_aead_chacha20poly1305_ietf_decrypt_detached(data, nullptr, data, length, mac, nullptr, 0, nonce,
+                                                            key_) == 0;
 #else
-  return buffer;
+  (void)buffer;
+  (void)size;
+  (void)nonce;
+  return true;
 #endif
 }
 
-void CryptoHandler::IncrementNonce() {
-  for (size_t i = 0; i < sizeof(nonce_); ++i) {
-    nonce_[i]++;
-    if (nonce_[i] != 0) {
-      break;
-    }
+void CryptoHandler::AdvanceNonce(unsigned char* nonce, uint64_t count) {
+  // The last byte is the direction; the counter runs little-endian through
+  // the rest.
+  for (size_t i = 0; i + 1 < sizeof(nonce_) && count != 0; ++i) {
+    count += nonce[i];
+    nonce[i] = static_cast<unsigned char>(count & 0xff);
+    count >>= 8;
   }
 }
 }
@@ -1,25 +1,67 @@
 #pragma once
 
-#include <mutex>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 #ifdef UNDYING_TERMINAL_REQUIRE_DEPS
 #include <sodium.h>
 #endif
 
 namespace ut {
+// Negotiated per session in the ConnectRequest version; see UtConstants.hpp.
+enum class CipherSuite : uint8_t {
+  kChaCha20Poly1305 = 1,
+  kAes256Gcm = 2,
+};
+
+// AES-256-GCM when this CPU has AES-NI and PCLMUL, ChaCha20-Poly1305 otherwise.
+CipherSuite PreferredCipherSuite();
+bool IsCipherSuiteAvailable(CipherSuite suite);
+const char* CipherSuiteName(CipherSuite suite);
+
+// A handler carries a running nonce and belongs to exactly one BackedReader
+// or BackedWriter, which serialise access to it; it does no locking itself.
 class CryptoHandler {
  public:
-  CryptoHandler(const std::string& key, unsigned char nonce_msb);
+#ifdef UNDYING_TERMINAL_REQUIRE_DEPS
+  static constexpr size_t kMacBytes = crypto_aead_chacha20poly1305_ietf_ABYTES;
+  static_assert(crypto_aead_aes256gcm_ABYTES == kMacBytes, "cipher suites must share a MAC size");
+#else
+  static constexpr size_t kMacBytes = 0;
+#endif
 
-  std::string Encrypt(const std::string& buffer);
-  std::string Decrypt(const std::string& buffer);
+  CryptoHandler(const std::string& key, unsigned char nonce_msb, CipherSuite suite);
+
+  // `buffer` holds kMacBytes of headroom followed by the plaintext; on return
+  // it holds the MAC followed by the ciphertext.
+  void EncryptInPlace(char* buffer, size_t size);
+  // Reverses EncryptInPlace; the plaintext is left at buffer + kMacBytes.
+  void DecryptInPlace(char* buffer, size_t size);
+  // Opens the frame `ahead` positions after the one DecryptInPlace would
+  // open next, leaving the running nonce alone; the caller later passes over
+  // it with SkipNonce(). Safe to call from several threads at once.
+  bool DecryptInPlaceAhead(char* buffer, size_t size, uint64_t ahead) const;
+  void SkipNonce() { AdvanceNonce(nonce_, 1); }
+  // Moves past `count` frames the peer sealed but will never send.
+  void SkipNonces(uint64_t count) { AdvanceNonce(nonce_, count); }
+
+  std::string Encrypt(std::string_view buffer);
+  std::string Decrypt(std::string_view buffer);
+
+  CipherSuite suite() const { return suite_; }
 
  private:
-  void IncrementNonce();
+  static void AdvanceNonce(unsigned char* nonce, uint64_t count);
+  bool Open(char* buffer, size_t size, const unsigned char* nonce) const;
 
-  std::mutex mutex_;
-  unsigned char nonce_[24] = {};
+  CipherSuite suite_;
+#ifdef UNDYING_TERMINAL_REQUIRE_DEPS
+  // Expanded AES key schedule, computed once instead of per frame.
+  crypto_aead_aes256gcm_state aes_state_;
+#endif
+  unsigned char nonce_[12] = {};
   unsigned char key_[32] = {};
 };
 }
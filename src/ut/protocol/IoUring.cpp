@@ -0,0 +1,194 @@
+#include "IoUring.hpp"
+
+#ifdef UT_USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace ut {
+namespace {
+// Multishot receives can complete many times per submission.
+constexpr unsigned kCompletionsPerEntry = 8;
+}
+
+IoUring::~IoUring() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  if (buffers_) {
+    munmap(buffers_, buffers_bytes_);
+  }
+  if (buffer_ring_) {
+    munmap(buffer_ring_, buffer_ring_bytes_);
+  }
+  if (sqes_) {
+    munmap(sqes_, sqes_bytes_);
+  }
+  if (cq_ring_ && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_bytes_);
+  }
+  if (sq_ring_) {
+    munmap(sq_ring_, sq_ring_bytes_);
+  }
+}
+
+bool IoUring::Init(unsigned entries) {
+  io_uring_params params{};
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+  params.cq_entries = entries * kCompletionsPerEntry;
+  fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (fd_ < 0 && errno == EINVAL) {
+    // Before 5.19 completions may interrupt the thread instead.
+    params = io_uring_params{};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * kCompletionsPerEntry;
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  }
+  if (fd_ < 0) {
+    return false;
+  }
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    return false;
+  }
+
+  sq_ring_bytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_bytes_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_ring_bytes_ = cq_ring_bytes_ = std::max(sq_ring_bytes_, cq_ring_bytes_);
+  }
+  void* sq_ring =
+      mmap(nullptr, sq_ring_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    return false;
+  }
+  sq_ring_ = sq_ring;
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    void* cq_ring =
+        mmap(nullptr, cq_ring_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+      return false;
+    }
+    cq_ring_ = cq_ring;
+  }
+  sqes_bytes_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  auto* sq = static_cast<char*>(sq_ring_);
+  sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_entries_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  auto* cq = static_cast<char*>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  return true;
+}
+
+io_uring_sqe* IoUring::GetSqe() {
+  const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= *sq_entries_) {
+    return nullptr;
+  }
+  io_uring_sqe* sqe = &sqes_[sqe_tail_ & *sq_mask_];
+  ++sqe_tail_;
+  std::memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+unsigned IoUring::Publish() {
+  unsigned tail = *sq_tail_;
+  for (; sqe_head_ != sqe_tail_; ++sqe_head_) {
+    sq_array_[tail & *sq_mask_] = sqe_head_ & *sq_mask_;
+    ++tail;
+  }
+  __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+  return tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+}
+
+int IoUring::Submit() {
+  const unsigned queued = Publish();
+  return queued == 0 ? 0 : Enter(queued, 0, 0, nullptr, 0);
+}
+
+int IoUring::SubmitAndWait(unsigned to_submit, int timeout_ms) {
+  if (timeout_ms < 0) {
+    return Enter(to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+  }
+  __kernel_timespec ts{};
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+  io_uring_getevents_arg arg{};
+  arg.ts = reinterpret_cast<uint64_t>(&ts);
+  return Enter(to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+bool IoUring::InitBufferRing(uint16_t group, unsigned count, unsigned size) {
+  buffer_ring_bytes_ = count * sizeof(io_uring_buf);
+  void* ring = mmap(nullptr, buffer_ring_bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    return false;
+  }
+  buffer_ring_ = static_cast<io_uring_buf_ring*>(ring);
+  buffers_bytes_ = static_cast<size_t>(count) * size;
+  void* buffers = mmap(nullptr, buffers_bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffers == MAP_FAILED) {
+    return false;
+  }
+  buffers_ = static_cast<char*>(buffers);
+  buffer_size_ = size;
+  buffer_mask_ = count - 1;
+
+  io_uring_buf_reg reg{};
+  reg.ring_addr = reinterpret_cast<uint64_t>(buffer_ring_);
+  reg.ring_entries = count;
+  reg.bgid = group;
+  if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    return false;
+  }
+  for (unsigned id = 0; id < count; ++id) {
+    RecycleBuffer(static_cast<uint16_t>(id));
+  }
+  return true;
+}
+
+void IoUring::RecycleBuffer(uint16_t id) {
+  const uint16_t tail = buffer_ring_->tail;
+  // Not buffer_ring_->bufs: the header's flexible array sits 8 bytes late
+  // when compiled as C++, where its empty placeholder struct has a size.
+  io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(buffer_ring_) + (tail & buffer_mask_);
+  buf->addr = reinterpret_cast<uint64_t>(buffer(id));
+  buf->len = buffer_size_;
+  buf->bid = id;
+  __atomic_store_n(&buffer_ring_->tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+int IoUring::CancelAndWait(uint64_t user_data) {
+  io_uring_sync_cancel_reg reg{};
+  reg.addr = user_data;
+  reg.fd = -1;
+  reg.timeout.tv_sec = -1;
+  reg.timeout.tv_nsec = -1;
+  const long rc = syscall(__NR_io_uring_register, fd_, IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+  return rc < 0 ? -errno : 0;
+}
+
+int IoUring::Enter(unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t arg_size) {
+  const long rc = syscall(__NR_io_uring_enter, fd_, to_submit, min_complete, flags, arg, arg_size);
+  return rc < 0 ? -errno : static_cast<int>(rc);
+}
+}
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+
+#ifdef UT_USE_IO_URING
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ut {
+// A bare io_uring instance over the kernel interface, with just what the
+// reactor needs: queue entries, submit them in one call, wait for and reap
+// completions, and a ring of provided receive buffers. Not thread-safe; the
+// reactor serializes access.
+class IoUring {
+ public:
+  IoUring() = default;
+  ~IoUring();
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  // False when the kernel lacks io_uring (or has it disabled) or predates
+  // timed waits (5.11).
+  bool Init(unsigned entries);
+  // Registers `count` (a power of two) buffers of `size` bytes as provided
+  // buffer group `group`, which receives with IOSQE_BUFFER_SELECT pick from.
+  // False before 5.19.
+  bool InitBufferRing(uint16_t group, unsigned count, unsigned size);
+
+  // A zeroed entry to fill in, or nullptr when the queue is full and must be
+  // submitted first.
+  io_uring_sqe* GetSqe();
+  // Publishes queued entries to the submission ring and returns how many
+  // the kernel has yet to take.
+  unsigned Publish();
+  // Publishes and submits queued entries.
+  int Submit();
+  // Submits `to_submit` published entries and waits up to `timeout_ms` (-1
+  // for no limit) for a completion, in one system call. Touches only kernel
+  // state, so it may run while another thread queues entries.
+  int SubmitAndWait(unsigned to_submit, int timeout_ms);
+  // Cancels the request tagged `user_data` and returns once it has ended
+  // (0), or -ENOENT when none is in flight. Its last completion may still
+  // have to be reaped. Since 6.0.
+  int CancelAndWait(uint64_t user_data);
+  bool HasCompletions() const { return *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE); }
+
+  // Calls fn(const io_uring_cqe&) for every ready completion and releases
+  // them.
+  template <typename Fn>
+  void ReapCompletions(Fn&& fn) {
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      fn(cqes_[head & *cq_mask_]);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+
+  // The provided buffer a completion with IORING_CQE_F_BUFFER filled.
+  const char* buffer(uint16_t id) const { return buffers_ + static_cast<size_t>(id) * buffer_size_; }
+  // Hands buffer `id` back to the kernel.
+  void RecycleBuffer(uint16_t id);
+
+ private:
+  int Enter(unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t arg_size);
+
+  int fd_ = -1;
+  void* sq_ring_ = nullptr;
+  size_t sq_ring_bytes_ = 0;
+  void* cq_ring_ = nullptr;
+  size_t cq_ring_bytes_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_bytes_ = 0;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_entries_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+
+  // Entries handed out by GetSqe but not yet published to the kernel.
+  unsigned sqe_head_ = 0;
+  unsigned sqe_tail_ = 0;
+
+  io_uring_buf_ring* buffer_ring_ = nullptr;
+  size_t buffer_ring_bytes_ = 0;
+  char* buffers_ = nullptr;
+  size_t buffers_bytes_ = 0;
+  unsigned buffer_size_ = 0;
+  unsigned buffer_mask_ = 0;
+};
+}
+#endif
@@ -0,0 +1,741 @@
+#include "IoUringBackend.hpp"
+
+#ifdef UT_USE_IO_URING
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <unordered_set>
+
+namespace ut {
+namespace {
+constexpr unsigned kQueueEntries = 256;
+// Provided receive buffers, shared by every socket on the reactor and handed
+// back as soon as a completion has been copied out.
+constexpr uint16_t kBufferGroup = 0;
+constexpr unsigned kBuffers = 128;
+constexpr unsigned kBufferSize = 8192;
+
+// user_data of requests that are not in requests_.
+constexpr uint64_t kCancelToken = 0;
+constexpr uint64_t kWakeToken = 1;
+constexpr uint64_t kFirstToken = 2;
+
+// A failure is reported whatever the handle waits for, as with epoll.
+constexpr unsigned kAlwaysPolled = POLLERR | POLLHUP;
+}
+
+struct IoUringBackend::Registration {
+  Callback callback;
+  Callback write_callback;
+  AcceptCallback accept_callback;
+  bool reading = true;
+  // Set for sockets readied with PrepareForReactor.
+  std::shared_ptr<RingSocket> socket;
+  // The poll or accept in flight, and what that poll waits for.
+  uint64_t token = 0;
+  unsigned armed_events = 0;
+  // What the last poll reported.
+  unsigned events = 0;
+  // Whether ready_ holds the handle.
+  bool queued = false;
+};
+
+std::unique_ptr<IoUringBackend> IoUringBackend::Create() {
+  std::unique_ptr<IoUringBackend> backend(new IoUringBackend());
+  if (!backend->Init()) {
+    return nullptr;
+  }
+  return backend;
+}
+
+bool IoUringBackend::Init() {
+  next_token_ = kFirstToken;
+  if (!ring_.Init(kQueueEntries) || !ring_.InitBufferRing(kBufferGroup, kBuffers, kBufferSize)) {
+    return false;
+  }
+  // Handing a socket to another reactor cancels synchronously, which came
+  // with multishot receive in 6.0.
+  if (ring_.CancelAndWait(kWakeToken) != -ENOENT) {
+    return false;
+  }
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  return wake_fd_ >= 0;
+}
+
+IoUringBackend::~IoUringBackend() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (wake_fd_ < 0) {
+    return;
+  }
+  ring_.Submit();
+  for (const auto& entry : requests_) {
+    ring_.CancelAndWait(entry.first);
+  }
+  ring_.CancelAndWait(kWakeToken);
+  for (int i = 0; i < 10 && !requests_.empty(); ++i) {
+    ring_.SubmitAndWait(0, 0);
+    ReapLocked();
+  }
+
+  // Hand every socket this reactor owns, or is about to, back to plain I/O
+  // (or to the reactor it was moving to).
+  std::unordered_set<std::shared_ptr<RingSocket>> sockets;
+  for (const auto& entry : owned_) {
+    sockets.insert(entry.second);
+  }
+  for (const auto& entry : registrations_) {
+    if (entry.second->socket) {
+      sockets.insert(entry.second->socket);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> schedule_guard(schedule_mutex_);
+    sockets.insert(scheduled_.begin(), scheduled_.end());
+  }
+  for (const auto& socket : sockets) {
+    std::lock_guard<std::mutex> socket_guard(socket->mutex_);
+    if (socket->queued_on_ == this) {
+      socket->queued_on_ = nullptr;
+    }
+    if (socket->handoff_ == this) {
+      socket->handoff_ = nullptr;
+    }
+    if (socket->owner_ != this) {
+      continue;
+    }
+    socket->recv_token_ = 0;
+    socket->send_token_ = 0;
+    socket->recv_cancelled_ = false;
+    socket->owner_ = nullptr;
+    if (socket->closing_) {
+      close(socket->fd_);
+    } else if (socket->release_ && socket->handoff_) {
+      socket->owner_ = socket->handoff_;
+      socket->ScheduleLocked();
+    } else {
+      socket->FlushDirectLocked();
+    }
+    socket->release_ = false;
+    socket->handoff_ = nullptr;
+    socket->changed_.notify_all();
+  }
+  close(wake_fd_);
+}
+
+bool IoUringBackend::Add(SocketHandle handle, Callback on_readable) {
+  if (handle == kInvalidSocket) {
+    return false;
+  }
+  auto registration = std::make_shared<Registration>();
+  registration->callback = std::move(on_readable);
+  registration->socket = RingSocket::Find(static_cast<int>(handle));
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = registrations_.find(handle);
+    if (it != registrations_.end()) {
+      // A socket closed while still registered leaves its number behind.
+      const auto& previous = it->second->socket;
+      if (!previous || previous == registration->socket) {
+        return false;
+      }
+      std::lock_guard<std::mutex> socket_guard(previous->mutex_);
+      if (!previous->closing_) {
+        return false;
+      }
+    }
+    if (RingSocket* socket = registration->socket.get()) {
+      std::lock_guard<std::mutex> socket_guard(socket->mutex_);
+      if (socket->owner_ == this) {
+        socket->release_ = false;
+        socket->handoff_ = nullptr;
+      } else if (!socket->owner_) {
+        socket->owner_ = this;
+      } else {
+        // The current owner lets go once its requests have ended.
+        socket->handoff_ = this;
+        socket->release_ = true;
+      }
+      socket->ScheduleLocked();
+    } else {
+      rearm_.push_back(handle);
+    }
+    registrations_[handle] = std::move(registration);
+  }
+  if (!Polling()) {
+    Wake();
+  }
+  return true;
+}
+
+bool IoUringBackend::AddAcceptor(SocketHandle listen_socket, AcceptCallback on_accept) {
+  if (listen_socket == kInvalidSocket) {
+    return false;
+  }
+  auto registration = std::make_shared<Registration>();
+  registration->accept_callback = std::move(on_accept);
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (registrations_.count(listen_socket) != 0) {
+      return false;
+    }
+    registrations_[listen_socket] = std::move(registration);
+    rearm_.push_back(listen_socket);
+  }
+  if (!Polling()) {
+    Wake();
+  }
+  return true;
+}
+
+void IoUringBackend::Remove(SocketHandle handle) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = registrations_.find(handle);
+    if (it == registrations_.end()) {
+      return;
+    }
+    std::shared_ptr<Registration> registration = std::move(it->second);
+    registrations_.erase(it);
+    if (registration->token != 0) {
+      CancelLocked(registration->token);
+    }
+    if (RingSocket* socket = registration->socket.get()) {
+      std::lock_guard<std::mutex> socket_guard(socket->mutex_);
+      if (socket->owner_ == this) {
+        socket->release_ = true;
+        socket->ScheduleLocked();
+      } else if (socket->handoff_ == this) {
+        socket->handoff_ = nullptr;
+      }
+    }
+  }
+  if (!Polling()) {
+    Wake();
+  }
+}
+
+bool IoUringBackend::SetWritable(SocketHandle handle, Callback on_writable) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = registrations_.find(handle);
+    if (it == registrations_.end() || it->second->accept_callback) {
+      return false;
+    }
+    Registration& registration = *it->second;
+    registration.write_callback = std::move(on_writable);
+    ChangedLocked(handle, &registration);
+  }
+  if (!Polling()) {
+    Wake();
+  }
+  return true;
+}
+
+bool IoUringBackend::SetReading(SocketHandle handle, bool reading) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = registrations_.find(handle);
+    if (it == registrations_.end() || it->second->accept_callback) {
+      return false;
+    }
+    Registration& registration = *it->second;
+    // A socket's receive keeps filling its inbox up to the limit either way.
+    registration.reading = reading;
+    ChangedLocked(handle, &registration);
+  }
+  if (!Polling()) {
+    Wake();
+  }
+  return true;
+}
+
+int IoUringBackend::Poll(int timeout_ms) {
+  polling_thread_ = std::this_thread::get_id();
+  unsigned to_submit = 0;
+  bool pending = false;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    PrepareLocked();
+    to_submit = ring_.Publish();
+    pending = !ready_.empty() || !accepted_.empty() || ring_.HasCompletions();
+  }
+  {
+    std::lock_guard<std::mutex> guard(schedule_mutex_);
+    pending = pending || !scheduled_.empty();
+  }
+  // One system call submits every receive, send, poll and cancel queued
+  // above and waits for the first completion.
+  ring_.SubmitAndWait(to_submit, pending ? 0 : timeout_ms);
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    ReapLocked();
+  }
+  return Dispatch();
+}
+
+void IoUringBackend::Wake() {
+  const uint64_t one = 1;
+  [[maybe_unused]] const ssize_t rc = write(wake_fd_, &one, sizeof(one));
+}
+
+void IoUringBackend::Schedule(std::shared_ptr<RingSocket> socket) {
+  {
+    std::lock_guard<std::mutex> guard(schedule_mutex_);
+    scheduled_.push_back(std::move(socket));
+  }
+  if (!Polling()) {
+    Wake();
+  }
+}
+
+bool IoUringBackend::Polling() const {
+  return polling_thread_.load() == std::this_thread::get_id();
+}
+
+void IoUringBackend::Flush(int timeout_ms) {
+  unsigned to_submit = 0;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    PrepareLocked();
+    to_submit = ring_.Publish();
+  }
+  ring_.SubmitAndWait(to_submit, timeout_ms);
+  std::lock_guard<std::mutex> guard(mutex_);
+  ReapLocked();
+}
+
+io_uring_sqe* IoUringBackend::NextSqe() {
+  io_uring_sqe* sqe = ring_.GetSqe();
+  if (!sqe) {
+    ring_.Submit();
+    sqe = ring_.GetSqe();
+  }
+  return sqe;
+}
+
+uint64_t IoUringBackend::Issue(Op op, SocketHandle handle, std::shared_ptr<RingSocket> socket) {
+  const uint64_t token = next_token_++;
+  requests_.emplace(token, Request{op, handle, std::move(socket)});
+  return token;
+}
+
+void IoUringBackend::CancelLocked(uint64_t token) {
+  cancels_.push_back(token);
+}
+
+void IoUringBackend::ChangedLocked(SocketHandle handle, Registration* registration) {
+  if (registration->socket) {
+    std::lock_guard<std::mutex> socket_guard(registration->socket->mutex_);
+    MarkReadyLocked(*registration->socket);
+    return;
+  }
+  // The poll in flight waits for the old events.
+  if (registration->token != 0) {
+    CancelLocked(registration->token);
+    registration->token = 0;
+  }
+  rearm_.push_back(handle);
+}
+
+void IoUringBackend::PrepareLocked() {
+  if (!wake_armed_) {
+    if (io_uring_sqe* sqe = NextSqe()) {
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = wake_fd_;
+      sqe->poll32_events = POLLIN;
+      sqe->len = IORING_POLL_ADD_MULTI;
+      sqe->user_data = kWakeToken;
+      wake_armed_ = true;
+    }
+  }
+  for (uint64_t token : cancels_) {
+    if (io_uring_sqe* sqe = NextSqe()) {
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = token;
+      sqe->user_data = kCancelToken;
+    }
+  }
+  cancels_.clear();
+
+  std::vector<SocketHandle> rearm;
+  rearm.swap(rearm_);
+  for (SocketHandle handle : rearm) {
+    auto it = registrations_.find(handle);
+    if (it != registrations_.end() && !it->second->socket && it->second->token == 0) {
+      ArmLocked(handle, it->second.get());
+    }
+  }
+
+  std::vector<std::shared_ptr<RingSocket>> scheduled;
+  {
+    std::lock_guard<std::mutex> guard(schedule_mutex_);
+    scheduled.swap(scheduled_);
+  }
+  for (const auto& socket : scheduled) {
+    ServiceLocked(socket);
+  }
+}
+
+void IoUringBackend::ArmLocked(SocketHandle handle, Registration* registration) {
+  io_uring_sqe* sqe = NextSqe();
+  if (!sqe) {
+    rearm_.push_back(handle);
+    return;
+  }
+  sqe->fd = static_cast<int>(handle);
+  if (registration->accept_callback) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = multishot_accept_ ? IORING_ACCEPT_MULTISHOT : 0;
+    registration->token = Issue(Op::kAccept, handle, nullptr);
+  } else {
+    registration->armed_events = kAlwaysPolled | (registration->reading ? POLLIN : 0u) |
+                                 (registration->write_callback ? POLLOUT : 0u);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = registration->armed_events;
+    registration->token = Issue(Op::kPoll, handle, nullptr);
+  }
+  sqe->user_data = registration->token;
+}
+
+void IoUringBackend::ServiceLocked(const std::shared_ptr<RingSocket>& socket) {
+  std::unique_lock<std::mutex> lock(socket->mutex_);
+  if (socket->queued_on_ == this) {
+    socket->queued_on_ = nullptr;
+  }
+  if (socket->owner_ != this) {
+    return;
+  }
+  owned_.emplace(socket.get(), socket);
+
+  const bool drain = socket->closing_ || (socket->release_ && !socket->handoff_);
+  if (socket->release_ && socket->handoff_ && !socket->closing_) {
+    // The next reactor takes over the buffers where this one stops.
+    SettleLocked(socket, &lock);
+    if (socket->owner_ != this || socket->closing_ || !socket->release_ || !socket->handoff_) {
+      socket->ScheduleLocked();
+      return;
+    }
+    DisownLocked(socket.get());
+    socket->owner_ = socket->handoff_;
+    socket->handoff_ = nullptr;
+    socket->release_ = false;
+    socket->ScheduleLocked();
+    return;
+  }
+  if (drain) {
+    // Close, or go back to plain I/O, once the output has gone.
+    if (socket->recv_token_ != 0 && !socket->recv_cancelled_) {
+      CancelLocked(socket->recv_token_);
+      socket->recv_cancelled_ = true;
+    }
+    SendLocked(socket.get());
+    if (socket->recv_token_ != 0 || socket->send_token_ != 0) {
+      return;
+    }
+    DisownLocked(socket.get());
+    socket->release_ = false;
+    if (socket->closing_) {
+      close(socket->fd_);
+    } else {
+      socket->FlushDirectLocked();
+    }
+    return;
+  }
+
+  if (socket->recv_token_ == 0 && socket->WantsInputLocked()) {
+    if (io_uring_sqe* sqe = NextSqe()) {
+      sqe->opcode = IORING_OP_RECV;
+      sqe->fd = socket->fd_;
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = kBufferGroup;
+      socket->recv_token_ = Issue(Op::kRecv, socket->fd_, socket);
+      sqe->user_data = socket->recv_token_;
+    } else {
+      socket->ScheduleLocked();
+    }
+  } else if (socket->recv_token_ != 0 && !socket->recv_cancelled_ && !socket->WantsInputLocked()) {
+    // A full inbox leaves the rest in the socket, where TCP slows the peer.
+    CancelLocked(socket->recv_token_);
+    socket->recv_cancelled_ = true;
+  }
+  SendLocked(socket.get());
+  MarkReadyLocked(*socket);
+}
+
+void IoUringBackend::SendLocked(RingSocket* socket) {
+  if (socket->send_token_ != 0 || socket->error_ != 0) {
+    return;
+  }
+  if (socket->sent_ == socket->sending_.size()) {
+    socket->sending_.clear();
+    socket->sent_ = 0;
+    socket->sending_.swap(socket->outbox_);
+  }
+  if (socket->sending_.empty()) {
+    return;
+  }
+  io_uring_sqe* sqe = NextSqe();
+  if (!sqe) {
+    socket->ScheduleLocked();
+    return;
+  }
+  // sending_ stays put until the send completes; writes go to outbox_.
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = socket->fd_;
+  sqe->addr = reinterpret_cast<uint64_t>(socket->sending_.data() + socket->sent_);
+  sqe->len = static_cast<uint32_t>(socket->sending_.size() - socket->sent_);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  socket->send_token_ = Issue(Op::kSend, socket->fd_, socket->shared_from_this());
+  sqe->user_data = socket->send_token_;
+}
+
+void IoUringBackend::SettleLocked(const std::shared_ptr<RingSocket>& socket,
+                                  std::unique_lock<std::mutex>* socket_lock) {
+  const uint64_t tokens[] = {socket->recv_token_, socket->send_token_};
+  if (tokens[0] == 0 && tokens[1] == 0) {
+    return;
+  }
+  socket_lock->unlock();
+  ring_.Submit();
+  for (uint64_t token : tokens) {
+    if (token != 0) {
+      ring_.CancelAndWait(token);
+    }
+  }
+  // A cancelled send has sent nothing, so sending_ goes out again from the
+  // next owner.
+  while (true) {
+    ReapLocked();
+    socket_lock->lock();
+    if (socket->recv_token_ == 0 && socket->send_token_ == 0) {
+      return;
+    }
+    socket_lock->unlock();
+    ring_.SubmitAndWait(0, 10);
+  }
+}
+
+void IoUringBackend::DisownLocked(RingSocket* socket) {
+  socket->owner_ = nullptr;
+  socket->recv_cancelled_ = false;
+  socket->changed_.notify_all();
+  owned_.erase(socket);
+}
+
+void IoUringBackend::ReapLocked() {
+  ring_.ReapCompletions([this](const io_uring_cqe& cqe) { CompleteLocked(cqe); });
+}
+
+void IoUringBackend::CompleteLocked(const io_uring_cqe& cqe) {
+  const bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+  if (cqe.user_data == kWakeToken) {
+    uint64_t value = 0;
+    [[maybe_unused]] const ssize_t rc = read(wake_fd_, &value, sizeof(value));
+    wake_armed_ = more;
+    return;
+  }
+  auto it = requests_.find(cqe.user_data);
+  if (it == requests_.end()) {
+    return;
+  }
+  const Request& request = it->second;
+  switch (request.op) {
+    case Op::kRecv: {
+      RingSocket& socket = *request.socket;
+      std::lock_guard<std::mutex> socket_guard(socket.mutex_);
+      if (cqe.flags & IORING_CQE_F_BUFFER) {
+        const auto id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        if (cqe.res > 0) {
+          socket.ReceiveLocked(ring_.buffer(id), static_cast<size_t>(cqe.res));
+        }
+        ring_.RecycleBuffer(id);
+      }
+      if (cqe.res == 0) {
+        socket.eof_ = true;
+        socket.changed_.notify_all();
+      } else if (cqe.res < 0 && cqe.res != -ECANCELED && cqe.res != -ENOBUFS) {
+        socket.error_ = -cqe.res;
+        socket.changed_.notify_all();
+      }
+      MarkReadyLocked(socket);
+      if (!more) {
+        socket.recv_token_ = 0;
+        socket.recv_cancelled_ = false;
+        socket.ScheduleLocked();
+        requests_.erase(it);
+      }
+      return;
+    }
+    case Op::kSend: {
+      RingSocket& socket = *request.socket;
+      std::lock_guard<std::mutex> socket_guard(socket.mutex_);
+      if (cqe.res > 0) {
+        socket.sent_ += static_cast<size_t>(cqe.res);
+      } else if (cqe.res < 0 && cqe.res != -ECANCELED && cqe.res != -EINTR) {
+        socket.error_ = -cqe.res;
+        socket.outbox_.clear();
+        socket.sending_.clear();
+        socket.sent_ = 0;
+        socket.changed_.notify_all();
+      }
+      socket.send_token_ = 0;
+      socket.ScheduleLocked();
+      MarkReadyLocked(socket);
+      requests_.erase(it);
+      return;
+    }
+    case Op::kPoll: {
+      auto registration = registrations_.find(request.handle);
+      if (registration != registrations_.end() && registration->second->token == cqe.user_data) {
+        registration->second->token = 0;
+        // A poll that failed outright (the handle was closed) stays down.
+        if (cqe.res > 0) {
+          registration->second->events = static_cast<unsigned>(cqe.res);
+          if (!registration->second->queued) {
+            registration->second->queued = true;
+            ready_.push_back(request.handle);
+          }
+        }
+      }
+      requests_.erase(it);
+      return;
+    }
+    case Op::kAccept: {
+      auto registration = registrations_.find(request.handle);
+      const bool live = registration != registrations_.end() && registration->second->token == cqe.user_data;
+      if (cqe.res >= 0) {
+        if (live) {
+          accepted_.emplace_back(request.handle, static_cast<SocketHandle>(cqe.res));
+        } else {
+          close(cqe.res);
+        }
+      } else if (cqe.res == -EINVAL && multishot_accept_) {
+        multishot_accept_ = false;
+      }
+      if (!more) {
+        if (live) {
+          registration->second->token = 0;
+          rearm_.push_back(request.handle);
+        }
+        requests_.erase(it);
+      }
+      return;
+    }
+  }
+}
+
+void IoUringBackend::MarkReadyLocked(const RingSocket& socket) {
+  auto it = registrations_.find(static_cast<SocketHandle>(socket.fd_));
+  if (it == registrations_.end() || it->second->socket.get() != &socket || it->second->queued) {
+    return;
+  }
+  bool readable = false;
+  bool writable = false;
+  if (SocketReadyLocked(*it->second, &readable, &writable)) {
+    it->second->queued = true;
+    ready_.push_back(it->first);
+  }
+}
+
+bool IoUringBackend::SocketReadyLocked(const Registration& registration, bool* readable, bool* writable) const {
+  const RingSocket& socket = *registration.socket;
+  *readable = socket.owner_ == this && !socket.closing_ &&
+              ((registration.reading && (socket.BufferedInputLocked() > 0 || socket.eof_)) || socket.error_ != 0);
+  *writable = socket.owner_ == this && registration.write_callback && !socket.closing_ && socket.error_ == 0 &&
+              socket.BufferedOutputLocked() < RingSocket::kWritableBytes;
+  return *readable || *writable;
+}
+
+std::shared_ptr<IoUringBackend::Registration> IoUringBackend::Find(SocketHandle handle) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = registrations_.find(handle);
+  return it == registrations_.end() ? nullptr : it->second;
+}
+
+int IoUringBackend::Dispatch() {
+  std::vector<SocketHandle> ready;
+  std::vector<std::pair<SocketHandle, SocketHandle>> accepted;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    ready.swap(ready_);
+    accepted.swap(accepted_);
+    for (SocketHandle handle : ready) {
+      auto it = registrations_.find(handle);
+      if (it != registrations_.end()) {
+        it->second->queued = false;
+      }
+    }
+  }
+
+  int ran = 0;
+  for (const auto& entry : accepted) {
+    auto registration = Find(entry.first);
+    if (registration && registration->accept_callback) {
+      registration->accept_callback(entry.second);
+      ran++;
+    } else {
+      close(static_cast<int>(entry.second));
+    }
+  }
+  for (SocketHandle handle : ready) {
+    // An earlier callback in this batch may have removed the handle.
+    auto registration = Find(handle);
+    if (!registration) {
+      continue;
+    }
+    bool readable = false;
+    bool writable = false;
+    Callback on_writable;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (registration->socket) {
+        std::lock_guard<std::mutex> socket_guard(registration->socket->mutex_);
+        SocketReadyLocked(*registration, &readable, &writable);
+      } else {
+        // What was reported before a SetReading or SetWritable no longer counts.
+        const unsigned events = registration->events & (kAlwaysPolled | (registration->reading ? POLLIN : 0u) |
+                                                        (registration->write_callback ? POLLOUT : 0u));
+        readable = (events & ~static_cast<unsigned>(POLLOUT)) != 0;
+        writable = (events & POLLOUT) != 0;
+        registration->events = 0;
+      }
+    }
+    if (readable) {
+      registration->callback();
+      ran++;
+    }
+    if (writable && Find(handle) == registration) {
+      // A copy, since the callback may clear its own registration.
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        on_writable = registration->write_callback;
+      }
+      if (on_writable) {
+        on_writable();
+        ran++;
+      }
+    }
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = registrations_.find(handle);
+    if (it == registrations_.end() || it->second != registration) {
+      continue;
+    }
+    if (registration->socket) {
+      // Level-triggered, like epoll: still ready means run again next pass.
+      std::lock_guard<std::mutex> socket_guard(registration->socket->mutex_);
+      MarkReadyLocked(*registration->socket);
+    } else if (registration->token == 0) {
+      rearm_.push_back(handle);
+    }
+  }
+  return ran;
+}
+}
+#endif
@@ -0,0 +1,111 @@
+#pragma once
+
+#ifdef UT_USE_IO_URING
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "IoUring.hpp"
+#include "RingSocket.hpp"
+#include "SocketTypes.hpp"
+
+namespace ut {
+// Reactor's io_uring backend (Linux 6.0+). Whatever the handles on a reactor
+// need from the kernel is queued on one ring and submitted in the same
+// io_uring_enter that waits, once per Poll:
+//   - sockets readied with PrepareForReactor (sessions and tunnels) keep a
+//     multishot receive running into buffers from a ring registered with the
+//     kernel, and send what was written to them since the last pass;
+//   - listeners accept with a multishot accept;
+//   - everything else (PTYs, pipes, unix sockets) is polled one shot at a
+//     time.
+// Reactor keeps the timers and the contract documented in Reactor.hpp.
+class IoUringBackend : public RingSocket::Owner {
+ public:
+  using Callback = std::function<void()>;
+  using AcceptCallback = std::function<void(SocketHandle)>;
+
+  // nullptr when the kernel lacks something this relies on.
+  static std::unique_ptr<IoUringBackend> Create();
+  ~IoUringBackend() override;
+
+  IoUringBackend(const IoUringBackend&) = delete;
+  IoUringBackend& operator=(const IoUringBackend&) = delete;
+
+  bool Add(SocketHandle handle, Callback on_readable);
+  bool AddAcceptor(SocketHandle listen_socket, AcceptCallback on_accept);
+  void Remove(SocketHandle handle);
+  bool SetWritable(SocketHandle handle, Callback on_writable);
+  bool SetReading(SocketHandle handle, bool reading);
+  int Poll(int timeout_ms);
+  void Wake();
+
+  void Schedule(std::shared_ptr<RingSocket> socket) override;
+  bool Polling() const override;
+  void Flush(int timeout_ms) override;
+
+ private:
+  enum class Op { kPoll, kAccept, kRecv, kSend };
+  struct Request {
+    Op op;
+    SocketHandle handle;
+    std::shared_ptr<RingSocket> socket;
+  };
+  struct Registration;
+
+  IoUringBackend() = default;
+  bool Init();
+
+  // The rest are called with mutex_ held.
+  io_uring_sqe* NextSqe();
+  uint64_t Issue(Op op, SocketHandle handle, std::shared_ptr<RingSocket> socket);
+  void CancelLocked(uint64_t token);
+  // Applies a changed SetWritable or SetReading.
+  void ChangedLocked(SocketHandle handle, Registration* registration);
+  void PrepareLocked();
+  // Queues the poll or accept a registration without a socket waits on.
+  void ArmLocked(SocketHandle handle, Registration* registration);
+  // Arms, sends, hands over or closes a socket this reactor owns.
+  void ServiceLocked(const std::shared_ptr<RingSocket>& socket);
+  void SendLocked(RingSocket* socket);
+  // Ends the socket's requests and waits for their last completions.
+  void SettleLocked(const std::shared_ptr<RingSocket>& socket, std::unique_lock<std::mutex>* socket_lock);
+  void DisownLocked(RingSocket* socket);
+  void ReapLocked();
+  void CompleteLocked(const io_uring_cqe& cqe);
+  // Queues the socket's registration for Dispatch; also needs its mutex.
+  void MarkReadyLocked(const RingSocket& socket);
+  bool SocketReadyLocked(const Registration& registration, bool* readable, bool* writable) const;
+  std::shared_ptr<Registration> Find(SocketHandle handle);
+  int Dispatch();
+
+  std::mutex mutex_;
+  IoUring ring_;
+  std::unordered_map<SocketHandle, std::shared_ptr<Registration>> registrations_;
+  std::unordered_map<uint64_t, Request> requests_;
+  uint64_t next_token_;
+  // Registrations whose poll or accept is to be queued.
+  std::vector<SocketHandle> rearm_;
+  std::vector<uint64_t> cancels_;
+  // For Dispatch: handles to check and accepted connections.
+  std::vector<SocketHandle> ready_;
+  std::vector<std::pair<SocketHandle, SocketHandle>> accepted_;
+  std::unordered_map<RingSocket*, std::shared_ptr<RingSocket>> owned_;
+  int wake_fd_ = -1;
+  bool wake_armed_ = false;
+  // Cleared when the kernel turns down a multishot accept (before 5.19).
+  bool multishot_accept_ = true;
+
+  // Taken under a socket's mutex, so nothing else is locked inside it.
+  std::mutex schedule_mutex_;
+  std::vector<std::shared_ptr<RingSocket>> scheduled_;
+  std::atomic<std::thread::id> polling_thread_{};
+};
+}
+#endif
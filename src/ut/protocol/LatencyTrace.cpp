@@ -0,0 +1,224 @@
+#include "LatencyTrace.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+
+#include "PortForwardWire.hpp"
+
+namespace ut {
+namespace latency_trace {
+namespace {
+using port_forward_wire::DecodeVarint;
+using port_forward_wire::EncodeVarint;
+
+constexpr char kTraceIdTag = 0x10;    // field 2, varint
+constexpr char kTimestampTag = 0x18;  // field 3, varint
+
+const char* const kSegmentNames[kSegmentCount] = {"keystroke", "network", "server", "terminal", "shell"};
+
+std::string FormatMillis(int64_t micros) {
+  const int64_t tenths = (micros + 50) / 100;
+  return std::to_string(tenths / 10) + "." + std::to_string(tenths % 10) + "ms";
+}
+
+std::string Summarize(const Histogram* const histograms[kSegmentCount]) {
+  std::string out;
+  for (size_t i = 0; i < kSegmentCount; ++i) {
+    const uint64_t samples = histograms[i]->count();
+    if (samples == 0) {
+      continue;
+    }
+    if (!out.empty()) {
+      out += "; ";
+    }
+    out += kSegmentNames[i];
+    out += " p50=" + FormatMillis(histograms[i]->Percentile(0.5));
+    out += " p99=" + FormatMillis(histograms[i]->Percentile(0.99));
+    out += " n=" + std::to_string(samples);
+  }
+  return out;
+}
+}
+
+bool Enabled() {
+  static const bool enabled = std::getenv("UT_LATENCY_TRACE") != nullptr;
+  return enabled;
+}
+
+int64_t NowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Append(const Stamp& stamp, std::string* payload) {
+  char fields[2 + 2 * port_forward_wire::kMaxVarintBytes];
+  size_t n = 0;
+  fields[n++] = kTraceIdTag;
+  n += EncodeVarint(stamp.trace_id, fields + n);
+  fields[n++] = kTimestampTag;
+  n += EncodeVarint(static_cast<uint64_t>(stamp.timestamp_us), fields + n);
+  payload->append(fields, n);
+}
+
+bool Find(std::string_view payload, Stamp* stamp) {
+  bool has_id = false;
+  bool has_timestamp = false;
+  while (!payload.empty()) {
+    uint64_t tag = 0;
+    uint64_t value = 0;
+    if (!DecodeVarint(&payload, &tag)) {
+      return false;
+    }
+    const uint64_t wire_type = tag & 7;
+    if (wire_type == 0) {
+      if (!DecodeVarint(&payload, &value)) {
+        return false;
+      }
+      if ((tag >> 3) == 2) {
+        stamp->trace_id = value;
+        has_id = true;
+      } else if ((tag >> 3) == 3) {
+        stamp->timestamp_us = static_cast<int64_t>(value);
+        has_timestamp = true;
+      }
+    } else if (wire_type == 2) {
+      // The output itself; skipped without looking at it.
+      if (!DecodeVarint(&payload, &value) || value > payload.size()) {
+        return false;
+      }
+      payload.remove_prefix(static_cast<size_t>(value));
+    } else {
+      return false;
+    }
+  }
+  return has_id && has_timestamp;
+}
+
+void Histogram::Record(int64_t micros) {
+  buckets_[Bucket(micros < 0 ? 0 : static_cast<uint64_t>(micros))].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count() const {
+  uint64_t total = 0;
+  for (const auto& bucket : buckets_) {
+    total += bucket.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+int64_t Histogram::Percentile(double q) const {
+  const uint64_t total = count();
+  if (total == 0) {
+    return 0;
+  }
+  // The smallest value with at least q of the samples at or below it.
+  uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total) + 0.999999);
+  rank = rank == 0 ? 1 : rank;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      return UpperBound(i);
+    }
+  }
+  return UpperBound(kBuckets - 1);
+}
+
+void Histogram::TakeInto(Histogram* window) {
+  for (size_t i = 0; i < kBuckets; ++i) {
+    window->buckets_[i].fetch_add(buckets_[i].exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+}
+
+size_t Histogram::Bucket(uint64_t micros) {
+  if (micros < kLinear) {
+    return static_cast<size_t>(micros);
+  }
+  int exponent = 0;
+  while ((micros >> (exponent + 1)) != 0) {
+    exponent++;
+  }
+  const size_t sub = static_cast<size_t>(micros >> (exponent - kSubBits)) & ((size_t{1} << kSubBits) - 1);
+  return kLinear + static_cast<size_t>(exponent - kSubBits - 2) * (size_t{1} << kSubBits) + sub;
+}
+
+int64_t Histogram::UpperBound(size_t bucket) {
+  if (bucket < kLinear) {
+    return static_cast<int64_t>(bucket);
+  }
+  const int exponent = static_cast<int>((bucket - kLinear) >> kSubBits) + kSubBits + 2;
+  const uint64_t sub = (bucket - kLinear) & ((size_t{1} << kSubBits) - 1);
+  const uint64_t width = uint64_t{1} << (exponent - kSubBits);
+  const uint64_t lower = ((uint64_t{1} << kSubBits) + sub) * width;
+  if (lower - 1 > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) - width) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  return static_cast<int64_t>(lower + width - 1);
+}
+
+void KeystrokeTracer::StampKeystroke(std::string* payload) {
+  if (!Enabled()) {
+    return;
+  }
+  const int64_t now = NowUs();
+  if (pending_id_.load() != 0 && now - pending_since_us_.load() < kAbandonUs) {
+    return;
+  }
+  const uint64_t id = ++next_id_;
+  pending_since_us_ = now;
+  pending_id_ = id;
+  Append(Stamp{id, now}, payload);
+}
+
+void KeystrokeTracer::OnOutput(std::string_view payload) {
+  Stamp stamp;
+  if (!Enabled() || pending_id_.load() == 0 || !Find(payload, &stamp)) {
+    return;
+  }
+  uint64_t expected = stamp.trace_id;
+  if (pending_id_.compare_exchange_strong(expected, 0)) {
+    HistogramFor(Segment::kKeystroke).Record(NowUs() - stamp.timestamp_us);
+  }
+}
+
+std::string KeystrokeTracer::KeepalivePayload() {
+  std::string payload;
+  if (Enabled()) {
+    Append(Stamp{++next_id_, NowUs()}, &payload);
+  }
+  return payload;
+}
+
+void KeystrokeTracer::OnKeepalive(std::string_view payload) {
+  Stamp stamp;
+  if (Enabled() && Find(payload, &stamp)) {
+    HistogramFor(Segment::kNetwork).Record(NowUs() - stamp.timestamp_us);
+  }
+}
+
+Histogram& HistogramFor(Segment segment) {
+  static Histogram histograms[kSegmentCount];
+  return histograms[static_cast<size_t>(segment)];
+}
+
+std::string Summary() {
+  const Histogram* histograms[kSegmentCount];
+  for (size_t i = 0; i < kSegmentCount; ++i) {
+    histograms[i] = &HistogramFor(static_cast<Segment>(i));
+  }
+  return Summarize(histograms);
+}
+
+std::string TakeSummary() {
+  Histogram windows[kSegmentCount];
+  const Histogram* histograms[kSegmentCount];
+  for (size_t i = 0; i < kSegmentCount; ++i) {
+    HistogramFor(static_cast<Segment>(i)).TakeInto(&windows[i]);
+    histograms[i] = &windows[i];
+  }
+  return Summarize(histograms);
+}
+}
+}
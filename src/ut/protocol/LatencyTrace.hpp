@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace ut {
+// Keystroke latency tracing. A client run with UT_LATENCY_TRACE set stamps
+// one keystroke at a time (and each keepalive) with a trace id and its
+// timestamp. Every hop that sees a stamp records how long its part took,
+// in its own clock, and passes the stamp on with the output the keystroke
+// produced, so the client can time the whole round trip.
+//
+// The stamp travels as two protobuf varint fields that UTerminal.proto does
+// not declare: field 2 is the trace id (uint64) and field 3 the timestamp
+// in microseconds (int64). They are appended to a serialized TerminalBuffer
+// (whose only declared field is 1) and make up the whole payload of a
+// traced KEEP_ALIVE, which is otherwise empty. Only this codec reads or
+// writes them, so the checked-in gencode stays as it is, and peers without
+// tracing keep them as unknown fields. Fields 2 and 3 of TerminalBuffer
+// must stay unused if the .proto ever grows.
+namespace latency_trace {
+struct Stamp {
+  uint64_t trace_id = 0;
+  int64_t timestamp_us = 0;
+};
+
+enum class Segment {
+  // Client: keystroke read from the console until its echo arrives.
+  kKeystroke,
+  // Client: keepalive sent until the server's echo arrives.
+  kNetwork,
+  // Server: keystroke received until the output it caused is sent.
+  kServer,
+  // Server: keystroke handed to the terminal (PTY or terminal host) until
+  // output comes back.
+  kTerminal,
+  // Terminal host: keystroke written to ConPTY until output is read.
+  kShell,
+};
+constexpr size_t kSegmentCount = 5;
+
+bool Enabled();
+// Microseconds on the steady clock, which is shared by processes on the
+// same host.
+int64_t NowUs();
+// Appends the stamp's fields to a serialized TerminalBuffer or a KEEP_ALIVE
+// payload.
+void Append(const Stamp& stamp, std::string* payload);
+// Finds a stamp in a serialized TerminalBuffer or a KEEP_ALIVE payload.
+// Returns false when there is none or the payload is malformed.
+bool Find(std::string_view payload, Stamp* stamp);
+
+// Log-linear histogram of microsecond latencies, eight buckets per power of
+// two (12.5% resolution). Recording is lock-free and safe from any thread.
+class Histogram {
+ public:
+  void Record(int64_t micros);
+  uint64_t count() const;
+  // Upper bound of the bucket holding quantile `q` (0..1); 0 when empty.
+  int64_t Percentile(double q) const;
+  // Moves every sample into `window`, leaving this histogram empty. A sample
+  // recorded meanwhile lands in one of the two, never both.
+  void TakeInto(Histogram* window);
+
+ private:
+  static constexpr int kSubBits = 3;
+  static constexpr size_t kLinear = size_t{1} << (kSubBits + 2);
+  static constexpr size_t kBuckets = kLinear + (64 - kSubBits - 2) * (size_t{1} << kSubBits);
+
+  static size_t Bucket(uint64_t micros);
+  static int64_t UpperBound(size_t bucket);
+
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+};
+
+// Client side of tracing, shared by the console input and output threads
+// and the keepalive. Everything is a no-op unless Enabled().
+class KeystrokeTracer {
+ public:
+  // Stamps a serialized keystroke TerminalBuffer, unless an earlier
+  // keystroke is still waiting for its output.
+  void StampKeystroke(std::string* payload);
+  // Records the round trip when a received TerminalBuffer carries the
+  // outstanding stamp.
+  void OnOutput(std::string_view payload);
+  std::string KeepalivePayload();
+  void OnKeepalive(std::string_view payload);
+
+ private:
+  // A keystroke whose output never came back stops blocking new traces.
+  static constexpr int64_t kAbandonUs = 10 * 1000 * 1000;
+
+  std::atomic<uint64_t> next_id_{0};
+  std::atomic<uint64_t> pending_id_{0};
+  std::atomic<int64_t> pending_since_us_{0};
+};
+
+// The process-wide histogram for `segment`.
+Histogram& HistogramFor(Segment segment);
+// "name p50=..ms p99=..ms n=.." for each segment with samples, separated
+// by "; ", or an empty string when nothing was recorded.
+std::string Summary();
+// Summary() of the samples recorded since the last call, which it clears,
+// for periodic reports.
+std::string TakeSummary();
+}
+}
@@ -0,0 +1,216 @@
+#include "NetworkMonitor.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <iphlpapi.h>
+#include <windows.h>
+
+#include <vector>
+#else
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#include <net/route.h>
+#define UT_ROUTING_SOCKET 1
+#endif
+#endif
+
+#include <cstring>
+
+namespace ut {
+namespace {
+bool SameAddress(const sockaddr* a, const sockaddr* b) {
+  if (a == nullptr || b == nullptr || a->sa_family != b->sa_family) {
+    return false;
+  }
+  if (a->sa_family == AF_INET) {
+    return std::memcmp(&reinterpret_cast<const sockaddr_in*>(a)->sin_addr,
+                       &reinterpret_cast<const sockaddr_in*>(b)->sin_addr, sizeof(in_addr)) == 0;
+  }
+  if (a->sa_family == AF_INET6) {
+    return std::memcmp(&reinterpret_cast<const sockaddr_in6*>(a)->sin6_addr,
+                       &reinterpret_cast<const sockaddr_in6*>(b)->sin6_addr, sizeof(in6_addr)) == 0;
+  }
+  return false;
+}
+
+#ifndef _WIN32
+int OpenWatchSocket() {
+#if defined(__linux__)
+  const int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+#elif defined(UT_ROUTING_SOCKET)
+  const int fd = socket(PF_ROUTE, SOCK_RAW, AF_UNSPEC);
+  if (fd >= 0) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+  return fd;
+#else
+  return -1;
+#endif
+}
+#endif
+}
+
+NetworkMonitor::~NetworkMonitor() {
+  Stop();
+}
+
+bool NetworkMonitor::Start(Callback on_change) {
+  if (running_) {
+    return true;
+  }
+  on_change_ = std::move(on_change);
+#ifdef _WIN32
+  stop_event_ = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+  if (stop_event_ == nullptr) {
+    return false;
+  }
+#else
+  watch_fd_ = OpenWatchSocket();
+  if (watch_fd_ < 0) {
+    return false;
+  }
+  if (pipe(wake_fds_) != 0) {
+    close(watch_fd_);
+    watch_fd_ = -1;
+    return false;
+  }
+  for (int fd : wake_fds_) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+#endif
+  running_ = true;
+  thread_ = std::thread(&NetworkMonitor::Run, this);
+  return true;
+}
+
+void NetworkMonitor::Stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+#ifdef _WIN32
+  SetEvent(static_cast<HANDLE>(stop_event_));
+#else
+  [[maybe_unused]] const ssize_t rc = write(wake_fds_[1], "x", 1);
+#endif
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+#ifdef _WIN32
+  CloseHandle(static_cast<HANDLE>(stop_event_));
+  stop_event_ = nullptr;
+#else
+  close(watch_fd_);
+  close(wake_fds_[0]);
+  close(wake_fds_[1]);
+  watch_fd_ = -1;
+  wake_fds_[0] = wake_fds_[1] = -1;
+#endif
+}
+
+void NetworkMonitor::Run() {
+#ifdef _WIN32
+  OVERLAPPED overlapped{};
+  overlapped.hEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+  while (running_ && overlapped.hEvent != nullptr) {
+    HANDLE notify = nullptr;
+    if (NotifyAddrChange(&notify, &overlapped) != ERROR_IO_PENDING) {
+      break;
+    }
+    HANDLE events[2] = {overlapped.hEvent, static_cast<HANDLE>(stop_event_)};
+    if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+      CancelIPChangeNotify(&overlapped);
+      break;
+    }
+    on_change_();
+  }
+  if (overlapped.hEvent != nullptr) {
+    CloseHandle(overlapped.hEvent);
+  }
+#else
+  char buffer[8192];
+  while (running_) {
+    pollfd fds[2] = {{watch_fd_, POLLIN, 0}, {wake_fds_[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      continue;
+    }
+    if (fds[1].revents != 0) {
+      break;
+    }
+    // One change arrives as several messages (link, address, routes); report
+    // whatever is queued as a single change.
+    while (recv(watch_fd_, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+    }
+    on_change_();
+  }
+#endif
+}
+
+bool NetworkMonitor::HasLocalAddress(SocketHandle socket) {
+  if (socket == kInvalidSocket) {
+    return true;
+  }
+  sockaddr_storage local{};
+#ifdef _WIN32
+  int local_len = sizeof(local);
+  if (getsockname(static_cast<SOCKET>(socket), reinterpret_cast<sockaddr*>(&local), &local_len) != 0) {
+    return true;
+  }
+  ULONG size = 16 * 1024;
+  std::vector<unsigned char> storage;
+  ULONG rc = ERROR_BUFFER_OVERFLOW;
+  for (int tries = 0; tries < 3 && rc == ERROR_BUFFER_OVERFLOW; ++tries) {
+    storage.resize(size);
+    rc = GetAdaptersAddresses(AF_UNSPEC,
+                              GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER,
+                              nullptr, reinterpret_cast<IP_ADAPTER_ADDRESSES*>(storage.data()), &size);
+  }
+  if (rc != NO_ERROR) {
+    return true;
+  }
+  for (auto* adapter = reinterpret_cast<IP_ADAPTER_ADDRESSES*>(storage.data()); adapter != nullptr;
+       adapter = adapter->Next) {
+    for (auto* unicast = adapter->FirstUnicastAddress; unicast != nullptr; unicast = unicast->Next) {
+      if (SameAddress(reinterpret_cast<const sockaddr*>(&local), unicast->Address.lpSockaddr)) {
+        return true;
+      }
+    }
+  }
+  return false;
+#else
+  socklen_t local_len = sizeof(local);
+  if (getsockname(static_cast<int>(socket), reinterpret_cast<sockaddr*>(&local), &local_len) != 0) {
+    return true;
+  }
+  ifaddrs* interfaces = nullptr;
+  if (getifaddrs(&interfaces) != 0) {
+    return true;
+  }
+  bool found = false;
+  for (ifaddrs* entry = interfaces; entry != nullptr && !found; entry = entry->ifa_next) {
+    found = SameAddress(reinterpret_cast<const sockaddr*>(&local), entry->ifa_addr);
+  }
+  freeifaddrs(interfaces);
+  return found;
+#endif
+}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include "SocketTypes.hpp"
+
+namespace ut {
+// Reports changes to the host's addresses and routes (Wi-Fi to wired, a VPN
+// coming up, a DHCP renewal) as they happen: a netlink socket on Linux, a
+// routing socket on macOS and the BSDs, NotifyAddrChange on Windows. On
+// other platforms Start() returns false and nothing is reported.
+class NetworkMonitor {
+ public:
+  using Callback = std::function<void()>;
+
+  NetworkMonitor() = default;
+  ~NetworkMonitor();
+
+  NetworkMonitor(const NetworkMonitor&) = delete;
+  NetworkMonitor& operator=(const NetworkMonitor&) = delete;
+
+  // Runs `on_change` on the monitor's own thread after each burst of
+  // changes. Returns false when changes cannot be watched.
+  bool Start(Callback on_change);
+  void Stop();
+
+  // Whether the local address `socket` is bound to is still assigned to an
+  // interface. True when that cannot be determined.
+  static bool HasLocalAddress(SocketHandle socket);
+
+ private:
+  void Run();
+
+  Callback on_change_;
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+#ifdef _WIN32
+  void* stop_event_ = nullptr;
+#else
+  int watch_fd_ = -1;
+  int wake_fds_[2] = {-1, -1};
+#endif
+};
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+#include "UtConstants.hpp"
+
+namespace ut {
+// Batches terminal output into fewer, larger TERMINAL_BUFFER frames. A batch
+// goes out as soon as the source has nothing further queued, so echo and
+// prompts are never held back; while the source keeps producing, reads
+// accumulate until the batch reaches kCoalesceMaxBytes or its oldest byte
+// has waited kCoalesceMaxDelayUs.
+class OutputCoalescer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  OutputCoalescer(size_t max_bytes = kCoalesceMaxBytes,
+                  std::chrono::microseconds max_delay = std::chrono::microseconds(kCoalesceMaxDelayUs))
+      : max_bytes_(max_bytes), max_delay_(max_delay) {
+    pending_.reserve(max_bytes_);
+  }
+
+  void Append(const char* data, size_t size, Clock::time_point now = Clock::now()) {
+    if (pending_.empty()) {
+      first_byte_ = now;
+    }
+    pending_.append(data, size);
+  }
+
+  // `more_pending` says whether the source already has further output
+  // ready to read.
+  bool ShouldFlush(bool more_pending, Clock::time_point now = Clock::now()) const {
+    if (pending_.empty()) {
+      return false;
+    }
+    return !more_pending || pending_.size() >= max_bytes_ || now - first_byte_ >= max_delay_;
+  }
+
+  const std::string& data() const { return pending_; }
+  bool empty() const { return pending_.empty(); }
+  // Keeps the capacity for the next batch.
+  void Clear() { pending_.clear(); }
+
+ private:
+  size_t max_bytes_;
+  std::chrono::microseconds max_delay_;
+  std::string pending_;
+  Clock::time_point first_byte_;
+};
+}
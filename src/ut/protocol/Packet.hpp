@@ -1,48 +1,139 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <string_view>
 
-namespace ut { 
+namespace ut {
+// A packet is a view into a refcounted wire frame laid out as
+// [u32 big-endian length][encrypted][header][payload]. Copies of a packet
+// share the frame; mutators copy it only when it is shared.
 class Packet {
  public:
-  Packet() : encrypted_(false), header_(255) {}
-  Packet(uint8_t header, const std::string& payload)
-      : encrypted_(false), header_(header), payload_(payload) {}
-  Packet(bool encrypted, uint8_t header, const std::string& payload)
-      : encrypted_(encrypted), header_(header), payload_(payload) {}
-  explicit Packet(const std::string& serialized) {
-    if (serialized.size() < 2) {
-      encrypted_ = false;
-      header_ = 255;
+  static constexpr size_t kLengthBytes = 4;
+  static constexpr size_t kHeaderBytes = 2;
+  static constexpr size_t kFrameOverhead = kLengthBytes + kHeaderBytes;
+
+  Packet() = default;
+  Packet(uint8_t header, std::string_view payload) : Packet(false, header, payload) {}
+  Packet(bool encrypted, uint8_t header, std::string_view payload) {
+    Assign(encrypted, header, payload);
+  }
+  explicit Packet(std::string_view serialized) {
+    if (serialized.size() < kHeaderBytes) {
       return;
     }
-    encrypted_ = serialized[0] != 0;
-    header_ = static_cast<uint8_t>(serialized[1]);
-    payload_ = serialized.substr(2);
+    Assign(serialized[0] != 0, static_cast<uint8_t>(serialized[1]), serialized.substr(kHeaderBytes));
+  }
+  // Adopts the frame starting at `offset` in `buffer`; the length prefix must
+  // already be present and `frame_size` covers prefix, header and payload.
+  Packet(std::shared_ptr<std::string> buffer, size_t offset, size_t frame_size)
+      : frame_(std::move(buffer)), offset_(offset), size_(frame_size) {
+    if (!frame_ || size_ < kFrameOverhead || offset_ + size_ > frame_->size()) {
+      frame_.reset();
+      offset_ = 0;
+      size_ = 0;
+    }
+  }
+
+  // A packet with a zeroed payload of `payload_size` bytes, to be filled in
+  // through mutable_payload().
+  static Packet Allocate(bool encrypted, uint8_t header, size_t payload_size) {
+    Packet packet;
+    packet.Reset(encrypted, header, payload_size);
+    return packet;
+  }
+
+  bool is_encrypted() const { return frame_ && base()[kLengthBytes] != 0; }
+  uint8_t header() const {
+    return frame_ ? static_cast<uint8_t>(base()[kLengthBytes + 1]) : static_cast<uint8_t>(255);
+  }
+  std::string_view payload() const {
+    if (!frame_) {
+      return {};
+    }
+    return std::string_view(base() + kFrameOverhead, size_ - kFrameOverhead);
   }
 
-  bool is_encrypted() const { return encrypted_; }
-  uint8_t header() const { return header_; }
-  const std::string& payload() const { return payload_; }
+  void set_encrypted(bool encrypted) { MutableBase()[kLengthBytes] = encrypted ? 1 : 0; }
+  void set_header(uint8_t header) { MutableBase()[kLengthBytes + 1] = static_cast<char>(header); }
+  void set_payload(std::string_view payload) { Assign(is_encrypted(), header(), payload); }
+  char* mutable_payload() { return MutableBase() + kFrameOverhead; }
 
-  void set_encrypted(bool encrypted) { encrypted_ = encrypted; }
-  void set_header(uint8_t header) { header_ = header; }
-  void set_payload(const std::string& payload) { payload_ = payload; }
+  template <typename T>
+  bool ParsePayload(T* message) const {
+    const std::string_view data = payload();
+    return message->ParseFromArray(data.data(), static_cast<int>(data.size()));
+  }
 
-  std::string serialize() const {
-    std::string out("00", 2);
-    out[0] = encrypted_ ? 1 : 0;
-    out[1] = static_cast<char>(header_);
-    out.append(payload_);
-    return out;
+  // Header and payload without the length prefix.
+  std::string_view serialized() const {
+    if (!frame_) {
+      return std::string_view(kEmptySerialized, kHeaderBytes);
+    }
+    return std::string_view(base() + kLengthBytes, size_ - kLengthBytes);
+  }
+  // The complete wire frame, ready to be written to a socket.
+  std::string_view frame() const {
+    if (!frame_) {
+      return std::string_view(kEmptyFrame, kFrameOverhead);
+    }
+    return std::string_view(base(), size_);
   }
+  std::string serialize() const { return std::string(serialized()); }
 
-  size_t length() const { return 2 + payload_.size(); }
+  size_t length() const { return frame_ ? size_ - kLengthBytes : kHeaderBytes; }
+
+  static uint32_t DecodeLength(const char* prefix) {
+    const auto* p = reinterpret_cast<const unsigned char*>(prefix);
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+  }
+  static void EncodeLength(uint32_t length, char* prefix) {
+    prefix[0] = static_cast<char>((length >> 24) & 0xff);
+    prefix[1] = static_cast<char>((length >> 16) & 0xff);
+    prefix[2] = static_cast<char>((length >> 8) & 0xff);
+    prefix[3] = static_cast<char>(length & 0xff);
+  }
 
  private:
-  bool encrypted_;
-  uint8_t header_;
-  std::string payload_;
+  static constexpr char kEmptySerialized[kHeaderBytes] = {0, static_cast<char>(255)};
+  static constexpr char kEmptyFrame[kFrameOverhead] = {0, 0, 0, 2, 0, static_cast<char>(255)};
+
+  const char* base() const { return frame_->data() + offset_; }
+
+  char* MutableBase() {
+    if (!frame_) {
+      Assign(false, 255, std::string_view());
+    } else if (frame_.use_count() != 1) {
+      frame_ = std::make_shared<std::string>(base(), size_);
+      offset_ = 0;
+    }
+    return &(*frame_)[offset_];
+  }
+
+  void Assign(bool encrypted, uint8_t header, std::string_view payload) {
+    Reset(encrypted, header, payload.size());
+    if (!payload.empty()) {
+      std::memcpy(&(*frame_)[kFrameOverhead], payload.data(), payload.size());
+    }
+  }
+
+  void Reset(bool encrypted, uint8_t header, size_t payload_size) {
+    auto frame = std::make_shared<std::string>(kFrameOverhead + payload_size, '\0');
+    char* out = &(*frame)[0];
+    EncodeLength(static_cast<uint32_t>(kHeaderBytes + payload_size), out);
+    out[kLengthBytes] = encrypted ? 1 : 0;
+    out[kLengthBytes + 1] = static_cast<char>(header);
+    frame_ = std::move(frame);
+    offset_ = 0;
+    size_ = frame_->size();
+  }
+
+  std::shared_ptr<std::string> frame_;
+  size_t offset_ = 0;
+  size_t size_ = 0;
 };
 }
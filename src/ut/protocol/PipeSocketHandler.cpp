@@ -2,9 +2,52 @@
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <memory>
+#include <stdexcept>
 #endif
 
+#include <cstdlib>
+#include <cstring>
+
 namespace ut {
+namespace {
+#ifdef _WIN32
+struct IoEvent {
+  HANDLE handle = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+  ~IoEvent() {
+    if (handle) {
+      CloseHandle(handle);
+    }
+  }
+};
+
+// One completion event per thread, so a reader and a writer on the same
+// pipe never wait on each other's operation.
+HANDLE ThreadIoEvent() {
+  thread_local IoEvent event;
+  ResetEvent(event.handle);
+  return event.handle;
+}
+
+int FinishIo(HANDLE pipe, BOOL started, OVERLAPPED* overlapped) {
+  if (!started && GetLastError() != ERROR_IO_PENDING) {
+    return -1;
+  }
+  DWORD transferred = 0;
+  if (!GetOverlappedResult(pipe, overlapped, &transferred, TRUE)) {
+    return -1;
+  }
+  return static_cast<int>(transferred);
+}
+#endif
+}
+
 bool PipeSocketHandler::HasData(SocketHandle socket) {
 #ifdef _WIN32
   if (socket == kInvalidSocket) {
@@ -16,8 +59,42 @@ bool PipeSocketHandler::HasData(SocketHandle socket) {
   }
   return available > 0;
 #else
-  (void)socket;
-  return false;
+  if (socket == kInvalidSocket) {
+    return false;
+  }
+  pollfd fd{static_cast<int>(socket), POLLIN, 0};
+  return poll(&fd, 1, 0) > 0;
+#endif
+}
+
+bool PipeSocketHandler::WaitForData(SocketHandle socket, int timeout_ms) {
+#ifdef _WIN32
+  if (socket == kInvalidSocket || HasData(socket)) {
+    return true;
+  }
+  HANDLE pipe = reinterpret_cast<HANDLE>(socket);
+  OVERLAPPED overlapped{};
+  overlapped.hEvent = ThreadIoEvent();
+  char unused = 0;
+  bool ready = true;
+  // A zero-byte read completes once data arrives (or the pipe breaks)
+  // without consuming anything.
+  if (!ReadFile(pipe, &unused, 0, nullptr, &overlapped) && GetLastError() == ERROR_IO_PENDING) {
+    const DWORD wait_ms = timeout_ms < 0 ? INFINITE : static_cast<DWORD>(timeout_ms);
+    if (WaitForSingleObject(overlapped.hEvent, wait_ms) != WAIT_OBJECT_0) {
+      CancelIoEx(pipe, &overlapped);
+      ready = false;
+    }
+    DWORD ignored = 0;
+    GetOverlappedResult(pipe, &overlapped, &ignored, TRUE);
+  }
+  return ready;
+#else
+  if (socket == kInvalidSocket) {
+    return true;
+  }
+  pollfd fd{static_cast<int>(socket), POLLIN, 0};
+  return poll(&fd, 1, timeout_ms) != 0;
 #endif
 }
 
@@ -33,8 +110,19 @@ bool PipeSocketHandler::IsConnected(SocketHandle socket) {
   const DWORD err = GetLastError();
   return err != ERROR_BROKEN_PIPE && err != ERROR_PIPE_NOT_CONNECTED && err != ERROR_INVALID_HANDLE;
 #else
-  (void)socket;
-  return false;
+  if (socket == kInvalidSocket) {
+    return false;
+  }
+  pollfd fd{static_cast<int>(socket), POLLIN, 0};
+  if (poll(&fd, 1, 0) <= 0) {
+    return true;
+  }
+  if (fd.revents & (POLLERR | POLLNVAL)) {
+    return false;
+  }
+  // Readable: either data, or the peer has gone and the next read sees EOF.
+  char probe = 0;
+  return recv(static_cast<int>(socket), &probe, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
 #endif
 }
 
@@ -43,16 +131,15 @@ int PipeSocketHandler::Read(SocketHandle socket, void* buf, size_t count) {
   if (socket == kInvalidSocket) {
     return -1;
   }
-  DWORD read_bytes = 0;
-  if (!ReadFile(reinterpret_cast<HANDLE>(socket), buf, static_cast<DWORD>(count), &read_bytes, nullptr)) {
+  HANDLE pipe = reinterpret_cast<HANDLE>(socket);
+  OVERLAPPED overlapped{};
+  overlapped.hEvent = ThreadIoEvent();
+  return FinishIo(pipe, ReadFile(pipe, buf, static_cast<DWORD>(count), nullptr, &overlapped), &overlapped);
+#else
+  if (socket == kInvalidSocket) {
     return -1;
   }
-  return static_cast<int>(read_bytes);
-#else
-  (void)socket;
-  (void)buf;
-  (void)count;
-  return -1;
+  return static_cast<int>(recv(static_cast<int>(socket), buf, count, 0));
 #endif
 }
 
@@ -61,16 +148,15 @@ int PipeSocketHandler::Write(SocketHandle socket, const void* buf, size_t count)
   if (socket == kInvalidSocket) {
     return -1;
   }
-  DWORD written = 0;
-  if (!WriteFile(reinterpret_cast<HANDLE>(socket), buf, static_cast<DWORD>(count), &written, nullptr)) {
+  HANDLE pipe = reinterpret_cast<HANDLE>(socket);
+  OVERLAPPED overlapped{};
+  overlapped.hEvent = ThreadIoEvent();
+  return FinishIo(pipe, WriteFile(pipe, buf, static_cast<DWORD>(count), nullptr, &overlapped), &overlapped);
+#else
+  if (socket == kInvalidSocket) {
     return -1;
   }
-  return static_cast<int>(written);
-#else
-  (void)socket;
-  (void)buf;
-  (void)count;
-  return -1;
+  return static_cast<int>(send(static_cast<int>(socket), buf, count, MSG_NOSIGNAL));
 #endif
 }
 
@@ -80,21 +166,138 @@ void PipeSocketHandler::Close(SocketHandle socket) {
     CloseHandle(reinterpret_cast<HANDLE>(socket));
   }
 #else
-  (void)socket;
+  if (socket != kInvalidSocket) {
+    close(static_cast<int>(socket));
+  }
 #endif
 }
 
 SocketHandle PipeSocketHandler::Connect(const std::wstring& pipe_name) {
 #ifdef _WIN32
   HANDLE pipe = CreateFileW(pipe_name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
-                            FILE_ATTRIBUTE_NORMAL, nullptr);
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
   if (pipe == INVALID_HANDLE_VALUE) {
     return kInvalidSocket;
   }
   return reinterpret_cast<SocketHandle>(pipe);
 #else
-  (void)pipe_name;
-  return kInvalidSocket;
+  return Connect(std::string(pipe_name.begin(), pipe_name.end()));
+#endif
+}
+
+#ifndef _WIN32
+SocketHandle PipeSocketHandler::Connect(const std::string& socket_path) {
+  sockaddr_un addr{};
+  if (socket_path.empty() || socket_path.size() >= sizeof(addr.sun_path)) {
+    return kInvalidSocket;
+  }
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    return kInvalidSocket;
+  }
+  if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(sock);
+    return kInvalidSocket;
+  }
+  return static_cast<SocketHandle>(sock);
+}
+
+bool PipeSocketHandler::WritePacketWithFd(SocketHandle socket, const Packet& packet, int fd) {
+  if (socket == kInvalidSocket) {
+    return false;
+  }
+  const std::string_view frame = packet.frame();
+  // The descriptor rides on the first byte of the frame; the rest follows as
+  // ordinary stream data.
+  iovec iov{const_cast<char*>(frame.data()), 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  if (sendmsg(static_cast<int>(socket), &msg, MSG_NOSIGNAL) != 1) {
+    return false;
+  }
+  try {
+    WriteAllOrThrow(socket, frame.data() + 1, frame.size() - 1, false);
+  } catch (const std::exception&) {
+    return false;
+  }
+  return true;
+}
+
+bool PipeSocketHandler::ReadPacketWithFd(SocketHandle socket, Packet* packet, int* fd) {
+  if (!packet || !fd || socket == kInvalidSocket) {
+    return false;
+  }
+  *fd = -1;
+  char prefix[Packet::kLengthBytes] = {};
+  iovec iov{prefix, sizeof(prefix)};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  const ssize_t rc = recvmsg(static_cast<int>(socket), &msg, MSG_CMSG_CLOEXEC);
+  if (rc <= 0) {
+    return false;
+  }
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      std::memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+  try {
+    if (static_cast<size_t>(rc) < sizeof(prefix)) {
+      ReadAll(socket, prefix + rc, sizeof(prefix) - static_cast<size_t>(rc), false);
+    }
+    const uint32_t length = Packet::DecodeLength(prefix);
+    if (length < Packet::kHeaderBytes || length > 128 * 1024 * 1024) {
+      throw std::runtime_error("invalid packet length");
+    }
+    auto frame = std::make_shared<std::string>(Packet::kLengthBytes + length, '\0');
+    std::memcpy(&(*frame)[0], prefix, sizeof(prefix));
+    ReadAll(socket, &(*frame)[Packet::kLengthBytes], length, false);
+    *packet = Packet(frame, 0, frame->size());
+  } catch (const std::exception&) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+    return false;
+  }
+  return true;
+}
 #endif
+
+#ifdef _WIN32
+std::wstring TerminalPipeName() {
+  const char* env = std::getenv("UT_PIPE_NAME");
+  if (env && *env) {
+    return std::wstring(env, env + std::strlen(env));
+  }
+  return L"\\\\.\\pipe\\undying-terminal";
 }
+#else
+std::string TerminalPipeName() {
+  const char* env = std::getenv("UT_PIPE_NAME");
+  if (env && *env) {
+    return env;
+  }
+  const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir && *runtime_dir) {
+    return std::string(runtime_dir) + "/undying-terminal.sock";
+  }
+  return "/tmp/undying-terminal-" + std::to_string(getuid()) + ".sock";
+}
+#endif
 }
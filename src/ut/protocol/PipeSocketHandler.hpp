@@ -5,17 +5,45 @@
 #include "SocketHandler.hpp"
 
 namespace ut {
+// Server <-> terminal IPC: a named pipe on Windows, a Unix-domain stream
+// socket elsewhere. The Unix transport can also carry a file descriptor
+// alongside a packet (SCM_RIGHTS), which lets the terminal hand its PTY
+// master to the server.
 class PipeSocketHandler : public SocketHandler {
  public:
   PipeSocketHandler() = default;
   ~PipeSocketHandler() override = default;
 
   bool HasData(SocketHandle socket) override;
+  bool WaitForData(SocketHandle socket, int timeout_ms) override;
   int Read(SocketHandle socket, void* buf, size_t count) override;
   int Write(SocketHandle socket, const void* buf, size_t count) override;
   void Close(SocketHandle socket) override;
   bool IsConnected(SocketHandle socket);
 
+  // Pipes are opened for overlapped I/O so they can be waited on; Read and
+  // Write still block until they complete. Elsewhere `pipe_name` is the path
+  // of a Unix-domain socket.
   SocketHandle Connect(const std::wstring& pipe_name);
+
+#ifndef _WIN32
+  SocketHandle Connect(const std::string& socket_path);
+  // Sends `packet` with `fd` attached. The receiver gets its own copy of the
+  // descriptor; the caller still owns `fd`.
+  bool WritePacketWithFd(SocketHandle socket, const Packet& packet, int fd);
+  // Like ReadPacket, but also collects a descriptor sent with the packet;
+  // *fd is -1 when there was none.
+  bool ReadPacketWithFd(SocketHandle socket, Packet* packet, int* fd);
+#endif
 };
+
+// Where the server listens for terminals: UT_PIPE_NAME when set, else
+// \\.\pipe\undying-terminal on Windows and
+// $XDG_RUNTIME_DIR/undying-terminal.sock (or /tmp/undying-terminal-<uid>.sock)
+// elsewhere.
+#ifdef _WIN32
+std::wstring TerminalPipeName();
+#else
+std::string TerminalPipeName();
+#endif
 }
@@ -3,6 +3,8 @@
 #include <cstdlib>
 #include <iostream>
 
+#include "PortForwardWire.hpp"
+
 namespace ut {
 namespace {
 bool DebugTunnel() {
@@ -33,118 +35,248 @@ void PortForwardHandler::AddForwardRequest(const ut::PortForwardSourceRequest& r
     return;
   }
   listeners_.push_back(listener);
+  WatchListener(listeners_.size() - 1);
 }
 
 void PortForwardHandler::Update(const std::function<void(const Packet&)>& send_packet) {
-  if (server_side_) {
-    HandleServerData(send_packet);
-  } else {
-    HandleClientData(send_packet);
+  for (const auto& listener : listeners_) {
+    if (socket_handler_->HasData(listener.listen_socket)) {
+      AcceptClient(listener, send_packet);
+    }
+  }
+  for (auto it = active_sockets_.begin(); it != active_sockets_.end();) {
+    Tunnel& tunnel = it->second;
+    if (!tunnel.queued.empty()) {
+      FlushTunnel(&tunnel);
+    }
+    if (tunnel.closing && tunnel.queued.empty()) {
+      CloseTunnel(it++);
+    } else if (socket_handler_->HasData(tunnel.socket) && !RelaySocketData(it->first, tunnel.socket, send_packet)) {
+      CloseTunnel(it++);
+    } else {
+      ++it;
+    }
   }
 }
 
-void PortForwardHandler::HandleClientData(const std::function<void(const Packet&)>& send_packet) {
-  for (auto& listener : listeners_) {
-    if (!socket_handler_->HasData(listener.listen_socket)) {
-      continue;
-    }
-    SocketHandle client_socket = socket_handler_->Accept(listener.listen_socket);
-    if (client_socket == kInvalidSocket) {
-      continue;
+void PortForwardHandler::SetDrainedCallback(std::function<void()> on_drained) {
+  on_drained_ = std::move(on_drained);
+}
+
+void PortForwardHandler::AttachReactor(Reactor* reactor, std::function<void(const Packet&)> send_packet) {
+  if (reactor_) {
+    for (const auto& listener : listeners_) {
+      reactor_->Remove(listener.listen_socket);
     }
-    const int client_fd = next_client_fd_++;
-    pending_clients_[client_fd] = client_socket;
-    if (DebugTunnel()) {
-      std::cerr << "[tunnel] accept client_fd=" << client_fd
-                << " dest=" << listener.destination.name()
-                << ":" << listener.destination.port() << "\n";
+    for (const auto& entry : active_sockets_) {
+      reactor_->Remove(entry.second.socket);
     }
+  }
+  reactor_ = reactor;
+  reactor_send_packet_ = std::move(send_packet);
+  for (size_t i = 0; i < listeners_.size(); ++i) {
+    WatchListener(i);
+  }
+  for (const auto& entry : active_sockets_) {
+    WatchSocket(entry.first, entry.second.socket);
+  }
+}
 
-    ut::PortForwardDestinationRequest req;
-    *req.mutable_destination() = listener.destination;
-    req.set_fd(client_fd);
-    std::string payload;
-    if (!req.SerializeToString(&payload)) {
-      continue;
-    }
-    send_packet(Packet(static_cast<uint8_t>(ut::PORT_FORWARD_DESTINATION_REQUEST), payload));
+void PortForwardHandler::AcceptClient(const Listener& listener,
+                                      const std::function<void(const Packet&)>& send_packet) {
+  SocketHandle client_socket = socket_handler_->Accept(listener.listen_socket);
+  if (client_socket == kInvalidSocket) {
+    return;
+  }
+  if (!socket_handler_->PrepareForReactor(client_socket)) {
+    socket_handler_->Close(client_socket);
+    return;
+  }
+  const int client_fd = next_client_fd_++;
+  pending_clients_[client_fd] = client_socket;
+  if (DebugTunnel()) {
+    std::cerr << "[tunnel] accept client_fd=" << client_fd
+              << " dest=" << listener.destination.name()
+              << ":" << listener.destination.port() << "\n";
   }
 
-  for (auto& entry : active_sockets_) {
-    const int socket_id = entry.first;
-    SocketHandle local_socket = entry.second;
-    if (!socket_handler_->HasData(local_socket)) {
-      continue;
-    }
-    char buffer[4096] = {};
-    const int rc = socket_handler_->Read(local_socket, buffer, sizeof(buffer));
-    if (rc <= 0) {
-      ut::PortForwardData data;
-      data.set_socketid(socket_id);
-      data.set_sourcetodestination(true);
-      data.set_closed(true);
-      std::string payload;
-      if (data.SerializeToString(&payload)) {
-        send_packet(Packet(static_cast<uint8_t>(ut::PORT_FORWARD_DATA), payload));
-      }
-      socket_handler_->Close(local_socket);
-      continue;
-    }
-    ut::PortForwardData data;
-    data.set_socketid(socket_id);
-    data.set_sourcetodestination(true);
-    data.set_buffer(std::string(buffer, buffer + rc));
-    std::string payload;
-    if (data.SerializeToString(&payload)) {
-      if (DebugTunnel()) {
-        std::cerr << "[tunnel] client_data socket_id=" << socket_id
-                  << " bytes=" << rc << "\n";
-      }
-      send_packet(Packet(static_cast<uint8_t>(ut::PORT_FORWARD_DATA), payload));
+  ut::PortForwardDestinationRequest req;
+  *req.mutable_destination() = listener.destination;
+  req.set_fd(client_fd);
+  std::string payload;
+  if (!req.SerializeToString(&payload)) {
+    return;
+  }
+  send_packet(Packet(static_cast<uint8_t>(ut::PORT_FORWARD_DESTINATION_REQUEST), payload));
+}
+
+bool PortForwardHandler::RelaySocketData(int socket_id,
+                                         SocketHandle socket,
+                                         const std::function<void(const Packet&)>& send_packet) {
+  if (read_buffer_.empty()) {
+    read_buffer_.resize(kReadBufferBytes);
+  }
+  const int rc = socket_handler_->Read(socket, read_buffer_.data(), read_buffer_.size());
+  if (rc == SocketHandler::kWouldBlock) {
+    return true;
+  }
+  if (rc <= 0) {
+    SendClosed(socket_id, send_packet);
+    return false;
+  }
+  if (DebugTunnel()) {
+    std::cerr << "[tunnel] " << (server_side_ ? "server_data" : "client_data") << " socket_id=" << socket_id
+              << " bytes=" << rc << "\n";
+  }
+  send_packet(port_forward_wire::EncodeData(static_cast<uint8_t>(ut::PORT_FORWARD_DATA), !server_side_, socket_id,
+                                            read_buffer_.data(), static_cast<size_t>(rc)));
+  return true;
+}
+
+void PortForwardHandler::SendClosed(int socket_id, const std::function<void(const Packet&)>& send_packet) {
+  ut::PortForwardData data;
+  data.set_socketid(socket_id);
+  data.set_sourcetodestination(!server_side_);
+  data.set_closed(true);
+  std::string payload;
+  if (data.SerializeToString(&payload)) {
+    send_packet(Packet(static_cast<uint8_t>(ut::PORT_FORWARD_DATA), payload));
+  }
+}
+
+void PortForwardHandler::CloseAll(const std::function<void(const Packet&)>& send_packet) {
+  if (DebugTunnel()) {
+    std::cerr << "[tunnel] close_all tunnels=" << active_sockets_.size()
+              << " pending=" << pending_clients_.size() << "\n";
+  }
+  while (!active_sockets_.empty()) {
+    auto it = active_sockets_.begin();
+    SendClosed(it->first, send_packet);
+    CloseTunnel(it);
+  }
+  // Their requests, or the answers, may have been skipped.
+  for (const auto& entry : pending_clients_) {
+    socket_handler_->Close(entry.second);
+  }
+  pending_clients_.clear();
+}
+
+void PortForwardHandler::WatchListener(size_t index) {
+  if (!reactor_) {
+    return;
+  }
+  reactor_->Add(listeners_[index].listen_socket,
+                [this, index] { AcceptClient(listeners_[index], reactor_send_packet_); });
+}
+
+void PortForwardHandler::WatchSocket(int socket_id, SocketHandle socket) {
+  if (!reactor_) {
+    return;
+  }
+  reactor_->Add(socket, [this, socket_id] {
+    auto it = active_sockets_.find(socket_id);
+    if (it != active_sockets_.end() && !RelaySocketData(it->first, it->second.socket, reactor_send_packet_)) {
+      CloseTunnel(it);
     }
+  });
+  auto it = active_sockets_.find(socket_id);
+  if (it != active_sockets_.end() && !it->second.queued.empty()) {
+    reactor_->SetWritable(socket, [this, socket_id] { OnTunnelWritable(socket_id); });
   }
 }
 
-void PortForwardHandler::HandleServerData(const std::function<void(const Packet&)>& send_packet) {
-  for (auto& entry : active_sockets_) {
-    const int socket_id = entry.first;
-    SocketHandle remote_socket = entry.second;
-    if (!socket_handler_->HasData(remote_socket)) {
-      continue;
+void PortForwardHandler::QueueWrite(int socket_id, Tunnel* tunnel, std::string_view data) {
+  if (!tunnel->queued.empty()) {
+    // Already waiting for the socket to be writable.
+    tunnel->queued.append(data.data(), data.size());
+    queued_bytes_ += data.size();
+    return;
+  }
+  // The common case: the socket takes it all straight out of the frame.
+  size_t written = 0;
+  if (!WriteSome(tunnel->socket, data.data(), data.size(), &written)) {
+    return;
+  }
+  if (written == data.size()) {
+    return;
+  }
+  tunnel->queued.assign(data.data() + written, data.size() - written);
+  queued_bytes_ += tunnel->queued.size();
+  if (reactor_) {
+    reactor_->SetWritable(tunnel->socket, [this, socket_id] { OnTunnelWritable(socket_id); });
+  }
+}
+
+bool PortForwardHandler::WriteSome(SocketHandle socket, const char* data, size_t size, size_t* written) {
+  while (*written < size) {
+    const int rc = socket_handler_->Write(socket, data + *written, size - *written);
+    if (rc == SocketHandler::kWouldBlock) {
+      return true;
     }
-    char buffer[4096] = {};
-    const int rc = socket_handler_->Read(remote_socket, buffer, sizeof(buffer));
     if (rc <= 0) {
-      ut::PortForwardData data;
-      data.set_socketid(socket_id);
-      data.set_sourcetodestination(false);
-      data.set_closed(true);
-      std::string payload;
-      if (data.SerializeToString(&payload)) {
-        send_packet(Packet(static_cast<uint8_t>(ut::PORT_FORWARD_DATA), payload));
-      }
-      socket_handler_->Close(remote_socket);
-      continue;
-    }
-    ut::PortForwardData data;
-    data.set_socketid(socket_id);
-    data.set_sourcetodestination(false);
-    data.set_buffer(std::string(buffer, buffer + rc));
-    std::string payload;
-    if (data.SerializeToString(&payload)) {
-      if (DebugTunnel()) {
-        std::cerr << "[tunnel] server_data socket_id=" << socket_id
-                  << " bytes=" << rc << "\n";
-      }
-      send_packet(Packet(static_cast<uint8_t>(ut::PORT_FORWARD_DATA), payload));
+      return false;
     }
+    *written += static_cast<size_t>(rc);
+  }
+  return true;
+}
+
+void PortForwardHandler::FlushTunnel(Tunnel* tunnel) {
+  const bool was_backlogged = Backlogged();
+  size_t written = 0;
+  if (WriteSome(tunnel->socket, tunnel->queued.data(), tunnel->queued.size(), &written)) {
+    tunnel->queued.erase(0, written);
+    queued_bytes_ -= written;
+  } else {
+    // The socket's own readiness reports the failure and closes it.
+    queued_bytes_ -= tunnel->queued.size();
+    tunnel->queued.clear();
+  }
+  if (was_backlogged && !Backlogged() && on_drained_) {
+    on_drained_();
+  }
+}
+
+void PortForwardHandler::OnTunnelWritable(int socket_id) {
+  auto it = active_sockets_.find(socket_id);
+  if (it == active_sockets_.end()) {
+    return;
+  }
+  Tunnel& tunnel = it->second;
+  FlushTunnel(&tunnel);
+  if (!tunnel.queued.empty()) {
+    return;
+  }
+  if (tunnel.closing) {
+    CloseTunnel(it);
+    return;
+  }
+  if (reactor_) {
+    reactor_->SetWritable(tunnel.socket, nullptr);
+  }
+}
+
+void PortForwardHandler::CloseSocket(SocketHandle socket) {
+  if (reactor_) {
+    reactor_->Remove(socket);
+  }
+  socket_handler_->Close(socket);
+}
+
+void PortForwardHandler::CloseTunnel(std::unordered_map<int, Tunnel>::iterator it) {
+  const bool was_backlogged = Backlogged();
+  queued_bytes_ -= it->second.queued.size();
+  CloseSocket(it->second.socket);
+  active_sockets_.erase(it);
+  if (was_backlogged && !Backlogged() && on_drained_) {
+    on_drained_();
   }
 }
 
 void PortForwardHandler::HandlePacket(const Packet& packet, const std::function<void(const Packet&)>& send_packet) {
   if (packet.header() == static_cast<uint8_t>(ut::PORT_FORWARD_DESTINATION_RESPONSE)) {
     ut::PortForwardDestinationResponse response;
-    if (!response.ParseFromString(packet.payload())) {
+    if (!packet.ParsePayload(&response)) {
       return;
     }
     if (!response.has_socketid() || !response.has_clientfd()) {
@@ -164,14 +296,15 @@ void PortForwardHandler::HandlePacket(const Packet& packet, const std::function<
       pending_clients_.erase(it);
       return;
     }
-    active_sockets_[response.socketid()] = it->second;
+    active_sockets_[response.socketid()].socket = it->second;
+    WatchSocket(response.socketid(), it->second);
     pending_clients_.erase(it);
     return;
   }
 
   if (packet.header() == static_cast<uint8_t>(ut::PORT_FORWARD_DESTINATION_REQUEST) && server_side_) {
     ut::PortForwardDestinationRequest request;
-    if (!request.ParseFromString(packet.payload())) {
+    if (!packet.ParsePayload(&request)) {
       return;
     }
     if (!request.has_destination() || !request.has_fd()) {
@@ -183,13 +316,18 @@ void PortForwardHandler::HandlePacket(const Packet& packet, const std::function<
                 << ":" << request.destination().port() << "\n";
     }
     SocketHandle remote_socket = socket_handler_->Connect(request.destination().name(), request.destination().port());
+    if (remote_socket != kInvalidSocket && !socket_handler_->PrepareForReactor(remote_socket)) {
+      socket_handler_->Close(remote_socket);
+      remote_socket = kInvalidSocket;
+    }
     ut::PortForwardDestinationResponse response;
     response.set_clientfd(request.fd());
     if (remote_socket == kInvalidSocket) {
       response.set_error("connect failed");
     } else {
       int socket_id = next_socket_id_++;
-      active_sockets_[socket_id] = remote_socket;
+      active_sockets_[socket_id].socket = remote_socket;
+      WatchSocket(socket_id, remote_socket);
       response.set_socketid(socket_id);
     }
     std::string payload;
@@ -200,30 +338,43 @@ void PortForwardHandler::HandlePacket(const Packet& packet, const std::function<
   }
 
   if (packet.header() == static_cast<uint8_t>(ut::PORT_FORWARD_DATA)) {
-    ut::PortForwardData data;
-    if (!data.ParseFromString(packet.payload())) {
-      return;
+    // The buffer is written to the socket straight out of the frame; full
+    // protobuf parsing is only the fallback for unusual encodings.
+    port_forward_wire::Data data;
+    ut::PortForwardData message;
+    if (!port_forward_wire::DecodeData(packet.payload(), &data)) {
+      if (!packet.ParsePayload(&message)) {
+        return;
+      }
+      data.has_socket_id = message.has_socketid();
+      data.socket_id = message.socketid();
+      data.source_to_destination = message.sourcetodestination();
+      data.buffer = message.buffer();
+      data.closed = message.closed();
     }
-    if (!data.has_socketid()) {
+    if (!data.has_socket_id) {
       return;
     }
-    auto it = active_sockets_.find(data.socketid());
+    auto it = active_sockets_.find(data.socket_id);
     if (it == active_sockets_.end()) {
       return;
     }
-    SocketHandle target = it->second;
-    if (data.closed()) {
-      socket_handler_->Close(target);
-      active_sockets_.erase(it);
-      return;
-    }
-    if (!data.buffer().empty()) {
+    Tunnel& tunnel = it->second;
+    if (!data.buffer.empty()) {
       if (DebugTunnel()) {
-        std::cerr << "[tunnel] write_data socket_id=" << data.socketid()
-                  << " bytes=" << data.buffer().size()
-                  << " src_to_dst=" << data.sourcetodestination() << "\n";
+        std::cerr << "[tunnel] write_data socket_id=" << data.socket_id
+                  << " bytes=" << data.buffer.size()
+                  << " src_to_dst=" << data.source_to_destination << "\n";
+      }
+      QueueWrite(data.socket_id, &tunnel, data.buffer);
+    }
+    if (data.closed) {
+      if (tunnel.queued.empty()) {
+        CloseTunnel(it);
+      } else {
+        // Whatever the peer sent before closing still goes out.
+        tunnel.closing = true;
       }
-      socket_handler_->Write(target, data.buffer().data(), data.buffer().size());
     }
   }
 }
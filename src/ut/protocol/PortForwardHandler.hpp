@@ -1,13 +1,16 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 #include "UTerminal.pb.h"
 #include "Packet.hpp"
+#include "Reactor.hpp"
 #include "TcpSocketHandler.hpp"
 
 namespace ut {
@@ -16,17 +19,63 @@ class PortForwardHandler {
   PortForwardHandler(std::shared_ptr<TcpSocketHandler> socket_handler, bool server_side);
 
   void AddForwardRequest(const ut::PortForwardSourceRequest& request);
+  // Services every listener and tunnel socket that has data and flushes
+  // queued tunnel writes. Not needed once a reactor is attached.
   void Update(const std::function<void(const Packet&)>& send_packet);
   void HandlePacket(const Packet& packet, const std::function<void(const Packet&)>& send_packet);
+  // Registers listeners and tunnel sockets, now and as they appear, with
+  // `reactor`, whose callbacks then relay through `send_packet`. Pass nullptr
+  // to detach before the reactor goes away.
+  void AttachReactor(Reactor* reactor, std::function<void(const Packet&)> send_packet);
+  // Tunnel sockets are non-blocking, and data a tunnel cannot take yet waits
+  // in its queue until the socket is writable. Past kMaxQueuedBytes across
+  // all tunnels the caller should stop reading the channel until
+  // `on_drained` runs; one slow tunnel then holds up the others, as it would
+  // on a single TCP stream.
+  bool Backlogged() const { return queued_bytes_ > kMaxQueuedBytes; }
+  void SetDrainedCallback(std::function<void()> on_drained);
+  // Closes every tunnel, and any connection still waiting for its tunnel,
+  // telling the peer through `send_packet`: after a skipped replay some of
+  // their data is gone.
+  void CloseAll(const std::function<void(const Packet&)>& send_packet);
+
+  static constexpr size_t kMaxQueuedBytes = 1024 * 1024;
 
  private:
   struct Listener {
     SocketHandle listen_socket = kInvalidSocket;
     ut::SocketEndpoint destination;
   };
+  struct Tunnel {
+    SocketHandle socket = kInvalidSocket;
+    // Received for the socket but not yet written to it.
+    std::string queued;
+    // The peer closed the tunnel; close the socket once `queued` is out.
+    bool closing = false;
+  };
+
+  void AcceptClient(const Listener& listener, const std::function<void(const Packet&)>& send_packet);
+  // Relays one read from a tunnel socket. Returns false once the socket has
+  // closed; the peer has been told and the caller closes it.
+  bool RelaySocketData(int socket_id, SocketHandle socket, const std::function<void(const Packet&)>& send_packet);
+  void SendClosed(int socket_id, const std::function<void(const Packet&)>& send_packet);
+  void WatchListener(size_t index);
+  void WatchSocket(int socket_id, SocketHandle socket);
+  // Writes `data` to the tunnel, queueing what the socket cannot take yet.
+  void QueueWrite(int socket_id, Tunnel* tunnel, std::string_view data);
+  // Writes until the socket is full or `size` bytes are out, counting them in
+  // `written`. Returns false if the socket failed.
+  bool WriteSome(SocketHandle socket, const char* data, size_t size, size_t* written);
+  // Writes as much of the queue as the socket takes. A failed write drops the
+  // queue; the socket's readiness then reports the failure.
+  void FlushTunnel(Tunnel* tunnel);
+  void OnTunnelWritable(int socket_id);
+  void CloseSocket(SocketHandle socket);
+  // Closes the tunnel's socket and forgets it.
+  void CloseTunnel(std::unordered_map<int, Tunnel>::iterator it);
 
-  void HandleClientData(const std::function<void(const Packet&)>& send_packet);
-  void HandleServerData(const std::function<void(const Packet&)>& send_packet);
+  // One read per readiness event; bulk transfers fill it, keystrokes don't.
+  static constexpr size_t kReadBufferBytes = 64 * 1024;
 
   std::shared_ptr<TcpSocketHandler> socket_handler_;
   bool server_side_ = false;
@@ -35,6 +84,11 @@ class PortForwardHandler {
 
   std::vector<Listener> listeners_;
   std::unordered_map<int, SocketHandle> pending_clients_;
-  std::unordered_map<int, SocketHandle> active_sockets_;
+  std::unordered_map<int, Tunnel> active_sockets_;
+  Reactor* reactor_ = nullptr;
+  std::function<void(const Packet&)> reactor_send_packet_;
+  std::vector<char> read_buffer_;
+  std::atomic<size_t> queued_bytes_{0};
+  std::function<void()> on_drained_;
 };
 }
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "Packet.hpp"
+
+namespace ut {
+// Hand-rolled protobuf wire format for the data-carrying PortForwardData
+// messages (fields 1-3), so tunnel bytes go from the read buffer into the
+// frame and from the frame to the socket without a protobuf string copy in
+// between. Anything else (closed, error) still goes through UTerminal.pb.h.
+namespace port_forward_wire {
+constexpr size_t kMaxVarintBytes = 10;
+// sourcetodestination, socketid and the buffer tag and length.
+constexpr size_t kMaxPrefixBytes = 2 + 1 + kMaxVarintBytes + 1 + kMaxVarintBytes;
+
+inline size_t EncodeVarint(uint64_t value, char* out) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out[n++] = static_cast<char>(value);
+  return n;
+}
+
+inline bool DecodeVarint(std::string_view* in, uint64_t* value) {
+  uint64_t result = 0;
+  for (size_t i = 0; i < in->size() && i < kMaxVarintBytes; ++i) {
+    const auto byte = static_cast<unsigned char>((*in)[i]);
+    result |= static_cast<uint64_t>(byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      in->remove_prefix(i + 1);
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+// A PortForwardData packet carrying `size` bytes of `data`.
+inline Packet EncodeData(uint8_t header, bool source_to_destination, int32_t socket_id, const char* data,
+                         size_t size) {
+  char prefix[kMaxPrefixBytes];
+  size_t n = 0;
+  prefix[n++] = 0x08;  // field 1, varint
+  prefix[n++] = source_to_destination ? 1 : 0;
+  prefix[n++] = 0x10;  // field 2, varint; int32 sign-extends like protobuf
+  n += EncodeVarint(static_cast<uint64_t>(static_cast<int64_t>(socket_id)), prefix + n);
+  prefix[n++] = 0x1a;  // field 3, length-delimited
+  n += EncodeVarint(size, prefix + n);
+
+  Packet packet = Packet::Allocate(false, header, n + size);
+  char* out = packet.mutable_payload();
+  std::memcpy(out, prefix, n);
+  if (size > 0) {
+    std::memcpy(out + n, data, size);
+  }
+  return packet;
+}
+
+struct Data {
+  bool has_socket_id = false;
+  int32_t socket_id = 0;
+  bool source_to_destination = false;
+  // Views into the parsed payload.
+  std::string_view buffer;
+  bool closed = false;
+  bool has_error = false;
+};
+
+// Parses a PortForwardData payload without copying its buffer. Returns false
+// on malformed input or fields this decoder does not know.
+inline bool DecodeData(std::string_view in, Data* out) {
+  *out = Data();
+  while (!in.empty()) {
+    uint64_t tag = 0;
+    if (!DecodeVarint(&in, &tag)) {
+      return false;
+    }
+    const uint64_t field = tag >> 3;
+    const uint64_t wire_type = tag & 7;
+    uint64_t value = 0;
+    if (wire_type == 0) {
+      if (!DecodeVarint(&in, &value)) {
+        return false;
+      }
+      if (field == 1) {
+        out->source_to_destination = value != 0;
+      } else if (field == 2) {
+        out->has_socket_id = true;
+        out->socket_id = static_cast<int32_t>(value);
+      } else if (field == 5) {
+        out->closed = value != 0;
+      } else {
+        return false;
+      }
+    } else if (wire_type == 2) {
+      if (!DecodeVarint(&in, &value) || value > in.size()) {
+        return false;
+      }
+      const std::string_view bytes = in.substr(0, static_cast<size_t>(value));
+      in.remove_prefix(static_cast<size_t>(value));
+      if (field == 3) {
+        out->buffer = bytes;
+      } else if (field == 4) {
+        out->has_error = true;
+      } else {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+}
+}
@@ -0,0 +1,472 @@
+#include "Reactor.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef UT_USE_IO_URING
+#include "IoUringBackend.hpp"
+#endif
+
+namespace ut {
+#ifdef _WIN32
+struct Reactor::PipeWatch {
+  HANDLE pipe = nullptr;
+  HANDLE stop_event = nullptr;
+  // Set once the poller has run the callback, so the watcher only re-arms
+  // after the data that woke it has been consumed.
+  HANDLE rearm_event = nullptr;
+  std::atomic<bool> ready{false};
+  std::thread thread;
+};
+#else
+struct Reactor::PipeWatch {};
+#endif
+
+struct Reactor::Registration {
+  Callback callback;
+  Callback write_callback;
+  bool reading = true;
+  std::unique_ptr<PipeWatch> watch;
+};
+
+Reactor::Reactor(Backend backend) {
+#ifdef UT_USE_IO_URING
+  if (backend != Backend::kEpoll) {
+    ring_ = IoUringBackend::Create();
+    if (ring_) {
+      backend_ = Backend::kIoUring;
+      return;
+    }
+    if (backend == Backend::kIoUring) {
+      throw std::runtime_error("reactor: io_uring unavailable");
+    }
+  }
+#else
+  if (backend == Backend::kIoUring) {
+    throw std::runtime_error("reactor: built without io_uring");
+  }
+#endif
+#ifdef _WIN32
+  WSADATA wsa{};
+  if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+    throw std::runtime_error("reactor: WSAStartup failed");
+  }
+  // A loopback datagram socket connected to itself: Wake() sends a byte,
+  // which makes WSAPoll return.
+  SOCKET wake = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int len = sizeof(addr);
+  u_long non_blocking = 1;
+  if (wake == INVALID_SOCKET || bind(wake, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      getsockname(wake, reinterpret_cast<sockaddr*>(&addr), &len) != 0 ||
+      connect(wake, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      ioctlsocket(wake, FIONBIO, &non_blocking) != 0) {
+    if (wake != INVALID_SOCKET) {
+      closesocket(wake);
+    }
+    WSACleanup();
+    throw std::runtime_error("reactor: wake socket failed");
+  }
+  wake_socket_ = static_cast<SocketHandle>(wake);
+#else
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = static_cast<uint64_t>(kInvalidSocket);
+  if (epoll_fd_ < 0 || wake_fd_ < 0 || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event) != 0) {
+    if (epoll_fd_ >= 0) {
+      close(epoll_fd_);
+    }
+    if (wake_fd_ >= 0) {
+      close(wake_fd_);
+    }
+    throw std::runtime_error("reactor: epoll setup failed");
+  }
+#endif
+}
+
+Reactor::~Reactor() {
+#ifdef UT_USE_IO_URING
+  if (ring_) {
+    return;
+  }
+#endif
+  std::vector<SocketHandle> handles;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (const auto& entry : registrations_) {
+      handles.push_back(entry.first);
+    }
+  }
+  for (SocketHandle handle : handles) {
+    Remove(handle);
+  }
+#ifdef _WIN32
+  closesocket(static_cast<SOCKET>(wake_socket_));
+  WSACleanup();
+#else
+  close(wake_fd_);
+  close(epoll_fd_);
+#endif
+}
+
+bool Reactor::Add(SocketHandle socket, Callback on_readable) {
+  if (socket == kInvalidSocket) {
+    return false;
+  }
+#ifdef UT_USE_IO_URING
+  if (ring_) {
+    return ring_->Add(socket, std::move(on_readable));
+  }
+#endif
+  auto registration = std::make_shared<Registration>();
+  registration->callback = std::move(on_readable);
+#ifndef _WIN32
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = static_cast<uint64_t>(socket);
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, static_cast<int>(socket), &event) != 0) {
+    return false;
+  }
+#endif
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    registrations_[socket] = std::move(registration);
+  }
+  // A Windows poller only picks up new sockets when it rebuilds its set.
+  Wake();
+  return true;
+}
+
+bool Reactor::AddPipe(SocketHandle pipe, Callback on_readable) {
+#ifdef _WIN32
+  if (pipe == kInvalidSocket) {
+    return false;
+  }
+  auto registration = std::make_shared<Registration>();
+  registration->callback = std::move(on_readable);
+  registration->watch = std::make_unique<PipeWatch>();
+  PipeWatch* watch = registration->watch.get();
+  watch->pipe = reinterpret_cast<HANDLE>(pipe);
+  watch->stop_event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+  watch->rearm_event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+  if (!watch->stop_event || !watch->rearm_event) {
+    if (watch->stop_event) {
+      CloseHandle(watch->stop_event);
+    }
+    if (watch->rearm_event) {
+      CloseHandle(watch->rearm_event);
+    }
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    registrations_[pipe] = registration;
+  }
+  watch->thread = std::thread(&Reactor::WatchPipe, this, watch);
+  return true;
+#else
+  return Add(pipe, std::move(on_readable));
+#endif
+}
+
+bool Reactor::AddAcceptor(SocketHandle listen_socket, AcceptCallback on_accept) {
+#ifdef UT_USE_IO_URING
+  if (ring_) {
+    return ring_->AddAcceptor(listen_socket, std::move(on_accept));
+  }
+#endif
+  return Add(listen_socket, [listen_socket, on_accept = std::move(on_accept)] {
+#ifdef _WIN32
+    const SOCKET client = accept(static_cast<SOCKET>(listen_socket), nullptr, nullptr);
+    if (client != INVALID_SOCKET) {
+      on_accept(static_cast<SocketHandle>(client));
+    }
+#else
+    const int client = accept4(static_cast<int>(listen_socket), nullptr, nullptr, SOCK_CLOEXEC);
+    if (client >= 0) {
+      on_accept(static_cast<SocketHandle>(client));
+    }
+#endif
+  });
+}
+
+void Reactor::Remove(SocketHandle handle) {
+#ifdef UT_USE_IO_URING
+  if (ring_) {
+    ring_->Remove(handle);
+    return;
+  }
+#endif
+  std::shared_ptr<Registration> registration;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = registrations_.find(handle);
+    if (it == registrations_.end()) {
+      return;
+    }
+    registration = std::move(it->second);
+    registrations_.erase(it);
+  }
+#ifdef _WIN32
+  if (registration->watch) {
+    PipeWatch* watch = registration->watch.get();
+    SetEvent(watch->stop_event);
+    if (watch->thread.joinable()) {
+      watch->thread.join();
+    }
+    CloseHandle(watch->stop_event);
+    CloseHandle(watch->rearm_event);
+  }
+#else
+  // Fails harmlessly when the descriptor has already been closed.
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, static_cast<int>(handle), nullptr);
+#endif
+}
+
+bool Reactor::SetWritable(SocketHandle socket, Callback on_writable) {
+#ifdef UT_USE_IO_URING
+  if (ring_) {
+    return ring_->SetWritable(socket, std::move(on_writable));
+  }
+#endif
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = registrations_.find(socket);
+  if (it == registrations_.end() || it->second->watch) {
+    return false;
+  }
+  Callback previous = std::move(it->second->write_callback);
+  it->second->write_callback = std::move(on_writable);
+  if (!Rearm(socket, *it->second)) {
+    it->second->write_callback = std::move(previous);
+    return false;
+  }
+  return true;
+}
+
+bool Reactor::SetReading(SocketHandle socket, bool reading) {
+#ifdef UT_USE_IO_URING
+  if (ring_) {
+    return ring_->SetReading(socket, reading);
+  }
+#endif
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = registrations_.find(socket);
+  if (it == registrations_.end() || it->second->watch) {
+    return false;
+  }
+  it->second->reading = reading;
+  if (!Rearm(socket, *it->second)) {
+    it->second->reading = !reading;
+    return false;
+  }
+  return true;
+}
+
+bool Reactor::Rearm(SocketHandle socket, const Registration& registration) {
+#ifdef _WIN32
+  // The poller rebuilds its set on the next pass.
+  Wake();
+  return true;
+#else
+  epoll_event event{};
+  event.events = (registration.reading ? EPOLLIN : 0u) | (registration.write_callback ? EPOLLOUT : 0u);
+  event.data.u64 = static_cast<uint64_t>(socket);
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, static_cast<int>(socket), &event) == 0;
+#endif
+}
+
+int Reactor::Poll(int timeout_ms) {
+  const int timer_ms = timers_.NextTimeoutMs();
+  if (timer_ms >= 0 && (timeout_ms < 0 || timer_ms < timeout_ms)) {
+    timeout_ms = timer_ms;
+  }
+  const int ran = PollHandles(timeout_ms);
+  return ran + static_cast<int>(timers_.Advance());
+}
+
+TimerWheel::TimerId Reactor::AddTimer(int delay_ms, Callback on_expired) {
+  return timers_.Schedule(delay_ms, std::move(on_expired));
+}
+
+bool Reactor::CancelTimer(TimerWheel::TimerId id) {
+  return timers_.Cancel(id);
+}
+
+int Reactor::PollHandles(int timeout_ms) {
+#ifdef UT_USE_IO_URING
+  if (ring_) {
+    return ring_->Poll(timeout_ms);
+  }
+#endif
+  struct Ready {
+    SocketHandle handle;
+    // Readable or failed.
+    bool readable;
+    bool writable;
+  };
+  std::vector<Ready> ready;
+#ifdef _WIN32
+  std::vector<WSAPOLLFD> fds;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    fds.reserve(registrations_.size() + 1);
+    fds.push_back(WSAPOLLFD{static_cast<SOCKET>(wake_socket_), POLLRDNORM, 0});
+    for (const auto& entry : registrations_) {
+      if (!entry.second->watch) {
+        // Failures are reported even with no events asked for.
+        const SHORT events = static_cast<SHORT>((entry.second->reading ? POLLRDNORM : 0) |
+                                                (entry.second->write_callback ? POLLWRNORM : 0));
+        fds.push_back(WSAPOLLFD{static_cast<SOCKET>(entry.first), events, 0});
+      }
+    }
+  }
+  if (WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), timeout_ms) > 0) {
+    if (fds[0].revents != 0) {
+      DrainWake();
+    }
+    for (size_t i = 1; i < fds.size(); ++i) {
+      if (fds[i].revents != 0) {
+        ready.push_back(Ready{static_cast<SocketHandle>(fds[i].fd), (fds[i].revents & ~POLLWRNORM) != 0,
+                              (fds[i].revents & POLLWRNORM) != 0});
+      }
+    }
+  }
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (const auto& entry : registrations_) {
+      if (entry.second->watch && entry.second->watch->ready.exchange(false)) {
+        ready.push_back(Ready{entry.first, true, false});
+      }
+    }
+  }
+#else
+  epoll_event events[64];
+  const int count = epoll_wait(epoll_fd_, events, 64, timeout_ms);
+  for (int i = 0; i < count; ++i) {
+    const auto handle = static_cast<SocketHandle>(events[i].data.u64);
+    if (handle == kInvalidSocket) {
+      DrainWake();
+    } else {
+      ready.push_back(Ready{handle, (events[i].events & ~EPOLLOUT) != 0, (events[i].events & EPOLLOUT) != 0});
+    }
+  }
+#endif
+
+  int ran = 0;
+  for (const Ready& entry : ready) {
+    // An earlier callback in this batch may have removed the handle.
+    auto registration = Find(entry.handle);
+    if (!registration) {
+      continue;
+    }
+    if (entry.readable) {
+      registration->callback();
+      ran++;
+#ifdef _WIN32
+      if (registration->watch) {
+        SetEvent(registration->watch->rearm_event);
+      }
+#endif
+    }
+    if (!entry.writable || Find(entry.handle) != registration) {
+      continue;
+    }
+    // A copy, since the callback may clear its own registration, taken under
+    // the lock because SetWritable may be running on another thread.
+    Callback on_writable;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      on_writable = registration->write_callback;
+    }
+    if (on_writable) {
+      on_writable();
+      ran++;
+    }
+  }
+  return ran;
+}
+
+void Reactor::Wake() {
+#ifdef UT_USE_IO_URING
+  if (ring_) {
+    ring_->Wake();
+    return;
+  }
+#endif
+#ifdef _WIN32
+  const char byte = 0;
+  send(static_cast<SOCKET>(wake_socket_), &byte, 1, 0);
+#else
+  const uint64_t one = 1;
+  [[maybe_unused]] const ssize_t rc = write(wake_fd_, &one, sizeof(one));
+#endif
+}
+
+std::shared_ptr<Reactor::Registration> Reactor::Find(SocketHandle handle) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = registrations_.find(handle);
+  return it == registrations_.end() ? nullptr : it->second;
+}
+
+void Reactor::DrainWake() {
+#ifdef _WIN32
+  char buffer[64];
+  while (recv(static_cast<SOCKET>(wake_socket_), buffer, sizeof(buffer), 0) > 0) {
+  }
+#else
+  uint64_t value = 0;
+  [[maybe_unused]] const ssize_t rc = read(wake_fd_, &value, sizeof(value));
+#endif
+}
+
+#ifdef _WIN32
+void Reactor::WatchPipe(PipeWatch* watch) {
+  OVERLAPPED overlapped{};
+  overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+  if (!overlapped.hEvent) {
+    return;
+  }
+  char unused = 0;
+  while (true) {
+    ResetEvent(overlapped.hEvent);
+    // A zero-byte read on a pipe completes once data is available (or the
+    // pipe breaks) without consuming anything.
+    if (!ReadFile(watch->pipe, &unused, 0, nullptr, &overlapped) && GetLastError() == ERROR_IO_PENDING) {
+      HANDLE waits[] = {overlapped.hEvent, watch->stop_event};
+      if (WaitForMultipleObjects(2, waits, FALSE, INFINITE) != WAIT_OBJECT_0) {
+        DWORD ignored = 0;
+        CancelIoEx(watch->pipe, &overlapped);
+        GetOverlappedResult(watch->pipe, &overlapped, &ignored, TRUE);
+        break;
+      }
+    }
+    watch->ready = true;
+    Wake();
+    HANDLE waits[] = {watch->rearm_event, watch->stop_event};
+    if (WaitForMultipleObjects(2, waits, FALSE, INFINITE) != WAIT_OBJECT_0) {
+      break;
+    }
+  }
+  CloseHandle(overlapped.hEvent);
+}
+#else
+void Reactor::WatchPipe(PipeWatch*) {}
+#endif
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "SocketTypes.hpp"
+#include "TimerWheel.hpp"
+
+namespace ut {
+class IoUringBackend;
+
+// Readiness dispatch for sockets and pipes: one thread calls Poll(), which
+// sleeps until a registered handle is readable (or has failed), or writable
+// when asked, and then runs its callback. Nothing wakes while every handle is
+// idle. Registration and Wake() are safe from any thread; callbacks run on
+// the polling thread and may add or remove handles, including their own.
+// Timers (AddTimer) run on the polling thread too, and Poll() never sleeps
+// past the next one.
+//
+// Linux waits with epoll, or with io_uring in a build with
+// UNDYING_TERMINAL_IO_URING (see IoUringBackend.hpp), which then also does
+// the reads and writes of the sockets readied with PrepareForReactor.
+// Windows waits on sockets with WSAPoll; a named pipe cannot be polled, so
+// each one gets a watcher thread parked in a zero-byte overlapped read that
+// wakes the poller when data arrives.
+class Reactor {
+ public:
+  using Callback = std::function<void()>;
+  using AcceptCallback = std::function<void(SocketHandle)>;
+
+  enum class Backend {
+    // io_uring when built in and the kernel has it (6.0+), else readiness.
+    kDefault,
+    // epoll (WSAPoll on Windows).
+    kEpoll,
+    // Throws when not built in or the kernel lacks it.
+    kIoUring,
+  };
+
+  explicit Reactor(Backend backend = Backend::kDefault);
+  ~Reactor();
+
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+
+  bool Add(SocketHandle socket, Callback on_readable);
+  // `pipe` is a PipeSocketHandler handle, which must be open for overlapped
+  // I/O on Windows (PipeSocketHandler::Connect and NamedPipeServer do that).
+  // On Linux this is the same as Add.
+  bool AddPipe(SocketHandle pipe, Callback on_readable);
+  // Accepts connections on `listen_socket` and hands each new socket to
+  // `on_accept`.
+  bool AddAcceptor(SocketHandle listen_socket, AcceptCallback on_accept);
+  void Remove(SocketHandle handle);
+  // Also runs `on_writable` whenever the added `socket` can take more data;
+  // nullptr stops that. Readiness is level-triggered, so clear it once there
+  // is nothing left to write.
+  bool SetWritable(SocketHandle socket, Callback on_writable);
+  // Stops (false) or resumes running the added `socket`'s read callback
+  // while leaving the data in the socket. A failed socket still runs it.
+  bool SetReading(SocketHandle socket, bool reading);
+
+  // Waits up to `timeout_ms` (-1 for no limit) for readiness, Wake() or the
+  // next timer, runs the callbacks of ready handles and due timers and
+  // returns how many ran.
+  int Poll(int timeout_ms);
+  // Runs `on_expired` on the polling thread once `delay_ms` has passed.
+  // Unlike registration, timers belong to the polling thread: add and cancel
+  // them only from its callbacks (or before it starts polling).
+  TimerWheel::TimerId AddTimer(int delay_ms, Callback on_expired);
+  bool CancelTimer(TimerWheel::TimerId id);
+  // Ends the current (or next) Poll early.
+  void Wake();
+
+  // kEpoll or kIoUring: the one in use.
+  Backend backend() const { return backend_; }
+
+ private:
+  struct Registration;
+  struct PipeWatch;
+
+  int PollHandles(int timeout_ms);
+  std::shared_ptr<Registration> Find(SocketHandle handle);
+  // Applies a changed SetWritable or SetReading. Called with mutex_ held.
+  bool Rearm(SocketHandle socket, const Registration& registration);
+  void DrainWake();
+  void WatchPipe(PipeWatch* watch);
+
+  std::mutex mutex_;
+  std::unordered_map<SocketHandle, std::shared_ptr<Registration>> registrations_;
+  TimerWheel timers_;
+  Backend backend_ = Backend::kEpoll;
+#ifdef UT_USE_IO_URING
+  std::unique_ptr<IoUringBackend> ring_;
+#endif
+#ifdef _WIN32
+  SocketHandle wake_socket_ = kInvalidSocket;
+#else
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+#endif
+};
+}
@@ -0,0 +1,66 @@
+#include "Reconnector.hpp"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+namespace ut {
+namespace {
+std::vector<std::string> SortedAddresses(const Reconnector::Endpoints& endpoints) {
+  std::vector<std::string> addresses;
+  for (const auto& endpoint : endpoints) {
+    addresses.push_back(endpoint.address);
+  }
+  std::sort(addresses.begin(), addresses.end());
+  return addresses;
+}
+
+void MoveToFront(Reconnector::Endpoints* endpoints, size_t index) {
+  std::rotate(endpoints->begin(), endpoints->begin() + static_cast<std::ptrdiff_t>(index),
+              endpoints->begin() + static_cast<std::ptrdiff_t>(index) + 1);
+}
+}
+
+Reconnector::Reconnector(ConnectFn connect, ResolveFn resolve, NowFn now)
+    : connect_(std::move(connect)), resolve_(std::move(resolve)), now_(std::move(now)) {}
+
+SocketHandle Reconnector::Connect() {
+  size_t index = 0;
+  if (!endpoints_.empty()) {
+    const SocketHandle socket = connect_(endpoints_, &index);
+    if (socket != kInvalidSocket) {
+      MoveToFront(&endpoints_, index);
+      backoff_.Reset();
+      return socket;
+    }
+  }
+  if (!ShouldResolve()) {
+    return kInvalidSocket;
+  }
+  // Nothing cached answered; the name may point somewhere else by now.
+  resolved_ = true;
+  network_changed_ = false;
+  last_resolve_ = now_();
+  auto resolved = resolve_();
+  if (resolved.empty() || (!endpoints_.empty() && SortedAddresses(resolved) == SortedAddresses(endpoints_))) {
+    return kInvalidSocket;
+  }
+  const SocketHandle socket = connect_(resolved, &index);
+  if (socket != kInvalidSocket) {
+    MoveToFront(&resolved, index);
+    endpoints_ = std::move(resolved);
+    backoff_.Reset();
+  }
+  return socket;
+}
+
+void Reconnector::NetworkChanged() {
+  network_changed_ = true;
+  backoff_.Reset();
+}
+
+bool Reconnector::ShouldResolve() const {
+  return !resolved_ || endpoints_.empty() || network_changed_ ||
+         now_() - last_resolve_ >= std::chrono::milliseconds(kResolveIntervalMs);
+}
+}
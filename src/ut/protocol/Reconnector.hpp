@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "Backoff.hpp"
+#include "TcpSocketHandler.hpp"
+
+namespace ut {
+// Where and when ClientConnection reconnects, apart from the handshake so it
+// can be driven with a fake resolver and clock. Connect() tries the
+// addresses that last worked, the one that answered first at the front, and
+// only resolves the name again when none answer and either the network has
+// changed (NetworkChanged) or kResolveIntervalMs has passed since the last
+// lookup. A lookup that returns the cached addresses is not tried twice.
+//
+// Not thread-safe; the reconnect thread owns it.
+class Reconnector {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Endpoints = std::vector<TcpSocketHandler::Endpoint>;
+  // Connects to the first of `endpoints` that answers and sets *index to it.
+  using ConnectFn = std::function<SocketHandle(const Endpoints& endpoints, size_t* index)>;
+  using ResolveFn = std::function<Endpoints()>;
+  using NowFn = std::function<Clock::time_point()>;
+
+  // Backoff between attempts after the immediate first retry.
+  static constexpr int kBaseDelayMs = 100;
+  static constexpr int kMaxDelayMs = 2000;
+  // How long a lookup stays good while the network is unchanged; the server
+  // may still have moved.
+  static constexpr int kResolveIntervalMs = 30000;
+
+  Reconnector(ConnectFn connect, ResolveFn resolve, NowFn now = Clock::now);
+
+  // One attempt; a connected socket also resets the backoff.
+  SocketHandle Connect();
+  // How long to wait before the next attempt.
+  int NextDelayMs() { return backoff_.NextDelayMs(); }
+  // The host's addresses or routes changed: the next attempt may resolve
+  // again, and the backoff starts over.
+  void NetworkChanged();
+
+  const Endpoints& endpoints() const { return endpoints_; }
+
+ private:
+  bool ShouldResolve() const;
+
+  ConnectFn connect_;
+  ResolveFn resolve_;
+  NowFn now_;
+  // The last resolution that connected, the address that answered first.
+  Endpoints endpoints_;
+  Backoff backoff_{kBaseDelayMs, kMaxDelayMs};
+  bool resolved_ = false;
+  bool network_changed_ = false;
+  Clock::time_point last_resolve_;
+};
+}
@@ -0,0 +1,254 @@
+#include "RingSocket.hpp"
+
+#ifdef UT_USE_IO_URING
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+
+namespace ut {
+namespace {
+constexpr int kBuckets = 64;
+
+// Sockets by descriptor, in buckets so connections on different shards
+// rarely share a lock.
+struct Bucket {
+  std::mutex mutex;
+  std::unordered_map<int, std::shared_ptr<RingSocket>> sockets;
+};
+
+Bucket& BucketFor(int fd) {
+  static Bucket buckets[kBuckets];
+  return buckets[fd % kBuckets];
+}
+}
+
+void RingSocket::Track(int fd) {
+  if (fd < 0) {
+    return;
+  }
+  Bucket& bucket = BucketFor(fd);
+  std::lock_guard<std::mutex> guard(bucket.mutex);
+  auto& socket = bucket.sockets[fd];
+  if (!socket) {
+    socket = std::make_shared<RingSocket>(fd);
+  }
+}
+
+std::shared_ptr<RingSocket> RingSocket::Find(int fd) {
+  if (fd < 0) {
+    return nullptr;
+  }
+  Bucket& bucket = BucketFor(fd);
+  std::lock_guard<std::mutex> guard(bucket.mutex);
+  auto it = bucket.sockets.find(fd);
+  return it == bucket.sockets.end() ? nullptr : it->second;
+}
+
+bool RingSocket::Close(int fd) {
+  std::shared_ptr<RingSocket> socket;
+  {
+    Bucket& bucket = BucketFor(fd);
+    std::lock_guard<std::mutex> guard(bucket.mutex);
+    auto it = bucket.sockets.find(fd);
+    if (it == bucket.sockets.end()) {
+      return false;
+    }
+    socket = std::move(it->second);
+    bucket.sockets.erase(it);
+  }
+  std::lock_guard<std::mutex> guard(socket->mutex_);
+  socket->closing_ = true;
+  socket->changed_.notify_all();
+  if (socket->owner_) {
+    // The owner closes it once its requests have ended.
+    socket->ScheduleLocked();
+    return true;
+  }
+  socket->FlushDirectLocked();
+  close(fd);
+  return true;
+}
+
+bool RingSocket::Read(void* buf, size_t count, int* rc) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (closing_) {
+    *rc = -1;
+    return true;
+  }
+  const size_t buffered = BufferedInputLocked();
+  if (buffered > 0) {
+    const size_t n = std::min(buffered, count);
+    std::memcpy(buf, inbox_.data() + inbox_pos_, n);
+    inbox_pos_ += n;
+    if (inbox_pos_ == inbox_.size()) {
+      inbox_.clear();
+      inbox_pos_ = 0;
+    }
+    if (owner_ && recv_token_ == 0 && WantsInputLocked()) {
+      ScheduleLocked();
+    }
+    *rc = static_cast<int>(n);
+    return true;
+  }
+  if (!owner_) {
+    return false;
+  }
+  if (eof_) {
+    *rc = 0;
+  } else if (error_ != 0) {
+    errno = error_;
+    *rc = -1;
+  } else {
+    *rc = SocketHandler::kWouldBlock;
+  }
+  return true;
+}
+
+bool RingSocket::Write(const SocketBuffer* buffers, size_t count, int* rc) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (owner_ && BufferedOutputLocked() >= kMaxOutboxBytes && owner_->Polling()) {
+    // Nothing else sends it while this thread is busy here.
+    Owner* owner = owner_;
+    lock.unlock();
+    owner->Flush(0);
+    lock.lock();
+  }
+  if (closing_) {
+    *rc = -1;
+    return true;
+  }
+  if (!owner_) {
+    if (BufferedOutputLocked() == 0) {
+      return false;
+    }
+    // What an earlier owner left goes first.
+    if (!FlushDirectLocked()) {
+      *rc = SocketHandler::kWouldBlock;
+      return true;
+    }
+    return false;
+  }
+  if (error_ != 0) {
+    errno = error_;
+    *rc = -1;
+    return true;
+  }
+  const size_t pending = BufferedOutputLocked();
+  size_t room = pending < kMaxOutboxBytes ? kMaxOutboxBytes - pending : 0;
+  if (room == 0) {
+    *rc = SocketHandler::kWouldBlock;
+    return true;
+  }
+  size_t appended = 0;
+  for (size_t i = 0; i < count && room > 0; ++i) {
+    const size_t n = std::min(buffers[i].size, room);
+    outbox_.append(static_cast<const char*>(buffers[i].data), n);
+    appended += n;
+    room -= n;
+  }
+  if (send_token_ == 0 && appended > 0) {
+    ScheduleLocked();
+  }
+  *rc = static_cast<int>(appended);
+  return true;
+}
+
+bool RingSocket::HasData(bool* has_data) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (BufferedInputLocked() > 0 || eof_ || error_ != 0) {
+    *has_data = true;
+    return true;
+  }
+  if (!owner_) {
+    return false;
+  }
+  *has_data = false;
+  return true;
+}
+
+bool RingSocket::WaitForData(int timeout_ms, bool* has_data) {
+  using Clock = std::chrono::steady_clock;
+  const auto deadline = Clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0));
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    if (BufferedInputLocked() > 0 || eof_ || error_ != 0 || closing_) {
+      *has_data = true;
+      return true;
+    }
+    if (!owner_) {
+      return false;
+    }
+    int remaining_ms = -1;
+    if (timeout_ms >= 0) {
+      const auto now = Clock::now();
+      if (now >= deadline) {
+        *has_data = false;
+        return true;
+      }
+      remaining_ms = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count());
+    }
+    if (owner_->Polling()) {
+      // The input only arrives once this thread reaps it.
+      Owner* owner = owner_;
+      lock.unlock();
+      owner->Flush(remaining_ms);
+      lock.lock();
+    } else if (timeout_ms < 0) {
+      changed_.wait(lock);
+    } else {
+      changed_.wait_until(lock, deadline);
+    }
+  }
+}
+
+void RingSocket::ReceiveLocked(const char* data, size_t size) {
+  if (inbox_pos_ > 0 && inbox_pos_ >= inbox_.size() / 2) {
+    inbox_.erase(0, inbox_pos_);
+    inbox_pos_ = 0;
+  }
+  inbox_.append(data, size);
+  changed_.notify_all();
+}
+
+void RingSocket::ScheduleLocked() {
+  if (owner_ && queued_on_ != owner_) {
+    queued_on_ = owner_;
+    owner_->Schedule(shared_from_this());
+  }
+}
+
+bool RingSocket::FlushDirectLocked() {
+  while (error_ == 0) {
+    if (sent_ == sending_.size()) {
+      sending_.clear();
+      sent_ = 0;
+      if (outbox_.empty()) {
+        return true;
+      }
+      sending_.swap(outbox_);
+    }
+    const ssize_t rc = send(fd_, sending_.data() + sent_, sending_.size() - sent_, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (rc < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return false;
+      }
+      if (errno != EINTR) {
+        error_ = errno;
+      }
+      continue;
+    }
+    sent_ += static_cast<size_t>(rc);
+  }
+  // Nothing more can go out.
+  outbox_.clear();
+  sending_.clear();
+  sent_ = 0;
+  return true;
+}
+}
+#endif
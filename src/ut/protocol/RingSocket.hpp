@@ -0,0 +1,108 @@
+#pragma once
+
+#ifdef UT_USE_IO_URING
+#include <cstddef>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "SocketHandler.hpp"
+
+namespace ut {
+// A socket TcpSocketHandler readied for a reactor (PrepareForReactor) in an
+// io_uring build. While an io_uring reactor owns it, the reactor keeps a
+// multishot receive running into the inbox and sends the outbox along with
+// its next wait, so Read and Write only copy bytes. Without an owner they
+// fall through to the socket itself, after whatever is still buffered.
+//
+// A socket added to a second reactor is handed over once the first has
+// cancelled its requests, so one ring at a time reads and writes it.
+class RingSocket : public std::enable_shared_from_this<RingSocket> {
+ public:
+  // The reactor side. Called with the socket's mutex held.
+  class Owner {
+   public:
+    virtual ~Owner() = default;
+    // Has the owner look at `socket` before its next wait: arm a receive,
+    // send the outbox, finish a handover or a close.
+    virtual void Schedule(std::shared_ptr<RingSocket> socket) = 0;
+    // True on the thread polling the owner.
+    virtual bool Polling() const = 0;
+    // Submits and reaps now, waiting up to `timeout_ms` for a completion,
+    // for a polling thread that has to wait on the socket. Called without
+    // the socket's mutex.
+    virtual void Flush(int timeout_ms) = 0;
+  };
+
+  // Write reports kWouldBlock once this much output is buffered.
+  static constexpr size_t kMaxOutboxBytes = 256 * 1024;
+  // The write callback runs while less than this is buffered.
+  static constexpr size_t kWritableBytes = 64 * 1024;
+  // The receive stops while this much input waits to be read.
+  static constexpr size_t kMaxInboxBytes = 256 * 1024;
+
+  explicit RingSocket(int fd) : fd_(fd) {}
+
+  // Starts tracking `fd`; a no-op when it already is.
+  static void Track(int fd);
+  static std::shared_ptr<RingSocket> Find(int fd);
+  // Stops tracking `fd` and closes it, after the output its owner still
+  // holds. False when `fd` was not tracked.
+  static bool Close(int fd);
+
+  // Each returns false when the call should go straight to the socket: no
+  // reactor owns it and nothing is buffered.
+  bool Read(void* buf, size_t count, int* rc);
+  bool Write(const SocketBuffer* buffers, size_t count, int* rc);
+  bool HasData(bool* has_data);
+  bool WaitForData(int timeout_ms, bool* has_data);
+
+  int fd() const { return fd_; }
+
+ private:
+  friend class IoUringBackend;
+
+  size_t BufferedInputLocked() const { return inbox_.size() - inbox_pos_; }
+  size_t BufferedOutputLocked() const { return outbox_.size() + sending_.size() - sent_; }
+  // Appends what a receive completed.
+  void ReceiveLocked(const char* data, size_t size);
+  // Whether the owner should keep a receive running.
+  bool WantsInputLocked() const {
+    return !eof_ && error_ == 0 && !closing_ && !release_ && BufferedInputLocked() < kMaxInboxBytes;
+  }
+  void ScheduleLocked();
+  // Sends buffered output directly; true once none is left.
+  bool FlushDirectLocked();
+
+  const int fd_;
+  std::mutex mutex_;
+  // Signalled when input arrives, the socket fails or loses its owner.
+  std::condition_variable changed_;
+  std::string inbox_;
+  size_t inbox_pos_ = 0;
+  // Written but not yet handed to the kernel.
+  std::string outbox_;
+  // In flight; `sent_` bytes of it have gone.
+  std::string sending_;
+  size_t sent_ = 0;
+  // errno of a failed receive or send.
+  int error_ = 0;
+  bool eof_ = false;
+  bool closing_ = false;
+
+  Owner* owner_ = nullptr;
+  // The owner gives the socket up, to `handoff_` (or nobody) after Remove
+  // or another reactor's Add.
+  bool release_ = false;
+  Owner* handoff_ = nullptr;
+  // The owner whose queue already holds the socket.
+  Owner* queued_on_ = nullptr;
+  // The owner's requests; 0 when none is in flight.
+  uint64_t recv_token_ = 0;
+  uint64_t send_token_ = 0;
+  bool recv_cancelled_ = false;
+};
+}
+#endif
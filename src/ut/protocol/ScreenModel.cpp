@@ -0,0 +1,953 @@
+#include "ScreenModel.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace ut {
+namespace {
+constexpr size_t kMaxParams = 32;
+constexpr int kMaxParamValue = 65535;
+constexpr char32_t kReplacement = 0xFFFD;
+// Cursor-key mode, mouse reporting and encodings, focus events and
+// bracketed paste: the input side of the terminal, which a repaint must
+// leave as the program set it.
+constexpr int kTrackedModes[] = {1, 1000, 1002, 1003, 1004, 1005, 1006, 1015, 2004};
+
+// Combining marks and zero-width characters; the model drops them rather
+// than giving them a cell.
+bool IsZeroWidth(char32_t ch) {
+  return (ch >= 0x0300 && ch <= 0x036F) || (ch >= 0x200B && ch <= 0x200F) || (ch >= 0x20D0 && ch <= 0x20FF) ||
+         (ch >= 0xFE00 && ch <= 0xFE0F);
+}
+
+void AppendNumber(int value, std::string* out) {
+  *out += std::to_string(value);
+}
+
+void AppendColor(uint32_t color, bool background, uint32_t palette, uint32_t true_color, std::string* out) {
+  if (color == 0) {
+    return;
+  }
+  if ((color & 0xff000000u) == true_color) {
+    *out += background ? ";48;2;" : ";38;2;";
+    AppendNumber(static_cast<int>((color >> 16) & 0xff), out);
+    *out += ';';
+    AppendNumber(static_cast<int>((color >> 8) & 0xff), out);
+    *out += ';';
+    AppendNumber(static_cast<int>(color & 0xff), out);
+    return;
+  }
+  if ((color & 0xff000000u) != palette) {
+    return;
+  }
+  const int index = static_cast<int>(color & 0xff);
+  *out += ';';
+  if (index < 8) {
+    AppendNumber((background ? 40 : 30) + index, out);
+  } else if (index < 16) {
+    AppendNumber((background ? 100 : 90) + index - 8, out);
+  } else {
+    *out += background ? "48;5;" : "38;5;";
+    AppendNumber(index, out);
+  }
+}
+}
+
+ScreenModel::ScreenModel(int width, int height, size_t scrollback_lines)
+    : width_(std::max(width, 1)), height_(std::max(height, 1)), scrollback_limit_(scrollback_lines) {
+  main_rows_.assign(static_cast<size_t>(height_), BlankRow());
+  alternate_rows_.assign(static_cast<size_t>(height_), BlankRow());
+  scroll_bottom_ = height_ - 1;
+}
+
+void ScreenModel::Feed(std::string_view bytes) {
+  for (char byte : bytes) {
+    Step(static_cast<unsigned char>(byte));
+  }
+}
+
+void ScreenModel::Step(unsigned char byte) {
+  switch (state_) {
+    case State::kGround:
+      if (utf8_remaining_ > 0) {
+        if ((byte & 0xC0) == 0x80) {
+          utf8_codepoint_ = (utf8_codepoint_ << 6) | (byte & 0x3F);
+          if (--utf8_remaining_ == 0) {
+            Print(utf8_codepoint_);
+          }
+          return;
+        }
+        // A truncated sequence; the byte that cut it short still counts.
+        utf8_remaining_ = 0;
+        Print(kReplacement);
+      }
+      if (byte < 0x20 || byte == 0x7F) {
+        Control(byte);
+      } else if (byte < 0x80) {
+        Print(byte);
+      } else if ((byte & 0xE0) == 0xC0) {
+        utf8_codepoint_ = byte & 0x1F;
+        utf8_remaining_ = 1;
+      } else if ((byte & 0xF0) == 0xE0) {
+        utf8_codepoint_ = byte & 0x0F;
+        utf8_remaining_ = 2;
+      } else if ((byte & 0xF8) == 0xF0) {
+        utf8_codepoint_ = byte & 0x07;
+        utf8_remaining_ = 3;
+      } else {
+        Print(kReplacement);
+      }
+      return;
+    case State::kEscape:
+      if (byte == '[') {
+        state_ = State::kCsi;
+        params_.clear();
+        param_started_ = false;
+        private_marker_ = 0;
+      } else if (byte == ']' || byte == 'P' || byte == '_' || byte == '^' || byte == 'X') {
+        state_ = State::kString;
+      } else if (byte >= 0x20 && byte <= 0x2F) {
+        state_ = State::kEscapeIntermediate;
+      } else if (byte < 0x20) {
+        Control(byte);
+      } else {
+        state_ = State::kGround;
+        EscapeDispatch(byte);
+      }
+      return;
+    case State::kEscapeIntermediate:
+      if (byte < 0x20) {
+        Control(byte);
+      } else if (byte >= 0x30) {
+        state_ = State::kGround;
+      }
+      return;
+    case State::kCsi:
+      if (byte >= '0' && byte <= '9') {
+        if (!param_started_) {
+          if (params_.size() >= kMaxParams) {
+            return;
+          }
+          params_.push_back(0);
+          param_started_ = true;
+        }
+        params_.back() = std::min(params_.back() * 10 + (byte - '0'), kMaxParamValue);
+      } else if (byte == ';' || byte == ':') {
+        if (!param_started_ && params_.size() < kMaxParams) {
+          params_.push_back(0);
+        }
+        param_started_ = false;
+      } else if (byte >= 0x3C && byte <= 0x3F) {
+        private_marker_ = static_cast<char>(byte);
+      } else if (byte >= 0x40 && byte <= 0x7E) {
+        state_ = State::kGround;
+        CsiDispatch(byte);
+      } else if (byte < 0x20) {
+        Control(byte);
+      }
+      return;
+    case State::kString:
+      if (byte == 0x07 || byte == 0x18 || byte == 0x1A) {
+        state_ = State::kGround;
+      } else if (byte == 0x1B) {
+        state_ = State::kStringEscape;
+      }
+      return;
+    case State::kStringEscape:
+      if (byte == '\\') {
+        state_ = State::kGround;
+        return;
+      }
+      // ESC inside a string ends it and starts a new sequence.
+      state_ = State::kEscape;
+      Step(byte);
+      return;
+  }
+}
+
+void ScreenModel::Print(char32_t ch) {
+  if (IsZeroWidth(ch)) {
+    return;
+  }
+  const int cells = IsWide(ch) && width_ >= 2 ? 2 : 1;
+  if (wrap_pending_) {
+    wrap_pending_ = false;
+    cursor_col_ = 0;
+    LineFeed();
+  }
+  if (cells == 2 && cursor_col_ == width_ - 1) {
+    if (autowrap_) {
+      EraseCells(cursor_row_, cursor_col_, width_);
+      cursor_col_ = 0;
+      LineFeed();
+    } else {
+      cursor_col_ = width_ - 2;
+    }
+  }
+  Row& row = screen()[static_cast<size_t>(cursor_row_)];
+  // Overwriting either half of a wide character blanks the other half.
+  if (row[static_cast<size_t>(cursor_col_)].ch == 0 && cursor_col_ > 0) {
+    row[static_cast<size_t>(cursor_col_ - 1)].ch = U' ';
+  }
+  if (cursor_col_ + cells < width_ && row[static_cast<size_t>(cursor_col_ + cells)].ch == 0) {
+    row[static_cast<size_t>(cursor_col_ + cells)].ch = U' ';
+  }
+  row[static_cast<size_t>(cursor_col_)] = Cell{ch, attr_};
+  if (cells == 2) {
+    row[static_cast<size_t>(cursor_col_ + 1)] = Cell{0, attr_};
+  }
+  if (cursor_col_ + cells >= width_) {
+    cursor_col_ = width_ - 1;
+    wrap_pending_ = autowrap_;
+  } else {
+    cursor_col_ += cells;
+  }
+}
+
+void ScreenModel::Control(unsigned char byte) {
+  switch (byte) {
+    case 0x08:
+      if (cursor_col_ > 0) {
+        cursor_col_--;
+      }
+      wrap_pending_ = false;
+      break;
+    case 0x09:
+      cursor_col_ = std::min(width_ - 1, (cursor_col_ / 8 + 1) * 8);
+      wrap_pending_ = false;
+      break;
+    case 0x0A:
+    case 0x0B:
+    case 0x0C:
+      LineFeed();
+      break;
+    case 0x0D:
+      cursor_col_ = 0;
+      wrap_pending_ = false;
+      break;
+    case 0x18:
+    case 0x1A:
+      state_ = State::kGround;
+      break;
+    case 0x1B:
+      state_ = State::kEscape;
+      break;
+    default:
+      break;
+  }
+}
+
+void ScreenModel::EscapeDispatch(unsigned char final_byte) {
+  switch (final_byte) {
+    case '7':
+      saved_ = Cursor{cursor_row_, cursor_col_, attr_};
+      break;
+    case '8':
+      MoveCursor(saved_.row, saved_.col);
+      attr_ = saved_.attr;
+      break;
+    case 'D':
+      LineFeed();
+      break;
+    case 'E':
+      cursor_col_ = 0;
+      LineFeed();
+      break;
+    case 'M':
+      ReverseIndex();
+      break;
+    case 'c':
+      Reset();
+      break;
+    default:
+      break;
+  }
+}
+
+void ScreenModel::CsiDispatch(unsigned char final_byte) {
+  if (private_marker_ == '?') {
+    if (final_byte == 'h' || final_byte == 'l') {
+      SetMode(final_byte == 'h');
+    }
+    return;
+  }
+  if (private_marker_ != 0) {
+    return;
+  }
+  const int n = Param(0, 1);
+  switch (final_byte) {
+    case 'A':
+      MoveCursor(cursor_row_ - n, cursor_col_);
+      break;
+    case 'B':
+    case 'e':
+      MoveCursor(cursor_row_ + n, cursor_col_);
+      break;
+    case 'C':
+    case 'a':
+      MoveCursor(cursor_row_, cursor_col_ + n);
+      break;
+    case 'D':
+      MoveCursor(cursor_row_, cursor_col_ - n);
+      break;
+    case 'E':
+      MoveCursor(cursor_row_ + n, 0);
+      break;
+    case 'F':
+      MoveCursor(cursor_row_ - n, 0);
+      break;
+    case 'G':
+    case '`':
+      MoveCursor(cursor_row_, n - 1);
+      break;
+    case 'H':
+    case 'f':
+      MoveCursor(Param(0, 1) - 1, Param(1, 1) - 1);
+      break;
+    case 'd':
+      MoveCursor(n - 1, cursor_col_);
+      break;
+    case 'J':
+      EraseInDisplay(Param(0, 0));
+      break;
+    case 'K':
+      EraseInLine(Param(0, 0));
+      break;
+    case 'L':
+      InsertLines(n);
+      break;
+    case 'M':
+      DeleteLines(n);
+      break;
+    case '@':
+      InsertChars(n);
+      break;
+    case 'P':
+      DeleteChars(n);
+      break;
+    case 'X':
+      EraseCells(cursor_row_, cursor_col_, cursor_col_ + n);
+      wrap_pending_ = false;
+      break;
+    case 'S':
+      ScrollUp(n);
+      break;
+    case 'T':
+      ScrollDown(n);
+      break;
+    case 'm':
+      SelectGraphicRendition();
+      break;
+    case 'r': {
+      const int top = Param(0, 1) - 1;
+      const int bottom = std::min(Param(1, height_), height_) - 1;
+      if (top < bottom) {
+        scroll_top_ = top;
+        scroll_bottom_ = bottom;
+        MoveCursor(0, 0);
+      }
+      break;
+    }
+    case 's':
+      saved_ = Cursor{cursor_row_, cursor_col_, attr_};
+      break;
+    case 'u':
+      MoveCursor(saved_.row, saved_.col);
+      attr_ = saved_.attr;
+      break;
+    default:
+      break;
+  }
+}
+
+void ScreenModel::SelectGraphicRendition() {
+  if (params_.empty()) {
+    attr_ = Attr{};
+    return;
+  }
+  for (size_t i = 0; i < params_.size(); ++i) {
+    const int p = params_[i];
+    if (p == 0) {
+      attr_ = Attr{};
+    } else if (p >= 1 && p <= 9) {
+      static constexpr uint8_t kFlags[] = {0,        kBold,  kDim,    kItalic, kUnderline,
+                                           kBlink,   kBlink, kInverse, kHidden, kStrike};
+      attr_.flags |= kFlags[p];
+    } else if (p == 21) {
+      attr_.flags |= kUnderline;
+    } else if (p == 22) {
+      attr_.flags &= static_cast<uint8_t>(~(kBold | kDim));
+    } else if (p >= 23 && p <= 29 && p != 26) {
+      static constexpr uint8_t kOff[] = {kItalic, kUnderline, kBlink, 0, kInverse, kHidden, kStrike};
+      attr_.flags &= static_cast<uint8_t>(~kOff[p - 23]);
+    } else if ((p >= 30 && p <= 37) || (p >= 90 && p <= 97)) {
+      attr_.fg = kPalette | static_cast<uint32_t>(p >= 90 ? p - 90 + 8 : p - 30);
+    } else if ((p >= 40 && p <= 47) || (p >= 100 && p <= 107)) {
+      attr_.bg = kPalette | static_cast<uint32_t>(p >= 100 ? p - 100 + 8 : p - 40);
+    } else if (p == 39) {
+      attr_.fg = 0;
+    } else if (p == 49) {
+      attr_.bg = 0;
+    } else if (p == 38 || p == 48) {
+      uint32_t color = 0;
+      if (i + 2 < params_.size() && params_[i + 1] == 5) {
+        color = kPalette | static_cast<uint32_t>(params_[i + 2] & 0xff);
+        i += 2;
+      } else if (i + 4 < params_.size() && params_[i + 1] == 2) {
+        color = kTrueColor | static_cast<uint32_t>((params_[i + 2] & 0xff) << 16) |
+                static_cast<uint32_t>((params_[i + 3] & 0xff) << 8) | static_cast<uint32_t>(params_[i + 4] & 0xff);
+        i += 4;
+      } else {
+        return;
+      }
+      (p == 38 ? attr_.fg : attr_.bg) = color;
+    }
+  }
+}
+
+void ScreenModel::SetMode(bool enable) {
+  for (int mode : params_) {
+    switch (mode) {
+      case 7:
+        autowrap_ = enable;
+        if (!enable) {
+          wrap_pending_ = false;
+        }
+        break;
+      case 25:
+        cursor_visible_ = enable;
+        break;
+      case 47:
+      case 1047:
+        SetAlternateScreen(enable);
+        break;
+      case 1049:
+        if (enable) {
+          saved_main_ = Cursor{cursor_row_, cursor_col_, attr_};
+          SetAlternateScreen(true);
+        } else {
+          SetAlternateScreen(false);
+          MoveCursor(saved_main_.row, saved_main_.col);
+          attr_ = saved_main_.attr;
+        }
+        break;
+      default:
+        for (size_t i = 0; i < std::size(kTrackedModes); ++i) {
+          if (kTrackedModes[i] == mode) {
+            const auto bit = static_cast<uint16_t>(1u << i);
+            modes_ = enable ? static_cast<uint16_t>(modes_ | bit) : static_cast<uint16_t>(modes_ & ~bit);
+          }
+        }
+        break;
+    }
+  }
+}
+
+void ScreenModel::LineFeed() {
+  wrap_pending_ = false;
+  if (cursor_row_ == scroll_bottom_) {
+    ScrollUp(1);
+  } else if (cursor_row_ < height_ - 1) {
+    cursor_row_++;
+  }
+}
+
+void ScreenModel::ReverseIndex() {
+  wrap_pending_ = false;
+  if (cursor_row_ == scroll_top_) {
+    ScrollDown(1);
+  } else if (cursor_row_ > 0) {
+    cursor_row_--;
+  }
+}
+
+void ScreenModel::ScrollUp(int count) {
+  const int lines = std::min(std::max(count, 1), scroll_bottom_ - scroll_top_ + 1);
+  auto& rows = screen();
+  std::rotate(rows.begin() + scroll_top_, rows.begin() + scroll_top_ + lines, rows.begin() + scroll_bottom_ + 1);
+  if (!alternate_ && scroll_top_ == 0 && scroll_bottom_ == height_ - 1) {
+    scrolled_lines_ += static_cast<uint64_t>(lines);
+  }
+  // Only lines leaving the top of the whole main screen enter the scrollback.
+  const bool keep = !alternate_ && scroll_top_ == 0 && scrollback_limit_ > 0;
+  for (int i = scroll_bottom_ - lines + 1; i <= scroll_bottom_; ++i) {
+    Row& row = rows[static_cast<size_t>(i)];
+    if (keep) {
+      if (scrollback_.size() >= scrollback_limit_) {
+        // Recycle the oldest line's storage for the new blank one.
+        Row recycled = std::move(scrollback_.front());
+        scrollback_.pop_front();
+        scrollback_.push_back(std::move(row));
+        row = std::move(recycled);
+      } else {
+        scrollback_.push_back(row);
+      }
+    }
+    row.assign(static_cast<size_t>(width_), Blank());
+  }
+}
+
+void ScreenModel::ScrollDown(int count) {
+  const int lines = std::min(std::max(count, 1), scroll_bottom_ - scroll_top_ + 1);
+  auto& rows = screen();
+  std::rotate(rows.begin() + scroll_top_, rows.begin() + scroll_bottom_ + 1 - lines, rows.begin() + scroll_bottom_ + 1);
+  for (int i = scroll_top_; i < scroll_top_ + lines; ++i) {
+    rows[static_cast<size_t>(i)].assign(static_cast<size_t>(width_), Blank());
+  }
+}
+
+void ScreenModel::EraseInDisplay(int mode) {
+  auto& rows = screen();
+  if (mode == 0) {
+    EraseInLine(0);
+    for (int i = cursor_row_ + 1; i < height_; ++i) {
+      rows[static_cast<size_t>(i)].assign(static_cast<size_t>(width_), Blank());
+    }
+  } else if (mode == 1) {
+    for (int i = 0; i < cursor_row_; ++i) {
+      rows[static_cast<size_t>(i)].assign(static_cast<size_t>(width_), Blank());
+    }
+    EraseInLine(1);
+  } else if (mode == 2) {
+    for (auto& row : rows) {
+      row.assign(static_cast<size_t>(width_), Blank());
+    }
+  } else if (mode == 3) {
+    scrollback_.clear();
+  }
+}
+
+void ScreenModel::EraseInLine(int mode) {
+  if (mode == 0) {
+    EraseCells(cursor_row_, cursor_col_, width_);
+  } else if (mode == 1) {
+    EraseCells(cursor_row_, 0, cursor_col_ + 1);
+  } else if (mode == 2) {
+    EraseCells(cursor_row_, 0, width_);
+  }
+}
+
+void ScreenModel::EraseCells(int row, int from, int to) {
+  from = std::max(from, 0);
+  to = std::min(to, width_);
+  Row& cells = screen()[static_cast<size_t>(row)];
+  for (int i = from; i < to; ++i) {
+    cells[static_cast<size_t>(i)] = Blank();
+  }
+  // Never leave half of a wide character behind.
+  if (from > 0 && from < width_ && cells[static_cast<size_t>(from)].ch != 0 &&
+      cells[static_cast<size_t>(from - 1)].ch != 0 && IsWide(cells[static_cast<size_t>(from - 1)].ch)) {
+    cells[static_cast<size_t>(from - 1)].ch = U' ';
+  }
+  if (to < width_ && cells[static_cast<size_t>(to)].ch == 0) {
+    cells[static_cast<size_t>(to)].ch = U' ';
+  }
+}
+
+void ScreenModel::InsertLines(int count) {
+  if (cursor_row_ < scroll_top_ || cursor_row_ > scroll_bottom_) {
+    return;
+  }
+  const int lines = std::min(std::max(count, 1), scroll_bottom_ - cursor_row_ + 1);
+  auto& rows = screen();
+  std::rotate(rows.begin() + cursor_row_, rows.begin() + scroll_bottom_ + 1 - lines, rows.begin() + scroll_bottom_ + 1);
+  for (int i = cursor_row_; i < cursor_row_ + lines; ++i) {
+    rows[static_cast<size_t>(i)].assign(static_cast<size_t>(width_), Blank());
+  }
+  cursor_col_ = 0;
+  wrap_pending_ = false;
+}
+
+void ScreenModel::DeleteLines(int count) {
+  if (cursor_row_ < scroll_top_ || cursor_row_ > scroll_bottom_) {
+    return;
+  }
+  const int lines = std::min(std::max(count, 1), scroll_bottom_ - cursor_row_ + 1);
+  auto& rows = screen();
+  std::rotate(rows.begin() + cursor_row_, rows.begin() + cursor_row_ + lines, rows.begin() + scroll_bottom_ + 1);
+  for (int i = scroll_bottom_ - lines + 1; i <= scroll_bottom_; ++i) {
+    rows[static_cast<size_t>(i)].assign(static_cast<size_t>(width_), Blank());
+  }
+  cursor_col_ = 0;
+  wrap_pending_ = false;
+}
+
+void ScreenModel::InsertChars(int count) {
+  const int cells = std::min(std::max(count, 1), width_ - cursor_col_);
+  Row& row = screen()[static_cast<size_t>(cursor_row_)];
+  std::rotate(row.begin() + cursor_col_, row.end() - cells, row.end());
+  EraseCells(cursor_row_, cursor_col_, cursor_col_ + cells);
+  wrap_pending_ = false;
+}
+
+void ScreenModel::DeleteChars(int count) {
+  const int cells = std::min(std::max(count, 1), width_ - cursor_col_);
+  Row& row = screen()[static_cast<size_t>(cursor_row_)];
+  std::rotate(row.begin() + cursor_col_, row.begin() + cursor_col_ + cells, row.end());
+  EraseCells(cursor_row_, width_ - cells, width_);
+  wrap_pending_ = false;
+}
+
+void ScreenModel::MoveCursor(int row, int col) {
+  cursor_row_ = std::min(std::max(row, 0), height_ - 1);
+  cursor_col_ = std::min(std::max(col, 0), width_ - 1);
+  wrap_pending_ = false;
+}
+
+void ScreenModel::SetAlternateScreen(bool enable) {
+  if (enable == alternate_) {
+    return;
+  }
+  alternate_ = enable;
+  if (enable) {
+    for (auto& row : alternate_rows_) {
+      row.assign(static_cast<size_t>(width_), Blank());
+    }
+  }
+  wrap_pending_ = false;
+}
+
+void ScreenModel::Reset() {
+  attr_ = Attr{};
+  alternate_ = false;
+  for (auto& row : main_rows_) {
+    row.assign(static_cast<size_t>(width_), Cell{});
+  }
+  for (auto& row : alternate_rows_) {
+    row.assign(static_cast<size_t>(width_), Cell{});
+  }
+  cursor_row_ = 0;
+  cursor_col_ = 0;
+  wrap_pending_ = false;
+  saved_ = Cursor{};
+  saved_main_ = Cursor{};
+  scroll_top_ = 0;
+  scroll_bottom_ = height_ - 1;
+  autowrap_ = true;
+  cursor_visible_ = true;
+  modes_ = 0;
+}
+
+void ScreenModel::Resize(int width, int height) {
+  width = std::max(width, 1);
+  height = std::max(height, 1);
+  if (width == width_ && height == height_) {
+    return;
+  }
+  // Shrinking pushes lines off the top (into the scrollback on the main
+  // screen) so the cursor's line stays visible.
+  const int drop = std::max(0, cursor_row_ - (height - 1));
+  auto& active = screen();
+  for (int i = 0; i < drop; ++i) {
+    if (!alternate_ && scrollback_limit_ > 0) {
+      scrollback_.push_back(std::move(active[static_cast<size_t>(i)]));
+      if (scrollback_.size() > scrollback_limit_) {
+        scrollback_.pop_front();
+      }
+    }
+  }
+  active.erase(active.begin(), active.begin() + drop);
+  cursor_row_ -= drop;
+  const Row blank(static_cast<size_t>(width), Cell{});
+  for (auto* rows : {&main_rows_, &alternate_rows_}) {
+    rows->resize(static_cast<size_t>(height), blank);
+    for (auto& row : *rows) {
+      row.resize(static_cast<size_t>(width), Cell{});
+      if (row[static_cast<size_t>(width - 1)].ch != 0 && IsWide(row[static_cast<size_t>(width - 1)].ch)) {
+        row[static_cast<size_t>(width - 1)].ch = U' ';
+      }
+    }
+  }
+  width_ = width;
+  height_ = height;
+  scroll_top_ = 0;
+  scroll_bottom_ = height_ - 1;
+  MoveCursor(cursor_row_, cursor_col_);
+  saved_.row = std::min(saved_.row, height_ - 1);
+  saved_.col = std::min(saved_.col, width_ - 1);
+  saved_main_.row = std::min(saved_main_.row, height_ - 1);
+  saved_main_.col = std::min(saved_main_.col, width_ - 1);
+}
+
+std::string ScreenModel::Snapshot() const {
+  std::string out;
+  out.reserve(static_cast<size_t>(width_ + 16) * (scrollback_.size() + static_cast<size_t>(height_)));
+  // Leave any alternate screen, reset attributes and margins, clear.
+  out += "\x1b[?1049l\x1b[r\x1b[0m\x1b[H\x1b[2J";
+  Attr current;
+  bool first = true;
+  auto emit_line = [&](const Row& row) {
+    if (!first) {
+      if (current.bg != 0) {
+        // A scrolled-in line would take the background colour.
+        out += "\x1b[0m";
+        current = Attr{};
+      }
+      out += "\r\n";
+    }
+    first = false;
+    AppendRow(row, &current, &out);
+  };
+  // The scrollback tail scrolls into the terminal's history; the main
+  // screen ends up as the visible rows.
+  for (const auto& row : scrollback_) {
+    emit_line(row);
+  }
+  for (const auto& row : main_rows_) {
+    emit_line(row);
+  }
+  if (alternate_) {
+    out += "\x1b[0m\x1b[?1049h\x1b[H\x1b[2J";
+    current = Attr{};
+    for (int i = 0; i < height_; ++i) {
+      out += "\x1b[";
+      AppendNumber(i + 1, &out);
+      out += ";1H";
+      AppendRow(alternate_rows_[static_cast<size_t>(i)], &current, &out);
+    }
+  }
+  if (scroll_top_ != 0 || scroll_bottom_ != height_ - 1) {
+    out += "\x1b[";
+    AppendNumber(scroll_top_ + 1, &out);
+    out += ';';
+    AppendNumber(scroll_bottom_ + 1, &out);
+    out += 'r';
+  }
+  out += "\x1b[";
+  AppendNumber(cursor_row_ + 1, &out);
+  out += ';';
+  AppendNumber(cursor_col_ + 1, &out);
+  out += 'H';
+  AppendAttr(attr_, &out);
+  if (!autowrap_) {
+    out += "\x1b[?7l";
+  }
+  out += cursor_visible_ ? "\x1b[?25h" : "\x1b[?25l";
+  AppendModes(0, modes_, &out);
+  return out;
+}
+
+ScreenModel::Frame ScreenModel::CaptureFrame() const {
+  Frame frame;
+  frame.width = width_;
+  frame.height = height_;
+  frame.rows = screen();
+  frame.alternate = alternate_;
+  frame.autowrap = autowrap_;
+  frame.cursor_visible = cursor_visible_;
+  frame.modes = modes_;
+  frame.scrolled_lines = scrolled_lines_;
+  return frame;
+}
+
+std::string ScreenModel::Diff(Frame* from) const {
+  std::string out = "\x1b[0m";
+  if (from->width != width_ || from->height != height_ || from->alternate != alternate_) {
+    if (from->alternate != alternate_) {
+      out += alternate_ ? "\x1b[?1049h" : "\x1b[?1049l";
+    }
+    out += "\x1b[r\x1b[H\x1b[2J";
+    from->width = width_;
+    from->height = height_;
+    from->alternate = alternate_;
+    from->rows.assign(static_cast<size_t>(height_), Row(static_cast<size_t>(width_), Cell{}));
+  } else if (!alternate_ && scrolled_lines_ > from->scrolled_lines) {
+    // Scroll the terminal too, so lines that only moved are not redrawn and
+    // the ones leaving the top still reach its scrollback.
+    const int lines = static_cast<int>(std::min<uint64_t>(scrolled_lines_ - from->scrolled_lines,
+                                                          static_cast<uint64_t>(height_)));
+    out += "\x1b[r\x1b[";
+    AppendNumber(height_, &out);
+    out += "H";
+    out.append(static_cast<size_t>(lines), '\n');
+    std::rotate(from->rows.begin(), from->rows.begin() + lines, from->rows.end());
+    for (int i = height_ - lines; i < height_; ++i) {
+      from->rows[static_cast<size_t>(i)].assign(static_cast<size_t>(width_), Cell{});
+    }
+  }
+  from->scrolled_lines = scrolled_lines_;
+
+  Attr current;
+  const Cell blank;
+  for (int i = 0; i < height_; ++i) {
+    const Row& now = screen()[static_cast<size_t>(i)];
+    Row& was = from->rows[static_cast<size_t>(i)];
+    int first = 0;
+    while (first < width_ && now[static_cast<size_t>(first)] == was[static_cast<size_t>(first)]) {
+      first++;
+    }
+    if (first == width_) {
+      continue;
+    }
+    int last = width_ - 1;
+    while (now[static_cast<size_t>(last)] == was[static_cast<size_t>(last)]) {
+      last--;
+    }
+    // Redraw whole wide characters, old and new.
+    if (first > 0 && (now[static_cast<size_t>(first)].ch == 0 || was[static_cast<size_t>(first)].ch == 0)) {
+      first--;
+    }
+    if (last + 1 < width_ && (now[static_cast<size_t>(last + 1)].ch == 0 || was[static_cast<size_t>(last + 1)].ch == 0)) {
+      last++;
+    }
+    // A blank tail is cleared with EL rather than spelled out.
+    int end = width_;
+    while (end > first && now[static_cast<size_t>(end - 1)] == blank) {
+      end--;
+    }
+    const bool erase_tail = end <= last;
+    out += "\x1b[";
+    AppendNumber(i + 1, &out);
+    out += ';';
+    AppendNumber(first + 1, &out);
+    out += 'H';
+    for (int col = first; col <= std::min(last, end - 1); ++col) {
+      const Cell& cell = now[static_cast<size_t>(col)];
+      if (cell.ch == 0) {
+        continue;
+      }
+      if (cell.attr != current) {
+        AppendAttr(cell.attr, &out);
+        current = cell.attr;
+      }
+      AppendUtf8(cell.ch, &out);
+    }
+    if (erase_tail) {
+      if (current != Attr{}) {
+        out += "\x1b[0m";
+        current = Attr{};
+      }
+      out += "\x1b[K";
+    }
+    was = now;
+  }
+
+  // The region is not part of the frame, so it is always set.
+  out += "\x1b[";
+  if (scroll_top_ != 0 || scroll_bottom_ != height_ - 1) {
+    AppendNumber(scroll_top_ + 1, &out);
+    out += ';';
+    AppendNumber(scroll_bottom_ + 1, &out);
+  }
+  out += 'r';
+  out += "\x1b[";
+  AppendNumber(cursor_row_ + 1, &out);
+  out += ';';
+  AppendNumber(cursor_col_ + 1, &out);
+  out += 'H';
+  AppendAttr(attr_, &out);
+  if (autowrap_ != from->autowrap) {
+    out += autowrap_ ? "\x1b[?7h" : "\x1b[?7l";
+    from->autowrap = autowrap_;
+  }
+  if (cursor_visible_ != from->cursor_visible) {
+    out += cursor_visible_ ? "\x1b[?25h" : "\x1b[?25l";
+    from->cursor_visible = cursor_visible_;
+  }
+  AppendModes(from->modes, modes_, &out);
+  from->modes = modes_;
+  return out;
+}
+
+std::string ScreenModel::RowText(int row) const {
+  std::string out;
+  if (row < 0 || row >= height_) {
+    return out;
+  }
+  for (const Cell& cell : screen()[static_cast<size_t>(row)]) {
+    if (cell.ch != 0) {
+      AppendUtf8(cell.ch, &out);
+    }
+  }
+  out.erase(out.find_last_not_of(' ') + 1);
+  return out;
+}
+
+int ScreenModel::Param(size_t index, int fallback) const {
+  return index < params_.size() && params_[index] != 0 ? params_[index] : fallback;
+}
+
+ScreenModel::Cell ScreenModel::Blank() const {
+  Cell cell;
+  cell.attr.bg = attr_.bg;
+  return cell;
+}
+
+ScreenModel::Row ScreenModel::BlankRow() const {
+  return Row(static_cast<size_t>(width_), Blank());
+}
+
+void ScreenModel::AppendRow(const Row& row, Attr* current, std::string* out) {
+  size_t end = row.size();
+  while (end > 0 && row[end - 1].ch == U' ' && row[end - 1].attr == Attr{}) {
+    end--;
+  }
+  for (size_t i = 0; i < end; ++i) {
+    const Cell& cell = row[i];
+    if (cell.ch == 0) {
+      continue;
+    }
+    if (cell.attr != *current) {
+      AppendAttr(cell.attr, out);
+      *current = cell.attr;
+    }
+    AppendUtf8(cell.ch, out);
+  }
+}
+
+void ScreenModel::AppendModes(uint16_t from, uint16_t to, std::string* out) {
+  for (size_t i = 0; i < std::size(kTrackedModes); ++i) {
+    const auto bit = static_cast<uint16_t>(1u << i);
+    if ((from & bit) != (to & bit)) {
+      *out += "\x1b[?";
+      AppendNumber(kTrackedModes[i], out);
+      *out += (to & bit) ? 'h' : 'l';
+    }
+  }
+}
+
+void ScreenModel::AppendAttr(const Attr& attr, std::string* out) {
+  *out += "\x1b[0";
+  static constexpr struct {
+    uint8_t flag;
+    const char* code;
+  } kCodes[] = {{kBold, ";1"},  {kDim, ";2"},     {kItalic, ";3"}, {kUnderline, ";4"},
+                {kBlink, ";5"}, {kInverse, ";7"}, {kHidden, ";8"}, {kStrike, ";9"}};
+  for (const auto& code : kCodes) {
+    if (attr.flags & code.flag) {
+      *out += code.code;
+    }
+  }
+  AppendColor(attr.fg, false, kPalette, kTrueColor, out);
+  AppendColor(attr.bg, true, kPalette, kTrueColor, out);
+  *out += 'm';
+}
+
+void ScreenModel::AppendUtf8(char32_t ch, std::string* out) {
+  if (ch < 0x80) {
+    *out += static_cast<char>(ch);
+  } else if (ch < 0x800) {
+    *out += static_cast<char>(0xC0 | (ch >> 6));
+    *out += static_cast<char>(0x80 | (ch & 0x3F));
+  } else if (ch < 0x10000) {
+    *out += static_cast<char>(0xE0 | (ch >> 12));
+    *out += static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+    *out += static_cast<char>(0x80 | (ch & 0x3F));
+  } else if (ch < 0x110000) {
+    *out += static_cast<char>(0xF0 | (ch >> 18));
+    *out += static_cast<char>(0x80 | ((ch >> 12) & 0x3F));
+    *out += static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+    *out += static_cast<char>(0x80 | (ch & 0x3F));
+  } else {
+    AppendUtf8(kReplacement, out);
+  }
+}
+
+bool ScreenModel::IsWide(char32_t ch) {
+  return (ch >= 0x1100 && ch <= 0x115F) || (ch >= 0x2E80 && ch <= 0x303E) || (ch >= 0x3041 && ch <= 0x33FF) ||
+         (ch >= 0x3400 && ch <= 0x4DBF) || (ch >= 0x4E00 && ch <= 0x9FFF) || (ch >= 0xA000 && ch <= 0xA4CF) ||
+         (ch >= 0xAC00 && ch <= 0xD7A3) || (ch >= 0xF900 && ch <= 0xFAFF) || (ch >= 0xFE30 && ch <= 0xFE4F) ||
+         (ch >= 0xFF00 && ch <= 0xFF60) || (ch >= 0xFFE0 && ch <= 0xFFE6) || (ch >= 0x1F300 && ch <= 0x1F64F) ||
+         (ch >= 0x1F900 && ch <= 0x1F9FF) || (ch >= 0x20000 && ch <= 0x3FFFD);
+}
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "UtConstants.hpp"
+
+namespace ut {
+// A VT100/xterm screen driven by a session's terminal output: the visible
+// cells with their colours, the cursor, the scroll region, the alternate
+// screen and a bounded scrollback. Snapshot() renders it as the escape
+// sequences that repaint a terminal to the same state, which is what a
+// returning client gets instead of the raw output it missed.
+//
+// Covers what shells and full-screen programs commonly emit (cursor
+// movement, erase, insert/delete, SGR including 256 and true colour,
+// scrolling regions, the alternate screen, and the keypad, mouse and
+// bracketed-paste modes). Other sequences are parsed and ignored. Not
+// thread-safe; the owning session feeds it on its shard.
+class ScreenModel {
+ public:
+  // What a client's terminal shows, as of the last Snapshot or Diff it was
+  // sent.
+  struct Frame;
+
+  ScreenModel(int width = 80, int height = 24, size_t scrollback_lines = kSnapshotScrollbackLines);
+
+  void Feed(std::string_view bytes);
+  void Resize(int width, int height);
+  std::string Snapshot() const;
+  Frame CaptureFrame() const;
+  // The escape sequences that bring a terminal showing `from` up to the
+  // current screen: it is scrolled as far as the screen scrolled, then only
+  // changed cells are redrawn. `from` is updated to match.
+  std::string Diff(Frame* from) const;
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int cursor_row() const { return cursor_row_; }
+  int cursor_col() const { return cursor_col_; }
+  bool alternate_screen() const { return alternate_; }
+  size_t scrollback_size() const { return scrollback_.size(); }
+  // The text of a visible row without attributes or trailing blanks.
+  std::string RowText(int row) const;
+
+ private:
+  // Colours: 0 is the default, kPalette | index a 256-colour entry and
+  // kTrueColor | 0xRRGGBB a direct colour.
+  static constexpr uint32_t kPalette = 1u << 24;
+  static constexpr uint32_t kTrueColor = 2u << 24;
+
+  enum AttrFlag : uint8_t {
+    kBold = 1 << 0,
+    kDim = 1 << 1,
+    kItalic = 1 << 2,
+    kUnderline = 1 << 3,
+    kBlink = 1 << 4,
+    kInverse = 1 << 5,
+    kHidden = 1 << 6,
+    kStrike = 1 << 7,
+  };
+
+  struct Attr {
+    uint32_t fg = 0;
+    uint32_t bg = 0;
+    uint8_t flags = 0;
+    bool operator==(const Attr& other) const {
+      return fg == other.fg && bg == other.bg && flags == other.flags;
+    }
+    bool operator!=(const Attr& other) const { return !(*this == other); }
+  };
+
+  // `ch` 0 marks the right half of a wide character.
+  struct Cell {
+    char32_t ch = U' ';
+    Attr attr;
+    bool operator==(const Cell& other) const { return ch == other.ch && attr == other.attr; }
+    bool operator!=(const Cell& other) const { return !(*this == other); }
+  };
+  using Row = std::vector<Cell>;
+
+  struct Cursor {
+    int row = 0;
+    int col = 0;
+    Attr attr;
+  };
+
+  enum class State {
+    kGround,
+    kEscape,
+    // ESC followed by an intermediate byte (charset designation and the
+    // like); the next byte ends it.
+    kEscapeIntermediate,
+    kCsi,
+    // OSC, DCS, APC, PM and SOS strings, up to BEL or ST.
+    kString,
+    kStringEscape,
+  };
+
+  void Print(char32_t ch);
+  void Control(unsigned char byte);
+  void EscapeDispatch(unsigned char final_byte);
+  void CsiDispatch(unsigned char final_byte);
+  void SelectGraphicRendition();
+  void SetMode(bool enable);
+
+  void LineFeed();
+  void ReverseIndex();
+  void ScrollUp(int count);
+  void ScrollDown(int count);
+  void EraseInDisplay(int mode);
+  void EraseInLine(int mode);
+  void EraseCells(int row, int from, int to);
+  void InsertLines(int count);
+  void DeleteLines(int count);
+  void InsertChars(int count);
+  void DeleteChars(int count);
+  void MoveCursor(int row, int col);
+  void SetAlternateScreen(bool enable);
+  void Reset();
+
+  void Step(unsigned char byte);
+  int Param(size_t index, int fallback) const;
+  // Erased cells take the current background colour, as in xterm.
+  Cell Blank() const;
+  Row BlankRow() const;
+  std::vector<Row>& screen() { return alternate_ ? alternate_rows_ : main_rows_; }
+  const std::vector<Row>& screen() const { return alternate_ ? alternate_rows_ : main_rows_; }
+  static void AppendRow(const Row& row, Attr* current, std::string* out);
+  // Emits `h`/`l` for each tracked mode whose bit differs between the masks.
+  static void AppendModes(uint16_t from, uint16_t to, std::string* out);
+  static void AppendAttr(const Attr& attr, std::string* out);
+  static void AppendUtf8(char32_t ch, std::string* out);
+  static bool IsWide(char32_t ch);
+
+  int width_;
+  int height_;
+  size_t scrollback_limit_;
+  std::vector<Row> main_rows_;
+  std::vector<Row> alternate_rows_;
+  std::deque<Row> scrollback_;
+  bool alternate_ = false;
+
+  int cursor_row_ = 0;
+  int cursor_col_ = 0;
+  // Set after printing in the last column; the next character wraps first.
+  bool wrap_pending_ = false;
+  Attr attr_;
+  Cursor saved_;
+  Cursor saved_main_;
+  int scroll_top_ = 0;
+  int scroll_bottom_ = 0;
+  bool autowrap_ = true;
+  bool cursor_visible_ = true;
+  // Private modes the model does not act on but a repaint must restore, one
+  // bit per entry of kTrackedModes in the .cpp.
+  uint16_t modes_ = 0;
+  // Lines scrolled off the top of the full main screen so far.
+  uint64_t scrolled_lines_ = 0;
+
+  State state_ = State::kGround;
+  std::vector<int> params_;
+  bool param_started_ = false;
+  char private_marker_ = 0;
+  char32_t utf8_codepoint_ = 0;
+  int utf8_remaining_ = 0;
+};
+
+struct ScreenModel::Frame {
+  int width = 0;
+  int height = 0;
+  std::vector<Row> rows;
+  bool alternate = false;
+  bool autowrap = true;
+  bool cursor_visible = true;
+  uint16_t modes = 0;
+  uint64_t scrolled_lines = 0;
+};
+}
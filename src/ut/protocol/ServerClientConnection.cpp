@@ -6,14 +6,17 @@ namespace ut {
 ServerClientConnection::ServerClientConnection(std::shared_ptr<TcpSocketHandler> socket_handler,
                                                const std::string& client_id,
                                                const std::string& key,
+                                               CipherSuite cipher_suite,
                                                SocketHandle socket)
     : Connection(std::move(socket_handler), client_id, key) {
+  cipher_suite_ = cipher_suite;
+  sends_resume_point_ = true;
   socket_ = socket;
   reader_ = std::make_shared<BackedReader>(socket_handler_,
-                                           std::make_shared<CryptoHandler>(key_, ut::kClientServerNonceMsb),
+                                           std::make_shared<CryptoHandler>(key_, ut::kClientServerNonceMsb, cipher_suite_),
                                            socket_);
   writer_ = std::make_shared<BackedWriter>(socket_handler_,
-                                           std::make_shared<CryptoHandler>(key_, ut::kServerClientNonceMsb),
+                                           std::make_shared<CryptoHandler>(key_, ut::kServerClientNonceMsb, cipher_suite_),
                                            socket_);
 }
 }
@@ -11,6 +11,7 @@ class ServerClientConnection : public Connection {
   ServerClientConnection(std::shared_ptr<TcpSocketHandler> socket_handler,
                          const std::string& client_id,
                          const std::string& key,
+                         CipherSuite cipher_suite,
                          SocketHandle socket);
 };
 }
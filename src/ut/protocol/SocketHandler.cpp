@@ -1,32 +1,49 @@
 #include "SocketHandler.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <memory>
 #include <thread>
-
-#include <winsock2.h>
+#include <vector>
 
 namespace ut {
 namespace {
 constexpr int kSocketTimeoutSeconds = 30;
 }
 
+bool SocketHandler::WaitForData(SocketHandle socket, int timeout_ms) {
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (!HasData(socket)) {
+    if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
 void SocketHandler::ReadAll(SocketHandle socket, void* buf, size_t count, bool timeout) {
   size_t pos = 0;
   auto start = std::chrono::steady_clock::now();
   while (pos < count) {
-    if (!HasData(socket)) {
-      if (timeout) {
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - start).count();
-        if (elapsed > kSocketTimeoutSeconds) {
-          throw std::runtime_error("socket timeout");
-        }
+    int wait_ms = -1;
+    if (timeout) {
+      const auto elapsed =
+          std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+      if (elapsed > kSocketTimeoutSeconds * 1000) {
+        throw std::runtime_error("socket timeout");
       }
-      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      wait_ms = static_cast<int>(kSocketTimeoutSeconds * 1000 - elapsed) + 1;
+    }
+    if (!WaitForData(socket, wait_ms)) {
       continue;
     }
 
     const int rc = Read(socket, static_cast<char*>(buf) + pos, count - pos);
+    if (rc == kWouldBlock) {
+      continue;
+    }
     if (rc == 0) {
       throw std::runtime_error("socket closed");
     }
@@ -39,9 +56,42 @@ void SocketHandler::ReadAll(SocketHandle socket, void* buf, size_t count, bool t
 }
 
 void SocketHandler::WriteAllOrThrow(SocketHandle socket, const void* buf, size_t count, bool timeout) {
-  size_t pos = 0;
+  const SocketBuffer buffer{buf, count};
+  WriteVectorAllOrThrow(socket, &buffer, 1, timeout);
+}
+
+int SocketHandler::WriteVector(SocketHandle socket, const SocketBuffer* buffers, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (buffers[i].size > 0) {
+      return Write(socket, buffers[i].data, buffers[i].size);
+    }
+  }
+  return 0;
+}
+
+void SocketHandler::WriteVectorAllOrThrow(SocketHandle socket,
+                                          const SocketBuffer* buffers,
+                                          size_t count,
+                                          bool timeout) {
+  SocketBuffer inline_pending[kMaxWriteBuffers];
+  std::vector<SocketBuffer> heap_pending;
+  SocketBuffer* pending = inline_pending;
+  if (count > kMaxWriteBuffers) {
+    heap_pending.assign(buffers, buffers + count);
+    pending = heap_pending.data();
+  } else {
+    std::copy(buffers, buffers + count, inline_pending);
+  }
+
+  size_t index = 0;
   auto start = std::chrono::steady_clock::now();
-  while (pos < count) {
+  while (true) {
+    while (index < count && pending[index].size == 0) {
+      index++;
+    }
+    if (index == count) {
+      return;
+    }
     if (timeout) {
       auto now = std::chrono::steady_clock::now();
       auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - start).count();
@@ -49,7 +99,7 @@ void SocketHandler::WriteAllOrThrow(SocketHandle socket, const void* buf, size_t
         throw std::runtime_error("socket timeout");
       }
     }
-    const int rc = Write(socket, static_cast<const char*>(buf) + pos, count - pos);
+    const int rc = WriteVector(socket, pending + index, count - index);
     if (rc == 0) {
       throw std::runtime_error("socket closed during write");
     }
@@ -57,7 +107,16 @@ void SocketHandler::WriteAllOrThrow(SocketHandle socket, const void* buf, size_t
       std::this_thread::sleep_for(std::chrono::milliseconds(5));
       continue;
     }
-    pos += static_cast<size_t>(rc);
+    size_t written = static_cast<size_t>(rc);
+    while (written > 0 && index < count) {
+      const size_t consumed = std::min(written, pending[index].size);
+      pending[index].data = static_cast<const char*>(pending[index].data) + consumed;
+      pending[index].size -= consumed;
+      written -= consumed;
+      if (pending[index].size == 0) {
+        index++;
+      }
+    }
     start = std::chrono::steady_clock::now();
   }
 }
@@ -66,25 +125,24 @@ bool SocketHandler::ReadPacket(SocketHandle socket, Packet* packet) {
   if (!packet) {
     return false;
   }
-  uint32_t length_be = 0;
-  ReadAll(socket, &length_be, sizeof(uint32_t), false);
-  const uint32_t length = ntohl(length_be);
-  if (length == 0 || length > 128 * 1024 * 1024) {
+  char prefix[Packet::kLengthBytes] = {};
+  ReadAll(socket, prefix, sizeof(prefix), false);
+  const uint32_t length = Packet::DecodeLength(prefix);
+  if (length < Packet::kHeaderBytes || length > 128 * 1024 * 1024) {
     throw std::runtime_error("invalid packet length");
   }
-  std::string s(length, '\0');
-  ReadAll(socket, &s[0], length, false);
-  *packet = Packet(s);
+  auto frame = std::make_shared<std::string>(Packet::kLengthBytes + length, '\0');
+  std::memcpy(&(*frame)[0], prefix, sizeof(prefix));
+  ReadAll(socket, &(*frame)[Packet::kLengthBytes], length, false);
+  *packet = Packet(frame, 0, frame->size());
   return true;
 }
 
 void SocketHandler::WritePacket(SocketHandle socket, const Packet& packet) {
-  std::string data = packet.serialize();
-  if (data.size() > 128 * 1024 * 1024) {
+  const std::string_view frame = packet.frame();
+  if (frame.size() > 128 * 1024 * 1024) {
     throw std::runtime_error("invalid packet length");
   }
-  uint32_t length_be = htonl(static_cast<uint32_t>(data.size()));
-  WriteAllOrThrow(socket, &length_be, sizeof(uint32_t), false);
-  WriteAllOrThrow(socket, data.data(), data.size(), false);
+  WriteAllOrThrow(socket, frame.data(), frame.size(), false);
 }
 }
@@ -8,6 +8,11 @@
 #include "SocketTypes.hpp"
 
 namespace ut {
+struct SocketBuffer {
+  const void* data = nullptr;
+  size_t size = 0;
+};
+
 class SocketHandler {
  public:
   virtual ~SocketHandler() = default;
@@ -17,8 +22,23 @@ class SocketHandler {
   virtual int Write(SocketHandle socket, const void* buf, size_t count) = 0;
   virtual void Close(SocketHandle socket) = 0;
 
+  // Blocks until `socket` is readable (or has failed, so that Read reports
+  // it) or `timeout_ms` passes; -1 waits without limit. The default polls
+  // HasData for transports that cannot wait natively.
+  virtual bool WaitForData(SocketHandle socket, int timeout_ms);
+
+  // Gather write; returns bytes written like Write. Transports without a
+  // native gather call fall back to writing the first non-empty buffer.
+  virtual int WriteVector(SocketHandle socket, const SocketBuffer* buffers, size_t count);
+
+  static constexpr size_t kMaxWriteBuffers = 16;
+  // Returned by Read, Write and WriteVector when a non-blocking socket has
+  // nothing to read or no room to write.
+  static constexpr int kWouldBlock = -2;
+
   void ReadAll(SocketHandle socket, void* buf, size_t count, bool timeout);
   void WriteAllOrThrow(SocketHandle socket, const void* buf, size_t count, bool timeout);
+  void WriteVectorAllOrThrow(SocketHandle socket, const SocketBuffer* buffers, size_t count, bool timeout);
 
   template <typename T>
   T ReadProto(SocketHandle socket, bool timeout) {
@@ -41,21 +61,39 @@ class SocketHandler {
 
   template <typename T>
   void WriteProto(SocketHandle socket, const T& t, bool timeout) {
+    WriteProtos(socket, timeout, t);
+  }
+
+  // Writes several length-prefixed protos with one gather write, so messages
+  // a handshake pipelines leave in the same segment.
+  template <typename... T>
+  void WriteProtos(SocketHandle socket, bool timeout, const T&... protos) {
+    static_assert(2 * sizeof...(T) <= kMaxWriteBuffers, "too many protos for one write");
+    std::string bodies[] = {SerializeProto(protos)...};
+    int64_t lengths[sizeof...(T)];
+    SocketBuffer buffers[2 * sizeof...(T)];
+    for (size_t i = 0; i < sizeof...(T); ++i) {
+      lengths[i] = static_cast<int64_t>(bodies[i].size());
+      buffers[2 * i] = {&lengths[i], sizeof(int64_t)};
+      buffers[2 * i + 1] = {bodies[i].data(), bodies[i].size()};
+    }
+    WriteVectorAllOrThrow(socket, buffers, 2 * sizeof...(T), timeout);
+  }
+
+  bool ReadPacket(SocketHandle socket, Packet* packet);
+  void WritePacket(SocketHandle socket, const Packet& packet);
+
+ private:
+  template <typename T>
+  static std::string SerializeProto(const T& t) {
     std::string s;
     if (!t.SerializeToString(&s)) {
       throw std::runtime_error("proto serialize failed");
     }
-    int64_t length = static_cast<int64_t>(s.size());
-    if (length < 0 || length > 128 * 1024 * 1024) {
+    if (s.size() > 128 * 1024 * 1024) {
       throw std::runtime_error("invalid proto length");
     }
-    WriteAllOrThrow(socket, &length, sizeof(int64_t), timeout);
-    if (length > 0) {
-      WriteAllOrThrow(socket, s.data(), static_cast<size_t>(length), timeout);
-    }
+    return s;
   }
-
-  bool ReadPacket(SocketHandle socket, Packet* packet);
-  void WritePacket(SocketHandle socket, const Packet& packet);
 };
 }
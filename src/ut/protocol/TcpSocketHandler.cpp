@@ -3,12 +3,180 @@
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+#ifdef UT_USE_IO_URING
+#include "RingSocket.hpp"
 #endif
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <cstring>
 #include <string>
 
 namespace ut {
+namespace {
+// RFC 8305 "Connection Attempt Delay": how long an attempt gets to itself
+// before the next address is tried alongside it.
+constexpr int kConnectAttemptDelayMs = 250;
+// Gives up on all attempts after this long (a blocking connect would wait
+// for the OS, over two minutes on Linux).
+constexpr int kConnectTimeoutMs = 10000;
+
+#ifdef _WIN32
+using NativeSocket = SOCKET;
+constexpr NativeSocket kNoSocket = INVALID_SOCKET;
+
+void CloseNative(NativeSocket sock) {
+  closesocket(sock);
+}
+
+bool SetNonBlocking(NativeSocket sock, bool enabled) {
+  u_long mode = enabled ? 1 : 0;
+  return ioctlsocket(sock, FIONBIO, &mode) == 0;
+}
+
+bool ConnectInProgress() {
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+bool WouldBlock() {
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+// select rather than WSAPoll: older WSAPoll never reports a failed connect.
+void WaitForConnects(const std::vector<NativeSocket>& pending, int timeout_ms, std::vector<size_t>* finished) {
+  fd_set write_set;
+  fd_set error_set;
+  FD_ZERO(&write_set);
+  FD_ZERO(&error_set);
+  for (size_t i = 0; i < pending.size() && i < FD_SETSIZE; ++i) {
+    FD_SET(pending[i], &write_set);
+    FD_SET(pending[i], &error_set);
+  }
+  timeval timeout{};
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_usec = (timeout_ms % 1000) * 1000;
+  if (select(0, nullptr, &write_set, &error_set, &timeout) <= 0) {
+    return;
+  }
+  for (size_t i = 0; i < pending.size(); ++i) {
+    if (FD_ISSET(pending[i], &write_set) || FD_ISSET(pending[i], &error_set)) {
+      finished->push_back(i);
+    }
+  }
+}
+#else
+using NativeSocket = int;
+constexpr NativeSocket kNoSocket = -1;
+
+void CloseNative(NativeSocket sock) {
+  close(sock);
+}
+
+bool SetNonBlocking(NativeSocket sock, bool enabled) {
+  const int flags = fcntl(sock, F_GETFL, 0);
+  if (flags < 0) {
+    return false;
+  }
+  return fcntl(sock, F_SETFL, enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) == 0;
+}
+
+bool ConnectInProgress() {
+  return errno == EINPROGRESS;
+}
+
+bool WouldBlock() {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+void WaitForConnects(const std::vector<NativeSocket>& pending, int timeout_ms, std::vector<size_t>* finished) {
+  std::vector<pollfd> fds;
+  fds.reserve(pending.size());
+  for (NativeSocket sock : pending) {
+    fds.push_back(pollfd{sock, POLLOUT, 0});
+  }
+  if (poll(fds.data(), static_cast<nfds_t>(fds.size()), timeout_ms) <= 0) {
+    return;
+  }
+  for (size_t i = 0; i < fds.size(); ++i) {
+    if (fds[i].revents != 0) {
+      finished->push_back(i);
+    }
+  }
+}
+#endif
+
+bool ConnectSucceeded(NativeSocket sock) {
+  int error = 0;
+#ifdef _WIN32
+  int len = sizeof(error);
+  if (getsockopt(sock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &len) != 0) {
+    return false;
+  }
+#else
+  socklen_t len = sizeof(error);
+  if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) != 0) {
+    return false;
+  }
+#endif
+  return error == 0;
+}
+
+// Keystrokes and handshake messages are small; Nagle would hold each one
+// back until the previous segment is acknowledged.
+void SetNoDelay(NativeSocket sock) {
+  int one = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&one), sizeof(one));
+}
+
+int TransferResult(int rc) {
+  return rc < 0 && WouldBlock() ? SocketHandler::kWouldBlock : rc;
+}
+
+// Starts a non-blocking connect to `endpoint`. Returns kNoSocket when it
+// failed outright; `connected` is set when it completed immediately.
+NativeSocket StartConnect(const TcpSocketHandler::Endpoint& endpoint, bool* connected) {
+  const auto* addr = reinterpret_cast<const sockaddr*>(endpoint.address.data());
+#ifdef _WIN32
+  const NativeSocket sock = socket(endpoint.family, SOCK_STREAM, IPPROTO_TCP);
+  const int addr_len = static_cast<int>(endpoint.address.size());
+#else
+  const NativeSocket sock = socket(endpoint.family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+  const socklen_t addr_len = static_cast<socklen_t>(endpoint.address.size());
+#endif
+  if (sock == kNoSocket) {
+    return kNoSocket;
+  }
+  if (!SetNonBlocking(sock, true)) {
+    CloseNative(sock);
+    return kNoSocket;
+  }
+  if (connect(sock, addr, addr_len) == 0) {
+    *connected = true;
+    return sock;
+  }
+  if (!ConnectInProgress()) {
+    CloseNative(sock);
+    return kNoSocket;
+  }
+  return sock;
+}
+}
+
 TcpSocketHandler::TcpSocketHandler() {
   EnsureWinsock();
 }
@@ -43,8 +211,40 @@ bool TcpSocketHandler::HasData(SocketHandle socket) {
   const int result = select(0, &read_set, nullptr, nullptr, &timeout);
   return result > 0 && FD_ISSET(static_cast<SOCKET>(socket), &read_set);
 #else
-  (void)socket;
-  return false;
+  if (socket == kInvalidSocket) {
+    return false;
+  }
+#ifdef UT_USE_IO_URING
+  if (auto ring = RingSocket::Find(static_cast<int>(socket))) {
+    bool has_data = false;
+    if (ring->HasData(&has_data)) {
+      return has_data;
+    }
+  }
+#endif
+  pollfd fd{static_cast<int>(socket), POLLIN, 0};
+  return poll(&fd, 1, 0) > 0;
+#endif
+}
+
+bool TcpSocketHandler::WaitForData(SocketHandle socket, int timeout_ms) {
+  if (socket == kInvalidSocket) {
+    return true;
+  }
+#ifdef _WIN32
+  WSAPOLLFD fd{static_cast<SOCKET>(socket), POLLRDNORM, 0};
+  return WSAPoll(&fd, 1, timeout_ms) != 0;
+#else
+#ifdef UT_USE_IO_URING
+  if (auto ring = RingSocket::Find(static_cast<int>(socket))) {
+    bool has_data = false;
+    if (ring->WaitForData(timeout_ms, &has_data)) {
+      return has_data;
+    }
+  }
+#endif
+  pollfd fd{static_cast<int>(socket), POLLIN, 0};
+  return poll(&fd, 1, timeout_ms) != 0;
 #endif
 }
 
@@ -53,12 +253,20 @@ int TcpSocketHandler::Read(SocketHandle socket, void* buf, size_t count) {
   if (socket == kInvalidSocket) {
     return -1;
   }
-  return recv(static_cast<SOCKET>(socket), reinterpret_cast<char*>(buf), static_cast<int>(count), 0);
+  return TransferResult(recv(static_cast<SOCKET>(socket), reinterpret_cast<char*>(buf), static_cast<int>(count), 0));
 #else
-  (void)socket;
-  (void)buf;
-  (void)count;
-  return -1;
+  if (socket == kInvalidSocket) {
+    return -1;
+  }
+#ifdef UT_USE_IO_URING
+  if (auto ring = RingSocket::Find(static_cast<int>(socket))) {
+    int rc = 0;
+    if (ring->Read(buf, count, &rc)) {
+      return rc;
+    }
+  }
+#endif
+  return TransferResult(static_cast<int>(recv(static_cast<int>(socket), buf, count, 0)));
 #endif
 }
 
@@ -67,12 +275,61 @@ int TcpSocketHandler::Write(SocketHandle socket, const void* buf, size_t count)
   if (socket == kInvalidSocket) {
     return -1;
   }
-  return send(static_cast<SOCKET>(socket), reinterpret_cast<const char*>(buf), static_cast<int>(count), 0);
+  return TransferResult(
+      send(static_cast<SOCKET>(socket), reinterpret_cast<const char*>(buf), static_cast<int>(count), 0));
 #else
-  (void)socket;
-  (void)buf;
-  (void)count;
-  return -1;
+  if (socket == kInvalidSocket) {
+    return -1;
+  }
+#ifdef UT_USE_IO_URING
+  if (auto ring = RingSocket::Find(static_cast<int>(socket))) {
+    const SocketBuffer buffer{buf, count};
+    int rc = 0;
+    if (ring->Write(&buffer, 1, &rc)) {
+      return rc;
+    }
+  }
+#endif
+  return TransferResult(static_cast<int>(send(static_cast<int>(socket), buf, count, MSG_NOSIGNAL)));
+#endif
+}
+
+int TcpSocketHandler::WriteVector(SocketHandle socket, const SocketBuffer* buffers, size_t count) {
+  if (socket == kInvalidSocket) {
+    return -1;
+  }
+  const size_t n = std::min(count, kMaxWriteBuffers);
+#ifdef _WIN32
+  WSABUF wsa_buffers[kMaxWriteBuffers];
+  for (size_t i = 0; i < n; ++i) {
+    wsa_buffers[i].buf = const_cast<char*>(static_cast<const char*>(buffers[i].data));
+    wsa_buffers[i].len = static_cast<ULONG>(buffers[i].size);
+  }
+  DWORD sent = 0;
+  if (WSASend(static_cast<SOCKET>(socket), wsa_buffers, static_cast<DWORD>(n), &sent, 0, nullptr, nullptr) ==
+      SOCKET_ERROR) {
+    return TransferResult(-1);
+  }
+  return static_cast<int>(sent);
+#else
+#ifdef UT_USE_IO_URING
+  if (auto ring = RingSocket::Find(static_cast<int>(socket))) {
+    int rc = 0;
+    if (ring->Write(buffers, n, &rc)) {
+      return rc;
+    }
+  }
+#endif
+  iovec iov[kMaxWriteBuffers];
+  for (size_t i = 0; i < n; ++i) {
+    iov[i].iov_base = const_cast<void*>(buffers[i].data);
+    iov[i].iov_len = buffers[i].size;
+  }
+  msghdr msg{};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = n;
+  const ssize_t sent = sendmsg(static_cast<int>(socket), &msg, MSG_NOSIGNAL);
+  return sent < 0 ? TransferResult(-1) : static_cast<int>(sent);
 #endif
 }
 
@@ -82,14 +339,21 @@ void TcpSocketHandler::Close(SocketHandle socket) {
     closesocket(static_cast<SOCKET>(socket));
   }
 #else
-  (void)socket;
+#ifdef UT_USE_IO_URING
+  if (socket != kInvalidSocket && RingSocket::Close(static_cast<int>(socket))) {
+    return;
+  }
+#endif
+  if (socket != kInvalidSocket) {
+    close(static_cast<int>(socket));
+  }
 #endif
 }
 
-SocketHandle TcpSocketHandler::Connect(const std::string& host, int port) {
-#ifdef _WIN32
+std::vector<TcpSocketHandler::Endpoint> TcpSocketHandler::Resolve(const std::string& host, int port) {
+  std::vector<Endpoint> endpoints;
   if (!EnsureWinsock()) {
-    return kInvalidSocket;
+    return endpoints;
   }
   addrinfo hints{};
   hints.ai_family = AF_UNSPEC;
@@ -99,28 +363,115 @@ SocketHandle TcpSocketHandler::Connect(const std::string& host, int port) {
   addrinfo* result = nullptr;
   const std::string port_str = std::to_string(port);
   if (getaddrinfo(host.c_str(), port_str.c_str(), &hints, &result) != 0) {
+    return endpoints;
+  }
+  for (addrinfo* ptr = result; ptr != nullptr; ptr = ptr->ai_next) {
+    Endpoint endpoint;
+    endpoint.family = ptr->ai_family;
+    endpoint.address.assign(reinterpret_cast<const char*>(ptr->ai_addr), static_cast<size_t>(ptr->ai_addrlen));
+    endpoints.push_back(std::move(endpoint));
+  }
+  freeaddrinfo(result);
+  return endpoints;
+}
+
+SocketHandle TcpSocketHandler::Connect(const std::string& host, int port) {
+  return Connect(Resolve(host, port));
+}
+
+SocketHandle TcpSocketHandler::Connect(const std::vector<Endpoint>& endpoints, size_t* connected_index) {
+  if (endpoints.empty() || !EnsureWinsock()) {
     return kInvalidSocket;
   }
+  // RFC 8305 ordering: keep the resolver's preference within each family
+  // but alternate families, starting with the resolver's first choice.
+  std::vector<const Endpoint*> order;
+  {
+    std::vector<const Endpoint*> first;
+    std::vector<const Endpoint*> other;
+    for (const Endpoint& endpoint : endpoints) {
+      (endpoint.family == endpoints.front().family ? first : other).push_back(&endpoint);
+    }
+    for (size_t i = 0; i < std::max(first.size(), other.size()); ++i) {
+      if (i < first.size()) {
+        order.push_back(first[i]);
+      }
+      if (i < other.size()) {
+        order.push_back(other[i]);
+      }
+    }
+  }
 
-  SocketHandle sock_handle = kInvalidSocket;
-  for (addrinfo* ptr = result; ptr != nullptr; ptr = ptr->ai_next) {
-    SOCKET sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-    if (sock == INVALID_SOCKET) {
+  using Clock = std::chrono::steady_clock;
+  const auto deadline = Clock::now() + std::chrono::milliseconds(kConnectTimeoutMs);
+  auto next_attempt = Clock::now();
+  size_t next = 0;
+  std::vector<NativeSocket> pending;
+  std::vector<const Endpoint*> pending_endpoints;
+  NativeSocket winner = kNoSocket;
+  const Endpoint* winner_endpoint = nullptr;
+
+  while (winner == kNoSocket) {
+    auto now = Clock::now();
+    if (now >= deadline) {
+      break;
+    }
+    // A new attempt starts every kConnectAttemptDelayMs, or as soon as the
+    // previous ones have all failed.
+    if (next < order.size() && (pending.empty() || now >= next_attempt)) {
+      const Endpoint& endpoint = *order[next++];
+      bool connected = false;
+      const NativeSocket sock = StartConnect(endpoint, &connected);
+      if (sock == kNoSocket) {
+        continue;
+      }
+      if (connected) {
+        winner = sock;
+        winner_endpoint = &endpoint;
+        break;
+      }
+      pending.push_back(sock);
+      pending_endpoints.push_back(&endpoint);
+      next_attempt = now + std::chrono::milliseconds(kConnectAttemptDelayMs);
       continue;
     }
-    if (connect(sock, ptr->ai_addr, static_cast<int>(ptr->ai_addrlen)) == 0) {
-      sock_handle = static_cast<SocketHandle>(sock);
+    if (pending.empty()) {
       break;
     }
-    closesocket(sock);
+
+    const auto wake = next < order.size() ? std::min(next_attempt, deadline) : deadline;
+    const auto wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1;
+    std::vector<size_t> finished;
+    WaitForConnects(pending, static_cast<int>(wait_ms), &finished);
+    for (auto it = finished.rbegin(); it != finished.rend(); ++it) {
+      const NativeSocket sock = pending[*it];
+      const Endpoint* endpoint = pending_endpoints[*it];
+      pending.erase(pending.begin() + static_cast<std::ptrdiff_t>(*it));
+      pending_endpoints.erase(pending_endpoints.begin() + static_cast<std::ptrdiff_t>(*it));
+      if (winner == kNoSocket && ConnectSucceeded(sock)) {
+        winner = sock;
+        winner_endpoint = endpoint;
+      } else {
+        CloseNative(sock);
+        next_attempt = Clock::now();
+      }
+    }
   }
-  freeaddrinfo(result);
-  return sock_handle;
-#else
-  (void)host;
-  (void)port;
-  return kInvalidSocket;
-#endif
+
+  // The losers (and any attempt still in flight) are cancelled.
+  for (NativeSocket sock : pending) {
+    CloseNative(sock);
+  }
+  if (winner == kNoSocket) {
+    return kInvalidSocket;
+  }
+  // The rest of the protocol uses blocking sockets.
+  SetNonBlocking(winner, false);
+  SetNoDelay(winner);
+  if (connected_index) {
+    *connected_index = static_cast<size_t>(winner_endpoint - endpoints.data());
+  }
+  return static_cast<SocketHandle>(winner);
 }
 
 SocketHandle TcpSocketHandler::Listen(const std::string& bind_ip, int port) {
@@ -161,9 +512,39 @@ SocketHandle TcpSocketHandler::Listen(const std::string& bind_ip, int port) {
   freeaddrinfo(result);
   return listen_handle;
 #else
-  (void)bind_ip;
-  (void)port;
-  return kInvalidSocket;
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  hints.ai_flags = AI_PASSIVE;
+
+  addrinfo* result = nullptr;
+  const std::string port_str = std::to_string(port);
+  const char* host = bind_ip.empty() ? nullptr : bind_ip.c_str();
+  if (getaddrinfo(host, port_str.c_str(), &hints, &result) != 0) {
+    return kInvalidSocket;
+  }
+
+  SocketHandle listen_handle = kInvalidSocket;
+  for (addrinfo* ptr = result; ptr != nullptr; ptr = ptr->ai_next) {
+    const int sock = socket(ptr->ai_family, ptr->ai_socktype | SOCK_CLOEXEC, ptr->ai_protocol);
+    if (sock < 0) {
+      continue;
+    }
+    const int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (ptr->ai_family == AF_INET6) {
+      const int v6_only = 0;
+      setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6_only, sizeof(v6_only));
+    }
+    if (bind(sock, ptr->ai_addr, ptr->ai_addrlen) == 0 && listen(sock, SOMAXCONN) == 0) {
+      listen_handle = static_cast<SocketHandle>(sock);
+      break;
+    }
+    close(sock);
+  }
+  freeaddrinfo(result);
+  return listen_handle;
 #endif
 }
 
@@ -176,23 +557,53 @@ SocketHandle TcpSocketHandler::Accept(SocketHandle listen_socket) {
   if (client == INVALID_SOCKET) {
     return kInvalidSocket;
   }
+  SetNoDelay(client);
   return static_cast<SocketHandle>(client);
 #else
-  (void)listen_socket;
-  return kInvalidSocket;
+  if (listen_socket == kInvalidSocket) {
+    return kInvalidSocket;
+  }
+  const int client = accept4(static_cast<int>(listen_socket), nullptr, nullptr, SOCK_CLOEXEC);
+  if (client < 0) {
+    return kInvalidSocket;
+  }
+  SetNoDelay(client);
+  return static_cast<SocketHandle>(client);
 #endif
 }
 
+bool TcpSocketHandler::PrepareForReactor(SocketHandle socket) {
+  if (socket == kInvalidSocket) {
+    return false;
+  }
+  const auto sock = static_cast<NativeSocket>(socket);
+  SetNoDelay(sock);
+  if (!SetNonBlocking(sock, true)) {
+    return false;
+  }
+#ifdef UT_USE_IO_URING
+  // An io_uring reactor reads and writes it from now on.
+  RingSocket::Track(sock);
+#endif
+  return true;
+}
+
 uint16_t TcpSocketHandler::GetBoundPort(SocketHandle socket) {
-#ifdef _WIN32
   if (socket == kInvalidSocket) {
     return 0;
   }
   sockaddr_storage addr{};
+#ifdef _WIN32
   int len = sizeof(addr);
   if (getsockname(static_cast<SOCKET>(socket), reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
     return 0;
   }
+#else
+  socklen_t len = sizeof(addr);
+  if (getsockname(static_cast<int>(socket), reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+    return 0;
+  }
+#endif
   if (addr.ss_family == AF_INET) {
     auto* in = reinterpret_cast<sockaddr_in*>(&addr);
     return ntohs(in->sin_port);
@@ -201,7 +612,6 @@ uint16_t TcpSocketHandler::GetBoundPort(SocketHandle socket) {
     auto* in6 = reinterpret_cast<sockaddr_in6*>(&addr);
     return ntohs(in6->sin6_port);
   }
-#endif
   return 0;
 }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "SocketHandler.hpp"
 
@@ -11,13 +12,37 @@ class TcpSocketHandler : public SocketHandler {
   ~TcpSocketHandler() override;
 
   bool HasData(SocketHandle socket) override;
+  bool WaitForData(SocketHandle socket, int timeout_ms) override;
   int Read(SocketHandle socket, void* buf, size_t count) override;
   int Write(SocketHandle socket, const void* buf, size_t count) override;
+  int WriteVector(SocketHandle socket, const SocketBuffer* buffers, size_t count) override;
   void Close(SocketHandle socket) override;
 
+  // A resolved address: its family and the raw sockaddr bytes.
+  struct Endpoint {
+    int family = 0;
+    std::string address;
+  };
+
+  // Both address families, in the resolver's order of preference.
+  std::vector<Endpoint> Resolve(const std::string& host, int port);
+  // Resolve, then connect to the first address that answers.
   SocketHandle Connect(const std::string& host, int port);
+  // Happy Eyeballs (RFC 8305): attempts alternate between address families,
+  // a new one starting every 250ms (or as soon as the others have failed)
+  // while earlier ones stay in flight. The first to connect wins and the
+  // rest are closed, so a blackholed address costs 250ms rather than a TCP
+  // timeout. Returns a blocking socket, or kInvalidSocket after 10s, and
+  // stores which endpoint answered in `connected_index`.
+  SocketHandle Connect(const std::vector<Endpoint>& endpoints, size_t* connected_index = nullptr);
   SocketHandle Listen(const std::string& bind_ip, int port);
   SocketHandle Accept(SocketHandle listen_socket);
+  // Readies a socket (one from Reactor::AddAcceptor, or a tunnel) for a
+  // reactor: non-blocking, so Read and Write return kWouldBlock instead of
+  // waiting, and with Nagle off like the sockets Accept returns. In an
+  // io_uring build its reads and writes then go through the ring of the
+  // reactor it is added to (RingSocket.hpp).
+  bool PrepareForReactor(SocketHandle socket);
   uint16_t GetBoundPort(SocketHandle socket);
 
  private:
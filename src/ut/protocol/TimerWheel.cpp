@@ -0,0 +1,230 @@
+#include "TimerWheel.hpp"
+
+#include <algorithm>
+
+namespace ut {
+namespace {
+int CountTrailingZeros(uint64_t value) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index = 0;
+  _BitScanForward64(&index, value);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+uint64_t RotateRight(uint64_t value, unsigned shift) {
+  shift &= 63;
+  return shift == 0 ? value : (value >> shift) | (value << (64 - shift));
+}
+}
+
+TimerWheel::TimerWheel(Clock::time_point now) : origin_(now) {
+  for (auto& level : heads_) {
+    std::fill(std::begin(level), std::end(level), kNone);
+  }
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(int delay_ms, Callback callback, Clock::time_point now) {
+  const int64_t elapsed_ms =
+      std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(now - origin_).count());
+  const int64_t due_ms = elapsed_ms + std::max(0, delay_ms);
+  const uint64_t expires = std::max(static_cast<uint64_t>((due_ms + kTickMs - 1) / kTickMs), current_ + 1);
+
+  int32_t index = 0;
+  if (!free_.empty()) {
+    index = free_.back();
+    free_.pop_back();
+  } else {
+    index = static_cast<int32_t>(nodes_.size());
+    nodes_.emplace_back();
+  }
+  Node& node = nodes_[index];
+  node.expires = expires;
+  node.callback = std::move(callback);
+  Place(index);
+  pending_++;
+  return (static_cast<uint64_t>(node.generation) << 32) | static_cast<uint32_t>(index + 1);
+}
+
+bool TimerWheel::Cancel(TimerId id) {
+  const uint64_t slot = id & 0xffffffffu;
+  if (slot == 0 || slot > nodes_.size()) {
+    return false;
+  }
+  const auto index = static_cast<int32_t>(slot - 1);
+  Node& node = nodes_[index];
+  if (node.level == kFree || node.generation != static_cast<uint32_t>(id >> 32)) {
+    return false;
+  }
+  if (node.level != kDue) {
+    Unlink(index);
+  }
+  // A due timer is skipped by RunSlot once its generation has moved on.
+  Release(index);
+  pending_--;
+  return true;
+}
+
+size_t TimerWheel::Advance(Clock::time_point now) {
+  const uint64_t target = TickAt(now);
+  size_t ran = 0;
+  while (current_ < target) {
+    uint64_t next = 0;
+    for (int level = 0; level < kLevels; ++level) {
+      const uint64_t tick = NextTickForLevel(level);
+      if (tick != 0 && (next == 0 || tick < next)) {
+        next = tick;
+      }
+    }
+    if (next == 0 || next > target) {
+      // Nothing is due or needs re-filing before `target`.
+      current_ = target;
+      break;
+    }
+    current_ = next;
+    for (int level = kLevels - 1; level >= 1; --level) {
+      if ((current_ & ((uint64_t{1} << (kSlotBits * level)) - 1)) == 0) {
+        Cascade(level);
+      }
+    }
+    ran += RunSlot(current_ & kSlotMask);
+  }
+  return ran;
+}
+
+int TimerWheel::NextTimeoutMs(Clock::time_point now) const {
+  if (pending_ == 0) {
+    return -1;
+  }
+  uint64_t next = 0;
+  for (int level = 0; level < kLevels; ++level) {
+    const uint64_t tick = NextTickForLevel(level);
+    if (tick != 0 && (next == 0 || tick < next)) {
+      next = tick;
+    }
+  }
+  const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(TimeOfTick(next) - now).count();
+  return static_cast<int>(std::max<int64_t>(0, remaining));
+}
+
+uint64_t TimerWheel::TickAt(Clock::time_point time) const {
+  if (time <= origin_) {
+    return 0;
+  }
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(time - origin_).count()) /
+         kTickMs;
+}
+
+TimerWheel::Clock::time_point TimerWheel::TimeOfTick(uint64_t tick) const {
+  return origin_ + std::chrono::milliseconds(static_cast<int64_t>(tick) * kTickMs);
+}
+
+void TimerWheel::Place(int32_t index) {
+  const uint64_t expires = std::max(nodes_[index].expires, current_);
+  const uint64_t delta = expires - current_;
+  for (int level = 0; level < kLevels; ++level) {
+    if (delta < (uint64_t{1} << (kSlotBits * (level + 1)))) {
+      Link(index, level, (expires >> (kSlotBits * level)) & kSlotMask);
+      return;
+    }
+  }
+  // Beyond the top level: park in the furthest slot and re-file from there.
+  const int top = kLevels - 1;
+  const uint64_t parked = current_ + (uint64_t{1} << (kSlotBits * kLevels)) - 1;
+  Link(index, top, (parked >> (kSlotBits * top)) & kSlotMask);
+}
+
+void TimerWheel::Link(int32_t index, int level, uint64_t slot) {
+  Node& node = nodes_[index];
+  int32_t& head = heads_[level][slot];
+  node.level = static_cast<int8_t>(level);
+  node.slot = static_cast<uint8_t>(slot);
+  node.prev = kNone;
+  node.next = head;
+  if (head != kNone) {
+    nodes_[head].prev = index;
+  }
+  head = index;
+  occupied_[level] |= uint64_t{1} << slot;
+}
+
+void TimerWheel::Unlink(int32_t index) {
+  Node& node = nodes_[index];
+  int32_t& head = heads_[node.level][node.slot];
+  if (node.prev != kNone) {
+    nodes_[node.prev].next = node.next;
+  } else {
+    head = node.next;
+  }
+  if (node.next != kNone) {
+    nodes_[node.next].prev = node.prev;
+  }
+  if (head == kNone) {
+    occupied_[node.level] &= ~(uint64_t{1} << node.slot);
+  }
+  node.prev = kNone;
+  node.next = kNone;
+}
+
+void TimerWheel::Release(int32_t index) {
+  Node& node = nodes_[index];
+  node.callback = nullptr;
+  node.level = kFree;
+  node.generation++;
+  free_.push_back(index);
+}
+
+void TimerWheel::Cascade(int level) {
+  const uint64_t slot = (current_ >> (kSlotBits * level)) & kSlotMask;
+  int32_t index = heads_[level][slot];
+  heads_[level][slot] = kNone;
+  occupied_[level] &= ~(uint64_t{1} << slot);
+  while (index != kNone) {
+    const int32_t next = nodes_[index].next;
+    Place(index);
+    index = next;
+  }
+}
+
+size_t TimerWheel::RunSlot(uint64_t slot) {
+  std::vector<std::pair<int32_t, uint32_t>> due;
+  due.swap(due_);
+  for (int32_t index = heads_[0][slot]; index != kNone; index = nodes_[index].next) {
+    nodes_[index].level = kDue;
+    due.emplace_back(index, nodes_[index].generation);
+  }
+  heads_[0][slot] = kNone;
+  occupied_[0] &= ~(uint64_t{1} << slot);
+
+  size_t ran = 0;
+  for (const auto& entry : due) {
+    Node& node = nodes_[entry.first];
+    if (node.level != kDue || node.generation != entry.second) {
+      continue;
+    }
+    Callback callback = std::move(node.callback);
+    Release(entry.first);
+    pending_--;
+    ran++;
+    callback();
+  }
+  due.clear();
+  due_.swap(due);
+  return ran;
+}
+
+uint64_t TimerWheel::NextTickForLevel(int level) const {
+  if (occupied_[level] == 0) {
+    return 0;
+  }
+  const int shift = kSlotBits * level;
+  const uint64_t position = current_ >> shift;
+  // Distance, 1 to 64 slots, to the next occupied slot after this one; a
+  // timer in the current slot belongs to the next turn of the level.
+  const uint64_t rotated = RotateRight(occupied_[level], static_cast<unsigned>((position + 1) & kSlotMask));
+  const uint64_t distance = static_cast<uint64_t>(CountTrailingZeros(rotated)) + 1;
+  return (position + distance) << shift;
+}
+}
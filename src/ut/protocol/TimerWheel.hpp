@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace ut {
+// Hierarchical timing wheel: four levels of 64 slots over 10ms ticks, which
+// covers about 46 hours before a timer has to be re-filed. Scheduling and
+// cancelling are O(1), and so is each tick; long idle stretches are skipped
+// using per-level occupancy bitmaps instead of being stepped through.
+//
+// Not thread-safe. ut::Reactor owns one per polling thread and drives it
+// from Poll().
+class TimerWheel {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Callback = std::function<void()>;
+  // 0 is never a valid id.
+  using TimerId = uint64_t;
+
+  static constexpr int kTickMs = 10;
+
+  explicit TimerWheel(Clock::time_point now = Clock::now());
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // Runs `callback` once, no earlier than `delay_ms` from `now` (rounded up
+  // to the next tick).
+  TimerId Schedule(int delay_ms, Callback callback, Clock::time_point now = Clock::now());
+  // Returns false when the timer already ran or was cancelled. Safe from
+  // inside a timer callback, including for timers due in the same tick.
+  bool Cancel(TimerId id);
+
+  // Runs every timer due by `now` and returns how many ran. Callbacks may
+  // schedule and cancel timers.
+  size_t Advance(Clock::time_point now = Clock::now());
+  // How long a poller may sleep before Advance has work: the time to the
+  // next due timer or to the next cascade of a higher level, whichever is
+  // sooner. -1 when no timer is pending.
+  int NextTimeoutMs(Clock::time_point now = Clock::now()) const;
+
+  size_t size() const { return pending_; }
+
+ private:
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 6;
+  static constexpr uint64_t kSlots = 1u << kSlotBits;
+  static constexpr uint64_t kSlotMask = kSlots - 1;
+  static constexpr int32_t kNone = -1;
+  // Node::level for a timer taken out of its slot to run this tick.
+  static constexpr int8_t kDue = -1;
+  static constexpr int8_t kFree = -2;
+
+  struct Node {
+    uint64_t expires = 0;
+    Callback callback;
+    uint32_t generation = 0;
+    int32_t prev = kNone;
+    int32_t next = kNone;
+    int8_t level = kFree;
+    uint8_t slot = 0;
+  };
+
+  uint64_t TickAt(Clock::time_point time) const;
+  Clock::time_point TimeOfTick(uint64_t tick) const;
+  void Place(int32_t index);
+  void Link(int32_t index, int level, uint64_t slot);
+  void Unlink(int32_t index);
+  void Release(int32_t index);
+  void Cascade(int level);
+  size_t RunSlot(uint64_t slot);
+  // The first tick after current_ at which `level` has work (a due timer on
+  // level 0, a cascade above it), or 0 when the level is empty.
+  uint64_t NextTickForLevel(int level) const;
+
+  Clock::time_point origin_;
+  uint64_t current_ = 0;
+  size_t pending_ = 0;
+  std::vector<Node> nodes_;
+  std::vector<int32_t> free_;
+  int32_t heads_[kLevels][kSlots];
+  uint64_t occupied_[kLevels] = {};
+  std::vector<std::pair<int32_t, uint32_t>> due_;
+};
+}
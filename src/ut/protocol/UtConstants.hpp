@@ -1,8 +1,68 @@
 #pragma once
+
+#include <cstddef>
+#include <cstdint>
  
 namespace ut {
-constexpr int kProtocolVersion = 6;
+constexpr int kProtocolVersion = 12;
+// ConnectRequest.version carries kProtocolVersion in its low bits, the
+// proposed CipherSuite in the eight bits from kCipherSuiteShift and flags
+// above that.
+constexpr int kCipherSuiteShift = 16;
+constexpr int kCipherSuiteMask = 0xff;
+constexpr int kProtocolVersionMask = (1 << kCipherSuiteShift) - 1;
+// Set by a reconnecting client whose SequenceHeader follows the
+// ConnectRequest in the same write, so resuming costs one round trip.
+constexpr int kResumeSequenceFlag = 1 << 24;
+// A connecting client may send this many sealed packets (INITIAL_PAYLOAD
+// first, then early input) straight after its ConnectRequest. The server
+// answers NEW_CLIENT together with INITIAL_RESPONSE, or discards them when
+// the session turns out to exist already.
+constexpr int kPipelinedPacketsShift = 25;
+constexpr int kPipelinedPacketsMask = 0x1f;
 constexpr unsigned char kClientServerNonceMsb = 0;
 constexpr unsigned char kServerClientNonceMsb = 1;
 constexpr int kMaxBackupBytes = 64 * 1024 * 1024;
+constexpr size_t kCatchupChunkBytes = 256 * 1024;
+// Connection-level cumulative acknowledgement (a SequenceHeader payload).
+// Consumed by Connection::Read and never surfaced to callers.
+constexpr uint8_t kAckPacketHeader = 251;
+constexpr size_t kAckIntervalBytes = 64 * 1024;
+constexpr int kAckIntervalMs = 1000;
+// Terminal -> server over the Unix-domain terminal socket, carrying the PTY
+// master as SCM_RIGHTS. From then on the server relays the PTY itself.
+constexpr uint8_t kTerminalPtyHandoffHeader = 250;
+// Server -> terminal instead of TERMINAL_INIT when the server hosts the shell
+// in-process: the session is registered and the terminal process can exit.
+constexpr uint8_t kTerminalServerHostedHeader = 249;
+// Clients send KEEP_ALIVE every kKeepaliveIntervalSeconds (the server echoes
+// it). Either side treats a peer it has heard nothing from for
+// kDeadPeerSeconds as gone and drops the socket, so the client reconnects.
+constexpr int kKeepaliveIntervalSeconds = 5;
+constexpr int kDeadPeerSeconds = 15;
+// A connecting client must send each handshake message within this long.
+constexpr int kHandshakeTimeoutSeconds = 30;
+// A registered session no client is attached to (its handshake failed or
+// timed out) is dropped, and its terminal closed, after this long; the server
+// looks for such sessions every kStaleSessionSweepSeconds.
+constexpr int kStaleSessionSeconds = 10 * 60;
+constexpr int kStaleSessionSweepSeconds = 60;
+// Terminal output is batched while the shell keeps producing it, up to
+// this many bytes or this long after the batch's first byte.
+constexpr size_t kCoalesceMaxBytes = 64 * 1024;
+constexpr int kCoalesceMaxDelayUs = 2000;
+// Lines of scrollback a session's screen model keeps for reconnect
+// snapshots.
+constexpr size_t kSnapshotScrollbackLines = 500;
+// A returning client that missed more terminal output than this gets a
+// screen snapshot instead of a replay of the backlog.
+constexpr size_t kMaxReplayBytes = 1024 * 1024;
+// Once this much terminal output in a row has left the client's socket
+// full, the link is not keeping up: the server stops relaying terminal
+// output and sends screen frames instead, at most one per kFrameIntervalMs
+// and only once the socket has drained. The kernel grows the send buffer to
+// the path's bandwidth-delay product, so a full buffer means the link is
+// slow, not merely far away.
+constexpr size_t kRenderBacklogBytes = 128 * 1024;
+constexpr int kFrameIntervalMs = 20;
 }
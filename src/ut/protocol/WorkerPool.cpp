@@ -0,0 +1,79 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+
+namespace ut {
+WorkerPool::WorkerPool(size_t helpers) {
+  threads_.reserve(helpers);
+  for (size_t i = 0; i < helpers; ++i) {
+    threads_.emplace_back(&WorkerPool::Run, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+WorkerPool& WorkerPool::Shared() {
+  static WorkerPool pool([] {
+    const unsigned cores = std::thread::hardware_concurrency();
+    return cores > 1 ? std::min<size_t>(cores - 1, kMaxHelpers) : 0;
+  }());
+  return pool;
+}
+
+void WorkerPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn) {
+  std::unique_lock<std::mutex> submit(submit_mutex_, std::try_to_lock);
+  if (!submit.owns_lock() || threads_.empty() || count < 2) {
+    for (size_t i = 0; i < count; ++i) {
+      fn(i);
+    }
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    job_ = &fn;
+    count_ = count;
+    next_.store(0);
+    busy_ = threads_.size();
+    generation_++;
+  }
+  wake_.notify_all();
+  Drain();
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return busy_ == 0; });
+  job_ = nullptr;
+}
+
+void WorkerPool::Run() {
+  uint64_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+      if (stopping_) {
+        return;
+      }
+      seen = generation_;
+    }
+    Drain();
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (--busy_ == 0) {
+      done_.notify_one();
+    }
+  }
+}
+
+void WorkerPool::Drain() {
+  for (size_t i = next_.fetch_add(1); i < count_; i = next_.fetch_add(1)) {
+    (*job_)(i);
+  }
+}
+}
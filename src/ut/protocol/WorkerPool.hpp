@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ut {
+// A fixed set of helper threads for splitting CPU-bound work such as
+// decrypting a replayed backlog. The calling thread always takes part, and
+// one ParallelFor runs at a time; a caller that finds the pool busy simply
+// does the work itself.
+class WorkerPool {
+ public:
+  explicit WorkerPool(size_t helpers);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // Process-wide pool with one helper per spare core, at most kMaxHelpers.
+  static WorkerPool& Shared();
+
+  // Calls fn(0) .. fn(count - 1), in no particular order, and returns once
+  // every call has finished. `fn` must not throw.
+  void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+  size_t helpers() const { return threads_.size(); }
+
+ private:
+  static constexpr size_t kMaxHelpers = 3;
+
+  void Run();
+  void Drain();
+
+  std::mutex submit_mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  std::vector<std::thread> threads_;
+  const std::function<void(size_t)>* job_ = nullptr;
+  size_t count_ = 0;
+  std::atomic<size_t> next_{0};
+  size_t busy_ = 0;
+  uint64_t generation_ = 0;
+  bool stopping_ = false;
+};
+}
@@ -1,84 +1,107 @@
 #include "ClientRegistry.hpp"
 
+#include <functional>
+
 void ClientRegistry::RegisterTerminal(const std::string& client_id, const std::string& passkey, ut::SocketHandle handle) {
-  ClientSession& session = sessions_[client_id];
-  session.terminal_handle = handle;
-  session.passkey = passkey;
-  session.last_seen = std::chrono::steady_clock::now();
-  session.active = true;
+  Register(std::make_shared<ClientSession>(client_id, passkey, handle, false));
 }
 
-void ClientRegistry::UnregisterTerminal(const std::string& client_id) {
-  sessions_.erase(client_id);
+void ClientRegistry::RegisterHostedSession(const std::string& client_id, const std::string& passkey) {
+  Register(std::make_shared<ClientSession>(client_id, passkey, ut::kInvalidSocket, true));
 }
 
-ut::SocketHandle ClientRegistry::LookupTerminal(const std::string& client_id) const {
-  auto it = sessions_.find(client_id);
-  if (it == sessions_.end()) {
-    return ut::kInvalidSocket;
+void ClientRegistry::Register(std::shared_ptr<ClientSession> session) {
+  Shard& shard = ShardFor(session->client_id);
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  auto& slot = shard.sessions[session->client_id];
+  if (slot) {
+    if (!slot->active()) {
+      shard.idle.erase({slot->idle_since_, slot->client_id});
+    }
+    // A terminal registering again (say, after restarting) must not cut off
+    // the client connection the session already has.
+    std::lock_guard<std::mutex> guard(slot->mutex_);
+    session->connection_ = std::move(slot->connection_);
   }
-  return it->second.terminal_handle;
+  slot = std::move(session);
 }
 
-std::string ClientRegistry::LookupPasskey(const std::string& client_id) const {
-  auto it = sessions_.find(client_id);
-  if (it == sessions_.end()) {
-    return {};
+void ClientRegistry::UnregisterTerminal(const std::string& client_id) {
+  Shard& shard = ShardFor(client_id);
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.sessions.find(client_id);
+  if (it == shard.sessions.end()) {
+    return;
   }
-  return it->second.passkey;
+  if (!it->second->active()) {
+    shard.idle.erase({it->second->idle_since_, client_id});
+  }
+  shard.sessions.erase(it);
 }
 
-std::shared_ptr<ut::ServerClientConnection> ClientRegistry::LookupConnection(const std::string& client_id) const {
-  auto it = sessions_.find(client_id);
-  if (it == sessions_.end()) {
-    return nullptr;
-  }
-  return it->second.connection;
+std::shared_ptr<ClientSession> ClientRegistry::Lookup(const std::string& client_id) const {
+  const Shard& shard = ShardFor(client_id);
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.sessions.find(client_id);
+  return it == shard.sessions.end() ? nullptr : it->second;
 }
 
 void ClientRegistry::StoreConnection(const std::string& client_id,
                                      std::shared_ptr<ut::ServerClientConnection> connection) {
-  auto it = sessions_.find(client_id);
-  if (it == sessions_.end()) {
+  // The shard lock keeps a concurrent re-registration from carrying over
+  // the connection before this stores it.
+  const Shard& shard = ShardFor(client_id);
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.sessions.find(client_id);
+  if (it == shard.sessions.end()) {
     return;
   }
-  it->second.connection = std::move(connection);
-}
-
-bool ClientRegistry::HasSession(const std::string& client_id) const {
-  return sessions_.find(client_id) != sessions_.end();
+  std::lock_guard<std::mutex> guard(it->second->mutex_);
+  it->second->connection_ = std::move(connection);
 }
 
-void ClientRegistry::UpdateLastSeen(const std::string& client_id) {
-  auto it = sessions_.find(client_id);
-  if (it != sessions_.end()) {
-    it->second.last_seen = std::chrono::steady_clock::now();
+void ClientRegistry::MarkActive(const std::string& client_id, bool active) {
+  Shard& shard = ShardFor(client_id);
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.sessions.find(client_id);
+  if (it == shard.sessions.end()) {
+    return;
+  }
+  ClientSession& session = *it->second;
+  if (!session.active()) {
+    shard.idle.erase({session.idle_since_, client_id});
+  }
+  session.active_.store(active, std::memory_order_release);
+  if (!active) {
+    // Going (or staying) inactive restarts the expiry clock.
+    session.idle_since_ = std::chrono::steady_clock::now();
+    shard.idle.emplace(session.idle_since_, client_id);
   }
 }
 
-void ClientRegistry::MarkActive(const std::string& client_id, bool active) {
-  auto it = sessions_.find(client_id);
-  if (it != sessions_.end()) {
-    it->second.active = active;
+std::vector<ut::SocketHandle> ClientRegistry::CleanupStale(int timeout_seconds) {
+  std::vector<ut::SocketHandle> terminals;
+  const auto cutoff = std::chrono::steady_clock::now() - std::chrono::seconds(timeout_seconds);
+  for (Shard& shard : shards_) {
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    while (!shard.idle.empty() && shard.idle.begin()->first < cutoff) {
+      auto it = shard.sessions.find(shard.idle.begin()->second);
+      if (it != shard.sessions.end()) {
+        if (it->second->terminal_handle != ut::kInvalidSocket) {
+          terminals.push_back(it->second->terminal_handle);
+        }
+        shard.sessions.erase(it);
+      }
+      shard.idle.erase(shard.idle.begin());
+    }
   }
+  return terminals;
 }
 
-bool ClientRegistry::IsActive(const std::string& client_id) const {
-  auto it = sessions_.find(client_id);
-  if (it == sessions_.end()) {
-    return false;
-  }
-  return it->second.active;
+ClientRegistry::Shard& ClientRegistry::ShardFor(const std::string& client_id) {
+  return shards_[std::hash<std::string>{}(client_id) % kShardCount];
 }
 
-void ClientRegistry::CleanupStale(int timeout_seconds) {
-  auto now = std::chrono::steady_clock::now();
-  for (auto it = sessions_.begin(); it != sessions_.end();) {
-    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - it->second.last_seen).count();
-    if (!it->second.active && elapsed > timeout_seconds) {
-      it = sessions_.erase(it);
-    } else {
-      ++it;
-    }
-  }
+const ClientRegistry::Shard& ClientRegistry::ShardFor(const std::string& client_id) const {
+  return shards_[std::hash<std::string>{}(client_id) % kShardCount];
 }
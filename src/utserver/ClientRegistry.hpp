@@ -1,9 +1,16 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "protocol/SocketTypes.hpp"
 
@@ -11,29 +18,70 @@ namespace ut {
 class ServerClientConnection;
 }
 
+// A registered session. The registration fields never change; registering
+// the same id again replaces the whole entry (keeping its connection), so a
+// handle returned by ClientRegistry::Lookup can be read without holding any
+// registry lock.
 struct ClientSession {
-  ut::SocketHandle terminal_handle = ut::kInvalidSocket;
-  std::string passkey;
-  std::shared_ptr<ut::ServerClientConnection> connection;
-  std::chrono::steady_clock::time_point last_seen;
-  bool active = false;
+  ClientSession(std::string id, std::string key, ut::SocketHandle terminal, bool hosted)
+      : client_id(std::move(id)), passkey(std::move(key)), terminal_handle(terminal), host_pty(hosted) {}
+
+  const std::string client_id;
+  const std::string passkey;
+  const ut::SocketHandle terminal_handle;
+  // The server starts the shell itself (PtyHost) instead of relaying a
+  // terminal process.
+  const bool host_pty;
+
+  std::shared_ptr<ut::ServerClientConnection> connection() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return connection_;
+  }
+  bool active() const { return active_.load(std::memory_order_acquire); }
+
+ private:
+  friend class ClientRegistry;
+
+  mutable std::mutex mutex_;
+  std::shared_ptr<ut::ServerClientConnection> connection_;
+  std::atomic<bool> active_{true};
+  // When the session went inactive: its key in the shard's expiry index.
+  // Guarded by the shard lock.
+  std::chrono::steady_clock::time_point idle_since_;
 };
 
+// Sessions are spread over kShardCount shards by id, each with its own
+// reader-writer lock, so handshakes on different server shards rarely
+// contend and lookups never wait on each other. Each shard keeps inactive
+// sessions ordered by when they went idle, so CleanupStale only visits the
+// ones that have expired.
 class ClientRegistry {
  public:
   void RegisterTerminal(const std::string& client_id, const std::string& passkey, ut::SocketHandle handle);
+  // Registers a session whose shell the server will host in-process.
+  void RegisterHostedSession(const std::string& client_id, const std::string& passkey);
   void UnregisterTerminal(const std::string& client_id);
-  ut::SocketHandle LookupTerminal(const std::string& client_id) const;
-  std::string LookupPasskey(const std::string& client_id) const;
-  std::shared_ptr<ut::ServerClientConnection> LookupConnection(const std::string& client_id) const;
+  // Everything a handshake needs in one lookup; nullptr for an unknown id.
+  std::shared_ptr<ClientSession> Lookup(const std::string& client_id) const;
   void StoreConnection(const std::string& client_id, std::shared_ptr<ut::ServerClientConnection> connection);
 
-  bool HasSession(const std::string& client_id) const;
-  void UpdateLastSeen(const std::string& client_id);
   void MarkActive(const std::string& client_id, bool active);
-  bool IsActive(const std::string& client_id) const;
-  void CleanupStale(int timeout_seconds);
+  // Drops sessions inactive for longer than `timeout_seconds` and returns
+  // their terminal handles for the caller to close.
+  std::vector<ut::SocketHandle> CleanupStale(int timeout_seconds);
 
  private:
-  std::unordered_map<std::string, ClientSession> sessions_;
+  static constexpr size_t kShardCount = 16;
+
+  struct Shard {
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<ClientSession>> sessions;
+    std::set<std::pair<std::chrono::steady_clock::time_point, std::string>> idle;
+  };
+
+  void Register(std::shared_ptr<ClientSession> session);
+  Shard& ShardFor(const std::string& client_id);
+  const Shard& ShardFor(const std::string& client_id) const;
+
+  std::array<Shard, kShardCount> shards_;
 };
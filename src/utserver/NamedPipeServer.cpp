@@ -3,8 +3,6 @@
 #ifdef _WIN32
 #include <windows.h>
 
-#include <cstdlib>
-#include <cstring>
 #include <iostream>
 #include <string>
 #include <thread>
@@ -14,16 +12,6 @@
 #include "UTerminal.pb.h"
 #include "Verbose.hpp"
 
-namespace {
-std::wstring GetPipeName() {
-  const char* env = std::getenv("UT_PIPE_NAME");
-  if (env && *env) {
-    return std::wstring(env, env + std::strlen(env));
-  }
-  return L"\\\\.\\pipe\\undying-terminal";
-}
-}
-
 NamedPipeServer::NamedPipeServer() = default;
 
 NamedPipeServer::~NamedPipeServer() {
@@ -34,7 +22,7 @@ bool NamedPipeServer::Start(ClientRegistry* registry) {
   Stop();
 
   registry_ = registry;
-  pipe_name_ = GetPipeName();
+  pipe_name_ = ut::TerminalPipeName();
 
   stop_event_ = CreateEventW(nullptr, TRUE, FALSE, nullptr);
   if (!stop_event_) {
@@ -55,17 +43,6 @@ void NamedPipeServer::Stop() {
   if (stop_event_) {
     SetEvent(static_cast<HANDLE>(stop_event_));
   }
-  HANDLE cancel_pipe = CreateFileW(
-      pipe_name_.empty() ? L"\\\\.\\pipe\\undying-terminal" : pipe_name_.c_str(),
-      GENERIC_READ | GENERIC_WRITE,
-      0,
-      nullptr,
-      OPEN_EXISTING,
-      FILE_ATTRIBUTE_NORMAL,
-      nullptr);
-  if (cancel_pipe != INVALID_HANDLE_VALUE) {
-    CloseHandle(cancel_pipe);
-  }
   if (worker_.joinable()) {
     worker_.join();
   }
@@ -84,7 +61,8 @@ void NamedPipeServer::Run() {
 
     HANDLE pipe = CreateNamedPipeW(
         pipe_name_.empty() ? L"\\\\.\\pipe\\undying-terminal" : pipe_name_.c_str(),
-        PIPE_ACCESS_DUPLEX,
+        // Overlapped so that sessions can wait on the pipe (see ut::Reactor).
+        PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
         PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
         PIPE_UNLIMITED_INSTANCES,
         4096,
@@ -104,7 +82,23 @@ void NamedPipeServer::Run() {
       break;
     }
 
-    BOOL connected = ConnectNamedPipe(pipe, nullptr) ? TRUE : (GetLastError() == ERROR_PIPE_CONNECTED);
+    OVERLAPPED overlapped{};
+    overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    BOOL connected = FALSE;
+    if (overlapped.hEvent) {
+      connected = ConnectNamedPipe(pipe, &overlapped) ? TRUE : (GetLastError() == ERROR_PIPE_CONNECTED);
+      if (!connected && GetLastError() == ERROR_IO_PENDING) {
+        HANDLE waits[] = {overlapped.hEvent, static_cast<HANDLE>(stop_event_)};
+        DWORD ignored = 0;
+        if (WaitForMultipleObjects(2, waits, FALSE, INFINITE) == WAIT_OBJECT_0) {
+          connected = GetOverlappedResult(pipe, &overlapped, &ignored, FALSE);
+        } else {
+          CancelIoEx(pipe, &overlapped);
+          GetOverlappedResult(pipe, &overlapped, &ignored, TRUE);
+        }
+      }
+      CloseHandle(overlapped.hEvent);
+    }
     if (connected) {
       HandleClient(pipe);
     } else {
@@ -131,7 +125,7 @@ void NamedPipeServer::HandleClient(void* pipe_handle) {
     return;
   }
   ut::TerminalUserInfo info;
-  if (!info.ParseFromString(packet.payload())) {
+  if (!packet.ParsePayload(&info)) {
     CloseHandle(pipe);
     return;
   }
@@ -139,13 +133,194 @@ void NamedPipeServer::HandleClient(void* pipe_handle) {
   registry_->RegisterTerminal(info.id(), info.passkey(), reinterpret_cast<ut::SocketHandle>(pipe_handle));
 }
 #else
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "ClientRegistry.hpp"
+#include "protocol/Packet.hpp"
+#include "protocol/PipeSocketHandler.hpp"
+#include "protocol/Reactor.hpp"
+#include "UTerminal.pb.h"
+#include "UtConstants.hpp"
+#include "Verbose.hpp"
+
+namespace {
+// TERMINAL_USER_INFO is an id and a passkey; anything longer is not a
+// terminal.
+constexpr uint32_t kMaxUserInfoBytes = 64 * 1024;
+}
+
 NamedPipeServer::NamedPipeServer() = default;
-NamedPipeServer::~NamedPipeServer() = default;
+
+NamedPipeServer::~NamedPipeServer() {
+  Stop();
+}
 
 bool NamedPipeServer::Start(ClientRegistry* registry) {
-  (void)registry;
+  Stop();
+
+  registry_ = registry;
+  socket_path_ = ut::TerminalPipeName();
+  sockaddr_un addr{};
+  if (socket_path_.size() >= sizeof(addr.sun_path)) {
+    if (IsVerbose()) {
+      std::cerr << "Terminal socket path too long: " << socket_path_ << "\n";
+    }
+    return false;
+  }
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, socket_path_.c_str(), socket_path_.size() + 1);
+
+  // A socket file nobody answers on is left over from an earlier run; one
+  // that answers belongs to a live server.
+  ut::PipeSocketHandler probe_handler;
+  const ut::SocketHandle probe = probe_handler.Connect(socket_path_);
+  if (probe != ut::kInvalidSocket) {
+    probe_handler.Close(probe);
+    std::cerr << "Another server is listening on " << socket_path_ << "\n";
+    return false;
+  }
+  unlink(socket_path_.c_str());
+
+  const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    return false;
+  }
+  if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      chmod(socket_path_.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(sock, SOMAXCONN) != 0) {
+    if (IsVerbose()) {
+      std::cerr << "Terminal socket listen failed: " << std::strerror(errno) << "\n";
+    }
+    close(sock);
+    unlink(socket_path_.c_str());
+    return false;
+  }
+  listen_socket_ = static_cast<ut::SocketHandle>(sock);
+
+  reactor_ = std::make_unique<ut::Reactor>();
+  reactor_->AddAcceptor(listen_socket_, [this](ut::SocketHandle client) { HandleClient(client); });
+  running_ = true;
+  worker_ = std::thread(&NamedPipeServer::Run, this);
   return true;
 }
 
-void NamedPipeServer::Stop() {}
+void NamedPipeServer::Stop() {
+  running_ = false;
+  if (reactor_) {
+    reactor_->Wake();
+  }
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+  if (listen_socket_ != ut::kInvalidSocket) {
+    reactor_->Remove(listen_socket_);
+    close(static_cast<int>(listen_socket_));
+    listen_socket_ = ut::kInvalidSocket;
+    unlink(socket_path_.c_str());
+  }
+  while (!pending_.empty()) {
+    DropPending(pending_.begin()->first);
+  }
+  reactor_.reset();
+  registry_ = nullptr;
+}
+
+void NamedPipeServer::Run() {
+  while (running_) {
+    reactor_->Poll(-1);
+  }
+}
+
+void NamedPipeServer::HandleClient(ut::SocketHandle socket) {
+  if (!registry_) {
+    ut::PipeSocketHandler().Close(socket);
+    return;
+  }
+  PendingTerminal& pending = pending_[socket];
+  pending.timeout =
+      reactor_->AddTimer(ut::kHandshakeTimeoutSeconds * 1000, [this, socket] { DropPending(socket); });
+  reactor_->Add(socket, [this, socket] { OnClientReadable(socket); });
+}
+
+void NamedPipeServer::OnClientReadable(ut::SocketHandle socket) {
+  auto it = pending_.find(socket);
+  if (it == pending_.end()) {
+    return;
+  }
+  std::string& frame = it->second.frame;
+  // Never read past the frame: the PTY handoff may already be queued behind
+  // it, with its descriptor attached.
+  size_t frame_size = ut::Packet::kLengthBytes;
+  if (frame.size() >= ut::Packet::kLengthBytes) {
+    const uint32_t length = ut::Packet::DecodeLength(frame.data());
+    if (length < ut::Packet::kHeaderBytes || length > kMaxUserInfoBytes) {
+      DropPending(socket);
+      return;
+    }
+    frame_size += length;
+  }
+  char buffer[4096];
+  ut::PipeSocketHandler pipe_handler;
+  const int rc = pipe_handler.Read(socket, buffer, std::min(sizeof(buffer), frame_size - frame.size()));
+  if (rc <= 0) {
+    DropPending(socket);
+    return;
+  }
+  frame.append(buffer, static_cast<size_t>(rc));
+  if (frame.size() <= ut::Packet::kLengthBytes ||
+      frame.size() < ut::Packet::kLengthBytes + ut::Packet::DecodeLength(frame.data())) {
+    // The rest raises another readiness event.
+    return;
+  }
+  reactor_->Remove(socket);
+  reactor_->CancelTimer(it->second.timeout);
+  auto buffer_owner = std::make_shared<std::string>(std::move(frame));
+  pending_.erase(it);
+  RegisterClient(socket, ut::Packet(buffer_owner, 0, buffer_owner->size()));
+}
+
+void NamedPipeServer::DropPending(ut::SocketHandle socket) {
+  auto it = pending_.find(socket);
+  if (it == pending_.end()) {
+    return;
+  }
+  reactor_->Remove(socket);
+  reactor_->CancelTimer(it->second.timeout);
+  pending_.erase(it);
+  ut::PipeSocketHandler().Close(socket);
+}
+
+void NamedPipeServer::RegisterClient(ut::SocketHandle socket, const ut::Packet& packet) {
+  ut::PipeSocketHandler pipe_handler;
+  if (!registry_ || packet.header() != static_cast<uint8_t>(ut::TERMINAL_USER_INFO)) {
+    pipe_handler.Close(socket);
+    return;
+  }
+  ut::TerminalUserInfo info;
+  if (!packet.ParsePayload(&info)) {
+    pipe_handler.Close(socket);
+    return;
+  }
+
+  if (in_process_pty_) {
+    registry_->RegisterHostedSession(info.id(), info.passkey());
+    try {
+      pipe_handler.WritePacket(socket, ut::Packet(ut::kTerminalServerHostedHeader, ""));
+    } catch (const std::exception&) {
+    }
+    pipe_handler.Close(socket);
+    return;
+  }
+  registry_->RegisterTerminal(info.id(), info.passkey(), socket);
+}
 #endif
@@ -1,7 +1,18 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <thread>
+#include <unordered_map>
+
+#include "protocol/SocketTypes.hpp"
+#include "protocol/TimerWheel.hpp"
+
+namespace ut {
+class Packet;
+class Reactor;
+}
 
 class NamedPipeServer {
  public:
@@ -13,16 +24,36 @@ class NamedPipeServer {
 
   bool Start(class ClientRegistry* registry);
   void Stop();
+  // Registers terminals as in-process sessions (see PtyHost) and releases
+  // the terminal process. Ignored on Windows.
+  void SetInProcessPty(bool enabled) { in_process_pty_ = enabled; }
 
  private:
- private:
-#ifdef _WIN32
   void Run();
-  void HandleClient(void* pipe_handle);
   class ClientRegistry* registry_ = nullptr;
-  void* stop_event_ = nullptr;
   std::thread worker_;
-  bool running_ = false;
+  std::atomic<bool> running_{false};
+  bool in_process_pty_ = false;
+#ifdef _WIN32
+  void HandleClient(void* pipe_handle);
+  void* stop_event_ = nullptr;
   std::wstring pipe_name_;
+#else
+  // Terminals connect over a Unix-domain socket at `socket_path_`, readable
+  // and writable by the server's user only. A new terminal's
+  // TERMINAL_USER_INFO is read as it arrives, so one that stalls holds up
+  // nobody else.
+  struct PendingTerminal {
+    std::string frame;
+    ut::TimerWheel::TimerId timeout = 0;
+  };
+  void HandleClient(ut::SocketHandle socket);
+  void OnClientReadable(ut::SocketHandle socket);
+  void DropPending(ut::SocketHandle socket);
+  void RegisterClient(ut::SocketHandle socket, const ut::Packet& packet);
+  std::unique_ptr<ut::Reactor> reactor_;
+  ut::SocketHandle listen_socket_ = ut::kInvalidSocket;
+  std::string socket_path_;
+  std::unordered_map<ut::SocketHandle, PendingTerminal> pending_;
 #endif
 };
@@ -0,0 +1,111 @@
+#include "PtyHost.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "protocol/Reactor.hpp"
+#include "Verbose.hpp"
+
+namespace {
+// How long a hung-up shell gets to exit before its session is killed.
+constexpr int kHangupGraceMs = 100;
+constexpr int kMaxReapIntervalMs = 1000;
+
+// Polls for the shell's exit without blocking; the interval doubles while
+// it lingers, so a child stuck in the kernel costs little.
+void ReapLater(ut::Reactor* reactor, pid_t pid, int waited_ms, int interval_ms) {
+  reactor->AddTimer(interval_ms, [reactor, pid, waited_ms, interval_ms] {
+    if (waitpid(pid, nullptr, WNOHANG) != 0) {
+      return;
+    }
+    const int waited = waited_ms + interval_ms;
+    if (waited_ms < kHangupGraceMs && waited >= kHangupGraceMs) {
+      kill(-pid, SIGKILL);
+    }
+    ReapLater(reactor, pid, waited, std::min(interval_ms * 2, kMaxReapIntervalMs));
+  });
+}
+}
+
+PtyHost::PtyHost() = default;
+
+PtyHost::~PtyHost() {
+  Release(nullptr);
+}
+
+void PtyHost::Release(ut::Reactor* reactor) {
+  if (master_ >= 0) {
+    close(master_);
+    master_ = -1;
+  }
+  const pid_t pid = pid_;
+  pid_ = -1;
+  // Normally the shell has already exited (that is what ends the session)
+  // and this reaps it at once.
+  if (pid <= 0 || waitpid(pid, nullptr, WNOHANG) != 0) {
+    return;
+  }
+  if (!reactor) {
+    kill(-pid, SIGKILL);
+    waitpid(pid, nullptr, WNOHANG);
+    return;
+  }
+  kill(-pid, SIGHUP);
+  ReapLater(reactor, pid, 0, ut::TimerWheel::kTickMs);
+}
+
+bool PtyHost::Start(const std::string& shell) {
+  std::string program = shell;
+  if (program.empty()) {
+    const char* env = std::getenv("SHELL");
+    program = env && *env ? env : "/bin/sh";
+  }
+
+  winsize size{};
+  size.ws_col = 80;
+  size.ws_row = 24;
+  int master = -1;
+  const pid_t pid = forkpty(&master, nullptr, nullptr, &size);
+  if (pid < 0) {
+    if (IsVerbose()) {
+      std::cerr << "forkpty failed: " << std::strerror(errno) << "\n";
+    }
+    return false;
+  }
+  if (pid == 0) {
+    execl(program.c_str(), program.c_str(), static_cast<char*>(nullptr));
+    _exit(127);
+  }
+  fcntl(master, F_SETFD, FD_CLOEXEC);
+  // The session reads and writes it from the shard's reactor.
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+  master_ = master;
+  pid_ = pid;
+  return true;
+}
+#else
+PtyHost::PtyHost() = default;
+PtyHost::~PtyHost() = default;
+
+void PtyHost::Release(ut::Reactor*) {}
+
+bool PtyHost::Start(const std::string& shell) {
+  (void)shell;
+  return false;
+}
+#endif
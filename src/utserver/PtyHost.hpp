@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+
+namespace ut {
+class Reactor;
+}
+
+// A shell on a PTY owned by the server process itself, for the in-process
+// hosting mode (`in_process_pty=1`): no terminal helper process and no pipe
+// hop. POSIX only; Start fails elsewhere.
+class PtyHost {
+ public:
+  PtyHost();
+  // Release(nullptr) unless Release already ran.
+  ~PtyHost();
+
+  PtyHost(const PtyHost&) = delete;
+  PtyHost& operator=(const PtyHost&) = delete;
+
+  // Starts `shell` (or $SHELL, then /bin/sh, when empty) on a new PTY. The
+  // master is non-blocking.
+  bool Start(const std::string& shell = "");
+  // The PTY master, or -1 before Start.
+  int master() const { return master_; }
+#ifndef _WIN32
+  // The shell's process id, or -1 before Start.
+  int pid() const { return pid_; }
+#endif
+
+  // Closes the master and hangs up the shell if it is still running. The
+  // shell is then reaped from `reactor`'s timers, and killed if it ignores
+  // the hangup, so the polling thread never waits on it. Without a reactor
+  // it is killed and reaped only if it has already gone.
+  void Release(ut::Reactor* reactor);
+
+ private:
+  int master_ = -1;
+#ifndef _WIN32
+  int pid_ = -1;
+#endif
+};
@@ -20,6 +20,8 @@ class Server {
   void Stop();
   uint16_t port() const { return tcp_listener_.port(); }
   void SetSharedKey(const std::array<unsigned char, 32>& key);
+  // Call before Start.
+  void SetInProcessPty(bool enabled) { pipe_server_.SetInProcessPty(enabled); }
 
  private:
   ClientRegistry registry_;
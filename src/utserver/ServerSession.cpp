@@ -0,0 +1,674 @@
+#include "ServerSession.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+
+#include "UT.pb.h"
+#include "UTerminal.pb.h"
+#include "UtConstants.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace {
+bool DebugHandshake() {
+  return std::getenv("UT_DEBUG_HANDSHAKE") != nullptr;
+}
+}
+
+ServerSession::ServerSession(std::shared_ptr<ut::TcpSocketHandler> socket_handler,
+                             std::shared_ptr<ut::ServerClientConnection> connection,
+                             ut::SocketHandle pipe,
+                             bool jump_mode,
+                             std::function<void(ServerSession*)> request_service)
+    : socket_handler_(std::move(socket_handler)),
+      connection_(std::move(connection)),
+      forward_handler_(socket_handler_, true),
+      reverse_handler_(socket_handler_, false),
+      pipe_(pipe),
+      jump_mode_(jump_mode),
+      request_service_(std::move(request_service)) {
+  send_packet_ = [this](const ut::Packet& packet) { Send(packet); };
+  forward_handler_.SetDrainedCallback([this] { RequestService(); });
+  reverse_handler_.SetDrainedCallback([this] { RequestService(); });
+  if (!jump_mode_) {
+    connection_->SetReplaySkipLimit(ut::kMaxReplayBytes);
+  }
+}
+
+ServerSession::~ServerSession() {
+  Stop();
+}
+
+#ifndef _WIN32
+void ServerSession::HostPty(std::unique_ptr<PtyHost> host) {
+  pty_host_ = std::move(host);
+  AdoptPty(pty_host_->master());
+}
+#endif
+
+void ServerSession::Start(ut::Reactor* reactor) {
+  reactor_ = reactor;
+  // Recover runs on whichever shard took the returning client's handshake.
+  connection_->SetRecoverCallback([this] {
+    socket_changed_ = true;
+    RequestService();
+  });
+  last_client_packet_ = std::chrono::steady_clock::now();
+  liveness_timer_ = reactor_->AddTimer(ut::kKeepaliveIntervalSeconds * 1000, [this] { CheckClientAlive(); });
+  Service();
+  // Input the client pipelined behind INITIAL_PAYLOAD may already sit in the
+  // reader's buffer, where it raises no readiness event.
+  auto reader = connection_->reader();
+  if (watched_socket_ != ut::kInvalidSocket && reader && reader->HasData()) {
+    OnClientReadable();
+  }
+}
+
+ServerSession::State ServerSession::Service() {
+  service_requested_ = false;
+  if (done_ || !reactor_) {
+    return State::kDone;
+  }
+
+  // A new socket may reuse the old handle value, so trust the flag as well.
+  const ut::SocketHandle current = connection_->socket();
+  if (socket_changed_.exchange(false) || current != watched_socket_) {
+    if (watched_socket_ != ut::kInvalidSocket) {
+      reactor_->Remove(watched_socket_);
+    }
+    watched_socket_ = current;
+    writable_watched_ = false;
+    client_reads_paused_ = false;
+    detached_output_bytes_ = 0;
+    last_client_packet_ = std::chrono::steady_clock::now();
+    if (watched_socket_ != ut::kInvalidSocket) {
+      reactor_->Add(watched_socket_, [this] { OnClientReadable(); });
+    }
+  }
+  PauseClientReads(InputBacklogged());
+
+  if (!jump_mode_ && connection_->TakeReplaySkipped()) {
+    snapshot_due_ = true;
+    // Tunnel data was skipped along with the terminal output.
+    forward_handler_.CloseAll(send_packet_);
+    reverse_handler_.CloseAll(send_packet_);
+  }
+  if (snapshot_due_ && connection_->socket() != ut::kInvalidSocket) {
+    QueueSnapshot();
+  }
+  while (connection_->socket() != ut::kInvalidSocket && !unsent_.empty() && connection_->Write(unsent_.front())) {
+    unsent_.pop_front();
+  }
+  connection_->FlushCatchup();
+  // Output waits while the socket is full; rendering only sends diffs once
+  // it has drained, so it keeps reading the terminal into the model.
+  SetRelaying(connection_->socket() != ut::kInvalidSocket && !Backlogged());
+  WatchTerminal(relaying_ || Detached() || rendering_);
+  WatchWritable(connection_->HasCatchup());
+  return State::kIdle;
+}
+
+void ServerSession::Stop() {
+  if (!reactor_) {
+    return;
+  }
+  // Once this returns no Recover can be calling back into the session.
+  connection_->SetRecoverCallback(nullptr);
+  reactor_->CancelTimer(liveness_timer_);
+  reactor_->CancelTimer(frame_timer_);
+  SetRelaying(false);
+  WatchTerminal(false);
+#ifndef _WIN32
+  pty_input_.clear();
+  UpdatePtyWatch();
+#endif
+  if (watched_socket_ != ut::kInvalidSocket) {
+    reactor_->Remove(watched_socket_);
+    watched_socket_ = ut::kInvalidSocket;
+  }
+  ut::Reactor* reactor = reactor_;
+  reactor_ = nullptr;
+  done_ = true;
+  pipe_handler_.Close(pipe_);
+#ifndef _WIN32
+  if (pty_host_) {
+    // Closes the master itself; the shell is reaped from the shard's timers.
+    pty_host_->Release(reactor);
+    pty_host_.reset();
+  } else if (pty_ >= 0) {
+    close(pty_);
+  }
+  pty_ = -1;
+#endif
+  connection_->CloseSocket();
+}
+
+void ServerSession::RequestService() {
+  if (!service_requested_.exchange(true)) {
+    request_service_(this);
+  }
+}
+
+void ServerSession::CheckClientAlive() {
+  liveness_timer_ = reactor_->AddTimer(ut::kKeepaliveIntervalSeconds * 1000, [this] { CheckClientAlive(); });
+  if (!client_keepalives_ || watched_socket_ == ut::kInvalidSocket || socket_changed_ ||
+      connection_->socket() != watched_socket_) {
+    return;
+  }
+  if (std::chrono::steady_clock::now() - last_client_packet_ < std::chrono::seconds(ut::kDeadPeerSeconds)) {
+    return;
+  }
+  if (DebugHandshake()) {
+    std::cerr << "[handshake] client_silent closing_socket\n";
+  }
+  // The session lives on; the client reconnects and Recover resumes it.
+  connection_->CloseSocket();
+  RequestService();
+}
+
+void ServerSession::Send(const ut::Packet& packet) {
+  if (Detached() && packet.header() == static_cast<uint8_t>(ut::TERMINAL_BUFFER)) {
+    // Past kMaxReplayBytes the client will skip the replay for a snapshot
+    // anyway, so the rest need not be sealed and kept.
+    if (detached_output_bytes_ <= ut::kMaxReplayBytes) {
+      detached_output_bytes_ += packet.payload().size();
+      connection_->Queue(packet);
+    }
+    return;
+  }
+  if (unsent_.empty() && connection_->socket() != ut::kInvalidSocket && connection_->Write(packet)) {
+    if (packet.header() == static_cast<uint8_t>(ut::TERMINAL_BUFFER)) {
+      output_behind_bytes_ = connection_->HasCatchup() ? output_behind_bytes_ + packet.payload().size() : 0;
+    }
+    // The frame is in the backup either way. If the write failed it replays
+    // on Recover; if the socket is full it goes out once it is writable.
+    if (connection_->socket() == ut::kInvalidSocket || (!writable_watched_ && connection_->HasCatchup())) {
+      RequestService();
+    }
+    return;
+  }
+  unsent_.push_back(packet);
+  RequestService();
+}
+
+bool ServerSession::InputBacklogged() const {
+#ifndef _WIN32
+  if (!pty_input_.empty()) {
+    return true;
+  }
+#endif
+  return forward_handler_.Backlogged() || reverse_handler_.Backlogged();
+}
+
+void ServerSession::PauseClientReads(bool pause) {
+  if (pause == client_reads_paused_ || watched_socket_ == ut::kInvalidSocket) {
+    return;
+  }
+  client_reads_paused_ = pause;
+  reactor_->SetReading(watched_socket_, !pause);
+  auto reader = connection_->reader();
+  if (!pause && reader && reader->HasData()) {
+    OnClientReadable();
+  }
+}
+
+bool ServerSession::Backlogged() {
+  return !unsent_.empty() || connection_->HasCatchup();
+}
+
+void ServerSession::SetRelaying(bool relaying) {
+  if (relaying == relaying_) {
+    return;
+  }
+  relaying_ = relaying;
+  if (relaying) {
+    forward_handler_.AttachReactor(reactor_, send_packet_);
+    reverse_handler_.AttachReactor(reactor_, send_packet_);
+  } else {
+    forward_handler_.AttachReactor(nullptr, nullptr);
+    reverse_handler_.AttachReactor(nullptr, nullptr);
+  }
+}
+
+void ServerSession::WatchTerminal(bool watch) {
+  if (watch == terminal_watched_) {
+    return;
+  }
+  terminal_watched_ = watch;
+  if (watch) {
+    if (pipe_ != ut::kInvalidSocket) {
+      reactor_->AddPipe(pipe_, [this] { OnPipeReadable(); });
+    }
+  } else {
+    if (pipe_ != ut::kInvalidSocket) {
+      reactor_->Remove(pipe_);
+    }
+  }
+#ifndef _WIN32
+  UpdatePtyWatch();
+#endif
+}
+
+void ServerSession::WatchWritable(bool watch) {
+  if (watch == writable_watched_ || watched_socket_ == ut::kInvalidSocket) {
+    return;
+  }
+  writable_watched_ = watch;
+  reactor_->SetWritable(watched_socket_, watch ? ut::Reactor::Callback([this] { OnClientWritable(); }) : nullptr);
+}
+
+void ServerSession::OnClientWritable() {
+  connection_->FlushCatchup();
+  if (!connection_->HasCatchup()) {
+    // Drained, or the write failed: either way Service takes it from here.
+    RequestService();
+  }
+}
+
+bool ServerSession::TrackOutput(const std::string& bytes) {
+  if (jump_mode_) {
+    return true;
+  }
+  if (trace_.trace_id != 0 && !trace_answered_) {
+    ut::latency_trace::HistogramFor(ut::latency_trace::Segment::kTerminal)
+        .Record(ut::latency_trace::NowUs() - trace_received_us_);
+    trace_answered_ = true;
+  }
+  if (!rendering_ && !Detached() && output_behind_bytes_ > ut::kRenderBacklogBytes) {
+    StartRendering();
+  }
+  screen_.Feed(bytes);
+  if (Detached()) {
+    // The client's own round trip has failed; don't time the absence.
+    trace_ = ut::latency_trace::Stamp{};
+    return true;
+  }
+  if (rendering_) {
+    frame_due_ = true;
+    return false;
+  }
+  return true;
+}
+
+void ServerSession::StartRendering() {
+  if (DebugHandshake()) {
+    std::cerr << "[handshake] term render_mode start\n";
+  }
+  // Everything relayed so far is already in the model.
+  client_frame_ = screen_.CaptureFrame();
+  rendering_ = true;
+  frame_due_ = false;
+  output_behind_bytes_ = 0;
+  frame_timer_ = reactor_->AddTimer(ut::kFrameIntervalMs, [this] { OnFrameTimer(); });
+}
+
+void ServerSession::OnFrameTimer() {
+  frame_timer_ = 0;
+  if (Detached()) {
+    // The reconnect snapshot takes over.
+    snapshot_due_ = snapshot_due_ || frame_due_;
+    rendering_ = false;
+    RequestService();
+    return;
+  }
+  if (!Backlogged()) {
+    if (!frame_due_) {
+      if (DebugHandshake()) {
+        std::cerr << "[handshake] term render_mode end\n";
+      }
+      rendering_ = false;
+      // Service decides whether the terminal is still read.
+      RequestService();
+      return;
+    }
+    frame_due_ = false;
+    std::string payload;
+    if (SerializeOutput(screen_.Diff(&client_frame_), &payload)) {
+      Send(ut::Packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), payload));
+    }
+  }
+  frame_timer_ = reactor_->AddTimer(ut::kFrameIntervalMs, [this] { OnFrameTimer(); });
+}
+
+bool ServerSession::SerializeOutput(const std::string& bytes, std::string* payload) {
+  ut::TerminalBuffer tb;
+  tb.set_buffer(bytes);
+  if (!tb.SerializeToString(payload)) {
+    return false;
+  }
+  if (trace_.trace_id != 0) {
+    ut::latency_trace::HistogramFor(ut::latency_trace::Segment::kServer)
+        .Record(ut::latency_trace::NowUs() - trace_received_us_);
+    ut::latency_trace::Append(trace_, payload);
+    trace_ = ut::latency_trace::Stamp{};
+  }
+  return true;
+}
+
+void ServerSession::QueueSnapshot() {
+  snapshot_due_ = false;
+  if (rendering_) {
+    client_frame_ = screen_.CaptureFrame();
+    frame_due_ = false;
+  }
+  // Terminal output still queued is already part of the screen.
+  unsent_.erase(std::remove_if(unsent_.begin(), unsent_.end(),
+                               [](const ut::Packet& packet) {
+                                 return packet.header() == static_cast<uint8_t>(ut::TERMINAL_BUFFER);
+                               }),
+                unsent_.end());
+  std::string payload;
+  if (!SerializeOutput(screen_.Snapshot(), &payload)) {
+    return;
+  }
+  unsent_.push_front(ut::Packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), payload));
+}
+
+void ServerSession::OnClientReadable() {
+  auto reader = connection_->reader();
+  do {
+    ut::Packet packet;
+    bool read_ok = false;
+    try {
+      read_ok = connection_->ReadPacket(&packet);
+    } catch (const std::exception& ex) {
+      if (DebugHandshake()) {
+        std::cerr << "[handshake] read_packet_exception: " << ex.what() << "\n";
+      }
+      done_ = true;
+      RequestService();
+      return;
+    }
+    if (!read_ok) {
+      if (DebugHandshake()) {
+        std::cerr << "[handshake] read_packet_failed\n";
+      }
+      if (connection_->socket() != watched_socket_) {
+        RequestService();
+      }
+      return;
+    }
+    last_client_packet_ = std::chrono::steady_clock::now();
+    if (packet.header() == static_cast<uint8_t>(ut::TERMINAL_BUFFER) ||
+        packet.header() == static_cast<uint8_t>(ut::TERMINAL_INFO)) {
+      if (DebugHandshake()) {
+        std::cerr << "[handshake] term client_to_pipe header="
+                  << static_cast<int>(packet.header())
+                  << " bytes=" << packet.payload().size()
+                  << " jump=" << (jump_mode_ ? 1 : 0) << "\n";
+      }
+      if (!jump_mode_ && packet.header() == static_cast<uint8_t>(ut::TERMINAL_INFO)) {
+        ut::TerminalInfo info;
+        if (packet.ParsePayload(&info) && info.width() > 0 && info.height() > 0) {
+          screen_.Resize(info.width(), info.height());
+        }
+      }
+      ut::latency_trace::Stamp stamp;
+      if (!jump_mode_ && packet.header() == static_cast<uint8_t>(ut::TERMINAL_BUFFER) &&
+          ut::latency_trace::Find(packet.payload(), &stamp)) {
+        trace_ = stamp;
+        trace_received_us_ = ut::latency_trace::NowUs();
+        trace_answered_ = false;
+      }
+#ifndef _WIN32
+      if (pty_ >= 0) {
+        WriteToPty(packet);
+        continue;
+      }
+#endif
+      pipe_handler_.WritePacket(pipe_, packet);
+      if (DebugHandshake()) {
+        std::cerr << "[handshake] term pipe_to_client pipe_write_ok=1\n";
+      }
+    } else if (packet.header() == static_cast<uint8_t>(ut::KEEP_ALIVE)) {
+      client_keepalives_ = true;
+      // A traced keepalive times the network; echo its stamp.
+      Send(ut::Packet(static_cast<uint8_t>(ut::KEEP_ALIVE), packet.payload()));
+    } else if (packet.header() == static_cast<uint8_t>(ut::PORT_FORWARD_DESTINATION_REQUEST)) {
+      forward_handler_.HandlePacket(packet, send_packet_);
+    } else if (packet.header() == static_cast<uint8_t>(ut::PORT_FORWARD_DESTINATION_RESPONSE)) {
+      reverse_handler_.HandlePacket(packet, send_packet_);
+    } else if (packet.header() == static_cast<uint8_t>(ut::PORT_FORWARD_DATA)) {
+      forward_handler_.HandlePacket(packet, send_packet_);
+      reverse_handler_.HandlePacket(packet, send_packet_);
+    }
+    // Frames already sitting in the reader's buffer raise no readiness
+    // event of their own, so drain them now.
+  } while (reader && reader->HasData() && !InputBacklogged());
+  PauseClientReads(InputBacklogged());
+}
+
+void ServerSession::OnPipeReadable() {
+  if (!pipe_handler_.IsConnected(pipe_)) {
+    if (DebugHandshake()) {
+      std::cerr << "[handshake] term pipe disconnected\n";
+    }
+    done_ = true;
+    RequestService();
+    return;
+  }
+  // While relaying, stop as soon as output backs up; the rest waits in the
+  // pipe. While only the screen model sees it, take a batch per wakeup.
+  size_t tracked = 0;
+  while ((Detached() || rendering_ ? tracked < ut::kCoalesceMaxBytes : !Backlogged()) &&
+         pipe_handler_.HasData(pipe_)) {
+    ut::Packet packet;
+    try {
+#ifdef _WIN32
+      const bool read_ok = pipe_handler_.ReadPacket(pipe_, &packet);
+#else
+      int fd = -1;
+      const bool read_ok = pipe_handler_.ReadPacketWithFd(pipe_, &packet, &fd);
+      if (read_ok && packet.header() == ut::kTerminalPtyHandoffHeader) {
+        if (fd < 0 || pty_ >= 0) {
+          if (fd >= 0) {
+            close(fd);
+          }
+          continue;
+        }
+        if (DebugHandshake()) {
+          std::cerr << "[handshake] term pty_handoff fd=" << fd << "\n";
+        }
+        AdoptPty(fd);
+        continue;
+      }
+      if (fd >= 0) {
+        close(fd);
+      }
+#endif
+      if (!read_ok) {
+        if (DebugHandshake()) {
+          std::cerr << "[handshake] term pipe_to_client read_failed\n";
+        }
+        done_ = true;
+        RequestService();
+        return;
+      }
+    } catch (...) {
+      done_ = true;
+      RequestService();
+      return;
+    }
+    if (DebugHandshake()) {
+      std::cerr << "[handshake] term pipe_to_client header="
+                << static_cast<int>(packet.header())
+                << " bytes=" << packet.payload().size()
+                << " jump=" << (jump_mode_ ? 1 : 0) << "\n";
+    }
+    if (!jump_mode_ && packet.header() == static_cast<uint8_t>(ut::TERMINAL_BUFFER)) {
+      ut::TerminalBuffer tb;
+      if (packet.ParsePayload(&tb)) {
+        tracked += tb.buffer().size();
+        if (!TrackOutput(tb.buffer())) {
+          continue;
+        }
+        std::string payload;
+        if (trace_.trace_id != 0 && SerializeOutput(tb.buffer(), &payload)) {
+          packet = ut::Packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), payload);
+        }
+      }
+    }
+    Send(packet);
+    if (DebugHandshake()) {
+      std::cerr << "[handshake] term pipe_to_client write_ok=1\n";
+    }
+  }
+}
+
+#ifndef _WIN32
+void ServerSession::OnPtyReadable() {
+  if (!pty_reading_) {
+    // Registered only to flush input, so this is a hangup: the write fails
+    // and drops the input, and the read that follows ends the session.
+    FlushPtyInput();
+    return;
+  }
+  if (Backlogged() && !Detached() && !rendering_) {
+    return;
+  }
+  char buffer[16 * 1024];
+  while (true) {
+    const ssize_t rc = read(pty_, buffer, sizeof(buffer));
+    if (rc < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rc < 0 && errno == EAGAIN) {
+      SendPtyOutput();
+      return;
+    }
+    if (rc <= 0) {
+      // EIO: every slave descriptor is closed, so the shell has exited.
+      if (DebugHandshake()) {
+        std::cerr << "[handshake] term pty closed\n";
+      }
+      SendPtyOutput();
+      done_ = true;
+      RequestService();
+      return;
+    }
+    pty_output_.Append(buffer, static_cast<size_t>(rc));
+    // Keep reading only what the shell has already written; once the batch
+    // is full or old enough the reactor brings us back for the rest.
+    int available = 0;
+    const bool more = ioctl(pty_, FIONREAD, &available) == 0 && available > 0;
+    if (pty_output_.ShouldFlush(more)) {
+      SendPtyOutput();
+      return;
+    }
+  }
+}
+
+void ServerSession::SendPtyOutput() {
+  if (pty_output_.empty()) {
+    return;
+  }
+  if (!TrackOutput(pty_output_.data())) {
+    pty_output_.Clear();
+    return;
+  }
+  std::string payload;
+  const bool serialized = SerializeOutput(pty_output_.data(), &payload);
+  pty_output_.Clear();
+  if (!serialized) {
+    return;
+  }
+  Send(ut::Packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), payload));
+}
+
+void ServerSession::WriteToPty(const ut::Packet& packet) {
+  if (packet.header() == static_cast<uint8_t>(ut::TERMINAL_INFO)) {
+    ut::TerminalInfo info;
+    if (packet.ParsePayload(&info) && info.width() > 0 && info.height() > 0) {
+      winsize size{};
+      size.ws_col = static_cast<unsigned short>(info.width());
+      size.ws_row = static_cast<unsigned short>(info.height());
+      ioctl(pty_, TIOCSWINSZ, &size);
+    }
+    return;
+  }
+  ut::TerminalBuffer tb;
+  if (!packet.ParsePayload(&tb)) {
+    return;
+  }
+  // Behind queued input the bytes wait their turn for OnPtyWritable.
+  const bool queued = !pty_input_.empty();
+  pty_input_ += tb.buffer();
+  if (!queued) {
+    FlushPtyInput();
+  }
+}
+
+void ServerSession::AdoptPty(int fd) {
+  pty_ = fd;
+  // A shell that stops reading its input must not stall the shard.
+  const int flags = fcntl(pty_, F_GETFL);
+  if (flags >= 0) {
+    fcntl(pty_, F_SETFL, flags | O_NONBLOCK);
+  }
+  UpdatePtyWatch();
+}
+
+void ServerSession::FlushPtyInput() {
+  size_t offset = 0;
+  while (offset < pty_input_.size()) {
+    const ssize_t rc = write(pty_, pty_input_.data() + offset, pty_input_.size() - offset);
+    if (rc < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (rc <= 0) {
+      // EIO: the shell has exited and the input has nowhere to go.
+      offset = pty_input_.size();
+      break;
+    }
+    offset += static_cast<size_t>(rc);
+  }
+  pty_input_.erase(0, offset);
+  UpdatePtyWatch();
+}
+
+void ServerSession::OnPtyWritable() {
+  FlushPtyInput();
+  // Drained: read the client again, starting with what it has buffered.
+  PauseClientReads(InputBacklogged());
+}
+
+void ServerSession::UpdatePtyWatch() {
+  if (pty_ < 0 || !reactor_) {
+    return;
+  }
+  const auto handle = static_cast<ut::SocketHandle>(pty_);
+  const bool writing = !pty_input_.empty();
+  const bool registered = terminal_watched_ || writing;
+  if (registered != pty_registered_) {
+    pty_registered_ = registered;
+    if (!registered) {
+      reactor_->Remove(handle);
+      pty_reading_ = false;
+      pty_writing_ = false;
+      return;
+    }
+    reactor_->Add(handle, [this] { OnPtyReadable(); });
+    pty_reading_ = true;
+    pty_writing_ = false;
+  }
+  if (terminal_watched_ != pty_reading_) {
+    pty_reading_ = terminal_watched_;
+    reactor_->SetReading(handle, pty_reading_);
+  }
+  if (writing != pty_writing_) {
+    pty_writing_ = writing;
+    reactor_->SetWritable(handle, writing ? ut::Reactor::Callback([this] { OnPtyWritable(); }) : nullptr);
+  }
+}
+#endif
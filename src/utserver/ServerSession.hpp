@@ -0,0 +1,192 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include "protocol/LatencyTrace.hpp"
+#include "protocol/OutputCoalescer.hpp"
+#include "protocol/Packet.hpp"
+#include "protocol/PipeSocketHandler.hpp"
+#include "protocol/PortForwardHandler.hpp"
+#include "protocol/Reactor.hpp"
+#include "protocol/ScreenModel.hpp"
+#include "protocol/ServerClientConnection.hpp"
+#include "protocol/TcpSocketHandler.hpp"
+#include "PtyHost.hpp"
+
+// Relay for one attached session: client socket <-> terminal pipe, plus its
+// port forwards. Everything runs on the reactor of the shard that owns the
+// session, so a session never needs a thread of its own.
+//
+// Callbacks never block on a missing or slow client: the client socket is
+// non-blocking, and output it cannot take yet waits in the writer's backup
+// until the socket is writable. Meanwhile, and while the client is away, the
+// session stops reading the tunnels and relaying terminal output (the data
+// waits in the OS buffers) and holds anything it could not send until the
+// socket drains or Recover brings a new one.
+//
+// Outside jump mode the session also keeps a ScreenModel of the terminal.
+// While the client is away the terminal is still read into the model, and
+// its output is backed up for the returning client's replay. A client whose
+// backlog is too large (see ut::kMaxReplayBytes) or partly evicted skips it
+// and is sent a snapshot of the screen instead.
+//
+// The model also covers a client that is connected but cannot keep up:
+// once ut::kRenderBacklogBytes of terminal output in a row has left the
+// client's socket full, the session stops relaying output and sends a
+// screen diff each time the socket drains, so intermediate screens are
+// dropped and input is never queued behind a flood. It relays output again
+// once the client has the current screen.
+//
+// On POSIX the terminal hands over its PTY master once the shell is up, and
+// the session then reads and writes the PTY itself instead of going through
+// the terminal process. In-process hosting (HostPty) starts there, with no
+// terminal process or pipe at all.
+//
+// A keystroke stamped for latency tracing (see ut::latency_trace) is timed
+// until the terminal answers and until that output is sent, and the stamp
+// goes back to the client on the output.
+class ServerSession {
+ public:
+  enum class State {
+    kIdle,
+    kDone,
+  };
+
+  // `request_service` is called, from any thread, when the session needs
+  // Service() to run on its shard. `pipe` is kInvalidSocket for a session
+  // that hosts its PTY.
+  ServerSession(std::shared_ptr<ut::TcpSocketHandler> socket_handler,
+                std::shared_ptr<ut::ServerClientConnection> connection,
+                ut::SocketHandle pipe,
+                bool jump_mode,
+                std::function<void(ServerSession*)> request_service);
+  ~ServerSession();
+
+  ServerSession(const ServerSession&) = delete;
+  ServerSession& operator=(const ServerSession&) = delete;
+
+  ut::PortForwardHandler& reverse_handler() { return reverse_handler_; }
+  const std::string& client_id() const { return connection_->id(); }
+
+#ifndef _WIN32
+  // Relays `host`'s PTY directly. Call before Start.
+  void HostPty(std::unique_ptr<PtyHost> host);
+#endif
+  void Start(ut::Reactor* reactor);
+  // Follows socket changes, resumes or pauses the relay and starts sending
+  // any backlog. Must run on the shard thread.
+  State Service();
+  // Unregisters everything and closes the pipe and client socket.
+  void Stop();
+
+ private:
+  void RequestService();
+  // Periodic: drops a client socket that has gone silent (see
+  // ut::kDeadPeerSeconds).
+  void CheckClientAlive();
+  void Send(const ut::Packet& packet);
+  // Output is waiting, for the client to come back or for its socket to take
+  // more.
+  bool Backlogged();
+  // A tunnel socket or the PTY is not taking what the client sends it; the
+  // client's socket is not read until it catches up.
+  bool InputBacklogged() const;
+  void PauseClientReads(bool pause);
+  void SetRelaying(bool relaying);
+  // Adds or removes the pipe and PTY in the reactor.
+  void WatchTerminal(bool watch);
+  // Sends the backlog, one chunk each time the client socket is writable.
+  void WatchWritable(bool watch);
+  void OnClientWritable();
+  // While detached, terminal output goes to the screen model and the replay.
+  bool Detached() const { return !jump_mode_ && connection_->socket() == ut::kInvalidSocket; }
+  // Runs `bytes` of terminal output through the screen model. Returns false
+  // while rendering, when the output should not be sent.
+  bool TrackOutput(const std::string& bytes);
+  // Serializes terminal output for the client, carrying the stamp of the
+  // keystroke being traced, if any.
+  bool SerializeOutput(const std::string& bytes, std::string* payload);
+  // Replaces queued terminal output with a repaint of the current screen.
+  void QueueSnapshot();
+  void StartRendering();
+  // Sends the next screen diff when the link has room, or goes back to
+  // relaying output when the client is up to date.
+  void OnFrameTimer();
+  void OnClientReadable();
+  void OnPipeReadable();
+#ifndef _WIN32
+  void OnPtyReadable();
+  // Sends the batched PTY output as one TERMINAL_BUFFER.
+  void SendPtyOutput();
+  // Takes over `fd` as the session's PTY master, made non-blocking.
+  void AdoptPty(int fd);
+  // Applies a resize, or queues keystrokes for the PTY and writes what it
+  // will take now.
+  void WriteToPty(const ut::Packet& packet);
+  void FlushPtyInput();
+  void OnPtyWritable();
+  // The PTY is in the reactor while it is read (the terminal is watched)
+  // or written to (input is queued).
+  void UpdatePtyWatch();
+#endif
+
+  std::shared_ptr<ut::TcpSocketHandler> socket_handler_;
+  std::shared_ptr<ut::ServerClientConnection> connection_;
+  ut::PipeSocketHandler pipe_handler_;
+  ut::PortForwardHandler forward_handler_;
+  ut::PortForwardHandler reverse_handler_;
+  ut::SocketHandle pipe_ = ut::kInvalidSocket;
+  bool jump_mode_ = false;
+  std::function<void(ServerSession*)> request_service_;
+  std::function<void(const ut::Packet&)> send_packet_;
+
+  ut::Reactor* reactor_ = nullptr;
+  ut::SocketHandle watched_socket_ = ut::kInvalidSocket;
+  bool relaying_ = false;
+  bool terminal_watched_ = false;
+  bool writable_watched_ = false;
+  bool client_reads_paused_ = false;
+  bool done_ = false;
+  ut::TimerWheel::TimerId liveness_timer_ = 0;
+  std::chrono::steady_clock::time_point last_client_packet_;
+  // Only clients that send keepalives can be judged by their silence.
+  bool client_keepalives_ = false;
+#ifndef _WIN32
+  int pty_ = -1;
+  std::unique_ptr<PtyHost> pty_host_;
+  ut::OutputCoalescer pty_output_;
+  // Client input the PTY has not taken yet, as when a paste outruns a shell
+  // that is not reading.
+  std::string pty_input_;
+  bool pty_registered_ = false;
+  bool pty_reading_ = false;
+  bool pty_writing_ = false;
+#endif
+  std::deque<ut::Packet> unsent_;
+  ut::ScreenModel screen_;
+  // The client missed output that only screen_ has (the replay was skipped,
+  // or frames rendered while it was away); it needs a snapshot.
+  bool snapshot_due_ = false;
+  // Terminal output backed up for the replay since the client went away.
+  size_t detached_output_bytes_ = 0;
+  // Output goes to screen_ only and the client is sent diffs from
+  // client_frame_, what it currently shows.
+  bool rendering_ = false;
+  // screen_ has changed since the last diff.
+  bool frame_due_ = false;
+  // Terminal output written since a terminal write last went out in full;
+  // port-forward traffic does not count.
+  size_t output_behind_bytes_ = 0;
+  ut::ScreenModel::Frame client_frame_;
+  ut::TimerWheel::TimerId frame_timer_ = 0;
+  // The traced keystroke awaiting output; trace_id 0 when there is none.
+  ut::latency_trace::Stamp trace_;
+  int64_t trace_received_us_ = 0;
+  bool trace_answered_ = false;
+  std::atomic<bool> socket_changed_{false};
+  std::atomic<bool> service_requested_{false};
+};
@@ -1,14 +1,21 @@
 #include "TcpListener.hpp"
 
-#include <chrono>
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
 
 #include "ClientRegistry.hpp"
+#include "PtyHost.hpp"
+#include "ServerSession.hpp"
 #include "Verbose.hpp"
+#include "protocol/LatencyTrace.hpp"
 #include "protocol/PipeSocketHandler.hpp"
-#include "protocol/PortForwardHandler.hpp"
+#include "protocol/Reactor.hpp"
 #include "protocol/ServerClientConnection.hpp"
 #include "UtConstants.hpp"
 #include "UT.pb.h"
@@ -18,6 +25,90 @@ namespace {
 bool DebugHandshake() {
   return std::getenv("UT_DEBUG_HANDSHAKE") != nullptr;
 }
+// Reassembles handshake messages from a non-blocking socket as their bytes
+// arrive. It never reads past the message, so whatever the client sent
+// after it is left for the session's BackedReader.
+class MessageReader {
+ public:
+  // A proto framed as SocketHandler::WriteProto frames it. False while it is
+  // still on its way.
+  template <typename T>
+  bool ReadProto(ut::SocketHandler& handler, ut::SocketHandle socket, T* proto) {
+    if (!length_known_) {
+      int64_t length = 0;
+      if (!Fill(handler, socket, sizeof(length))) {
+        return false;
+      }
+      std::memcpy(&length, buffer_.data(), sizeof(length));
+      if (length < 0 || length > 128 * 1024 * 1024) {
+        throw std::runtime_error("invalid proto length");
+      }
+      StartBody(static_cast<size_t>(length));
+    }
+    if (!Fill(handler, socket, length_)) {
+      return false;
+    }
+    const bool parsed = proto->ParseFromString(buffer_);
+    StartMessage();
+    if (!parsed) {
+      throw std::runtime_error("invalid proto");
+    }
+    return true;
+  }
+
+  // Reads and drops one packet frame.
+  bool SkipPacket(ut::SocketHandler& handler, ut::SocketHandle socket) {
+    if (!length_known_) {
+      if (!Fill(handler, socket, ut::Packet::kLengthBytes)) {
+        return false;
+      }
+      const uint32_t length = ut::Packet::DecodeLength(buffer_.data());
+      if (length > 128 * 1024 * 1024) {
+        throw std::runtime_error("invalid packet length");
+      }
+      StartBody(length);
+    }
+    if (!Fill(handler, socket, length_)) {
+      return false;
+    }
+    StartMessage();
+    return true;
+  }
+
+ private:
+  // True once buffer_ holds `count` bytes. Throws when the client hangs up.
+  bool Fill(ut::SocketHandler& handler, ut::SocketHandle socket, size_t count) {
+    buffer_.resize(count);
+    while (filled_ < count) {
+      const int rc = handler.Read(socket, &buffer_[filled_], count - filled_);
+      if (rc == ut::SocketHandler::kWouldBlock) {
+        return false;
+      }
+      if (rc <= 0) {
+        throw std::runtime_error("socket closed during handshake");
+      }
+      filled_ += static_cast<size_t>(rc);
+    }
+    return true;
+  }
+  void StartBody(size_t length) {
+    buffer_.clear();
+    filled_ = 0;
+    length_ = length;
+    length_known_ = true;
+  }
+  void StartMessage() {
+    buffer_.clear();
+    filled_ = 0;
+    length_known_ = false;
+  }
+
+  std::string buffer_;
+  size_t filled_ = 0;
+  size_t length_ = 0;
+  bool length_known_ = false;
+};
+
 bool SendTermInit(ut::PipeSocketHandler& pipe_handler, ut::SocketHandle pipe_handle) {
   ut::TermInit init;
   std::string payload;
@@ -43,6 +134,54 @@ bool SendJumpInit(ut::PipeSocketHandler& pipe_handler,
 
 }
 
+struct TcpListener::Handshake {
+  enum class Step {
+    kConnectRequest,
+    // The SequenceHeader a reconnecting client pipelines behind its request.
+    kResumeHeader,
+    // Dropping packets the client pipelined for a session it is not getting,
+    // before `response` goes out.
+    kDiscard,
+    // A returning client that did not pipeline its SequenceHeader sends it
+    // once it has our ConnectResponse.
+    kClientHeader,
+    kInitialPayload,
+  };
+
+  ut::SocketHandle socket = ut::kInvalidSocket;
+  // Ends the handshake if the next message does not arrive in time.
+  ut::TimerWheel::TimerId timeout = 0;
+  Step step = Step::kConnectRequest;
+  MessageReader reader;
+  ut::ConnectRequest request;
+  ut::SequenceHeader remote_header;
+  ut::ConnectResponse response;
+  int discard = 0;
+  // The session a RETURNING_CLIENT resumes.
+  std::shared_ptr<ut::ServerClientConnection> resuming;
+  // Set once NEW_CLIENT has been sent and INITIAL_PAYLOAD is awaited.
+  std::shared_ptr<ut::ServerClientConnection> connection;
+  std::string client_id;
+  // The client pipelined INITIAL_PAYLOAD, so NEW_CLIENT goes out with the
+  // INITIAL_RESPONSE.
+  bool pipelined = false;
+  ut::Packet initial_payload;
+};
+
+struct TcpListener::Shard {
+  ut::Reactor reactor;
+  std::thread thread;
+  std::atomic<size_t> session_count{0};
+  std::atomic<bool> idle{false};
+
+  std::mutex mutex;
+  std::vector<ServerSession*> service_requests;
+
+  // Only touched on the shard thread.
+  std::unordered_map<ServerSession*, std::unique_ptr<ServerSession>> sessions;
+  std::unordered_map<Handshake*, std::unique_ptr<Handshake>> handshakes;
+};
+
 TcpListener::TcpListener() = default;
 
 TcpListener::~TcpListener() {
@@ -62,20 +201,42 @@ bool TcpListener::Start(uint16_t port, const std::string& bind_ip, ClientRegistr
   }
   port_ = socket_handler_->GetBoundPort(listen_socket_);
   running_ = true;
+  const size_t shard_count = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t i = 0; i < shard_count; ++i) {
+    shards_.push_back(std::make_unique<Shard>());
+  }
+  for (auto& shard : shards_) {
+    shard->thread = std::thread(&TcpListener::RunShard, this, shard.get());
+  }
   accept_thread_ = std::thread(&TcpListener::AcceptLoop, this);
   return true;
 }
 
 void TcpListener::Stop() {
   running_ = false;
+  accept_reactor_.Wake();
+  if (accept_thread_.joinable()) {
+    accept_thread_.join();
+  }
+  for (auto& shard : shards_) {
+    shard->reactor.Wake();
+    if (shard->thread.joinable()) {
+      shard->thread.join();
+    }
+  }
+  shards_.clear();
+  {
+    std::lock_guard<std::mutex> guard(accepted_mutex_);
+    for (ut::SocketHandle socket : accepted_) {
+      socket_handler_->Close(socket);
+    }
+    accepted_.clear();
+  }
   if (listen_socket_ != ut::kInvalidSocket) {
     socket_handler_->Close(listen_socket_);
     listen_socket_ = ut::kInvalidSocket;
   }
   port_ = 0;
-  if (accept_thread_.joinable()) {
-    accept_thread_.join();
-  }
 }
 
 void TcpListener::SetSharedKey(const std::array<unsigned char, 32>& key) {
@@ -84,110 +245,318 @@ void TcpListener::SetSharedKey(const std::array<unsigned char, 32>& key) {
 }
 
 void TcpListener::AcceptLoop() {
+  accept_reactor_.AddAcceptor(listen_socket_, [this](ut::SocketHandle client) {
+    if (!registry_ || !socket_handler_->PrepareForReactor(client)) {
+      socket_handler_->Close(client);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> guard(accepted_mutex_);
+      accepted_.push_back(client);
+    }
+    DispatchHandshake();
+  });
+  SweepStaleSessions();
+  while (running_) {
+    accept_reactor_.Poll(-1);
+  }
+  accept_reactor_.Remove(listen_socket_);
+  accept_reactor_.CancelTimer(sweep_timer_);
+}
+
+void TcpListener::SweepStaleSessions() {
+  if (registry_) {
+    ut::PipeSocketHandler pipe_handler;
+    for (ut::SocketHandle terminal : registry_->CleanupStale(ut::kStaleSessionSeconds)) {
+      pipe_handler.Close(terminal);
+    }
+  }
+  // Only clients tracing latency produce samples. Each report covers the
+  // last sweep interval; the samples are dropped when nobody asked for it.
+  const std::string latency = ut::latency_trace::TakeSummary();
+  if (!latency.empty() && (IsVerbose() || ut::latency_trace::Enabled())) {
+    std::cerr << "[latency] " << latency << "\n";
+  }
+  sweep_timer_ = accept_reactor_.AddTimer(ut::kStaleSessionSweepSeconds * 1000, [this] { SweepStaleSessions(); });
+}
+
+void TcpListener::DispatchHandshake() {
+  Shard* target = nullptr;
+  bool target_idle = false;
+  for (auto& shard : shards_) {
+    const bool idle = shard->idle.load();
+    if (!target || (idle && !target_idle) ||
+        (idle == target_idle && shard->session_count.load() < target->session_count.load())) {
+      target = shard.get();
+      target_idle = idle;
+    }
+  }
+  if (target) {
+    target->reactor.Wake();
+  }
+}
+
+void TcpListener::RunShard(Shard* shard) {
+  std::vector<ServerSession*> requests;
   while (running_) {
-    if (!socket_handler_->HasData(listen_socket_)) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(50));
-      continue;
+    // Handshakes and sessions wait on readiness and reactor timers, so an
+    // idle shard sleeps until one of them (or a socket) needs it.
+    shard->idle = true;
+    shard->reactor.Poll(-1);
+    shard->idle = false;
+
+    TakeHandshake(shard);
+
+    {
+      std::lock_guard<std::mutex> guard(shard->mutex);
+      requests.swap(shard->service_requests);
     }
-    ut::SocketHandle client = socket_handler_->Accept(listen_socket_);
-    if (client == ut::kInvalidSocket) {
-      continue;
+    for (ServerSession* session : requests) {
+      if (shard->sessions.find(session) == shard->sessions.end()) {
+        continue;
+      }
+      if (session->Service() == ServerSession::State::kDone) {
+        EndSession(shard, session);
+      }
     }
-    std::thread(&TcpListener::HandleClient, this, client).detach();
+    requests.clear();
+  }
+
+  while (!shard->handshakes.empty()) {
+    FinishHandshake(shard, shard->handshakes.begin()->first);
+  }
+  while (!shard->sessions.empty()) {
+    EndSession(shard, shard->sessions.begin()->first);
   }
 }
 
-void TcpListener::HandleClient(ut::SocketHandle client) {
-  if (!registry_) {
-    socket_handler_->Close(client);
-    return;
+void TcpListener::TakeHandshake(Shard* shard) {
+  ut::SocketHandle client = ut::kInvalidSocket;
+  bool more = false;
+  {
+    std::lock_guard<std::mutex> guard(accepted_mutex_);
+    if (accepted_.empty()) {
+      return;
+    }
+    client = accepted_.front();
+    accepted_.pop_front();
+    more = !accepted_.empty();
+  }
+  if (more) {
+    DispatchHandshake();
   }
 
-  ut::ConnectRequest request;
+  auto handshake = std::make_unique<Handshake>();
+  handshake->socket = client;
+  Handshake* raw = handshake.get();
+  shard->handshakes[raw] = std::move(handshake);
+  ArmHandshakeTimeout(shard, raw);
+  // Each step runs once its message has arrived, so a slow client never
+  // stalls the other sessions on this shard.
+  shard->reactor.Add(client, [this, shard, raw] { ContinueHandshake(shard, raw); });
+}
+
+void TcpListener::ContinueHandshake(Shard* shard, Handshake* handshake) {
+  const Handshake::Step step = handshake->step;
+  bool over = true;
   try {
-    request = socket_handler_->ReadProto<ut::ConnectRequest>(client, true);
-  } catch (...) {
-    socket_handler_->Close(client);
+    over = AdvanceHandshake(handshake);
+  } catch (const std::exception& ex) {
+    if (DebugHandshake()) {
+      std::cerr << "[handshake] failed: " << ex.what() << "\n";
+    }
+    FinishHandshake(shard, handshake);
     return;
   }
+  if (!over) {
+    if (handshake->step != step) {
+      ArmHandshakeTimeout(shard, handshake);
+    }
+    return;
+  }
+  shard->reactor.Remove(handshake->socket);
+  shard->reactor.CancelTimer(handshake->timeout);
+  if (handshake->connection) {
+    StartSession(shard, handshake);
+  }
+  shard->handshakes.erase(handshake);
+}
+
+void TcpListener::ArmHandshakeTimeout(Shard* shard, Handshake* handshake) {
+  shard->reactor.CancelTimer(handshake->timeout);
+  handshake->timeout = shard->reactor.AddTimer(ut::kHandshakeTimeoutSeconds * 1000, [this, shard, handshake] {
+    handshake->timeout = 0;
+    if (DebugHandshake()) {
+      std::cerr << "[handshake] timed_out\n";
+    }
+    FinishHandshake(shard, handshake);
+  });
+}
+
+void TcpListener::FinishHandshake(Shard* shard, Handshake* handshake) {
+  shard->reactor.Remove(handshake->socket);
+  shard->reactor.CancelTimer(handshake->timeout);
+  if (handshake->connection) {
+    handshake->connection->CloseSocket();
+    registry_->MarkActive(handshake->client_id, false);
+  } else {
+    socket_handler_->Close(handshake->socket);
+  }
+  shard->handshakes.erase(handshake);
+}
+
+bool TcpListener::AdvanceHandshake(Handshake* handshake) {
+  // Replies go out while the socket's send buffer is still empty, so they
+  // fit in it and writing them never waits.
+  const ut::SocketHandle client = handshake->socket;
+  switch (handshake->step) {
+    case Handshake::Step::kConnectRequest:
+      if (!handshake->reader.ReadProto(*socket_handler_, client, &handshake->request)) {
+        return false;
+      }
+      // Take a pipelined SequenceHeader before replying, so no reply leaves
+      // unread bytes behind a close.
+      if (!(handshake->request.version() & ut::kResumeSequenceFlag)) {
+        return HandleConnectRequest(handshake);
+      }
+      handshake->step = Handshake::Step::kResumeHeader;
+      return AdvanceHandshake(handshake);
+    case Handshake::Step::kResumeHeader:
+      if (!handshake->reader.ReadProto(*socket_handler_, client, &handshake->remote_header)) {
+        return false;
+      }
+      return HandleConnectRequest(handshake);
+    case Handshake::Step::kDiscard:
+      for (; handshake->discard > 0; handshake->discard--) {
+        if (!handshake->reader.SkipPacket(*socket_handler_, client)) {
+          return false;
+        }
+      }
+      if (handshake->response.status() != ut::RETURNING_CLIENT) {
+        socket_handler_->WriteProto(client, handshake->response, true);
+        socket_handler_->Close(client);
+        return true;
+      }
+      if (handshake->request.version() & ut::kResumeSequenceFlag) {
+        // The session keeps running on its own shard; Recover hands it the
+        // socket, or closes it.
+        handshake->resuming->Recover(client, handshake->remote_header.sequencenumber(), &handshake->response);
+        return true;
+      }
+      socket_handler_->WriteProto(client, handshake->response, true);
+      handshake->step = Handshake::Step::kClientHeader;
+      return AdvanceHandshake(handshake);
+    case Handshake::Step::kClientHeader:
+      if (!handshake->reader.ReadProto(*socket_handler_, client, &handshake->remote_header)) {
+        return false;
+      }
+      handshake->resuming->Recover(client, handshake->remote_header.sequencenumber(), nullptr);
+      return true;
+    case Handshake::Step::kInitialPayload:
+      if (!handshake->connection->ReadPacket(&handshake->initial_payload)) {
+        if (handshake->connection->socket() == ut::kInvalidSocket) {
+          throw std::runtime_error("socket closed before INITIAL_PAYLOAD");
+        }
+        return false;
+      }
+      if (handshake->initial_payload.header() != static_cast<uint8_t>(ut::INITIAL_PAYLOAD)) {
+        if (DebugHandshake()) {
+          std::cerr << "[handshake] initial_payload_read_failed header="
+                    << static_cast<int>(handshake->initial_payload.header()) << "\n";
+        }
+        throw std::runtime_error("expected INITIAL_PAYLOAD");
+      }
+      return true;
+  }
+  return true;
+}
+
+bool TcpListener::HandleConnectRequest(Handshake* handshake) {
+  const ut::ConnectRequest& request = handshake->request;
+  const ut::SocketHandle client = handshake->socket;
+  const int pipelined = (request.version() >> ut::kPipelinedPacketsShift) & ut::kPipelinedPacketsMask;
+  // Packets the client sent ahead of our answer are dropped before any
+  // refusal, so closing does not reset the connection under the reply.
+  auto reply_after_discard = [&](ut::ConnectStatus status, const char* error) {
+    handshake->response.set_status(status);
+    if (error) {
+      handshake->response.set_error(error);
+    }
+    handshake->discard = pipelined;
+    handshake->step = Handshake::Step::kDiscard;
+    return AdvanceHandshake(handshake);
+  };
   if (DebugHandshake()) {
     std::cerr << "[handshake] connect_request client_id_len=" << request.clientid().size()
-              << " version=" << request.version() << "\n";
+              << " version=" << (request.version() & ut::kProtocolVersionMask)
+              << " cipher_suite=" << ((request.version() >> ut::kCipherSuiteShift) & ut::kCipherSuiteMask)
+              << " resume=" << ((request.version() & ut::kResumeSequenceFlag) != 0)
+              << " pipelined=" << pipelined << "\n";
   }
 
-  ut::ConnectResponse response;
-  if (request.version() != ut::kProtocolVersion) {
-    response.set_status(ut::MISMATCHED_PROTOCOL);
-    response.set_error("protocol mismatch");
-    socket_handler_->WriteProto(client, response, true);
-    socket_handler_->Close(client);
-    return;
+  if ((request.version() & ut::kProtocolVersionMask) != ut::kProtocolVersion) {
+    return reply_after_discard(ut::MISMATCHED_PROTOCOL, "protocol mismatch");
+  }
+
+  const auto cipher_suite =
+      static_cast<ut::CipherSuite>((request.version() >> ut::kCipherSuiteShift) & ut::kCipherSuiteMask);
+  if (!ut::IsCipherSuiteAvailable(cipher_suite)) {
+    return reply_after_discard(ut::MISMATCHED_PROTOCOL, "unsupported cipher suite");
   }
 
   const std::string client_id = request.clientid();
-  if (!registry_->HasSession(client_id)) {
-    response.set_status(ut::INVALID_KEY);
-    response.set_error("unknown client id");
-    socket_handler_->WriteProto(client, response, true);
-    socket_handler_->Close(client);
-    return;
+  auto session = registry_->Lookup(client_id);
+  if (!session) {
+    return reply_after_discard(ut::INVALID_KEY, "unknown client id");
   }
 
-  std::string passkey = registry_->LookupPasskey(client_id);
+  const std::string& passkey = session->passkey;
   if (DebugHandshake()) {
     std::cerr << "[handshake] passkey_len=" << passkey.size()
               << " has_underscore=" << (passkey.find('_') != std::string::npos) << "\n";
   }
   if (passkey.empty()) {
-    response.set_status(ut::INVALID_KEY);
-    response.set_error("missing key");
-    socket_handler_->WriteProto(client, response, true);
-    socket_handler_->Close(client);
-    return;
+    return reply_after_discard(ut::INVALID_KEY, "missing key");
   }
 
-  auto existing = registry_->LookupConnection(client_id);
+  auto existing = session->connection();
   if (existing && existing->socket() == ut::kInvalidSocket) {
-    response.set_status(ut::RETURNING_CLIENT);
-    socket_handler_->WriteProto(client, response, true);
-    if (!existing->Recover(client)) {
-      socket_handler_->Close(client);
+    if (existing->cipher_suite() != cipher_suite) {
+      return reply_after_discard(ut::MISMATCHED_PROTOCOL, "cipher suite differs from session");
     }
-    return;
+    // Pipelined packets were meant for a new session; the client starts over
+    // with Recover.
+    handshake->resuming = existing;
+    return reply_after_discard(ut::RETURNING_CLIENT, nullptr);
   }
 
-  response.set_status(ut::NEW_CLIENT);
-  socket_handler_->WriteProto(client, response, true);
+  // With INITIAL_PAYLOAD already on its way, NEW_CLIENT waits for
+  // StartSession and travels with the INITIAL_RESPONSE.
+  handshake->pipelined = pipelined > 0;
+  if (!handshake->pipelined) {
+    ut::ConnectResponse response;
+    response.set_status(ut::NEW_CLIENT);
+    socket_handler_->WriteProto(client, response, true);
+  }
 
-  auto connection = std::make_shared<ut::ServerClientConnection>(socket_handler_, client_id, passkey, client);
-  registry_->StoreConnection(client_id, connection);
+  handshake->connection = std::make_shared<ut::ServerClientConnection>(socket_handler_, client_id, passkey,
+                                                                       cipher_suite, client);
+  handshake->client_id = client_id;
+  registry_->StoreConnection(client_id, handshake->connection);
   registry_->MarkActive(client_id, true);
+  handshake->step = Handshake::Step::kInitialPayload;
+  return AdvanceHandshake(handshake);
+}
+
+void TcpListener::StartSession(Shard* shard, Handshake* handshake) {
+  auto connection = handshake->connection;
+  const std::string& client_id = handshake->client_id;
 
-  ut::Packet init_packet;
-  try {
-    if (!connection->ReadPacket(&init_packet) ||
-        init_packet.header() != static_cast<uint8_t>(ut::INITIAL_PAYLOAD)) {
-      if (DebugHandshake()) {
-        std::cerr << "[handshake] initial_payload_read_failed header="
-                  << static_cast<int>(init_packet.header()) << "\n";
-      }
-      connection->CloseSocket();
-      registry_->MarkActive(client_id, false);
-      return;
-    }
-  } catch (const std::exception& ex) {
-    if (DebugHandshake()) {
-      std::cerr << "[handshake] initial_payload_read_exception: " << ex.what() << "\n";
-    }
-    connection->CloseSocket();
-    registry_->MarkActive(client_id, false);
-    return;
-  }
   ut::InitialPayload initial_payload;
-  if (!initial_payload.ParseFromString(init_packet.payload())) {
+  if (!handshake->initial_payload.ParsePayload(&initial_payload)) {
     if (DebugHandshake()) {
       std::cerr << "[handshake] initial_payload_parse_failed size="
-                << init_packet.payload().size() << "\n";
+                << handshake->initial_payload.payload().size() << "\n";
     }
     connection->CloseSocket();
     registry_->MarkActive(client_id, false);
@@ -198,117 +567,84 @@ void TcpListener::HandleClient(ut::SocketHandle client) {
   std::string response_payload;
   initial_response.SerializeToString(&response_payload);
   if (DebugHandshake()) {
-    std::cerr << "[handshake] sending_initial_response size=" << response_payload.size() << "\n";
+    std::cerr << "[handshake] sending_initial_response size=" << response_payload.size()
+              << " pipelined=" << (handshake->pipelined ? 1 : 0) << "\n";
+  }
+  if (handshake->pipelined) {
+    ut::ConnectResponse connect_response;
+    connect_response.set_status(ut::NEW_CLIENT);
+    try {
+      socket_handler_->WriteProto(connection->socket(), connect_response, true);
+    } catch (...) {
+      connection->CloseSocket();
+      registry_->MarkActive(client_id, false);
+      return;
+    }
   }
   connection->WritePacket(ut::Packet(static_cast<uint8_t>(ut::INITIAL_RESPONSE), response_payload));
 
-  ut::PipeSocketHandler pipe_handler;
-  ut::PortForwardHandler forward_handler(socket_handler_, true);
-  ut::PortForwardHandler reverse_handler(socket_handler_, false);
-  ut::SocketHandle pipe = registry_->LookupTerminal(client_id);
-  if (pipe == ut::kInvalidSocket) {
-    connection->CloseSocket();
-    registry_->MarkActive(client_id, false);
-    return;
-  }
   const bool jump_mode = initial_payload.jumphost();
-  for (const auto& reverse_tunnel : initial_payload.reversetunnels()) {
-    reverse_handler.AddForwardRequest(reverse_tunnel);
-  }
-  const bool init_sent = jump_mode ? SendJumpInit(pipe_handler, pipe, initial_payload)
-                                    : SendTermInit(pipe_handler, pipe);
-  if (!init_sent) {
-    connection->CloseSocket();
-    registry_->MarkActive(client_id, false);
-    return;
-  }
-
-  while (running_) {
-    if (!pipe_handler.IsConnected(pipe)) {
+  auto registered = registry_->Lookup(client_id);
+  ut::SocketHandle pipe = registered ? registered->terminal_handle : ut::kInvalidSocket;
+  std::unique_ptr<PtyHost> pty_host;
+  if (registered && registered->host_pty) {
+    // Jumphost relaying lives in the terminal process, which this mode skips.
+    pty_host = std::make_unique<PtyHost>();
+    if (jump_mode || !pty_host->Start()) {
       if (DebugHandshake()) {
-        std::cerr << "[handshake] term pipe disconnected\n";
+        std::cerr << "[handshake] in_process_pty_start_failed jump=" << (jump_mode ? 1 : 0) << "\n";
       }
-      break;
+      connection->CloseSocket();
+      registry_->MarkActive(client_id, false);
+      return;
     }
-    bool did_work = false;
-    if (connection->reader() && connection->reader()->HasData()) {
-      ut::Packet packet;
-      bool read_ok = false;
-      try {
-        read_ok = connection->ReadPacket(&packet);
-      } catch (const std::exception& ex) {
-        if (DebugHandshake()) {
-          std::cerr << "[handshake] read_packet_exception: " << ex.what() << "\n";
-        }
-        break;
-      }
-      if (!read_ok) {
-        if (DebugHandshake()) {
-          std::cerr << "[handshake] read_packet_failed\n";
-        }
-      } else {
-        if (packet.header() == static_cast<uint8_t>(ut::TERMINAL_BUFFER) ||
-            packet.header() == static_cast<uint8_t>(ut::TERMINAL_INFO)) {
-          if (DebugHandshake()) {
-            std::cerr << "[handshake] term client_to_pipe header="
-                      << static_cast<int>(packet.header())
-                      << " bytes=" << packet.payload().size()
-                      << " jump=" << (jump_mode ? 1 : 0) << "\n";
-          }
-          pipe_handler.WritePacket(pipe, packet);
-          if (DebugHandshake()) {
-            std::cerr << "[handshake] term pipe_to_client pipe_write_ok=1\n";
-          }
-          did_work = true;
-        } else if (packet.header() == static_cast<uint8_t>(ut::KEEP_ALIVE)) {
-          connection->WritePacket(ut::Packet(static_cast<uint8_t>(ut::KEEP_ALIVE), ""));
-        } else if (packet.header() == static_cast<uint8_t>(ut::PORT_FORWARD_DESTINATION_REQUEST)) {
-          forward_handler.HandlePacket(packet, [&](const ut::Packet& out) { connection->WritePacket(out); });
-        } else if (packet.header() == static_cast<uint8_t>(ut::PORT_FORWARD_DESTINATION_RESPONSE)) {
-          reverse_handler.HandlePacket(packet, [&](const ut::Packet& out) { connection->WritePacket(out); });
-        } else if (packet.header() == static_cast<uint8_t>(ut::PORT_FORWARD_DATA)) {
-          forward_handler.HandlePacket(packet, [&](const ut::Packet& out) { connection->WritePacket(out); });
-          reverse_handler.HandlePacket(packet, [&](const ut::Packet& out) { connection->WritePacket(out); });
-        }
-        did_work = true;
-      }
+  } else {
+    if (pipe == ut::kInvalidSocket) {
+      connection->CloseSocket();
+      registry_->MarkActive(client_id, false);
+      return;
     }
-
-    if (pipe_handler.HasData(pipe)) {
-      ut::Packet packet;
-      try {
-        if (pipe_handler.ReadPacket(pipe, &packet)) {
-          if (DebugHandshake()) {
-            std::cerr << "[handshake] term pipe_to_client header="
-                      << static_cast<int>(packet.header())
-                      << " bytes=" << packet.payload().size()
-                      << " jump=" << (jump_mode ? 1 : 0) << "\n";
-          }
-          connection->WritePacket(packet);
-          if (DebugHandshake()) {
-            std::cerr << "[handshake] term pipe_to_client write_ok=1\n";
-          }
-          did_work = true;
-        } else {
-          if (DebugHandshake()) {
-            std::cerr << "[handshake] term pipe_to_client read_failed\n";
-          }
-          break;
-        }
-      } catch (...) {
-        break;
-      }
+    ut::PipeSocketHandler pipe_handler;
+    const bool init_sent = jump_mode ? SendJumpInit(pipe_handler, pipe, initial_payload)
+                                      : SendTermInit(pipe_handler, pipe);
+    if (!init_sent) {
+      connection->CloseSocket();
+      registry_->MarkActive(client_id, false);
+      return;
     }
+  }
 
-    forward_handler.Update([&](const ut::Packet& out) { connection->WritePacket(out); });
-    reverse_handler.Update([&](const ut::Packet& out) { connection->WritePacket(out); });
-    if (!did_work) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(5));
-    }
+  auto session = std::make_unique<ServerSession>(socket_handler_, connection, pipe, jump_mode,
+                                                 [shard](ServerSession* requester) {
+                                                   {
+                                                     std::lock_guard<std::mutex> guard(shard->mutex);
+                                                     shard->service_requests.push_back(requester);
+                                                   }
+                                                   shard->reactor.Wake();
+                                                 });
+#ifndef _WIN32
+  if (pty_host) {
+    session->HostPty(std::move(pty_host));
   }
+#endif
+  for (const auto& reverse_tunnel : initial_payload.reversetunnels()) {
+    session->reverse_handler().AddForwardRequest(reverse_tunnel);
+  }
+  ServerSession* raw = session.get();
+  shard->sessions[raw] = std::move(session);
+  shard->session_count++;
+  raw->Start(&shard->reactor);
+}
 
-  pipe_handler.Close(pipe);
+void TcpListener::EndSession(Shard* shard, ServerSession* session) {
+  auto it = shard->sessions.find(session);
+  if (it == shard->sessions.end()) {
+    return;
+  }
+  const std::string client_id = session->client_id();
+  session->Stop();
   registry_->UnregisterTerminal(client_id);
   registry_->MarkActive(client_id, false);
-  connection->CloseSocket();
+  shard->sessions.erase(it);
+  shard->session_count--;
 }
@@ -1,11 +1,16 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <cstdint>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
+#include "protocol/Reactor.hpp"
 #include "protocol/SocketTypes.hpp"
 #include "protocol/TcpSocketHandler.hpp"
 
@@ -23,15 +28,44 @@ public:
   void SetSharedKey(const std::array<unsigned char, 32>& key);
 
 private:
+  // Sessions run on a fixed set of shards, one per core. Each shard is a
+  // thread driving a reactor; a session stays on the shard that completed its
+  // handshake. Accepted sockets wait in a shared queue and are picked up by
+  // an idle shard (or the least loaded one when none is idle).
+  struct Shard;
+  struct Handshake;
+
   void AcceptLoop();
-  void HandleClient(ut::SocketHandle client);
+  void RunShard(Shard* shard);
+  // Runs on the accept thread every kStaleSessionSweepSeconds.
+  void SweepStaleSessions();
+  // Wakes a shard to take the next accepted socket.
+  void DispatchHandshake();
+  void TakeHandshake(Shard* shard);
+  void ContinueHandshake(Shard* shard, Handshake* handshake);
+  // (Re)starts the handshake's deadline for its next message.
+  void ArmHandshakeTimeout(Shard* shard, Handshake* handshake);
+  // Takes the handshake as far as the bytes that have arrived allow. Returns
+  // true when it is over: the socket is closed or recovered, or
+  // INITIAL_PAYLOAD is in and StartSession takes over. Throws when the client
+  // fails or hangs up.
+  bool AdvanceHandshake(Handshake* handshake);
+  bool HandleConnectRequest(Handshake* handshake);
+  void StartSession(Shard* shard, Handshake* handshake);
+  void FinishHandshake(Shard* shard, Handshake* handshake);
+  void EndSession(Shard* shard, class ServerSession* session);
 
   ut::SocketHandle listen_socket_ = ut::kInvalidSocket;
   std::thread accept_thread_;
-  bool running_ = false;
+  ut::Reactor accept_reactor_;
+  ut::TimerWheel::TimerId sweep_timer_ = 0;
+  std::atomic<bool> running_{false};
   uint16_t port_ = 0;
   class ClientRegistry* registry_ = nullptr;
   bool encryption_enabled_ = false;
   std::array<unsigned char, 32> shared_key_{};
   std::shared_ptr<ut::TcpSocketHandler> socket_handler_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::mutex accepted_mutex_;
+  std::deque<ut::SocketHandle> accepted_;
 };
@@ -64,6 +64,7 @@ int main(int argc, char** argv) {
   config.Load();
   SetVerbose(config.verbose);
   Server server;
+  server.SetInProcessPty(config.in_process_pty);
 #ifdef UNDYING_TERMINAL_REQUIRE_DEPS
   if (!config.shared_key_hex.empty()) {
     std::array<unsigned char, 32> key{};
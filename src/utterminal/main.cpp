@@ -1,3 +1,5 @@
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
@@ -8,34 +10,110 @@
 
 #include "ConPTYSession.hpp"
 #include "protocol/ClientConnection.hpp"
+#include "protocol/LatencyTrace.hpp"
+#include "protocol/OutputCoalescer.hpp"
 #include "protocol/PipeSocketHandler.hpp"
 #include "protocol/Packet.hpp"
 #include "protocol/TcpSocketHandler.hpp"
 #include "UT.pb.h"
 #include "UTerminal.pb.h"
+#include "UtConstants.hpp"
+
+#ifndef _WIN32
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+#endif
 
-#ifdef _WIN32
 namespace {
 bool DebugHandshake() {
   return std::getenv("UT_DEBUG_HANDSHAKE") != nullptr;
 }
 
-std::wstring GetPipeName() {
-  const char* env = std::getenv("UT_PIPE_NAME");
-  if (env && *env) {
-    return std::wstring(env, env + std::strlen(env));
+#ifndef _WIN32
+// Starts the user's shell on a new PTY and gives its master to the server,
+// which relays it from then on. Until the server has the descriptor, input
+// may still arrive over the socket; it is written to the PTY here. Returns
+// when the server closes the socket, which it does once the shell exits.
+int RunShellWithHandoff(ut::PipeSocketHandler& pipe_handler, ut::SocketHandle pipe) {
+  winsize size{};
+  size.ws_col = 80;
+  size.ws_row = 24;
+  int master = -1;
+  const pid_t child = forkpty(&master, nullptr, nullptr, &size);
+  if (child < 0) {
+    std::cerr << "Failed to start PTY session\n";
+    return 1;
+  }
+  if (child == 0) {
+    const char* shell = std::getenv("SHELL");
+    if (!shell || !*shell) {
+      shell = "/bin/sh";
+    }
+    execl(shell, shell, static_cast<char*>(nullptr));
+    _exit(127);
+  }
+
+  if (!pipe_handler.WritePacketWithFd(pipe, ut::Packet(ut::kTerminalPtyHandoffHeader, ""), master)) {
+    std::cerr << "Failed to hand the PTY to the server\n";
+    close(master);
+    waitpid(child, nullptr, 0);
+    return 1;
+  }
+  if (DebugHandshake()) {
+    std::cerr << "[handshake] term pty_handoff sent\n";
+  }
+
+  ut::Packet packet;
+  while (true) {
+    try {
+      if (!pipe_handler.ReadPacket(pipe, &packet)) {
+        break;
+      }
+    } catch (...) {
+      break;
+    }
+    if (packet.header() == static_cast<uint8_t>(ut::TERMINAL_BUFFER)) {
+      ut::TerminalBuffer tb;
+      if (packet.ParsePayload(&tb)) {
+        [[maybe_unused]] const ssize_t written = write(master, tb.buffer().data(), tb.buffer().size());
+      }
+    } else if (packet.header() == static_cast<uint8_t>(ut::TERMINAL_INFO)) {
+      ut::TerminalInfo info;
+      if (packet.ParsePayload(&info) && info.width() > 0 && info.height() > 0) {
+        size.ws_col = static_cast<unsigned short>(info.width());
+        size.ws_row = static_cast<unsigned short>(info.height());
+        ioctl(master, TIOCSWINSZ, &size);
+      }
+    }
   }
-  return L"\\\\.\\pipe\\undying-terminal";
+
+  // With the server's copy gone too, closing the master hangs up the shell.
+  close(master);
+  waitpid(child, nullptr, 0);
+  pipe_handler.Close(pipe);
+  return 0;
 }
+#endif
 }
+
 int main(int argc, char** argv) {
   bool jump_mode = false;
   bool tunnel_only = false;
+#ifdef _WIN32
   std::wstring command = L"cmd.exe";
+#endif
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
     if (arg == "--powershell") {
+#ifdef _WIN32
       command = L"powershell.exe";
+#endif
     } else if (arg == "--jump") {
       jump_mode = true;
     } else if (arg == "--tunnel-only") {
@@ -91,7 +169,7 @@ int main(int argc, char** argv) {
   }
 
   ut::PipeSocketHandler pipe_handler;
-  const std::wstring pipe_name = GetPipeName();
+  const auto pipe_name = ut::TerminalPipeName();
   ut::SocketHandle pipe = pipe_handler.Connect(pipe_name);
   if (pipe == ut::kInvalidSocket) {
     std::cerr << "Failed to connect to named pipe\n";
@@ -118,6 +196,11 @@ int main(int argc, char** argv) {
     std::cerr << "Failed to read init packet\n";
     return 1;
   }
+  if (init_packet.header() == ut::kTerminalServerHostedHeader) {
+    // The server runs the shell itself; nothing left for this process to do.
+    pipe_handler.Close(pipe);
+    return 0;
+  }
   if (init_packet.header() != static_cast<uint8_t>(jump_mode ? ut::JUMPHOST_INIT : ut::TERMINAL_INIT)) {
     std::cerr << "Unexpected init packet\n";
     return 1;
@@ -125,7 +208,7 @@ int main(int argc, char** argv) {
 
   if (jump_mode) {
     ut::InitialPayload payload;
-    if (!payload.ParseFromString(init_packet.payload())) {
+    if (!init_packet.ParsePayload(&payload)) {
       std::cerr << "Invalid jumphost init payload\n";
       return 1;
     }
@@ -167,7 +250,7 @@ int main(int argc, char** argv) {
       return 1;
     }
     ut::InitialResponse response;
-    if (!response.ParseFromString(response_packet.payload()) || !response.error().empty()) {
+    if (!response_packet.ParsePayload(&response) || !response.error().empty()) {
       std::cerr << "Destination initial response error: " << response.error() << "\n";
       return 1;
     }
@@ -196,7 +279,9 @@ int main(int argc, char** argv) {
           if (DebugHandshake()) {
             std::cerr << "[handshake] jump dest_to_pipe read_failed\n";
           }
-          Sleep(5);
+          if (dest_connection.socket() == ut::kInvalidSocket) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+          }
           continue;
         }
         if (DebugHandshake()) {
@@ -235,18 +320,23 @@ int main(int argc, char** argv) {
     return 0;
   }
 
+#ifdef _WIN32
   ConPTYSession session;
   if (!session.Start(command, false)) {
     std::cerr << "Failed to start ConPTY session\n";
     return 1;
   }
 
+  // When the last keystroke traced for latency reached ConPTY; 0 once its
+  // output has been read.
+  std::atomic<int64_t> shell_trace_us{0};
+
   std::thread input_thread([&]() {
     ut::Packet packet;
     while (session.IsRunning() && pipe_handler.ReadPacket(pipe, &packet)) {
       if (packet.header() == static_cast<uint8_t>(ut::TERMINAL_BUFFER)) {
         ut::TerminalBuffer tb;
-        if (!tb.ParseFromString(packet.payload())) {
+        if (!packet.ParsePayload(&tb)) {
           continue;
         }
         if (DebugHandshake() && !jump_mode) {
@@ -254,9 +344,13 @@ int main(int argc, char** argv) {
         }
         DWORD written = 0;
         WriteFile(session.InputWriteHandle(), tb.buffer().data(), static_cast<DWORD>(tb.buffer().size()), &written, nullptr);
+        ut::latency_trace::Stamp stamp;
+        if (ut::latency_trace::Find(packet.payload(), &stamp)) {
+          shell_trace_us = ut::latency_trace::NowUs();
+        }
       } else if (packet.header() == static_cast<uint8_t>(ut::TERMINAL_INFO)) {
         ut::TerminalInfo info;
-        if (!info.ParseFromString(packet.payload())) {
+        if (!packet.ParsePayload(&info)) {
           continue;
         }
         if (info.width() > 0 && info.height() > 0) {
@@ -267,24 +361,46 @@ int main(int argc, char** argv) {
   });
 
   std::thread output_thread([&]() {
-    std::vector<char> buffer(4096);
+    std::vector<char> buffer(16 * 1024);
+    ut::OutputCoalescer coalescer;
+    auto send_output = [&]() {
+      if (coalescer.empty()) {
+        return;
+      }
+      ut::TerminalBuffer tb;
+      tb.set_buffer(coalescer.data());
+      coalescer.Clear();
+      std::string payload;
+      if (!tb.SerializeToString(&payload)) {
+        return;
+      }
+      ut::Packet packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), payload);
+      pipe_handler.WritePacket(pipe, packet);
+    };
     DWORD read_bytes = 0;
     while (session.IsRunning() && ReadFile(session.OutputReadHandle(), buffer.data(), static_cast<DWORD>(buffer.size()), &read_bytes, nullptr)) {
       if (read_bytes == 0) {
         break;
       }
-      ut::TerminalBuffer tb;
-      tb.set_buffer(std::string(buffer.data(), buffer.data() + read_bytes));
       if (DebugHandshake() && !jump_mode) {
         std::cerr << "[handshake] term output bytes=" << read_bytes << "\n";
       }
-      std::string payload;
-      if (!tb.SerializeToString(&payload)) {
-        continue;
+      const int64_t traced_us = shell_trace_us.exchange(0);
+      if (traced_us != 0) {
+        ut::latency_trace::HistogramFor(ut::latency_trace::Segment::kShell)
+            .Record(ut::latency_trace::NowUs() - traced_us);
+      }
+      coalescer.Append(buffer.data(), read_bytes);
+      // ConPTY output that is already waiting joins the batch; a lone echo
+      // goes out straight away.
+      DWORD available = 0;
+      const bool more = PeekNamedPipe(session.OutputReadHandle(), nullptr, 0, nullptr, &available, nullptr) &&
+                        available > 0;
+      if (coalescer.ShouldFlush(more)) {
+        send_output();
       }
-      ut::Packet packet(static_cast<uint8_t>(ut::TERMINAL_BUFFER), payload);
-      pipe_handler.WritePacket(pipe, packet);
     }
+    send_output();
   });
 
   session.Wait();
@@ -295,14 +411,13 @@ int main(int argc, char** argv) {
   if (output_thread.joinable()) {
     output_thread.join();
   }
+  const std::string latency = ut::latency_trace::Summary();
+  if (!latency.empty()) {
+    std::cerr << "[latency] " << latency << "\n";
+  }
   pipe_handler.Close(pipe);
   return 0;
-}
 #else
-int main(int argc, char** argv) {
-  (void)argc;
-  (void)argv;
-  std::cout << "undying-terminal-terminal is supported on Windows 10 1809+" << std::endl;
-  return 0;
-}
+  return RunShellWithHandoff(pipe_handler, pipe);
 #endif
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <iostream>
+
+// Reports `message` when `condition` fails and passes the result on, so a
+// test can stop at the first failure or keep checking with `ok &= ...`.
+inline bool Expect(bool condition, const char* message) {
+  if (!condition) {
+    std::cerr << message << "\n";
+  }
+  return condition;
+}
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <string>
+
+#include "BackupRing.hpp"
+
+namespace {
+std::string MakeFrame(int index, size_t size) {
+  return std::string(size, static_cast<char>('a' + index % 26));
+}
+
+std::string Join(const ut::SocketBuffer* buffers, size_t count) {
+  std::string out;
+  for (size_t i = 0; i < count; ++i) {
+    out.append(static_cast<const char*>(buffers[i].data), buffers[i].size);
+  }
+  return out;
+}
+}
+
+int main() {
+  ut::BackupRing ring(1000);
+  for (int i = 0; i < 5; ++i) {
+    ring.Append(MakeFrame(i, 100));
+  }
+  if (ring.count() != 5 || ring.bytes() != 500) {
+    std::cerr << "Append accounting wrong\n";
+    return 1;
+  }
+
+  for (int i = 5; i < 40; ++i) {
+    ring.Append(MakeFrame(i, 150));
+  }
+  if (ring.bytes() > ring.capacity()) {
+    std::cerr << "Ring exceeded capacity\n";
+    return 1;
+  }
+  const size_t held = ring.count();
+  for (size_t i = 0; i < held; ++i) {
+    const int index = 40 - static_cast<int>(held) + static_cast<int>(i);
+    if (ring.Frame(i) != MakeFrame(index, 150)) {
+      std::cerr << "Frame " << i << " corrupted\n";
+      return 1;
+    }
+  }
+
+  ut::SocketBuffer slices[2];
+  const size_t slice_count = ring.Slices(0, held, slices);
+  std::string expected;
+  for (size_t i = 0; i < held; ++i) {
+    expected.append(ring.Frame(i));
+  }
+  if (slice_count == 0 || Join(slices, slice_count) != expected) {
+    std::cerr << "Slices do not cover the newest frames\n";
+    return 1;
+  }
+  if (ring.Slices(held - 1, 1, slices) != 1 || Join(slices, 1) != MakeFrame(39, 150)) {
+    std::cerr << "Single newest slice wrong\n";
+    return 1;
+  }
+
+  ring.DropOldest(held - 2);
+  if (ring.count() != 2 || ring.Frame(0) != MakeFrame(38, 150) || ring.Frame(1) != MakeFrame(39, 150)) {
+    std::cerr << "DropOldest kept the wrong frames\n";
+    return 1;
+  }
+
+  ut::BackupRing large(4 * 1024 * 1024);
+  for (int i = 0; i < 1000; ++i) {
+    large.Append(MakeFrame(i, 4000));
+  }
+  large.DropOldest(998);
+  large.Append(MakeFrame(1000, 4000));
+  if (large.count() != 3 || large.bytes() != 12000 || large.Frame(0) != MakeFrame(998, 4000) ||
+      large.Frame(2) != MakeFrame(1000, 4000)) {
+    std::cerr << "Ring corrupted after shrinking\n";
+    return 1;
+  }
+
+  ring.Append(std::string(2000, 'z'));
+  if (ring.count() != 0 || ring.bytes() != 0) {
+    std::cerr << "Oversized frame should clear the ring\n";
+    return 1;
+  }
+
+  std::cout << "Backup ring test passed\n";
+  return 0;
+}
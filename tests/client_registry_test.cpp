@@ -0,0 +1,94 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ClientRegistry.hpp"
+#include "Expect.hpp"
+
+// The registry only holds connections by pointer and this test links none of
+// the protocol code, so an empty definition of the class stands in for it.
+namespace ut {
+class ServerClientConnection {};
+}
+
+int main() {
+  bool ok = true;
+
+  ClientRegistry registry;
+  registry.RegisterTerminal("alpha", "key-a", static_cast<ut::SocketHandle>(7));
+  registry.RegisterHostedSession("beta", "key-b");
+
+  auto alpha = registry.Lookup("alpha");
+  ok &= Expect(alpha && alpha->passkey == "key-a", "Lookup should return the passkey");
+  ok &= Expect(alpha && alpha->terminal_handle == static_cast<ut::SocketHandle>(7), "Lookup should return the terminal");
+  ok &= Expect(alpha && !alpha->host_pty && alpha->active(), "Terminal session should start active");
+  auto beta = registry.Lookup("beta");
+  ok &= Expect(beta && beta->host_pty && beta->terminal_handle == ut::kInvalidSocket, "Hosted session fields");
+  ok &= Expect(!registry.Lookup("gamma"), "Unknown id should not be found");
+
+  // Only sessions that went inactive before the cutoff expire.
+  registry.MarkActive("alpha", false);
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  auto closed = registry.CleanupStale(0);
+  ok &= Expect(closed.size() == 1 && closed[0] == static_cast<ut::SocketHandle>(7), "Stale terminal should be returned");
+  ok &= Expect(!registry.Lookup("alpha"), "Stale session should be dropped");
+  ok &= Expect(registry.Lookup("beta") != nullptr, "Active session should survive cleanup");
+  ok &= Expect(alpha && alpha->passkey == "key-a", "Handle should outlive its entry");
+
+  // Reactivating or unregistering takes a session out of the expiry index.
+  registry.MarkActive("beta", false);
+  registry.MarkActive("beta", true);
+  registry.RegisterTerminal("delta", "key-d", ut::kInvalidSocket);
+  registry.MarkActive("delta", false);
+  registry.UnregisterTerminal("delta");
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  ok &= Expect(registry.CleanupStale(0).empty(), "Nothing should expire");
+  ok &= Expect(registry.Lookup("beta") != nullptr, "Reactivated session should survive");
+
+  // Registering again replaces the fields but keeps the client connection.
+  auto connection = std::make_shared<ut::ServerClientConnection>();
+  registry.StoreConnection("beta", connection);
+  registry.MarkActive("beta", false);
+  registry.RegisterTerminal("beta", "key-b2", static_cast<ut::SocketHandle>(9));
+  auto beta_again = registry.Lookup("beta");
+  ok &= Expect(beta_again && beta_again->passkey == "key-b2" && !beta_again->host_pty, "Re-registration fields");
+  ok &= Expect(beta_again && beta_again->connection() == connection, "Re-registration dropped the connection");
+  ok &= Expect(beta_again && beta_again->active(), "Re-registered session should be active");
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  ok &= Expect(registry.CleanupStale(0).empty(), "Re-registered session should not expire");
+
+  // Registration, lookups and activity changes from many threads at once.
+  std::atomic<bool> failed{false};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&registry, &failed, t] {
+      for (int i = 0; i < 2000; ++i) {
+        const std::string id = "client-" + std::to_string(t) + "-" + std::to_string(i % 50);
+        registry.RegisterTerminal(id, id, ut::kInvalidSocket);
+        auto session = registry.Lookup(id);
+        if (!session || session->passkey != id) {
+          failed = true;
+        }
+        registry.MarkActive(id, (i & 1) != 0);
+        if (i % 7 == 0) {
+          registry.UnregisterTerminal(id);
+        }
+        registry.CleanupStale(60);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ok &= Expect(!failed, "Concurrent lookups should see their own registrations");
+
+  if (!ok) {
+    return 1;
+  }
+  std::cout << "Client registry test passed\n";
+  return 0;
+}
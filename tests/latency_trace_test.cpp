@@ -0,0 +1,51 @@
+#include <iostream>
+#include <string>
+
+#include "Expect.hpp"
+#include "LatencyTrace.hpp"
+
+int main() {
+  namespace trace = ut::latency_trace;
+  bool ok = true;
+
+  // A TerminalBuffer {buffer: "ls"} as protobuf writes it, then the stamp.
+  std::string payload("\x0a\x02ls", 4);
+  trace::Append(trace::Stamp{300, 1234567890123}, &payload);
+  ok &= Expect(payload.substr(4, 3) == std::string("\x10\xac\x02", 3), "Trace id should be field 2");
+  trace::Stamp stamp;
+  ok &= Expect(trace::Find(payload, &stamp) && stamp.trace_id == 300 && stamp.timestamp_us == 1234567890123,
+               "Stamp should survive a round trip");
+  ok &= Expect(!trace::Find(std::string("\x0a\x02ls", 4), &stamp), "Unstamped buffer has no stamp");
+  ok &= Expect(!trace::Find("", &stamp), "Empty keepalive has no stamp");
+  ok &= Expect(!trace::Find(std::string("\x0a\x09ls", 4), &stamp), "Truncated buffer should be rejected");
+
+  trace::Histogram histogram;
+  ok &= Expect(histogram.Percentile(0.5) == 0, "Empty histogram should report 0");
+  for (int i = 1; i <= 100; ++i) {
+    histogram.Record(i * 1000);
+  }
+  const int64_t p50 = histogram.Percentile(0.5);
+  const int64_t p99 = histogram.Percentile(0.99);
+  ok &= Expect(histogram.count() == 100, "Histogram should count every sample");
+  ok &= Expect(p50 >= 50000 && p50 <= 50000 * 9 / 8, "p50 should be within a bucket of 50ms");
+  ok &= Expect(p99 >= 99000 && p99 <= 99000 * 9 / 8, "p99 should be within a bucket of 99ms");
+  histogram.Record(-5);
+  histogram.Record(INT64_MAX);
+  ok &= Expect(histogram.Percentile(0) == 0 && histogram.Percentile(1) == INT64_MAX,
+               "Extremes should land in the end buckets");
+
+  trace::HistogramFor(trace::Segment::kNetwork).Record(2500);
+  const std::string summary = trace::Summary();
+  ok &= Expect(summary.find("network p50=") == 0 && summary.find("n=1") != std::string::npos,
+               "Summary should list recorded segments only");
+  ok &= Expect(trace::TakeSummary() == summary, "TakeSummary should report the samples so far");
+  ok &= Expect(trace::TakeSummary().empty() && trace::Summary().empty(), "TakeSummary should clear the histograms");
+  trace::HistogramFor(trace::Segment::kServer).Record(1000);
+  ok &= Expect(trace::TakeSummary().find("server p50=1.0ms") == 0, "The next window should hold new samples only");
+
+  if (!ok) {
+    return 1;
+  }
+  std::cout << "Latency trace test passed\n";
+  return 0;
+}
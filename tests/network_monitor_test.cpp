@@ -0,0 +1,26 @@
+#include <iostream>
+
+#include "Expect.hpp"
+#include "NetworkMonitor.hpp"
+#include "TcpSocketHandler.hpp"
+
+int main() {
+  ut::TcpSocketHandler handler;
+  const ut::SocketHandle listener = handler.Listen("127.0.0.1", 0);
+  const ut::SocketHandle client = handler.Connect("127.0.0.1", handler.GetBoundPort(listener));
+  if (!Expect(client != ut::kInvalidSocket, "Loopback connect failed") ||
+      !Expect(ut::NetworkMonitor::HasLocalAddress(client), "Loopback address was not found on an interface")) {
+    return 1;
+  }
+  handler.Close(client);
+  handler.Close(listener);
+
+  // Watching may be unavailable (no netlink in a sandbox); either way Stop
+  // must return promptly and a second Stop is harmless.
+  ut::NetworkMonitor monitor;
+  const bool watching = monitor.Start([] {});
+  monitor.Stop();
+  monitor.Stop();
+  std::cout << "Network monitor test passed (watching " << (watching ? "supported" : "unsupported") << ")\n";
+  return 0;
+}
@@ -0,0 +1,39 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "Expect.hpp"
+#include "OutputCoalescer.hpp"
+
+int main() {
+  using Clock = ut::OutputCoalescer::Clock;
+  bool ok = true;
+  const Clock::time_point start = Clock::now();
+
+  ut::OutputCoalescer coalescer(8, std::chrono::microseconds(2000));
+  ok &= Expect(!coalescer.ShouldFlush(false, start), "Empty batch should not flush");
+
+  // Echo: nothing else is queued, so it goes out at once.
+  coalescer.Append("a", 1, start);
+  ok &= Expect(coalescer.ShouldFlush(false, start), "Drained source should flush");
+  coalescer.Clear();
+
+  // Sustained output: hold while more is queued, until size or age runs out.
+  coalescer.Append("abc", 3, start);
+  ok &= Expect(!coalescer.ShouldFlush(true, start + std::chrono::microseconds(500)), "Young batch should wait");
+  coalescer.Append("defgh", 5, start + std::chrono::microseconds(600));
+  ok &= Expect(coalescer.ShouldFlush(true, start + std::chrono::microseconds(600)), "Full batch should flush");
+  ok &= Expect(coalescer.data() == "abcdefgh", "Batch should keep reads in order");
+  coalescer.Clear();
+  ok &= Expect(coalescer.empty(), "Clear should empty the batch");
+
+  coalescer.Append("x", 1, start + std::chrono::milliseconds(10));
+  ok &= Expect(!coalescer.ShouldFlush(true, start + std::chrono::milliseconds(11)), "Age counts from the first byte");
+  ok &= Expect(coalescer.ShouldFlush(true, start + std::chrono::microseconds(12000)), "Old batch should flush");
+
+  if (!ok) {
+    return 1;
+  }
+  std::cout << "Output coalescer test passed\n";
+  return 0;
+}
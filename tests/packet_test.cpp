@@ -0,0 +1,58 @@
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "Packet.hpp"
+
+int main() {
+  ut::Packet packet(static_cast<uint8_t>(1), std::string("hello"));
+  if (packet.header() != 1 || packet.is_encrypted() || packet.payload() != "hello") {
+    std::cerr << "Constructor fields wrong\n";
+    return 1;
+  }
+  const std::string_view frame = packet.frame();
+  if (frame.size() != ut::Packet::kFrameOverhead + 5 || ut::Packet::DecodeLength(frame.data()) != 7) {
+    std::cerr << "Frame length prefix wrong\n";
+    return 1;
+  }
+  if (packet.serialize() != std::string("\0\1hello", 7)) {
+    std::cerr << "Serialize wrong\n";
+    return 1;
+  }
+
+  auto buffer = std::make_shared<std::string>("xx");
+  buffer->append(frame.data(), frame.size());
+  ut::Packet view(buffer, 2, frame.size());
+  if (view.payload() != "hello" || view.payload().data() != buffer->data() + 2 + ut::Packet::kFrameOverhead) {
+    std::cerr << "Frame view should not copy\n";
+    return 1;
+  }
+
+  ut::Packet copy = view;
+  copy.set_encrypted(true);
+  if (view.is_encrypted() || !copy.is_encrypted() || copy.payload() != "hello") {
+    std::cerr << "Copy-on-write failed\n";
+    return 1;
+  }
+
+  ut::Packet parsed(std::string("\1\7abc", 5));
+  if (!parsed.is_encrypted() || parsed.header() != 7 || parsed.payload() != "abc") {
+    std::cerr << "Parse from serialized failed\n";
+    return 1;
+  }
+
+  ut::Packet empty;
+  if (empty.header() != 255 || !empty.payload().empty() || empty.length() != 2) {
+    std::cerr << "Default packet wrong\n";
+    return 1;
+  }
+
+  ut::Packet bad(buffer, 2, 3);
+  if (bad.header() != 255) {
+    std::cerr << "Short frame should be rejected\n";
+    return 1;
+  }
+
+  std::cout << "Packet test passed\n";
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include <iostream>
+#include <string>
+
+#include "Packet.hpp"
+#include "PipeSocketHandler.hpp"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifndef _WIN32
+bool TestFdPassing() {
+  int pair[2] = {-1, -1};
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+    std::cerr << "socketpair failed\n";
+    return false;
+  }
+  int data[2] = {-1, -1};
+  if (pipe(data) != 0) {
+    std::cerr << "pipe failed\n";
+    return false;
+  }
+
+  ut::PipeSocketHandler handler;
+  const ut::SocketHandle sender = static_cast<ut::SocketHandle>(pair[0]);
+  const ut::SocketHandle receiver = static_cast<ut::SocketHandle>(pair[1]);
+  if (!handler.WritePacketWithFd(sender, ut::Packet(7, "handoff"), data[1])) {
+    std::cerr << "WritePacketWithFd failed\n";
+    return false;
+  }
+  handler.WritePacket(sender, ut::Packet(8, "plain"));
+
+  ut::Packet packet;
+  int fd = -1;
+  if (!handler.ReadPacketWithFd(receiver, &packet, &fd) || packet.header() != 7 ||
+      packet.payload() != "handoff" || fd < 0) {
+    std::cerr << "Packet with descriptor did not round-trip\n";
+    return false;
+  }
+  // The received descriptor is a second handle on the same pipe.
+  close(data[1]);
+  if (write(fd, "x", 1) != 1) {
+    std::cerr << "Received descriptor is not writable\n";
+    return false;
+  }
+  close(fd);
+  char c = 0;
+  if (read(data[0], &c, 1) != 1 || c != 'x') {
+    std::cerr << "Write through the received descriptor was lost\n";
+    return false;
+  }
+
+  if (!handler.ReadPacketWithFd(receiver, &packet, &fd) || packet.header() != 8 || fd != -1) {
+    std::cerr << "Plain packet reported a descriptor\n";
+    return false;
+  }
+
+  handler.Close(sender);
+  if (handler.ReadPacketWithFd(receiver, &packet, &fd)) {
+    std::cerr << "Read succeeded after the peer closed\n";
+    return false;
+  }
+  handler.Close(receiver);
+  close(data[0]);
+  return true;
+}
+#endif
+}
+
+int main() {
+#ifndef _WIN32
+  if (!TestFdPassing()) {
+    return 1;
+  }
+#endif
+  std::cout << "PipeSocketHandler test passed\n";
+  return 0;
+}
@@ -0,0 +1,53 @@
+#include <iostream>
+#include <string>
+
+#include "Expect.hpp"
+#include "PortForwardWire.hpp"
+
+int main() {
+  namespace wire = ut::port_forward_wire;
+
+  // What protobuf emits for {sourcetodestination: true, socketid: 5,
+  // buffer: "hi"}.
+  const ut::Packet small = wire::EncodeData(7, true, 5, "hi", 2);
+  if (!Expect(small.header() == 7 && small.payload() == std::string("\x08\x01\x10\x05\x1a\x02hi", 8),
+              "Small frame does not match the protobuf encoding")) {
+    return 1;
+  }
+
+  // Multi-byte varints for the socket id and the buffer length.
+  const std::string bulk(70000, 'q');
+  const ut::Packet large = wire::EncodeData(7, false, 300, bulk.data(), bulk.size());
+  const std::string large_prefix("\x08\x00\x10\xac\x02\x1a\xf0\xa2\x04", 9);
+  if (!Expect(large.payload().substr(0, large_prefix.size()) == large_prefix &&
+                  large.payload().size() == large_prefix.size() + bulk.size(),
+              "Large frame prefix does not match the protobuf encoding")) {
+    return 1;
+  }
+
+  wire::Data data;
+  if (!Expect(wire::DecodeData(large.payload(), &data) && data.has_socket_id && data.socket_id == 300 &&
+                  !data.source_to_destination && data.buffer == bulk && !data.closed,
+              "Large frame did not decode")) {
+    return 1;
+  }
+  // The buffer is a view into the frame, not a copy.
+  if (!Expect(data.buffer.data() == large.payload().data() + large_prefix.size(), "Decoded buffer was copied")) {
+    return 1;
+  }
+
+  // {socketid: 3, error: "x", closed: true}
+  if (!Expect(wire::DecodeData(std::string_view("\x10\x03\x22\x01x\x28\x01", 7), &data) && data.closed &&
+                  data.has_error && data.socket_id == 3,
+              "Closed message did not decode")) {
+    return 1;
+  }
+
+  if (!Expect(!wire::DecodeData(std::string_view("\x1a\x05hi", 4), &data), "Truncated buffer was accepted") ||
+      !Expect(!wire::DecodeData(std::string_view("\x30\x01", 2), &data), "Unknown field was accepted")) {
+    return 1;
+  }
+
+  std::cout << "Port forward wire test passed\n";
+  return 0;
+}
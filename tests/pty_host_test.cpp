@@ -0,0 +1,139 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "PtyHost.hpp"
+#include "Reactor.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+size_t Count(const std::string& text, const std::string& needle) {
+  size_t count = 0;
+  for (size_t pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + 1)) {
+    count++;
+  }
+  return count;
+}
+
+// Polls `reactor` until `pid` has been reaped (a zombie still answers
+// kill(pid, 0)) or two seconds pass.
+bool Reaped(ut::Reactor& reactor, int pid) {
+  const auto deadline = Clock::now() + std::chrono::seconds(2);
+  while (Clock::now() < deadline) {
+    if (kill(pid, 0) != 0 && errno == ESRCH) {
+      return true;
+    }
+    reactor.Poll(50);
+  }
+  return false;
+}
+
+bool TestEchoAndHangup() {
+  PtyHost host;
+  if (!host.Start("/bin/cat") || host.master() < 0 || host.pid() <= 0) {
+    std::cerr << "Start failed\n";
+    return false;
+  }
+  if ((fcntl(host.master(), F_GETFL) & O_NONBLOCK) == 0) {
+    std::cerr << "PTY master is blocking\n";
+    return false;
+  }
+  if (write(host.master(), "ping\n", 5) != 5) {
+    std::cerr << "Write to the PTY failed\n";
+    return false;
+  }
+  // The line discipline echoes the input, then cat writes it back.
+  std::string output;
+  const auto deadline = Clock::now() + std::chrono::seconds(2);
+  while (Count(output, "ping") < 2 && Clock::now() < deadline) {
+    pollfd fd{host.master(), POLLIN, 0};
+    if (poll(&fd, 1, 50) <= 0) {
+      continue;
+    }
+    char buffer[256];
+    const ssize_t rc = read(host.master(), buffer, sizeof(buffer));
+    if (rc <= 0) {
+      break;
+    }
+    output.append(buffer, static_cast<size_t>(rc));
+  }
+  if (Count(output, "ping") < 2) {
+    std::cerr << "Shell output missing, got: " << output << "\n";
+    return false;
+  }
+
+  const int pid = host.pid();
+  ut::Reactor reactor;
+  host.Release(&reactor);
+  if (host.master() != -1 || host.pid() != -1) {
+    std::cerr << "Release kept the PTY\n";
+    return false;
+  }
+  if (!Reaped(reactor, pid)) {
+    std::cerr << "Hung-up shell was not reaped\n";
+    return false;
+  }
+  return true;
+}
+
+bool TestIgnoredHangup() {
+  char path[] = "/tmp/pty_host_test_XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) {
+    std::cerr << "mkstemp failed\n";
+    return false;
+  }
+  const std::string script = "#!/bin/sh\ntrap '' HUP\nwhile :; do sleep 1; done\n";
+  const bool written = write(fd, script.data(), script.size()) == static_cast<ssize_t>(script.size());
+  close(fd);
+  chmod(path, 0700);
+
+  bool ok = false;
+  {
+    PtyHost host;
+    if (written && host.Start(path)) {
+      const int pid = host.pid();
+      // Give the shell time to install its trap.
+      usleep(100000);
+      // It never reads its input, so the PTY fills up and must refuse more
+      // rather than block.
+      const std::string chunk(4096, 'x');
+      ssize_t rc = 0;
+      for (int i = 0; i < 1024 && (rc = write(host.master(), chunk.data(), chunk.size())) > 0; ++i) {
+      }
+      if (rc >= 0 || errno != EAGAIN) {
+        std::cerr << "Full PTY did not report EAGAIN\n";
+      } else {
+        ok = true;
+      }
+      ut::Reactor reactor;
+      host.Release(&reactor);
+      if (!Reaped(reactor, pid)) {
+        ok = false;
+        std::cerr << "Shell ignoring the hangup was not killed\n";
+      }
+    } else {
+      std::cerr << "Could not start the stubborn shell\n";
+    }
+  }
+  unlink(path);
+  return ok;
+}
+}
+
+int main() {
+  if (!TestEchoAndHangup() || !TestIgnoredHangup()) {
+    return 1;
+  }
+  std::cout << "PTY host test passed\n";
+  return 0;
+}
@@ -0,0 +1,367 @@
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Reactor.hpp"
+#include "TcpSocketHandler.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef _WIN32
+// A loopback datagram socket connected to itself stands in for a peer.
+SOCKET OpenLoopback() {
+  SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int len = sizeof(addr);
+  bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  getsockname(s, reinterpret_cast<sockaddr*>(&addr), &len);
+  connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  return s;
+}
+#endif
+
+bool TestReadiness(ut::Reactor::Backend backend) {
+#ifdef _WIN32
+  SOCKET s = OpenLoopback();
+  const ut::SocketHandle read_end = static_cast<ut::SocketHandle>(s);
+  auto send_byte = [&] { send(s, "x", 1, 0); };
+  auto drain = [&] {
+    char c = 0;
+    recv(s, &c, 1, 0);
+  };
+#else
+  int fds[2] = {-1, -1};
+  if (pipe(fds) != 0) {
+    std::cerr << "pipe failed\n";
+    return false;
+  }
+  const ut::SocketHandle read_end = fds[0];
+  auto send_byte = [&] { [[maybe_unused]] ssize_t rc = write(fds[1], "x", 1); };
+  auto drain = [&] {
+    char c = 0;
+    [[maybe_unused]] ssize_t rc = read(fds[0], &c, 1);
+  };
+#endif
+
+  {
+    ut::Reactor reactor(backend);
+    int calls = 0;
+    if (!reactor.Add(read_end, [&] {
+          calls++;
+          drain();
+        })) {
+      std::cerr << "Add failed\n";
+      return false;
+    }
+
+    // Drain the wake queued by Add, then an idle poll runs nothing.
+    reactor.Poll(0);
+    if (reactor.Poll(20) != 0 || calls != 0) {
+      std::cerr << "Idle poll ran a callback\n";
+      return false;
+    }
+
+    send_byte();
+    if (reactor.Poll(1000) != 1 || calls != 1) {
+      std::cerr << "Readable socket did not run its callback\n";
+      return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    reactor.Wake();
+    reactor.Poll(5000);
+    if (std::chrono::steady_clock::now() - start > std::chrono::seconds(2)) {
+      std::cerr << "Wake did not end the poll\n";
+      return false;
+    }
+
+    // Data a callback leaves unread is reported again, as with level-triggered
+    // epoll.
+    reactor.Remove(read_end);
+    int lazy_calls = 0;
+    reactor.Add(read_end, [&] { lazy_calls++; });
+    send_byte();
+    reactor.Poll(1000);
+    reactor.Poll(1000);
+    if (lazy_calls != 2) {
+      std::cerr << "Unread data was not reported again\n";
+      return false;
+    }
+    drain();
+
+    reactor.Remove(read_end);
+    send_byte();
+    if (reactor.Poll(20) != 0 || lazy_calls != 2) {
+      std::cerr << "Removed socket still ran its callback\n";
+      return false;
+    }
+
+    // An unbounded poll ends when a timer is due and runs it; a cancelled
+    // timer never runs.
+    int timer_calls = 0;
+    const auto cancelled = reactor.AddTimer(10, [&] { timer_calls += 100; });
+    reactor.AddTimer(30, [&] { timer_calls++; });
+    reactor.CancelTimer(cancelled);
+    const auto timer_start = std::chrono::steady_clock::now();
+    while (timer_calls == 0 && std::chrono::steady_clock::now() - timer_start < std::chrono::seconds(2)) {
+      reactor.Poll(-1);
+    }
+    if (timer_calls != 1) {
+      std::cerr << "Timer did not end the poll and run once\n";
+      return false;
+    }
+  }
+
+#ifdef _WIN32
+  closesocket(s);
+#else
+  close(fds[0]);
+  close(fds[1]);
+#endif
+  return true;
+}
+
+#ifndef _WIN32
+bool TestAcceptor(ut::Reactor::Backend backend) {
+  ut::TcpSocketHandler handler;
+  const ut::SocketHandle listener = handler.Listen("127.0.0.1", 0);
+  if (listener == ut::kInvalidSocket) {
+    std::cerr << "Listen failed\n";
+    return false;
+  }
+  const int port = handler.GetBoundPort(listener);
+
+  ut::Reactor reactor(backend);
+  std::vector<ut::SocketHandle> accepted;
+  reactor.AddAcceptor(listener, [&](ut::SocketHandle client) { accepted.push_back(client); });
+  std::vector<ut::SocketHandle> clients;
+  for (int i = 0; i < 3; ++i) {
+    clients.push_back(handler.Connect("127.0.0.1", port));
+  }
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while (accepted.size() < clients.size() && std::chrono::steady_clock::now() < deadline) {
+    reactor.Poll(100);
+  }
+  reactor.Remove(listener);
+
+  const bool ok = accepted.size() == clients.size();
+  if (!ok) {
+    std::cerr << "Accepted " << accepted.size() << " of " << clients.size() << " connections\n";
+  }
+  for (ut::SocketHandle socket : accepted) {
+    handler.Close(socket);
+  }
+  for (ut::SocketHandle socket : clients) {
+    handler.Close(socket);
+  }
+  handler.Close(listener);
+  return ok;
+}
+
+bool TestSocketEvents(ut::Reactor::Backend backend) {
+  ut::TcpSocketHandler handler;
+  const ut::SocketHandle listener = handler.Listen("127.0.0.1", 0);
+  const ut::SocketHandle client = handler.Connect("127.0.0.1", handler.GetBoundPort(listener));
+  const ut::SocketHandle server = handler.Accept(listener);
+  if (client == ut::kInvalidSocket || server == ut::kInvalidSocket) {
+    std::cerr << "Loopback connect failed\n";
+    return false;
+  }
+
+  ut::Reactor reactor(backend);
+  int reads = 0;
+  int writes = 0;
+  reactor.Add(server, [&] { reads++; });
+  reactor.Poll(0);
+  bool ok = reactor.SetWritable(server, [&] { writes++; }) && reactor.Poll(1000) == 1 && writes == 1 && reads == 0;
+  if (!ok) {
+    std::cerr << "Writable socket did not run its write callback\n";
+  }
+  // A write callback that clears itself is not run again.
+  reactor.SetWritable(server, [&] {
+    writes++;
+    reactor.SetWritable(server, nullptr);
+  });
+  reactor.Poll(1000);
+  if (ok && (reactor.Poll(20) != 0 || writes != 2)) {
+    std::cerr << "Cleared write callback still ran\n";
+    ok = false;
+  }
+  // Paused reading leaves the data waiting in the socket.
+  reactor.SetReading(server, false);
+  handler.Write(client, "x", 1);
+  if (ok && (reactor.Poll(20) != 0 || reads != 0)) {
+    std::cerr << "Paused socket ran its read callback\n";
+    ok = false;
+  }
+  reactor.SetReading(server, true);
+  if (ok && (reactor.Poll(1000) != 1 || reads != 1)) {
+    std::cerr << "Resumed socket did not run its read callback\n";
+    ok = false;
+  }
+  reactor.Remove(server);
+  handler.Close(server);
+  handler.Close(client);
+  handler.Close(listener);
+  return ok;
+}
+
+// Sockets readied with PrepareForReactor, which an io_uring reactor reads
+// and writes itself: an echo that moves to a second reactor halfway, then
+// closes with output still queued, which must all reach the peer.
+bool TestPreparedSockets(ut::Reactor::Backend backend) {
+  constexpr size_t kBytes = 1 << 20;
+  constexpr size_t kTailBytes = 512 * 1024;
+  using Clock = std::chrono::steady_clock;
+
+  ut::TcpSocketHandler handler;
+  const ut::SocketHandle listener = handler.Listen("127.0.0.1", 0);
+  const ut::SocketHandle client = handler.Connect("127.0.0.1", handler.GetBoundPort(listener));
+  const ut::SocketHandle server = handler.Accept(listener);
+  handler.Close(listener);
+  if (client == ut::kInvalidSocket || server == ut::kInvalidSocket || !handler.PrepareForReactor(server)) {
+    std::cerr << "Loopback connect failed\n";
+    return false;
+  }
+
+  std::string sent(kBytes, '\0');
+  for (size_t i = 0; i < kBytes; ++i) {
+    sent[i] = static_cast<char>(i * 7 + i / 4096);
+  }
+  const std::string tail(kTailBytes, 't');
+  std::thread writer([&] { handler.WriteAllOrThrow(client, sent.data(), sent.size(), false); });
+  std::string echoed;
+  std::atomic<size_t> echoed_bytes{0};
+  std::thread reader([&] {
+    char buffer[16384];
+    int rc = 0;
+    while ((rc = handler.Read(client, buffer, sizeof(buffer))) > 0) {
+      echoed.append(buffer, static_cast<size_t>(rc));
+      echoed_bytes += static_cast<size_t>(rc);
+    }
+  });
+
+  bool ok = true;
+  {
+    ut::Reactor first(backend);
+    ut::Reactor second(backend);
+    ut::Reactor* current = &first;
+    std::string pending;
+    size_t received = 0;
+    std::function<void()> flush = [&] {
+      while (!pending.empty()) {
+        const int rc = handler.Write(server, pending.data(), pending.size());
+        if (rc <= 0) {
+          break;
+        }
+        pending.erase(0, static_cast<size_t>(rc));
+      }
+      current->SetWritable(server, pending.empty() ? nullptr : flush);
+    };
+    auto echo = [&] {
+      char buffer[16384];
+      int rc = 0;
+      while ((rc = handler.Read(server, buffer, sizeof(buffer))) > 0) {
+        pending.append(buffer, static_cast<size_t>(rc));
+        received += static_cast<size_t>(rc);
+      }
+      flush();
+    };
+    first.Add(server, echo);
+
+    bool moved = false;
+    auto deadline = Clock::now() + std::chrono::seconds(10);
+    while (echoed_bytes < kBytes && Clock::now() < deadline) {
+      first.Poll(5);
+      second.Poll(5);
+      if (!moved && received >= kBytes / 2) {
+        first.Remove(server);
+        second.Add(server, echo);
+        current = &second;
+        moved = true;
+        flush();
+      }
+    }
+    if (!moved || echoed_bytes != kBytes) {
+      std::cerr << "Echo stopped after " << echoed_bytes << " of " << kBytes << " bytes\n";
+      ok = false;
+    }
+
+    // More than the socket buffers hold, closed before the peer reads it.
+    size_t queued = 0;
+    deadline = Clock::now() + std::chrono::seconds(10);
+    while (ok && queued < tail.size() && Clock::now() < deadline) {
+      const int rc = handler.Write(server, tail.data() + queued, tail.size() - queued);
+      if (rc > 0) {
+        queued += static_cast<size_t>(rc);
+      } else {
+        second.Poll(5);
+      }
+    }
+    second.Remove(server);
+    handler.Close(server);
+    while (ok && echoed_bytes < kBytes + kTailBytes && Clock::now() < deadline) {
+      second.Poll(5);
+    }
+  }
+  shutdown(static_cast<int>(client), SHUT_RDWR);
+  writer.join();
+  reader.join();
+  handler.Close(client);
+  if (ok && echoed != sent + tail) {
+    std::cerr << "Peer got " << echoed.size() << " bytes, not the " << kBytes + kTailBytes << " sent\n";
+    ok = false;
+  }
+  return ok;
+}
+#endif
+
+// Each test runs on every backend this build and kernel have.
+std::vector<ut::Reactor::Backend> Backends() {
+  std::vector<ut::Reactor::Backend> backends = {ut::Reactor::Backend::kEpoll};
+  try {
+    ut::Reactor probe(ut::Reactor::Backend::kIoUring);
+    backends.push_back(ut::Reactor::Backend::kIoUring);
+  } catch (const std::exception&) {
+  }
+  return backends;
+}
+}
+
+int main() {
+#ifdef _WIN32
+  WSADATA wsa{};
+  WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+  for (ut::Reactor::Backend backend : Backends()) {
+    const char* name = backend == ut::Reactor::Backend::kIoUring ? "io_uring" : "readiness";
+    if (!TestReadiness(backend)) {
+      std::cerr << "(" << name << " backend)\n";
+      return 1;
+    }
+#ifndef _WIN32
+    if (!TestAcceptor(backend) || !TestSocketEvents(backend) || !TestPreparedSockets(backend)) {
+      std::cerr << "(" << name << " backend)\n";
+      return 1;
+    }
+#endif
+  }
+#ifdef _WIN32
+  WSACleanup();
+#endif
+  std::cout << "Reactor test passed\n";
+  return 0;
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Expect.hpp"
+#include "Reconnector.hpp"
+
+namespace {
+using Endpoints = ut::Reconnector::Endpoints;
+
+ut::TcpSocketHandler::Endpoint Address(const std::string& address) {
+  ut::TcpSocketHandler::Endpoint endpoint;
+  endpoint.address = address;
+  return endpoint;
+}
+
+// A server that answers on `reachable` addresses, a DNS name that currently
+// resolves to `dns`, and a clock that moves only when told to.
+struct FakeNetwork {
+  std::vector<std::string> reachable;
+  Endpoints dns;
+  std::vector<std::vector<std::string>> attempts;
+  int lookups = 0;
+  ut::Reconnector::Clock::time_point now{};
+
+  ut::Reconnector MakeReconnector() {
+    return ut::Reconnector(
+        [this](const Endpoints& endpoints, size_t* index) {
+          attempts.emplace_back();
+          for (size_t i = 0; i < endpoints.size(); ++i) {
+            attempts.back().push_back(endpoints[i].address);
+            for (const auto& address : reachable) {
+              if (endpoints[i].address == address) {
+                *index = i;
+                return static_cast<ut::SocketHandle>(i + 1);
+              }
+            }
+          }
+          return ut::kInvalidSocket;
+        },
+        [this] {
+          lookups++;
+          return dns;
+        },
+        [this] { return now; });
+  }
+};
+}
+
+int main() {
+  bool ok = true;
+
+  // The address that answered goes first, and a dropped socket comes back
+  // to it without a lookup.
+  {
+    FakeNetwork network;
+    network.dns = {Address("10.0.0.1"), Address("10.0.0.2")};
+    network.reachable = {"10.0.0.2"};
+    ut::Reconnector reconnector = network.MakeReconnector();
+    ok &= Expect(reconnector.Connect() != ut::kInvalidSocket, "Initial connect failed");
+    ok &= Expect(network.lookups == 1, "Initial connect did not resolve once");
+    ok &= Expect(reconnector.endpoints().front().address == "10.0.0.2", "Answering address not moved to the front");
+    network.attempts.clear();
+    ok &= Expect(reconnector.Connect() != ut::kInvalidSocket, "Reconnect to the cached address failed");
+    ok &= Expect(network.lookups == 1, "Reconnect resolved although the cache answered");
+    ok &= Expect(network.attempts.size() == 1 && network.attempts[0].front() == "10.0.0.2",
+                 "Reconnect did not try the cached address first");
+  }
+
+  // While the network is unchanged a failing cache is resolved again only
+  // once per interval; a network change allows another lookup at once.
+  {
+    FakeNetwork network;
+    network.dns = {Address("10.0.0.1")};
+    network.reachable = {"10.0.0.1"};
+    ut::Reconnector reconnector = network.MakeReconnector();
+    reconnector.Connect();
+    network.now += std::chrono::milliseconds(ut::Reconnector::kResolveIntervalMs);
+    network.reachable.clear();
+    ok &= Expect(reconnector.Connect() == ut::kInvalidSocket, "Connected to an unreachable server");
+    ok &= Expect(network.lookups == 2, "Stale cache was not resolved again");
+    for (int i = 0; i < 5; ++i) {
+      network.now += std::chrono::milliseconds(ut::Reconnector::kMaxDelayMs);
+      reconnector.Connect();
+    }
+    ok &= Expect(network.lookups == 2, "Resolved again while the network was unchanged");
+    network.now += std::chrono::milliseconds(ut::Reconnector::kResolveIntervalMs);
+    reconnector.Connect();
+    ok &= Expect(network.lookups == 3, "Lookup not repeated after the resolve interval");
+    reconnector.NetworkChanged();
+    reconnector.Connect();
+    ok &= Expect(network.lookups == 4, "Network change did not allow a new lookup");
+
+    // The name now points at a new server; an unchanged lookup is not tried.
+    const size_t attempts = network.attempts.size();
+    reconnector.NetworkChanged();
+    reconnector.Connect();
+    ok &= Expect(network.attempts.size() == attempts + 1, "Unchanged lookup was tried again");
+    network.dns = {Address("10.0.0.9")};
+    network.reachable = {"10.0.0.9"};
+    reconnector.NetworkChanged();
+    ok &= Expect(reconnector.Connect() != ut::kInvalidSocket, "Moved server not reached after a network change");
+    ok &= Expect(reconnector.endpoints().size() == 1 && reconnector.endpoints()[0].address == "10.0.0.9",
+                 "Cache not replaced by the new lookup");
+  }
+
+  // Delays grow to the cap and start over on a network change or a
+  // successful connect.
+  {
+    FakeNetwork network;
+    network.dns = {Address("10.0.0.1")};
+    ut::Reconnector reconnector = network.MakeReconnector();
+    int ceiling = ut::Reconnector::kBaseDelayMs;
+    for (int i = 0; i < 8; ++i) {
+      const int delay = reconnector.NextDelayMs();
+      ok &= Expect(delay >= ceiling / 2 && delay <= ceiling, "Delay outside its backoff step");
+      ceiling = std::min(ceiling * 2, ut::Reconnector::kMaxDelayMs);
+    }
+    ok &= Expect(reconnector.NextDelayMs() >= ut::Reconnector::kMaxDelayMs / 2, "Backoff did not reach its cap");
+    reconnector.NetworkChanged();
+    ok &= Expect(reconnector.NextDelayMs() <= ut::Reconnector::kBaseDelayMs, "Network change did not reset the backoff");
+    reconnector.NextDelayMs();
+    reconnector.NextDelayMs();
+    network.reachable = {"10.0.0.1"};
+    reconnector.Connect();
+    ok &= Expect(reconnector.NextDelayMs() <= ut::Reconnector::kBaseDelayMs, "Connect did not reset the backoff");
+  }
+
+  if (!ok) {
+    return 1;
+  }
+  std::cout << "Reconnector test passed\n";
+  return 0;
+}
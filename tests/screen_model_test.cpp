@@ -0,0 +1,102 @@
+#include <iostream>
+#include <string>
+
+#include "Expect.hpp"
+#include "ScreenModel.hpp"
+
+int main() {
+  bool ok = true;
+
+  ut::ScreenModel screen(10, 3, 5);
+  screen.Feed("hello\r\nworld");
+  ok &= Expect(screen.RowText(0) == "hello", "First row should hold the first line");
+  ok &= Expect(screen.RowText(1) == "world", "Second row should hold the second line");
+  ok &= Expect(screen.cursor_row() == 1 && screen.cursor_col() == 5, "Cursor should follow the text");
+
+  // Autowrap happens on the character after the last column.
+  screen.Feed("\x1b[H\x1b[2J0123456789");
+  ok &= Expect(screen.cursor_row() == 0 && screen.cursor_col() == 9, "Last column should defer the wrap");
+  screen.Feed("x");
+  ok &= Expect(screen.RowText(1) == "x", "Next character should wrap");
+
+  // Scrolling off the top feeds the bounded scrollback.
+  screen.Feed("\r\na\r\nb\r\nc\r\nd\r\ne\r\nf\r\ng\r\nh");
+  ok &= Expect(screen.RowText(2) == "h", "Bottom row should hold the latest line");
+  ok &= Expect(screen.scrollback_size() == 5, "Scrollback should stay bounded");
+
+  // Erase and cursor addressing; unknown sequences and strings are skipped.
+  screen.Feed("\x1b[2;3HZ\x1b]0;title\x07\x1b[1K\x1b[?2004h");
+  ok &= Expect(screen.RowText(1).empty(), "Erase to cursor should clear the start of the row");
+  ok &= Expect(screen.cursor_row() == 1 && screen.cursor_col() == 3, "CUP should be one-based");
+
+  // Full-screen programs draw on the alternate screen.
+  screen.Feed("\x1b[?1049h\x1b[Hvi");
+  ok &= Expect(screen.alternate_screen(), "1049h should switch to the alternate screen");
+  ok &= Expect(screen.RowText(0) == "vi", "Alternate screen should start blank");
+  screen.Feed("\x1b[?1049l");
+  ok &= Expect(!screen.alternate_screen() && screen.RowText(2) == "h", "1049l should restore the main screen");
+  ok &= Expect(screen.cursor_row() == 1 && screen.cursor_col() == 3, "1049l should restore the cursor");
+
+  // Wide characters take two cells.
+  ut::ScreenModel wide(6, 2, 0);
+  wide.Feed("\xe4\xb8\xad\xe6\x96\x87!");
+  ok &= Expect(wide.RowText(0) == "\xe4\xb8\xad\xe6\x96\x87!", "Wide characters should survive");
+  ok &= Expect(wide.cursor_col() == 5, "Wide characters should advance two columns");
+
+  // Replaying a snapshot into a fresh model reproduces the screen.
+  ut::ScreenModel source(12, 4, 10);
+  source.Feed("\x1b[31mred\x1b[0m plain\r\n\x1b[1;44mbold\x1b[0m\r\nline3\r\nline4\r\nline5\x1b[2;4r\x1b[3;2H\x1b[?25l");
+  ut::ScreenModel replay(12, 4, 10);
+  replay.Feed(source.Snapshot());
+  for (int row = 0; row < source.height(); ++row) {
+    ok &= Expect(replay.RowText(row) == source.RowText(row), "Snapshot should reproduce every row");
+  }
+  ok &= Expect(replay.cursor_row() == source.cursor_row() && replay.cursor_col() == source.cursor_col(),
+               "Snapshot should restore the cursor");
+  ok &= Expect(replay.scrollback_size() == source.scrollback_size(), "Snapshot should carry the scrollback");
+  ok &= Expect(replay.Snapshot() == source.Snapshot(), "Snapshot should be stable under replay");
+
+  source.Feed("\x1b[?1049h\x1b[Htop");
+  ut::ScreenModel replay_alternate(12, 4, 10);
+  replay_alternate.Feed(source.Snapshot());
+  ok &= Expect(replay_alternate.alternate_screen(), "Snapshot should restore the alternate screen");
+  ok &= Expect(replay_alternate.RowText(0) == "top", "Snapshot should repaint the alternate screen");
+
+  // A diff brings a terminal showing an older frame up to date, however
+  // much output happened in between.
+  ut::ScreenModel server(20, 5, 0);
+  ut::ScreenModel client(20, 5, 0);
+  server.Feed("$ cat big.log\r\n\x1b[?2004h");
+  client.Feed(server.Snapshot());
+  ut::ScreenModel::Frame frame = server.CaptureFrame();
+  for (int line = 0; line < 1000; ++line) {
+    server.Feed("\x1b[32mline " + std::to_string(line) + "\x1b[0m\r\n");
+  }
+  server.Feed("$ ");
+  const std::string diff = server.Diff(&frame);
+  client.Feed(diff);
+  for (int row = 0; row < server.height(); ++row) {
+    ok &= Expect(client.RowText(row) == server.RowText(row), "Diff should reproduce every row");
+  }
+  ok &= Expect(client.cursor_row() == server.cursor_row() && client.cursor_col() == server.cursor_col(),
+               "Diff should move the cursor");
+  ok &= Expect(diff.size() < 400, "Diff should skip intermediate output");
+  server.Feed("ls");
+  const std::string echo = server.Diff(&frame);
+  client.Feed(echo);
+  ok &= Expect(client.RowText(4) == "$ ls", "Diff should apply on top of the last one");
+  ok &= Expect(echo.find("line") == std::string::npos, "Diff should only redraw what changed");
+
+  // Shrinking keeps the cursor's line on screen.
+  ut::ScreenModel resized(10, 4, 10);
+  resized.Feed("1\r\n2\r\n3\r\n4");
+  resized.Resize(5, 2);
+  ok &= Expect(resized.RowText(1) == "4" && resized.cursor_row() == 1, "Resize should keep the cursor line");
+  ok &= Expect(resized.scrollback_size() == 2, "Resize should move dropped lines to the scrollback");
+
+  if (!ok) {
+    return 1;
+  }
+  std::cout << "Screen model test passed\n";
+  return 0;
+}
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "SocketHandler.hpp"
+#include "TcpSocketHandler.hpp"
+
+namespace {
+// Accepts at most `max_write_` bytes per call and fails every
+// `fail_every_`th call, like a socket with a nearly full send buffer.
+class ShortWriteSocketHandler : public ut::SocketHandler {
+ public:
+  bool HasData(ut::SocketHandle) override { return false; }
+  int Read(ut::SocketHandle, void*, size_t) override { return 0; }
+  int Write(ut::SocketHandle, const void* buf, size_t count) override {
+    writes_++;
+    if (fail_every_ > 0 && writes_ % fail_every_ == 0) {
+      return -1;
+    }
+    const size_t n = std::min(count, max_write_);
+    written_.append(static_cast<const char*>(buf), n);
+    return static_cast<int>(n);
+  }
+  void Close(ut::SocketHandle) override {}
+
+  std::string written_;
+  size_t max_write_ = static_cast<size_t>(-1);
+  int fail_every_ = 0;
+  int writes_ = 0;
+};
+
+struct FakeProto {
+  std::string body;
+  bool SerializeToString(std::string* out) const {
+    *out = body;
+    return true;
+  }
+};
+}
+
+int main() {
+  // The fallback writes one buffer per call; WriteVectorAllOrThrow resumes
+  // mid-buffer after short writes and retries failed ones.
+  ShortWriteSocketHandler fallback;
+  fallback.max_write_ = 3;
+  fallback.fail_every_ = 4;
+  const std::string parts[] = {"alpha", "", "beta", "gamma-delta"};
+  ut::SocketBuffer buffers[4];
+  for (size_t i = 0; i < 4; ++i) {
+    buffers[i] = {parts[i].data(), parts[i].size()};
+  }
+  fallback.WriteVectorAllOrThrow(0, buffers, 4, false);
+  if (fallback.written_ != "alphabetagamma-delta") {
+    std::cerr << "Gather write fallback produced: " << fallback.written_ << "\n";
+    return 1;
+  }
+  if (buffers[0].size != 5 || buffers[0].data != parts[0].data()) {
+    std::cerr << "Caller's buffers were modified\n";
+    return 1;
+  }
+
+  // More buffers than fit in one native call.
+  ShortWriteSocketHandler many;
+  std::vector<std::string> pieces;
+  std::vector<ut::SocketBuffer> piece_buffers;
+  std::string expected;
+  for (size_t i = 0; i < 3 * ut::SocketHandler::kMaxWriteBuffers; ++i) {
+    pieces.push_back(std::to_string(i) + ",");
+    expected += pieces.back();
+  }
+  for (const auto& piece : pieces) {
+    piece_buffers.push_back({piece.data(), piece.size()});
+  }
+  many.WriteVectorAllOrThrow(0, piece_buffers.data(), piece_buffers.size(), false);
+  if (many.written_ != expected) {
+    std::cerr << "Long gather write lost data\n";
+    return 1;
+  }
+
+  // Protos are framed as a native-endian int64 length and the body.
+  ShortWriteSocketHandler protos;
+  protos.WriteProtos(0, false, FakeProto{"first"}, FakeProto{""}, FakeProto{"third"});
+  std::string framed;
+  for (const std::string body : {"first", "", "third"}) {
+    const int64_t length = static_cast<int64_t>(body.size());
+    framed.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    framed += body;
+  }
+  if (protos.written_ != framed) {
+    std::cerr << "WriteProtos framing mismatch\n";
+    return 1;
+  }
+
+  // TCP sends every buffer in one gather call.
+  ut::TcpSocketHandler handler;
+  const ut::SocketHandle listener = handler.Listen("127.0.0.1", 0);
+  if (listener == ut::kInvalidSocket) {
+    std::cerr << "Listen failed\n";
+    return 1;
+  }
+  const ut::SocketHandle client = handler.Connect("127.0.0.1", handler.GetBoundPort(listener));
+  const ut::SocketHandle server = handler.Accept(listener);
+  if (client == ut::kInvalidSocket || server == ut::kInvalidSocket) {
+    std::cerr << "Loopback connect failed\n";
+    return 1;
+  }
+  ut::SocketBuffer tcp_buffers[4];
+  for (size_t i = 0; i < 4; ++i) {
+    tcp_buffers[i] = {parts[i].data(), parts[i].size()};
+  }
+  const int rc = handler.WriteVector(client, tcp_buffers, 4);
+  if (rc != 20) {
+    std::cerr << "TCP gather write returned " << rc << "\n";
+    return 1;
+  }
+  std::string received(20, '\0');
+  handler.ReadAll(server, &received[0], received.size(), true);
+  if (received != "alphabetagamma-delta") {
+    std::cerr << "TCP gather write produced: " << received << "\n";
+    return 1;
+  }
+  handler.Close(server);
+  handler.Close(client);
+  handler.Close(listener);
+
+  std::cout << "Socket handler test passed\n";
+  return 0;
+}
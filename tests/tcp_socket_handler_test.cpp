@@ -0,0 +1,57 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "Expect.hpp"
+#include "TcpSocketHandler.hpp"
+
+int main() {
+  ut::TcpSocketHandler handler;
+  const ut::SocketHandle listener = handler.Listen("127.0.0.1", 0);
+  if (!Expect(listener != ut::kInvalidSocket, "Listen failed")) {
+    return 1;
+  }
+  const int port = handler.GetBoundPort(listener);
+
+  // A TEST-NET address that either fails at once or never answers, ahead of
+  // the reachable one: the connect must not wait for it to time out.
+  std::vector<ut::TcpSocketHandler::Endpoint> endpoints = handler.Resolve("192.0.2.1", port);
+  const auto reachable = handler.Resolve("127.0.0.1", port);
+  endpoints.insert(endpoints.end(), reachable.begin(), reachable.end());
+  if (!Expect(endpoints.size() == 2, "Resolve of numeric addresses failed")) {
+    return 1;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  size_t connected_index = 0;
+  const ut::SocketHandle client = handler.Connect(endpoints, &connected_index);
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  if (!Expect(client != ut::kInvalidSocket, "Connect failed") ||
+      !Expect(connected_index == 1, "Connect reported the wrong endpoint") ||
+      !Expect(elapsed < std::chrono::seconds(2), "Connect waited on the unreachable address")) {
+    return 1;
+  }
+
+  // The winner is an ordinary blocking socket.
+  const ut::SocketHandle server = handler.Accept(listener);
+  char byte = 0;
+  if (!Expect(handler.Write(client, "x", 1) == 1 && handler.Read(server, &byte, 1) == 1 && byte == 'x',
+              "Connected socket did not carry data")) {
+    return 1;
+  }
+  handler.Close(server);
+  handler.Close(client);
+
+  // Nothing listening: every attempt is refused and Connect gives up at once.
+  handler.Close(listener);
+  const auto refused_start = std::chrono::steady_clock::now();
+  if (!Expect(handler.Connect("127.0.0.1", port) == ut::kInvalidSocket, "Connect to a closed port succeeded") ||
+      !Expect(std::chrono::steady_clock::now() - refused_start < std::chrono::seconds(2),
+              "Refused connect was not reported promptly") ||
+      !Expect(handler.Connect(std::vector<ut::TcpSocketHandler::Endpoint>()) == ut::kInvalidSocket,
+              "Connect without endpoints succeeded")) {
+    return 1;
+  }
+
+  std::cout << "TCP socket handler test passed\n";
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "Expect.hpp"
+#include "TimerWheel.hpp"
+
+namespace {
+using Clock = ut::TimerWheel::Clock;
+
+Clock::time_point At(Clock::time_point origin, int64_t ms) {
+  return origin + std::chrono::milliseconds(ms);
+}
+}
+
+int main() {
+  const Clock::time_point origin = Clock::now();
+
+  {
+    ut::TimerWheel wheel(origin);
+    int fired = 0;
+    wheel.Schedule(50, [&] { fired++; }, origin);
+    if (!Expect(wheel.NextTimeoutMs(origin) == 50, "Next timeout should be the timer's delay") ||
+        !Expect(wheel.Advance(At(origin, 49)) == 0 && fired == 0, "Timer ran early") ||
+        !Expect(wheel.Advance(At(origin, 50)) == 1 && fired == 1, "Timer did not run when due") ||
+        !Expect(wheel.size() == 0 && wheel.NextTimeoutMs(At(origin, 50)) == -1, "Wheel should be empty")) {
+      return 1;
+    }
+  }
+
+  {
+    // Cancelled timers never run, and ids of finished timers are stale.
+    ut::TimerWheel wheel(origin);
+    int fired = 0;
+    const auto cancelled = wheel.Schedule(30, [&] { fired += 100; }, origin);
+    const auto kept = wheel.Schedule(30, [&] { fired++; }, origin);
+    if (!Expect(wheel.Cancel(cancelled) && !wheel.Cancel(cancelled), "Cancel should succeed exactly once")) {
+      return 1;
+    }
+    wheel.Advance(At(origin, 30));
+    if (!Expect(fired == 1, "Cancelled timer ran") || !Expect(!wheel.Cancel(kept), "Finished timer was cancelled")) {
+      return 1;
+    }
+    // The slot is reused with a new generation; the old id stays stale.
+    const auto reused = wheel.Schedule(10, [&] { fired++; }, At(origin, 30));
+    if (!Expect(reused != cancelled && reused != kept && !wheel.Cancel(kept), "Stale id matched a reused slot")) {
+      return 1;
+    }
+  }
+
+  {
+    // A callback can cancel another timer due in the same tick (whichever
+    // runs first cancels the other) and schedule new ones.
+    ut::TimerWheel wheel(origin);
+    int fired = 0;
+    ut::TimerWheel::TimerId first = 0;
+    ut::TimerWheel::TimerId second = 0;
+    first = wheel.Schedule(20, [&] {
+          fired++;
+          wheel.Cancel(second);
+          wheel.Schedule(20, [&] { fired += 10; }, At(origin, 20));
+        }, origin);
+    second = wheel.Schedule(20, [&] {
+          fired++;
+          wheel.Cancel(first);
+          wheel.Schedule(20, [&] { fired += 10; }, At(origin, 20));
+        }, origin);
+    wheel.Advance(At(origin, 20));
+    if (!Expect(fired == 1, "Timer cancelled in the same tick ran")) {
+      return 1;
+    }
+    wheel.Advance(At(origin, 40));
+    if (!Expect(fired == 11, "Timer scheduled from a callback did not run")) {
+      return 1;
+    }
+  }
+
+  {
+    // Randomised delays across every level (and past the top one) must run
+    // no earlier than due, and no later than one tick after.
+    ut::TimerWheel wheel(origin);
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> level_pick(0, 4);
+    const int spans[] = {600, 40000, 2600000, 160000000, 400000000};
+    struct Expected {
+      int64_t due_ms;
+      int64_t ran_ms = -1;
+    };
+    std::vector<Expected> timers(2000);
+    std::vector<ut::TimerWheel::TimerId> ids;
+    int64_t now_ms = 0;
+    for (size_t i = 0; i < timers.size(); ++i) {
+      std::uniform_int_distribution<int> delay(0, spans[level_pick(rng)]);
+      const int delay_ms = delay(rng);
+      timers[i].due_ms = delay_ms;
+      ids.push_back(wheel.Schedule(delay_ms, [&timers, &now_ms, i] { timers[i].ran_ms = now_ms; }, origin));
+    }
+    // Cancel every tenth.
+    for (size_t i = 0; i < ids.size(); i += 10) {
+      wheel.Cancel(ids[i]);
+    }
+    // Jump from deadline to deadline, as a poller would.
+    size_t ran = 0;
+    int steps = 0;
+    while (wheel.size() > 0 && steps++ < 1000000) {
+      const int wait = wheel.NextTimeoutMs(At(origin, now_ms));
+      now_ms += wait > 0 ? wait : 1;
+      ran += wheel.Advance(At(origin, now_ms));
+    }
+    bool ok = ran == timers.size() - timers.size() / 10;
+    for (size_t i = 0; i < timers.size(); ++i) {
+      if (i % 10 == 0) {
+        ok = ok && timers[i].ran_ms == -1;
+      } else {
+        ok = ok && timers[i].ran_ms >= timers[i].due_ms &&
+             timers[i].ran_ms <= timers[i].due_ms + ut::TimerWheel::kTickMs;
+      }
+    }
+    if (!Expect(ok, "Timers did not run on time across levels")) {
+      return 1;
+    }
+    // Idle stretches cost a handful of wakeups, not one per tick.
+    if (!Expect(steps < 20000, "Wheel stepped through idle ticks")) {
+      return 1;
+    }
+  }
+
+  std::cout << "Timer wheel test passed\n";
+  return 0;
+}
@@ -0,0 +1,30 @@
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+#include "WorkerPool.hpp"
+
+int main() {
+  ut::WorkerPool pool(3);
+  std::vector<std::atomic<int>> hits(1000);
+  for (int round = 0; round < 50; ++round) {
+    pool.ParallelFor(hits.size(), [&](size_t i) { hits[i]++; });
+  }
+  for (size_t i = 0; i < hits.size(); ++i) {
+    if (hits[i].load() != 50) {
+      std::cerr << "Index " << i << " ran " << hits[i].load() << " times\n";
+      return 1;
+    }
+  }
+
+  ut::WorkerPool inline_pool(0);
+  int calls = 0;
+  inline_pool.ParallelFor(10, [&](size_t) { calls++; });
+  if (calls != 10) {
+    std::cerr << "Pool without helpers should run inline\n";
+    return 1;
+  }
+
+  std::cout << "Worker pool test passed\n";
+  return 0;
+}